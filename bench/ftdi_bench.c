@@ -0,0 +1,197 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * FTDI driver benchmark.
+ * Runs "ftdi_generic" driver against emulated FT2232H with a USB timing model of a high speed
+ * link and measures throughput of DR scans of different lengths, shifted one by one and batched,
+ * for several driver configurations. Numbers are only as good as the model, but they show how
+ * changes to encoding and buffering affect number of USB transfers and time spent in them.
+ */
+
+#include "ftdiemu/ftdi_emu.h"
+#include "txvc/driver.h"
+#include "txvc/log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_BATCH 16
+#define MAX_VECTOR_BYTES 4096
+
+extern const struct txvc_driver driver_ftdi_generic;
+
+static const struct txvc_jtag_sim_device gDevices[] = {
+    { .irLength = 6, .idcode = 0x13631093u, .idcodeOpcode = 0x09u, },
+};
+
+static const struct txvc_ftdi_emu_options gEmuOptions = {
+    .chip = TXVC_FTDI_EMU_FT2232H,
+    .serialNumber = "FT0EMU",
+    .numDevices = 1,
+    .devices = gDevices,
+    .timing = {
+        /* One microframe and roughly what bulk transfers get on a quiet high speed bus */
+        .usbLatencyUs = 125,
+        .usbBytesPerSec = 40l * 1000 * 1000,
+        .clockTck = true,
+    },
+};
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void set_bit(uint8_t *vector, int idx, bool value) {
+    if (value) {
+        vector[idx / 8] |= (uint8_t) (1u << (idx % 8));
+    } else {
+        vector[idx / 8] &= (uint8_t) ~(1u << (idx % 8));
+    }
+}
+
+/* DR scan of `numDataBits` that starts and ends in Run-Test/Idle */
+static int make_dr_scan(uint8_t *tms, uint8_t *tdi, int numDataBits) {
+    const int numBits = 3 + numDataBits + 2;
+    for (int i = 0; i < numBits; i++) {
+        const int dataIdx = i - 3;
+        set_bit(tms, i, i == 0 || dataIdx == numDataBits - 1 || dataIdx == numDataBits);
+        set_bit(tdi, i, rand() & 1);
+    }
+    return numBits;
+}
+
+static bool run_scenario(void *ctx, int numDataBits, int batch, int numShifts) {
+    static uint8_t tms[MAX_BATCH][MAX_VECTOR_BYTES];
+    static uint8_t tdi[MAX_BATCH][MAX_VECTOR_BYTES];
+    static uint8_t tdo[MAX_BATCH][MAX_VECTOR_BYTES];
+    struct txvc_shift shifts[MAX_BATCH];
+    for (int i = 0; i < batch; i++) {
+        shifts[i].numBits = make_dr_scan(tms[i], tdi[i], numDataBits);
+        shifts[i].tmsVector = tms[i];
+        shifts[i].tdiVector = tdi[i];
+        shifts[i].tdoVector = tdo[i];
+    }
+    struct txvc_ftdi_emu_stats before;
+    txvc_ftdi_emu_get_stats(0, &before);
+    bool res = true;
+    const double startUs = now_us();
+    for (int done = 0; res && done < numShifts; done += batch) {
+        if (batch == 1) {
+            res = driver_ftdi_generic.shift_bits(ctx, shifts[0].numBits,
+                    tms[0], tdi[0], tdo[0]);
+        } else {
+            res = driver_ftdi_generic.shift_bits_batch(ctx, batch, shifts);
+        }
+    }
+    const double elapsedUs = now_us() - startUs;
+    if (!res) {
+        fprintf(stderr, "Shift failed\n");
+        return false;
+    }
+    struct txvc_ftdi_emu_stats after;
+    txvc_ftdi_emu_get_stats(0, &after);
+    const double numBits = (double) shifts[0].numBits * numShifts;
+    printf("%6d bits, batch of %2d: %8.1f us per shift, %7.2f Mbit/s, %5.2f USB writes"
+            " and %5.2f reads per shift, %5.2f bytes per bit\n", shifts[0].numBits, batch,
+            elapsedUs / numShifts, numBits / elapsedUs,
+            (double) (after.numWrites - before.numWrites) / numShifts,
+            (double) (after.numReads - before.numReads) / numShifts,
+            (double) (after.numTxBytes - before.numTxBytes) / numBits);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    TXVC_UNUSED(argc);
+    TXVC_UNUSED(argv);
+    txvc_log_configure("all+", LOG_LEVEL_INFO, false);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    const struct {
+        int numDataBits;
+        int batch;
+        int numShifts;
+    } scenarios[] = {
+        { 32, 1, 2000, },
+        { 32, MAX_BATCH, 8000, },
+        { 1024, 1, 2000, },
+        { 1024, MAX_BATCH, 4000, },
+        { 8 * MAX_VECTOR_BYTES - 5, 1, 200, },
+    };
+    const struct {
+        const char *name;
+        const char *ioThread;
+        const char *cacheKbytes;
+        const char *writeBehind;
+    } runs[] = {
+        { "defaults", "0", "256", "0", },
+        { "no vector cache", "0", "0", "0", },
+        { "write-behind", "0", "256", "1", },
+        { "USB I/O thread", "1", "256", "0", },
+    };
+    bool res = true;
+    for (size_t run = 0; res && run < sizeof(runs) / sizeof(runs[0]); run++) {
+        printf("Driver configuration: %s\n", runs[run].name);
+        const char *names[] = {
+            "device", "vid", "pid", "channel", "read_latency_millis",
+            "d4", "d5", "d6", "d7",
+            "io_thread", "cache_kbytes", "write_behind",
+        };
+        const char *values[] = {
+            "ft2232h", "0403", "6010", "A", "auto",
+            "ignored", "ignored", "ignored", "ignored",
+            runs[run].ioThread, runs[run].cacheKbytes, runs[run].writeBehind,
+        };
+        void *ctx = calloc(1, driver_ftdi_generic.contextSize);
+        if (!ctx || !txvc_ftdi_emu_plug(&gEmuOptions)) {
+            fprintf(stderr, "Can not set up emulated chip\n");
+            free(ctx);
+            return EXIT_FAILURE;
+        }
+        if (!driver_ftdi_generic.activate(ctx, sizeof(names) / sizeof(names[0]), names, values)) {
+            fprintf(stderr, "Can not activate driver\n");
+            txvc_ftdi_emu_unplug();
+            free(ctx);
+            return EXIT_FAILURE;
+        }
+        /* 30MHz, the fastest TCK of the chip */
+        driver_ftdi_generic.set_tck_period(ctx, 33);
+        for (size_t i = 0; res && i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+            res = run_scenario(ctx, scenarios[i].numDataBits, scenarios[i].batch,
+                    scenarios[i].numShifts);
+        }
+        driver_ftdi_generic.deactivate(ctx);
+        txvc_ftdi_emu_unplug();
+        free(ctx);
+    }
+    return res ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * JTAG splitter benchmark.
+ * Measures how fast TMS vectors are split into TMS and TDI shifts by the bitwise reference,
+ * by callbacks and by batched decoding, for a single long DR scan and for short scans mixed with
+ * TAP navigation. Results of the fast paths are checked against the reference in unit tests.
+ */
+
+#include "txvc/defs.h"
+#include "txvc/jtag_splitter.h"
+#include "txvc/log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_VECTOR_BYTES (512 * 1024)
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void set_bit(uint8_t *vector, int idx, bool value) {
+    if (value) {
+        vector[idx / 8] |= (uint8_t) (1u << (idx % 8));
+    } else {
+        vector[idx / 8] &= (uint8_t) ~(1u << (idx % 8));
+    }
+}
+
+/* Alternating runs of random bits and zeros, zero runs keep TAP in stable states for a while */
+static void random_tms(uint8_t *tms, int numBits) {
+    int bitIdx = 0;
+    while (bitIdx < numBits) {
+        for (int n = 1 + rand() % 12; n > 0 && bitIdx < numBits; n--) {
+            set_bit(tms, bitIdx++, rand() & 1);
+        }
+        for (int n = rand() % 300; n > 0 && bitIdx < numBits; n--) {
+            set_bit(tms, bitIdx++, false);
+        }
+    }
+}
+
+static bool null_splitter_callback(const struct txvc_jtag_split_event *event, void *extra) {
+    TXVC_UNUSED(event);
+    TXVC_UNUSED(extra);
+    return true;
+}
+
+static bool measure_throughput(const char *name, int numBits, const uint8_t *tms, int rounds) {
+    static uint8_t tdi[MAX_VECTOR_BYTES];
+    static uint8_t tdo[MAX_VECTOR_BYTES];
+    static struct txvc_jtag_split_segment segments[TXVC_JTAG_SPLIT_MAX_SEGMENTS(4096 * 8)];
+    struct txvc_jtag_splitter bitwise, callback, batched;
+    if (!txvc_jtag_splitter_init(&bitwise, null_splitter_callback, NULL)
+            || !txvc_jtag_splitter_init(&callback, null_splitter_callback, NULL)
+            || !txvc_jtag_splitter_init(&batched, null_splitter_callback, NULL)) {
+        fprintf(stderr, "Can not init splitters\n");
+        return false;
+    }
+
+    bool res = true;
+    double t = now_seconds();
+    for (int i = 0; res && i < rounds; i++) {
+        res = txvc_jtag_splitter_process_bitwise(&bitwise, numBits, tms, tdi, tdo);
+    }
+    const double bitwiseSeconds = now_seconds() - t;
+    t = now_seconds();
+    for (int i = 0; res && i < rounds; i++) {
+        res = txvc_jtag_splitter_process(&callback, numBits, tms, tdi, tdo);
+    }
+    const double callbackSeconds = now_seconds() - t;
+    t = now_seconds();
+    for (int i = 0; res && i < rounds; i++) {
+        res = txvc_jtag_splitter_decode(&batched, numBits, tms, NULL,
+                segments, sizeof(segments) / sizeof(segments[0])) >= 0;
+    }
+    const double batchedSeconds = now_seconds() - t;
+    txvc_jtag_splitter_deinit(&bitwise);
+    txvc_jtag_splitter_deinit(&callback);
+    txvc_jtag_splitter_deinit(&batched);
+    if (!res) {
+        fprintf(stderr, "Splitting failed\n");
+        return false;
+    }
+
+    const double megabits = (double) numBits * rounds / 1e6;
+    printf("%s, %d bits: bitwise %.0f Mbit/s, callbacks %.0f Mbit/s, batched %.0f Mbit/s\n",
+            name, numBits, megabits / bitwiseSeconds, megabits / callbackSeconds,
+            megabits / batchedSeconds);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    TXVC_UNUSED(argc);
+    TXVC_UNUSED(argv);
+    txvc_log_configure("all+", LOG_LEVEL_INFO, false);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    static uint8_t tms[MAX_VECTOR_BYTES];
+
+    /* Long DR scan, e.g. a configuration data or a readback */
+    memset(tms, 0, sizeof(tms));
+    tms[0] = 0x02; /* TLR -> RTI -> SELECT_DR -> CAPTURE_DR -> SHIFT_DR */
+    const int numScanBits = sizeof(tms) * 8;
+    set_bit(tms, numScanBits - 3, true);
+    set_bit(tms, numScanBits - 2, true);
+    if (!measure_throughput("Single scan", numScanBits, tms, 20)) {
+        return EXIT_FAILURE;
+    }
+
+    /* Short scans mixed with TAP navigation, e.g. debug cores polling */
+    srand(1);
+    random_tms(tms, 4096 * 8);
+    return measure_throughput("Mixed", 4096 * 8, tms, 200) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
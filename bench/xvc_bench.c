@@ -0,0 +1,240 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * XVC server microbenchmark.
+ * Runs server with "echo" driver, or with the one named by the only argument (e.g. "sim" for
+ * a simulated chain with its default parameters), and measures latency of shift commands that
+ * are sent one by one as well as several at once without waiting for responses, with each of
+ * server I/O engines.
+ * Latency percentiles are per shift, i.e. round trip time divided by number of shifts in flight.
+ * Number of socket syscalls that server made is reported by server itself in its log once each
+ * connection is closed.
+ */
+
+#include "drivers/drivers.h"
+#include "txvc/driver.h"
+#include "txvc/log.h"
+#include "txvc/server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SERVER_ADDR "127.0.0.1"
+#define SERVER_PORT 2552
+#define MAX_IN_FLIGHT 16
+#define MAX_VECTOR_BYTES (1024 * 1024)
+#define MAX_ROUND_TRIPS 20000
+
+static volatile sig_atomic_t gServerShouldTerminate;
+static const struct txvc_driver *gDriver;
+static void *gDriverCtx;
+static in_port_t gServerPort = SERVER_PORT;
+static struct txvc_server_options gServerOptions = {
+    .maxVectorBits = 8 * MAX_VECTOR_BYTES,
+};
+
+static void *server_thread(void *arg) {
+    TXVC_UNUSED(arg);
+    char addr[32];
+    snprintf(addr, sizeof(addr), "%s:%d", SERVER_ADDR, gServerPort);
+    txvc_run_server(addr, gDriver, gDriverCtx, &gServerOptions, &gServerShouldTerminate);
+    return NULL;
+}
+
+static bool find_by_name(const struct txvc_driver *d, const void *extra) {
+    return strcmp(d->name, extra) != 0;
+}
+
+static int connect_to_server(void) {
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(gServerPort),
+        .sin_addr.s_addr = inet_addr(SERVER_ADDR),
+    };
+    for (int attempt = 0; attempt < 100; attempt++) {
+        if (connect(s, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+            int noDelay = 1;
+            setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            return s;
+        }
+        usleep(10 * 1000);
+    }
+    close(s);
+    return -1;
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* `samples` must be sorted */
+static double percentile(const double *samples, int numSamples, double p) {
+    int idx = (int) (p / 100.0 * numSamples);
+    return samples[idx < numSamples ? idx : numSamples - 1];
+}
+
+static bool run_scenario(int numBits, int inFlight, int numShifts) {
+    static uint8_t request[MAX_IN_FLIGHT * (10 + 2 * MAX_VECTOR_BYTES)];
+    static uint8_t response[MAX_IN_FLIGHT * MAX_VECTOR_BYTES];
+    const size_t numBytes = (size_t) (numBits + 7) / 8;
+    const size_t requestBytes = 10 + 2 * numBytes;
+    for (int i = 0; i < inFlight; i++) {
+        uint8_t *r = request + i * requestBytes;
+        memcpy(r, "shift:", 6);
+        r[6] = (uint8_t) (numBits >> 0);
+        r[7] = (uint8_t) (numBits >> 8);
+        r[8] = (uint8_t) (numBits >> 16);
+        r[9] = (uint8_t) (numBits >> 24);
+        for (size_t j = 0; j < 2 * numBytes; j++) {
+            r[10 + j] = (uint8_t) rand();
+        }
+    }
+
+    int s = connect_to_server();
+    if (s < 0) {
+        fprintf(stderr, "Can not connect to server: %s\n", strerror(errno));
+        return false;
+    }
+    static double latencies[MAX_ROUND_TRIPS];
+    int numRoundTrips = 0;
+    bool res = true;
+    const double startUs = now_us();
+    for (int done = 0; res && done < numShifts; done += inFlight) {
+        const double roundTripStartUs = now_us();
+        res = send(s, request, inFlight * requestBytes, 0) == (ssize_t) (inFlight * requestBytes)
+            && recv(s, response, inFlight * numBytes, MSG_WAITALL) == (ssize_t) (inFlight * numBytes);
+        latencies[numRoundTrips++] = (now_us() - roundTripStartUs) / inFlight;
+    }
+    const double elapsedUs = now_us() - startUs;
+    close(s);
+    if (!res) {
+        fprintf(stderr, "Shift failed\n");
+        return false;
+    }
+    qsort(latencies, numRoundTrips, sizeof(latencies[0]), compare_doubles);
+    printf("%8d bits, %2d in flight: %8.1f us per shift, %8.1f Mbit/s,"
+            " p50 %8.1f us, p99 %8.1f us, p99.9 %8.1f us\n", numBits, inFlight,
+            elapsedUs / numShifts, (double) numBits * numShifts / elapsedUs,
+            percentile(latencies, numRoundTrips, 50.0),
+            percentile(latencies, numRoundTrips, 99.0),
+            percentile(latencies, numRoundTrips, 99.9));
+    /* Let server report this connection before the next one */
+    usleep(50 * 1000);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    txvc_log_configure("all+", LOG_LEVEL_INFO, false);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    const char *driverName = argc > 1 ? argv[1] : "echo";
+    gDriver = txvc_enumerate_drivers(find_by_name, driverName);
+    gDriverCtx = gDriver ? calloc(1, gDriver->contextSize ? gDriver->contextSize : 1) : NULL;
+    if (!gDriverCtx || !gDriver->activate(gDriverCtx, 0, NULL, NULL)) {
+        fprintf(stderr, "Can not activate %s driver\n", driverName);
+        return EXIT_FAILURE;
+    }
+    gDriver->set_tck_period(gDriverCtx, 100);
+
+    const struct {
+        int numBits;
+        int inFlight;
+        int numShifts;
+    } scenarios[] = {
+        { 32, 1, MAX_ROUND_TRIPS, },
+        { 32, 16, MAX_ROUND_TRIPS, },
+        { 1024, 1, MAX_ROUND_TRIPS, },
+        { 1024, 16, MAX_ROUND_TRIPS, },
+        { 32768, 1, 2000, },
+        { MAX_VECTOR_BYTES, 1, 100, },
+        { 8 * MAX_VECTOR_BYTES, 1, 20, },
+    };
+    const size_t numScenarios = sizeof(scenarios) / sizeof(scenarios[0]);
+    const struct {
+        const char *name;
+        bool useIoUring;
+        size_t zeroCopyMinBytes;
+        size_t pipelineDepth;
+        size_t firstScenario;
+    } runs[] = {
+        { "regular socket calls", false, 0, 0, 0, },
+        { "io_uring", true, 0, 0, 0, },
+        { "regular socket calls, pipeline of 16 shifts", false, 0, 16, 0, },
+        /* Zero-copy only matters for large responses */
+        { "regular socket calls, zero-copy responses 64K and larger",
+            false, 64 * 1024, 0, numScenarios - 2, },
+    };
+    bool res = true;
+    for (size_t run = 0; res && run < sizeof(runs) / sizeof(runs[0]); run++) {
+        gServerOptions.useIoUring = runs[run].useIoUring;
+        gServerOptions.zeroCopyMinBytes = runs[run].zeroCopyMinBytes;
+        gServerOptions.pipelineDepth = runs[run].pipelineDepth;
+        /* Previous server address may be unusable for a while */
+        gServerPort = SERVER_PORT + run;
+        printf("Server engine: %s\n", runs[run].name);
+        gServerShouldTerminate = 0;
+        pthread_t serverThread;
+        pthread_create(&serverThread, NULL, server_thread, NULL);
+        for (size_t i = runs[run].firstScenario; res && i < numScenarios; i++) {
+            res = run_scenario(scenarios[i].numBits, scenarios[i].inFlight, scenarios[i].numShifts);
+        }
+        gServerShouldTerminate = 1;
+        int s = connect_to_server();
+        if (s >= 0) {
+            close(s);
+        }
+        pthread_join(serverThread, NULL);
+    }
+    gDriver->deactivate(gDriverCtx);
+    free(gDriverCtx);
+    return res ? EXIT_SUCCESS : EXIT_FAILURE;
+}
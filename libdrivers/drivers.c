@@ -31,10 +31,12 @@
 
 extern const struct txvc_driver driver_echo;
 extern const struct txvc_driver driver_ftdi_generic;
+extern const struct txvc_driver driver_sim;
 
 static const struct txvc_driver * const gDrivers[] = {
     &driver_echo,
     &driver_ftdi_generic,
+    &driver_sim,
 };
 static const size_t gNumDrivers = sizeof(gDrivers) / sizeof(gDrivers[0]);
 
@@ -30,40 +30,77 @@
 #include <stddef.h>
 #include <string.h>
 
-static bool activate(int numArg, const char **argNames, const char **argValues){
+#define ECHO_MAX_SHIFTS_IN_FLIGHT 16
+
+struct echo {
+    int numInFlight;
+};
+
+static bool activate(void *ctx, int numArg, const char **argNames, const char **argValues){
+    TXVC_UNUSED(ctx);
     TXVC_UNUSED(numArg);
     TXVC_UNUSED(argNames);
     TXVC_UNUSED(argValues);
     return true;
 }
 
-static bool deactivate(void){
+static bool deactivate(void *ctx){
+    TXVC_UNUSED(ctx);
     return true;
 }
 
-static int max_vector_bits(void){
+static int max_vector_bits(void *ctx){
+    TXVC_UNUSED(ctx);
     return 1024;
 }
 
-static int set_tck_period(int tckPeriodNs){
+static int set_tck_period(void *ctx, int tckPeriodNs){
+    TXVC_UNUSED(ctx);
     return tckPeriodNs;
 }
 
-static bool shift_bits(int numBits, const uint8_t *tmsVector, const uint8_t *tdiVector,
+static bool shift_bits(void *ctx, int numBits, const uint8_t *tmsVector, const uint8_t *tdiVector,
         uint8_t *tdoVector){
+    TXVC_UNUSED(ctx);
     TXVC_UNUSED(tmsVector);
     memcpy(tdoVector, tdiVector, (size_t) (numBits / 8 + !!(numBits % 8)));
     return true;
 }
 
+static int max_shifts_in_flight(void *ctx){
+    TXVC_UNUSED(ctx);
+    return ECHO_MAX_SHIFTS_IN_FLIGHT;
+}
+
+static bool submit_shift(void *ctx, const struct txvc_shift *shift){
+    struct echo *e = ctx;
+    if (e->numInFlight == ECHO_MAX_SHIFTS_IN_FLIGHT) {
+        return false;
+    }
+    e->numInFlight++;
+    return shift_bits(ctx, shift->numBits, shift->tmsVector, shift->tdiVector, shift->tdoVector);
+}
+
+static int complete_shifts(void *ctx, bool wait){
+    TXVC_UNUSED(wait);
+    struct echo *e = ctx;
+    int numCompleted = e->numInFlight;
+    e->numInFlight = 0;
+    return numCompleted;
+}
+
 const struct txvc_driver driver_echo = {
     .name = "echo",
     .help = "Simple loopback driver that forwards TDI vector to TDO. No real device is involved\n"
             "Parameters:\n   none\n",
+    .contextSize = sizeof(struct echo),
     .activate = activate,
     .deactivate = deactivate,
     .max_vector_bits = max_vector_bits,
     .set_tck_period = set_tck_period,
     .shift_bits = shift_bits,
+    .max_shifts_in_flight = max_shifts_in_flight,
+    .submit_shift = submit_shift,
+    .complete_shifts = complete_shifts,
 };
 
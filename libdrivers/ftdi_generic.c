@@ -33,11 +33,13 @@
 
 #include <ftd2xx.h>
 
+#include <pthread.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <time.h>
 
 TXVC_DEFAULT_LOG_TAG(ftdiGeneric);
 
@@ -91,22 +93,87 @@ static int str_to_usb_id(const char *s) {
     return *endp != '\0' ||  res <= 0l || res > 0xffffl ? -1 : (int) res;
 }
 
+/* USB IN transfer size is chosen at activation by measuring round trips */
+#define FTDI_LATENCY_AUTO 256
+/* Same value as chip uses after reset */
+#define FTDI_DEFAULT_LATENCY_MILLIS 16
+
 static int str_to_ftdi_latency(const char *s) {
     if (*s == '\0') {
-        return 16; /* Same value as chip uses after reset */
+        return FTDI_DEFAULT_LATENCY_MILLIS;
+    }
+    if (strcmp(s, "auto") == 0) {
+        return FTDI_LATENCY_AUTO;
     }
     char *endp;
     long res = strtol(s, &endp, 10);
     return *endp != '\0' ||  res < 0l || res > 255l ? -1 : (int) res;
 }
 
+/* Up to TXVC_JTAG_SPLIT_MAX_DEVICES numbers, separated by '/' */
+struct int_list {
+    int numItems; /* -1 if list is malformed */
+    int items[TXVC_JTAG_SPLIT_MAX_DEVICES];
+};
+
+static struct int_list str_to_int_list(const char *s, int base) {
+    struct int_list res = { .numItems = 0 };
+    while (*s) {
+        char *endp;
+        long item = strtol(s, &endp, base);
+        if (endp == s || (*endp != '\0' && *endp != '/') || item < 0l || item > 0xffffffl
+                || res.numItems == TXVC_JTAG_SPLIT_MAX_DEVICES) {
+            res.numItems = -1;
+            break;
+        }
+        res.items[res.numItems++] = (int) item;
+        s = *endp ? endp + 1 : endp;
+    }
+    return res;
+}
+
+static struct int_list str_to_ir_lengths(const char *s) {
+    return str_to_int_list(s, 10);
+}
+
+static struct int_list str_to_opcodes(const char *s) {
+    return str_to_int_list(s, 16);
+}
+
+static const char *str_to_serial(const char *s) {
+    return s;
+}
+
+static int str_to_flag(const char *s) {
+    return strcmp(s, "1") == 0 ? 1 : strcmp(s, "0") == 0 ? 0 : -1;
+}
+
+static int str_to_kbytes(const char *s) {
+    char *endp;
+    long res = strtol(s, &endp, 10);
+    return *endp != '\0' ||  res < 0l || res > 1024l * 1024l ? -1 : (int) res;
+}
+
+static int str_to_octet(const char *s) {
+    char *endp;
+    long res = strtol(s, &endp, 16);
+    return *endp != '\0' ||  res < 0l || res > 0xffl ? -1 : (int) res;
+}
+
 struct ft_params {
     FT_DEVICE device;
     int vid;
     int pid;
     char channel;
+    const char *serial;
     int read_latency_millis;
     enum pin_role d_pins[8];
+    struct int_list wo_ir_lengths;
+    struct int_list wo_opcodes;
+    int wo_tdo_fill;
+    int io_thread;
+    int cache_kbytes;
+    int write_behind;
 };
 
 #define PARAM_LIST_ITEMS(X)                                                                        \
@@ -115,12 +182,37 @@ struct ft_params {
     X("vid", vid, str_to_usb_id, > 0, 0, "USB device vendor ID")                                   \
     X("pid", pid, str_to_usb_id, > 0, 0, "USB device product ID")                                  \
     X("channel", channel, str_to_ftdi_interface, != '?', '?', "FTDI channel to use")               \
-    X("read_latency_millis", read_latency_millis, str_to_ftdi_latency, >= 0, 16,                   \
-            "FTDI latency timer duration")                                                         \
+    X("serial", serial, str_to_serial, != NULL, "",                                                \
+            "Serial number of the chip to use, without channel name, or any chip if it is empty"  \
+            " (default)")                                                                          \
+    X("read_latency_millis", read_latency_millis, str_to_ftdi_latency, >= 0, FTDI_LATENCY_AUTO,    \
+            "FTDI latency timer duration, or \"auto\" (default) to keep chip's default of 16ms"    \
+            " and choose USB IN transfer size by measuring round trips to the chip")               \
     X("d4", d_pins[4], str_to_pin_role, != PIN_ROLE_INVALID, PIN_ROLE_INVALID, "D4 pin role")      \
     X("d5", d_pins[5], str_to_pin_role, != PIN_ROLE_INVALID, PIN_ROLE_INVALID, "D5 pin role")      \
     X("d6", d_pins[6], str_to_pin_role, != PIN_ROLE_INVALID, PIN_ROLE_INVALID, "D6 pin role")      \
     X("d7", d_pins[7], str_to_pin_role, != PIN_ROLE_INVALID, PIN_ROLE_INVALID, "D7 pin role")      \
+    X("wo_ir_lengths", wo_ir_lengths, str_to_ir_lengths, .numItems >= 0,                           \
+            (struct int_list) { .numItems = 0 },                                                   \
+            "IR lengths of chain devices, starting from the closest to TDO, separated by '/'."     \
+            " Enables write-only DR shifts for instructions given by \"wo_opcodes\"")              \
+    X("wo_opcodes", wo_opcodes, str_to_opcodes, .numItems >= 0,                                    \
+            (struct int_list) { .numItems = 0 },                                                   \
+            "Instructions (hex, separated by '/') that make DR shifts write-only when loaded into" \
+            " any chain device, e.g. CFG_IN")                                                      \
+    X("wo_tdo_fill", wo_tdo_fill, str_to_octet, >= 0, 0,                                           \
+            "Octet (hex) to report as TDO of write-only DR shifts")                                \
+    X("io_thread", io_thread, str_to_flag, >= 0, 0,                                                \
+            "Whether to run USB transfers on a separate thread while next ones are prepared"       \
+            " (1) or to run them in place (0, default)")                                           \
+    X("cache_kbytes", cache_kbytes, str_to_kbytes, >= 0, 256,                                      \
+            "Memory limit (KiB) for encoded vectors that are reused when the same vector is"       \
+            " shifted again, 0 disables caching")                                                  \
+    X("write_behind", write_behind, str_to_flag, >= 0, 0,                                          \
+            "Whether to hold commands of vectors that do not read TDO (e.g. TAP navigation) to"    \
+            " send them along with the next vector (1), or to send them right away (0, default)."  \
+            " Held commands reach the chip, and their USB errors are reported, only by the next"   \
+            " vector")                                                                             \
 
 static bool load_config(int numArgs, const char **argNames, const char **argValues,
                             struct ft_params *out) {
@@ -153,26 +245,158 @@ static bool load_config(int numArgs, const char **argNames, const char **argValu
 /*
  * Driver implementation.
  */
-typedef void (*rx_observer_fn)(const uint8_t *rxData, void *extra);
 
-struct rx_observer_node {
-    struct rx_observer_node *next;
-    rx_observer_fn fn;
-    const uint8_t *data;
-    void *extra;
+/*
+ * Destination of read data.
+ * Long byte runs are read by USB straight into their destination, everything else is read into
+ * transfer RX buffer first and then copied out in one pass, in the same order as appended.
+ */
+struct rx_chunk {
+    uint8_t *dst;
+    int numBytes; /* Number of read bytes, always 1 for bit copies */
+    int fromBit; /* Bit copies only, first bit of a read byte to copy */
+    int toBit; /* Bit copies only, where to put the first copied bit in `dst` */
+    int numBits; /* Number of bits to copy, 0 for byte runs */
+    bool direct; /* Byte run that is read straight into `dst` */
 };
 
-struct ft_buffer {
-    FT_HANDLE ftChip;
+/* Shorter runs are cheaper to copy than to read with a separate call */
+#define RX_DIRECT_MIN_BYTES 64
+
+/* Same as above, but with destination given as offset in a vector that is not known yet */
+struct cached_rx_chunk {
+    struct rx_chunk chunk;
+    int dstOffset;
+};
+
+/* Commands for a single USB write and data from a following read */
+struct ft_transfer {
     struct txvc_mempool pool;
     uint8_t *txBuffer;
     int txNumBytes;
+    uint8_t *rxBuffer; /* Only for data that is not read directly */
+    int rxNumBytes; /* All data, including direct reads */
+    struct rx_chunk *rxChunks;
+    int numRxChunks;
+    bool inFlight; /* Owned by USB I/O thread */
+};
+
+/*
+ * Transfers alternate so that the next one can be filled while USB I/O thread sends the
+ * previous one to the chip and reads data back.
+ */
+#define FT_BUFFER_NUM_TRANSFERS 2
+
+typedef void (*ft_transfer_observer_fn)(const struct ft_transfer *t, void *extra);
+
+struct ft_buffer {
+    FT_HANDLE ftChip;
     int maxTxBufferBytes;
-    uint8_t *rxBuffer;
-    int rxNumBytes;
     int maxRxBufferBytes;
-    struct rx_observer_node *rxObserverFirst;
-    struct rx_observer_node *rxObserverLast;
+    struct ft_transfer transfers[FT_BUFFER_NUM_TRANSFERS];
+    int fillingIdx;
+    bool useIoThread;
+    pthread_t ioThread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int ioIdx;
+    bool stopIo;
+    bool failed;
+    unsigned long long totalTxBytes;
+    /* Round trips of transfers that read data back, i.e. from write start to read end */
+    unsigned long long numRoundTrips;
+    long long totalRoundTripUs;
+    long long minRoundTripUs;
+    long long maxRoundTripUs;
+    /* Sees every transfer right before it is sent, if set */
+    ft_transfer_observer_fn submitObserver;
+    void *submitObserverExtra;
+};
+
+enum mpsse_cmd_kind {
+    MPSSE_CMD_NONE,
+    MPSSE_CMD_TMS,
+    MPSSE_CMD_TDI_BITS,
+    MPSSE_CMD_TDI_BYTES,
+    MPSSE_CMD_CLOCKS,
+    MPSSE_CMD_CONST_TDI_BYTES,
+};
+
+struct mpsse_cmd {
+    enum mpsse_cmd_kind kind;
+    int numBits; /* MPSSE_CMD_TMS and MPSSE_CMD_TDI_BITS, or number of MPSSE_CMD_CLOCKS */
+    uint8_t bits; /* TMS or TDI bits, LSB first */
+    bool tdi; /* TDI level to hold during MPSSE_CMD_TMS and MPSSE_CMD_CONST_TDI_BYTES */
+    const uint8_t *tdiBytes; /* MPSSE_CMD_TDI_BYTES only */
+    int numBytes; /* MPSSE_CMD_TDI_BYTES and MPSSE_CMD_CONST_TDI_BYTES only */
+    uint8_t *tdo; /* Where to store read TDO bits, NULL if TDO is not needed */
+    int tdoBitIdx; /* Position of the first read bit in `tdo` */
+    int numTdoBits; /* How many leading command bits to read, 0 if TDO is not needed */
+};
+
+/*
+ * Cache of encoded vectors.
+ * Debuggers poll the same status registers with identical vectors many times a second. When
+ * a vector was already seen with the same splitter state, transfers that it was encoded to are
+ * sent again without decoding and encoding it.
+ */
+#define VECTOR_CACHE_NUM_BUCKETS 256
+/* Vectors that need more transfers are not cached, these are usually one-off loads */
+#define VECTOR_CACHE_MAX_TRANSFERS 4
+
+struct cached_transfer {
+    int txNumBytes;
+    int numRxChunks;
+};
+
+struct cache_entry {
+    struct cache_entry *bucketNext;
+    struct cache_entry *lruPrev; /* Used more recently */
+    struct cache_entry *lruNext; /* Used less recently */
+    uint64_t hash;
+    size_t numBytes; /* Memory taken by the whole entry */
+    struct txvc_jtag_splitter splitterBefore;
+    struct txvc_jtag_splitter splitterAfter;
+    bool lastTdiBefore;
+    bool lastTdiAfter;
+    int numBits;
+    int numTransfers;
+    struct cached_transfer transfers[VECTOR_CACHE_MAX_TRANSFERS];
+    struct cached_rx_chunk *rxChunks;
+    uint8_t *tms;
+    uint8_t *tdi;
+    uint8_t *tx;
+};
+
+/* Transfers of a vector that is being encoded */
+struct vector_recording {
+    bool active;
+    bool failed; /* Vector can not be cached */
+    /* Appended by previous vectors (written behind or batched), these precede the first transfer */
+    int skipTxBytes;
+    int skipRxChunks;
+    uint8_t *tdo;
+    int tdoNumBytes;
+    int numTransfers;
+    struct cached_transfer transfers[VECTOR_CACHE_MAX_TRANSFERS];
+    uint8_t *tx;
+    int txNumBytes;
+    int maxTxBytes;
+    struct cached_rx_chunk *rxChunks;
+    int numRxChunks;
+    int maxRxChunks;
+};
+
+struct vector_cache {
+    size_t maxBytes; /* 0 if caching is disabled */
+    size_t numBytes;
+    int numEntries;
+    struct cache_entry *buckets[VECTOR_CACHE_NUM_BUCKETS];
+    struct cache_entry *lruFirst;
+    struct cache_entry *lruLast;
+    struct vector_recording recording;
+    unsigned long long numHits;
+    unsigned long long numMisses;
 };
 
 struct driver {
@@ -181,13 +405,17 @@ struct driver {
     bool highSpeedCapable;
     FT_HANDLE ftHandle;
     struct txvc_jtag_splitter jtagSplitter;
+    struct txvc_jtag_split_segment *segments;
+    int maxSegments;
     unsigned lastTdi : 1;
-    struct txvc_mempool pool;
+    uint8_t gpioLevels;
+    uint8_t gpioDirections;
+    struct mpsse_cmd pendingCmd;
     struct ft_buffer cmdBuffer;
+    struct vector_cache cache;
+    unsigned long long numShiftedBits;
 };
 
-static struct driver gFtdi;
-
 
 /* FTDI MPSSE opcodes */
 static const uint8_t OP_BAD_COMMANDS = 0xfau;
@@ -202,6 +430,18 @@ static const uint8_t OP_SHIFT_WR_TMS_FLAG = 1u << 6;
 static const uint8_t OP_SET_DBUS_LOBYTE = 0x80u;
 static const uint8_t OP_SET_TCK_DIVISOR = 0x86u;
 static const uint8_t OP_DISABLE_CLK_DIVIDE_BY_5 = 0x8au;
+static const uint8_t OP_SEND_IMMEDIATE = 0x87u;
+static const uint8_t OP_CLOCK_BITS = 0x8eu;
+static const uint8_t OP_CLOCK_BYTES = 0x8fu;
+
+/* JTAG pins on the low GPIO byte */
+static const uint8_t PIN_TCK = 1u << 0;
+static const uint8_t PIN_TDI = 1u << 1;
+static const uint8_t PIN_TMS = 1u << 3;
+
+/* USB high-speed bulk packet, chip prepends 2 modem status bytes to each one it sends */
+#define USB_HS_PACKET_BYTES 512
+#define USB_HS_PACKET_PAYLOAD_BYTES (USB_HS_PACKET_BYTES - 2)
 
 static const char *ft_status_name(FT_STATUS s) {
     switch (s) {
@@ -236,6 +476,12 @@ static inline int min(int a, int b) {
     return a < b ? a : b;
 }
 
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ll + ts.tv_nsec / 1000;
+}
+
 static inline bool get_bit(const uint8_t* p, int idx) {
     return !!(p[idx / 8] & (1 << (idx % 8)));
 }
@@ -256,9 +502,11 @@ static void copy_bits(const uint8_t* src, int fromIdx,
     }
 }
 
-static void ft_buffer_init(struct ft_buffer *b, FT_HANDLE ftChip, int chipBufferBytes) {
+static void *ft_buffer_io_thread(void *arg);
+
+static void ft_buffer_init(struct ft_buffer *b, FT_HANDLE ftChip, int chipBufferBytes,
+        bool useIoThread) {
     b->ftChip = ftChip;
-    txvc_mempool_init(&b->pool, 128 * 1024);
     /*
      * Buffer limits must be chosen in a such way that:
      * - there will be no unnecessarily frequent flushes
@@ -268,145 +516,353 @@ static void ft_buffer_init(struct ft_buffer *b, FT_HANDLE ftChip, int chipBuffer
      * Hence an optimal RX buffer must be of the same size as chip buffer.
      * TX buffer must be larger to accommodate command headers that do not result in read data. In
      * the worst case (bitmode write with read) each 3 written bytes result in 1 read byte;
+     * Last TX byte is reserved for SEND_IMMEDIATE so that a full transfer still occupies a whole
+     * number of USB packets.
      */
     b->maxTxBufferBytes = 3 * chipBufferBytes;
     b->maxRxBufferBytes = chipBufferBytes;
-    b->txBuffer = b->rxBuffer = NULL;
-    b->txNumBytes = b->rxNumBytes = 0;
-    b->rxObserverFirst = b->rxObserverLast = NULL;
+    /* Worst case is when every read byte has its own chunk */
+    const size_t poolBytes = b->maxTxBufferBytes + b->maxRxBufferBytes
+        + b->maxRxBufferBytes * sizeof(struct rx_chunk) + _Alignof(struct rx_chunk);
+    for (int i = 0; i < FT_BUFFER_NUM_TRANSFERS; i++) {
+        struct ft_transfer *t = &b->transfers[i];
+        txvc_mempool_init(&t->pool, poolBytes);
+        t->rxChunks = (struct rx_chunk *) txvc_mempool_alloc_aligned(&t->pool,
+                b->maxRxBufferBytes * sizeof(struct rx_chunk), _Alignof(struct rx_chunk));
+        t->txBuffer = txvc_mempool_alloc_unaligned(&t->pool, b->maxTxBufferBytes);
+        t->rxBuffer = txvc_mempool_alloc_unaligned(&t->pool, b->maxRxBufferBytes);
+        t->txNumBytes = t->rxNumBytes = t->numRxChunks = 0;
+        t->inFlight = false;
+    }
+    b->fillingIdx = 0;
+    b->failed = false;
+    b->totalTxBytes = 0;
+    b->numRoundTrips = 0;
+    b->totalRoundTripUs = 0;
+    b->minRoundTripUs = 0;
+    b->maxRoundTripUs = 0;
+    b->submitObserver = NULL;
+    b->submitObserverExtra = NULL;
+    b->useIoThread = useIoThread;
+    if (useIoThread) {
+        b->ioIdx = 0;
+        b->stopIo = false;
+        pthread_mutex_init(&b->lock, NULL);
+        pthread_cond_init(&b->cond, NULL);
+        if (pthread_create(&b->ioThread, NULL, ft_buffer_io_thread, b) != 0) {
+            FATAL("Can not start USB I/O thread\n");
+        }
+    }
 }
 
-static bool ft_buffer_flush(struct ft_buffer *b) {
-    if (b->txBuffer) {
+static bool ft_read(struct ft_buffer *b, uint8_t *dst, int numBytes) {
+    if (numBytes == 0) {
+        return true;
+    }
+    DWORD read;
+    FT_STATUS status = FT_Read(b->ftChip, dst, numBytes, &read);
+    if (!FT_SUCCESS(status)) {
+        ERROR("Failed to receive data: %s\n", ft_status_name(status));
+        return false;
+    }
+    if (read != (DWORD) numBytes) {
+        ERROR("Received only %u bytes of %d\n", read, numBytes);
+        return false;
+    }
+    return true;
+}
+
+static inline void ft_transfer_clear(struct ft_transfer *t) {
+    t->txNumBytes = t->rxNumBytes = t->numRxChunks = 0;
+}
+
+/*
+ * Runs USB transfer and stores read data to its destinations.
+ * Returns false if chip did not respond as expected.
+ */
+static bool ft_transfer_run(struct ft_buffer *b, struct ft_transfer *t) {
+    bool res = false;
+    const long long startUs = now_us();
+    if (t->numRxChunks) {
+        /*
+         * Otherwise chip holds the last partial packet of read data until latency timer
+         * expires. Room for this byte is always reserved in TX buffer.
+         */
+        t->txBuffer[t->txNumBytes++] = OP_SEND_IMMEDIATE;
+    }
+    if (t->txNumBytes) {
         DWORD written;
-        FT_STATUS status = FT_Write(b->ftChip, (LPVOID *) b->txBuffer, b->txNumBytes, &written);
+        FT_STATUS status = FT_Write(b->ftChip, (LPVOID *) t->txBuffer, t->txNumBytes, &written);
         if (!FT_SUCCESS(status)) {
             ERROR("Failed to send data: %s\n", ft_status_name(status));
-            return false;
+            goto bail;
         }
-        if (written != (DWORD) b->txNumBytes) {
-            ERROR("Sent only %u bytes of %d\n", written, b->txNumBytes);
-            return false;
+        if (written != (DWORD) t->txNumBytes) {
+            ERROR("Sent only %u bytes of %d\n", written, t->txNumBytes);
+            goto bail;
         }
-        b->txBuffer = NULL;
-        b->txNumBytes = 0;
+        b->totalTxBytes += t->txNumBytes;
     }
-    if (b->rxBuffer) {
-        DWORD read;
-        FT_STATUS status = FT_Read(b->ftChip, b->rxBuffer, b->rxNumBytes, &read);
-        if (!FT_SUCCESS(status)) {
-            ERROR("Failed to receive data: %s\n", ft_status_name(status));
-            return false;
+    if (t->numRxChunks) {
+        /* Split reads only around direct runs */
+        int rxReadEnd = 0;
+        int rxEnd = 0;
+        for (int i = 0; i < t->numRxChunks; i++) {
+            const struct rx_chunk *c = &t->rxChunks[i];
+            if (!c->direct) {
+                rxEnd += c->numBytes;
+                continue;
+            }
+            if (!ft_read(b, t->rxBuffer + rxReadEnd, rxEnd - rxReadEnd)
+                    || !ft_read(b, c->dst, c->numBytes)) {
+                goto bail;
+            }
+            rxReadEnd = rxEnd;
         }
-        if (read != (DWORD) b->rxNumBytes) {
-            ERROR("Received only %u bytes of %d\n", read, b->rxNumBytes);
-            return false;
+        if (!ft_read(b, t->rxBuffer + rxReadEnd, rxEnd - rxReadEnd)) {
+            goto bail;
+        }
+        const long long roundTripUs = now_us() - startUs;
+        VERBOSE("Round trip: %d bytes out, %d bytes in, %lldus\n",
+                t->txNumBytes, t->rxNumBytes, roundTripUs);
+        if (!b->numRoundTrips || roundTripUs < b->minRoundTripUs) {
+            b->minRoundTripUs = roundTripUs;
         }
-        for (const struct rx_observer_node *o = b->rxObserverFirst; o; o = o->next) {
-            o->fn(o->data, o->extra);
+        if (!b->numRoundTrips || roundTripUs > b->maxRoundTripUs) {
+            b->maxRoundTripUs = roundTripUs;
+        }
+        b->numRoundTrips++;
+        b->totalRoundTripUs += roundTripUs;
+        const uint8_t *rxData = t->rxBuffer;
+        for (int i = 0; i < t->numRxChunks; i++) {
+            const struct rx_chunk *c = &t->rxChunks[i];
+            if (c->direct) {
+                continue;
+            }
+            if (c->numBits) {
+                copy_bits(rxData, c->fromBit, c->dst, c->toBit, c->numBits, false);
+            } else {
+                memcpy(c->dst, rxData, c->numBytes);
+            }
+            rxData += c->numBytes;
         }
-        b->rxObserverFirst = b->rxObserverLast = NULL;
-        b->rxBuffer = NULL;
-        b->rxNumBytes = 0;
     }
-    txvc_mempool_reclaim_all(&b->pool);
-    return true;
+    res = true;
+
+bail:
+    ft_transfer_clear(t);
+    return res;
 }
 
-static void ft_buffer_deinit(struct ft_buffer *b) {
-    ft_buffer_flush(b);
-    txvc_mempool_deinit(&b->pool);
-}
-
-static bool ft_buffer_append(struct ft_buffer *b, const uint8_t *txData, int txNumBytes,
-        rx_observer_fn observer, void *observerExtra, int rxNumBytes) {
-    if (txNumBytes > 0) {
-        if (!b->txBuffer) {
-            b->txBuffer = txvc_mempool_alloc_unaligned(&b->pool, b->maxTxBufferBytes);
-        }
-        memcpy(b->txBuffer + b->txNumBytes, txData, txNumBytes);
-        b->txNumBytes += txNumBytes;
-    }
-    if (rxNumBytes > 0) {
-        if (!b->rxBuffer) {
-            b->rxBuffer = txvc_mempool_alloc_unaligned(&b->pool, b->maxRxBufferBytes);
-        }
-        if (observer) {
-            struct rx_observer_node *node =
-                txvc_mempool_alloc_object(&b->pool, struct rx_observer_node);
-            node->next = NULL;
-            node->fn = observer;
-            node->data = b->rxBuffer + b->rxNumBytes;
-            node->extra = observerExtra;
-            if (!b->rxObserverFirst) {
-                b->rxObserverFirst = b->rxObserverLast = node;
-            } else {
-                b->rxObserverLast->next = node;
-                b->rxObserverLast = node;
-            }
+/*
+ * USB I/O thread.
+ * Transfers are handed over in the same order as they are filled, so it simply takes them
+ * one by one. Everything that a transfer refers to must stay valid until it is completed.
+ */
+static void *ft_buffer_io_thread(void *arg) {
+    struct ft_buffer *b = arg;
+    pthread_mutex_lock(&b->lock);
+    for (;;) {
+        struct ft_transfer *t = &b->transfers[b->ioIdx];
+        while (!t->inFlight && !b->stopIo) {
+            pthread_cond_wait(&b->cond, &b->lock);
         }
-        b->rxNumBytes += rxNumBytes;
+        if (!t->inFlight) {
+            break;
+        }
+        pthread_mutex_unlock(&b->lock);
+        const bool res = ft_transfer_run(b, t);
+        pthread_mutex_lock(&b->lock);
+        b->failed |= !res;
+        t->inFlight = false;
+        b->ioIdx = (b->ioIdx + 1) % FT_BUFFER_NUM_TRANSFERS;
+        pthread_cond_broadcast(&b->cond);
     }
-    return true;
+    pthread_mutex_unlock(&b->lock);
+    return NULL;
 }
 
-static bool ft_buffer_ensure_can_append(struct ft_buffer *b, int txNumBytes, int rxNumBytes) {
-    ALWAYS_ASSERT(txNumBytes <= b->maxRxBufferBytes && rxNumBytes <= b->maxRxBufferBytes);
-    const bool shouldFlush = b->txNumBytes + txNumBytes > b->maxTxBufferBytes
-                          || b->rxNumBytes + rxNumBytes > b->maxRxBufferBytes;
-    if (shouldFlush && !ft_buffer_flush(b)) {
-        return false;
+static inline struct ft_transfer *ft_buffer_filling(struct ft_buffer *b) {
+    return &b->transfers[b->fillingIdx];
+}
+
+/*
+ * Hands currently filled transfer over to USB and switches to the next one, waiting for
+ * it to complete if it is still in flight.
+ */
+static bool ft_buffer_submit(struct ft_buffer *b) {
+    struct ft_transfer *t = ft_buffer_filling(b);
+    if (!t->txNumBytes) {
+        return true;
     }
-    return true;
+    if (b->submitObserver) {
+        b->submitObserver(t, b->submitObserverExtra);
+    }
+    if (!b->useIoThread) {
+        return ft_transfer_run(b, t);
+    }
+    pthread_mutex_lock(&b->lock);
+    t->inFlight = true;
+    pthread_cond_broadcast(&b->cond);
+    b->fillingIdx = (b->fillingIdx + 1) % FT_BUFFER_NUM_TRANSFERS;
+    struct ft_transfer *next = ft_buffer_filling(b);
+    while (next->inFlight) {
+        pthread_cond_wait(&b->cond, &b->lock);
+    }
+    const bool res = !b->failed;
+    pthread_mutex_unlock(&b->lock);
+    return res;
+}
+
+/* Sends everything that was appended and waits until all read data is stored */
+static bool ft_buffer_wait_submitted(struct ft_buffer *b) {
+    bool res = true;
+    if (b->useIoThread) {
+        pthread_mutex_lock(&b->lock);
+        for (int i = 0; i < FT_BUFFER_NUM_TRANSFERS; i++) {
+            while (b->transfers[i].inFlight) {
+                pthread_cond_wait(&b->cond, &b->lock);
+            }
+        }
+        res = !b->failed;
+        b->failed = false;
+        pthread_mutex_unlock(&b->lock);
+    }
+    return res;
 }
 
-static bool ft_buffer_add_write_to_chip_with_readback(struct ft_buffer *b,
-        const uint8_t *txData, int txNumBytes,
-        rx_observer_fn observer, void *observerExtra, int rxNumBytes) {
-    return ft_buffer_ensure_can_append(b, txNumBytes, rxNumBytes)
-        && ft_buffer_append(b, txData, txNumBytes, observer, observerExtra, rxNumBytes);
+static bool ft_buffer_flush(struct ft_buffer *b) {
+    const bool res = ft_buffer_submit(b);
+    return ft_buffer_wait_submitted(b) && res;
 }
 
-struct bit_copier_rx_observer_extra {
-    int fromBit;
-    uint8_t* dst;
-    int toBit;
-    int numBits;
-};
+/*
+ * Same as above, but if filled transfer does not read anything, it may be kept to be sent along
+ * with the next one ("written behind"). Its failure is then reported by a later call.
+ */
+static bool ft_buffer_sync(struct ft_buffer *b, bool allowWriteBehind) {
+    struct ft_transfer *t = ft_buffer_filling(b);
+    if (!allowWriteBehind || t->numRxChunks) {
+        return ft_buffer_flush(b);
+    }
+    /* Read data of already submitted transfers must be stored before returning */
+    return ft_buffer_wait_submitted(b);
+}
 
-static void bit_copier_rx_observer_fn(const uint8_t *rxData, void *extra) {
-    const struct bit_copier_rx_observer_extra *e = extra;
-    copy_bits(rxData, e->fromBit, e->dst, e->toBit, e->numBits, false);
+/* Drops everything that was appended but not submitted and waits for submitted transfers */
+static void ft_buffer_discard(struct ft_buffer *b) {
+    if (b->useIoThread) {
+        pthread_mutex_lock(&b->lock);
+        for (int i = 0; i < FT_BUFFER_NUM_TRANSFERS; i++) {
+            while (b->transfers[i].inFlight) {
+                pthread_cond_wait(&b->cond, &b->lock);
+            }
+        }
+        b->failed = false;
+        pthread_mutex_unlock(&b->lock);
+    }
+    ft_transfer_clear(ft_buffer_filling(b));
 }
 
-struct byte_copier_rx_observer_extra {
-    uint8_t* dst;
-    int numBytes;
-};
+static void ft_buffer_deinit(struct ft_buffer *b) {
+    ft_buffer_flush(b);
+    if (b->useIoThread) {
+        pthread_mutex_lock(&b->lock);
+        b->stopIo = true;
+        pthread_cond_broadcast(&b->cond);
+        pthread_mutex_unlock(&b->lock);
+        pthread_join(b->ioThread, NULL);
+        pthread_cond_destroy(&b->cond);
+        pthread_mutex_destroy(&b->lock);
+    }
+    for (int i = 0; i < FT_BUFFER_NUM_TRANSFERS; i++) {
+        txvc_mempool_deinit(&b->transfers[i].pool);
+    }
+}
 
-static void byte_copier_rx_observer_fn(const uint8_t *rxData, void *extra) {
-    const struct byte_copier_rx_observer_extra *e = extra;
-    memcpy(e->dst, rxData, e->numBytes);
+static void ft_buffer_append(struct ft_buffer *b, const uint8_t *txData, int txNumBytes,
+        const struct rx_chunk *rx) {
+    struct ft_transfer *t = ft_buffer_filling(b);
+    memcpy(t->txBuffer + t->txNumBytes, txData, txNumBytes);
+    t->txNumBytes += txNumBytes;
+    if (rx) {
+        t->rxChunks[t->numRxChunks++] = *rx;
+        t->rxNumBytes += rx->numBytes;
+    }
+}
+
+static bool ft_buffer_ensure_can_append(struct ft_buffer *b, int txNumBytes, int rxNumBytes) {
+    ALWAYS_ASSERT(txNumBytes < b->maxTxBufferBytes && rxNumBytes <= b->maxRxBufferBytes);
+    const struct ft_transfer *t = ft_buffer_filling(b);
+    const bool shouldSubmit = t->txNumBytes + txNumBytes > b->maxTxBufferBytes - 1
+                           || t->rxNumBytes + rxNumBytes > b->maxRxBufferBytes;
+    if (shouldSubmit && !ft_buffer_submit(b)) {
+        return false;
+    }
+    return true;
 }
 
 static inline bool ft_buffer_add_write_to_chip(struct ft_buffer *b,
         const uint8_t *txData, int txNumBytes) {
-    return ft_buffer_add_write_to_chip_with_readback(b, txData, txNumBytes, 0, NULL, 0);
+    if (!ft_buffer_ensure_can_append(b, txNumBytes, 0)) {
+        return false;
+    }
+    ft_buffer_append(b, txData, txNumBytes, NULL);
+    return true;
 }
 
-static bool ft_buffer_add_write_to_chip_with_readback_simple(struct ft_buffer *t,
+/* Read bytes are stored to `rxData` */
+static bool ft_buffer_add_write_to_chip_with_readback_simple(struct ft_buffer *b,
         const uint8_t *txData, int txNumBytes, uint8_t *rxData, int rxNumBytes) {
-    /* Flush if needed right now, to not invalidate below allocated observer extra
-     * before it is added to a list
-     */
-    if (!ft_buffer_ensure_can_append(t, txNumBytes, rxNumBytes)) {
+    if (!ft_buffer_ensure_can_append(b, txNumBytes, rxNumBytes)) {
         return false;
     }
-    struct byte_copier_rx_observer_extra *e =
-        txvc_mempool_alloc_object(&t->pool, struct byte_copier_rx_observer_extra);
-    e->dst = rxData;
-    e->numBytes = rxNumBytes;
-    return ft_buffer_append(t, txData, txNumBytes, byte_copier_rx_observer_fn, e, rxNumBytes);
+    const struct rx_chunk rx = {
+        .dst = rxData,
+        .numBytes = rxNumBytes,
+        .direct = rxNumBytes >= RX_DIRECT_MIN_BYTES,
+    };
+    ft_buffer_append(b, txData, txNumBytes, &rx);
+    return true;
+}
+
+/* A single byte is read, `numBits` of it starting from `fromBit` are stored to `dst` */
+static bool ft_buffer_add_write_to_chip_with_bit_readback(struct ft_buffer *b,
+        const uint8_t *txData, int txNumBytes, int fromBit, uint8_t *dst, int toBit, int numBits) {
+    if (!ft_buffer_ensure_can_append(b, txNumBytes, 1)) {
+        return false;
+    }
+    const struct rx_chunk rx = {
+        .dst = dst,
+        .numBytes = 1,
+        .fromBit = fromBit,
+        .toBit = toBit,
+        .numBits = numBits,
+    };
+    ft_buffer_append(b, txData, txNumBytes, &rx);
+    return true;
+}
+
+/* Appends a transfer that was recorded earlier, with read data destined to `dstBase` vector */
+static bool ft_buffer_append_recorded(struct ft_buffer *b, const uint8_t *txData, int txNumBytes,
+        const struct cached_rx_chunk *rx, int numRxChunks, uint8_t *dstBase) {
+    int rxNumBytes = 0;
+    for (int i = 0; i < numRxChunks; i++) {
+        rxNumBytes += rx[i].chunk.numBytes;
+    }
+    if (!ft_buffer_ensure_can_append(b, txNumBytes, rxNumBytes)) {
+        return false;
+    }
+    struct ft_transfer *t = ft_buffer_filling(b);
+    memcpy(t->txBuffer + t->txNumBytes, txData, txNumBytes);
+    t->txNumBytes += txNumBytes;
+    for (int i = 0; i < numRxChunks; i++) {
+        struct rx_chunk *c = &t->rxChunks[t->numRxChunks++];
+        *c = rx[i].chunk;
+        c->dst = dstBase + rx[i].dstOffset;
+    }
+    t->rxNumBytes += rxNumBytes;
+    return true;
 }
 
 static bool check_device_in_sync(struct driver *d) {
@@ -419,34 +875,355 @@ static bool check_device_in_sync(struct driver *d) {
         && resp[1] == cmd[0];
 }
 
+/*
+ * USB tuning.
+ * Every transfer ends with SEND_IMMEDIATE, so latency timer never delays reads of JTAG traffic
+ * and can not be told apart by round trips, chip's default is kept unless user asks otherwise.
+ * IN transfer size determines how many USB requests one chip buffer of read data is split to,
+ * which depends on host controller and kernel, so when asked to, pick the one that yields the
+ * shortest round trips.
+ */
+static int usb_in_transfer_bytes(int payloadBytes) {
+    const int numPackets =
+        (payloadBytes + USB_HS_PACKET_PAYLOAD_BYTES - 1) / USB_HS_PACKET_PAYLOAD_BYTES;
+    return numPackets * USB_HS_PACKET_BYTES;
+}
+
+static bool set_usb_params(struct driver *d, int latencyMillis, int inTransferBytes) {
+    FT_STATUS status = FT_SetLatencyTimer(d->ftHandle, latencyMillis);
+    if (!FT_SUCCESS(status)) {
+        ERROR("Can't set latency timer %dms: %s\n", latencyMillis, ft_status_name(status));
+        return false;
+    }
+    status = FT_SetUSBParameters(d->ftHandle, inTransferBytes, d->cmdBuffer.maxTxBufferBytes);
+    if (!FT_SUCCESS(status)) {
+        ERROR("Can't set USB transfer size %d: %s\n", inTransferBytes, ft_status_name(status));
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Average round trip of reads of a whole chip buffer, -1 on failure.
+ * TDI and TMS are held at their initial levels so reads keep TAP in Test-Logic-Reset.
+ */
+static long long measure_round_trip_us(struct driver *d, int numTrips) {
+    const int lenField = d->chipBufferBytes - 1;
+    const uint8_t readCmd[] = {
+        OP_SHIFT_RD_TDO_FLAG | OP_SHIFT_LSB_FIRST_FLAG,
+        lenField & 0xff,
+        (lenField >> 8) & 0xff,
+    };
+    uint8_t *scratch = malloc(d->chipBufferBytes);
+    if (!scratch) {
+        return -1;
+    }
+    long long res = 0;
+    const long long startUs = now_us();
+    for (int i = 0; i < numTrips; i++) {
+        const bool ok = ft_buffer_add_write_to_chip_with_readback_simple(&d->cmdBuffer,
+                readCmd, sizeof(readCmd), scratch, d->chipBufferBytes)
+            && ft_buffer_flush(&d->cmdBuffer);
+        if (!ok) {
+            res = -1;
+            break;
+        }
+    }
+    if (res == 0) {
+        res = (now_us() - startUs) / numTrips;
+    }
+    free(scratch);
+    return res;
+}
+
+static bool tune_usb(struct driver *d) {
+    const int alignedInTransferBytes = usb_in_transfer_bytes(d->cmdBuffer.maxRxBufferBytes);
+    if (d->params.read_latency_millis != FTDI_LATENCY_AUTO) {
+        return set_usb_params(d, d->params.read_latency_millis, alignedInTransferBytes);
+    }
+
+    const int latencyMillis = FTDI_DEFAULT_LATENCY_MILLIS;
+
+    /* Exactly as many packets as chip buffer needs, USB defaults and a single large request */
+    const int transferCandidates[] = { alignedInTransferBytes, 4096, 64 * 1024, };
+    const int numTransferCandidates = sizeof(transferCandidates) / sizeof(transferCandidates[0]);
+    int inTransferBytes = alignedInTransferBytes;
+    long long bestRoundTripUs = -1;
+    for (int i = 0; i < numTransferCandidates; i++) {
+        if (!set_usb_params(d, latencyMillis, transferCandidates[i])) {
+            return false;
+        }
+        const long long roundTripUs = measure_round_trip_us(d, 4);
+        if (roundTripUs < 0) {
+            return false;
+        }
+        VERBOSE("IN transfer size %d: %lldus round trip\n", transferCandidates[i], roundTripUs);
+        if (bestRoundTripUs < 0 || roundTripUs < bestRoundTripUs) {
+            bestRoundTripUs = roundTripUs;
+            inTransferBytes = transferCandidates[i];
+        }
+    }
+    INFO("Using latency timer %dms and USB IN transfer size %d\n", latencyMillis, inTransferBytes);
+    return set_usb_params(d, latencyMillis, inTransferBytes);
+}
+
+/*
+ * MPSSE command compiler.
+ *
+ * Splitter segments are translated to intermediate MPSSE commands which are encoded and appended
+ * to ft_buffer. The last TMS command is kept pending so that following TMS bits (which may come
+ * from subsequent segments) can be merged into it, as long as it has room for them. This also
+ * makes the last bit of a TDI shift and a following TMS path a single TMS command with readback.
+ */
+static bool mpsse_cmd_encode(struct driver *d, const struct mpsse_cmd *cmd) {
+    switch (cmd->kind) {
+        case MPSSE_CMD_NONE:
+            return true;
+        case MPSSE_CMD_TMS:
+        case MPSSE_CMD_TDI_BITS: {
+            const bool isTms = cmd->kind == MPSSE_CMD_TMS;
+            uint8_t data = cmd->bits;
+            if (isTms) {
+                /* TMS wire keeps level of the bit that follows the last shifted one, so fill
+                 * the rest of the octet with the last bit to not change TMS after command is
+                 * completed. When all 7 bits are used, the 8th is TDI and compiler guarantees
+                 * that it is the same as the last TMS bit.
+                 */
+                const bool lastTms = (data >> (cmd->numBits - 1)) & 1u;
+                for (int i = cmd->numBits; i < 7; i++) {
+                    data = (data & ~(1u << i)) | (lastTms << i);
+                }
+                data = (data & 0x7fu) | (cmd->tdi << 7);
+                ALWAYS_ASSERT(cmd->numBits < 7 || lastTms == cmd->tdi);
+            }
+            const uint8_t op[] = {
+                (isTms ? OP_SHIFT_WR_TMS_FLAG : OP_SHIFT_WR_TDI_FLAG)
+                    | (cmd->numTdoBits ? OP_SHIFT_RD_TDO_FLAG : 0)
+                    | OP_SHIFT_LSB_FIRST_FLAG | OP_SHIFT_BITMODE_FLAG | OP_SHIFT_WR_FALLING_FLAG,
+                cmd->numBits - 1,
+                data,
+            };
+            if (!cmd->numTdoBits) {
+                return ft_buffer_add_write_to_chip(&d->cmdBuffer, op, 3);
+            }
+            /* TDO is shifted in from the left side */
+            return ft_buffer_add_write_to_chip_with_bit_readback(&d->cmdBuffer, op, 3,
+                    8 - cmd->numBits, cmd->tdo, cmd->tdoBitIdx, cmd->numTdoBits);
+        }
+        case MPSSE_CMD_TDI_BYTES: {
+            ALWAYS_ASSERT(cmd->numTdoBits == 0 || cmd->numTdoBits == cmd->numBytes * 8);
+            const uint8_t op[] = {
+                (cmd->numTdoBits ? OP_SHIFT_RD_TDO_FLAG : 0) | OP_SHIFT_WR_TDI_FLAG
+                    | OP_SHIFT_LSB_FIRST_FLAG | OP_SHIFT_WR_FALLING_FLAG,
+                ((cmd->numBytes - 1) >> 0) & 0xff,
+                ((cmd->numBytes - 1) >> 8) & 0xff,
+            };
+            /* Header and data must go in the same transfer, it may be ended with SEND_IMMEDIATE */
+            if (!ft_buffer_ensure_can_append(&d->cmdBuffer,
+                        3 + cmd->numBytes, cmd->numTdoBits ? cmd->numBytes : 0)) {
+                return false;
+            }
+            if (!cmd->numTdoBits) {
+                return ft_buffer_add_write_to_chip(&d->cmdBuffer, op, 3)
+                    && ft_buffer_add_write_to_chip(&d->cmdBuffer, cmd->tdiBytes, cmd->numBytes);
+            }
+            return ft_buffer_add_write_to_chip(&d->cmdBuffer, op, 3)
+                && ft_buffer_add_write_to_chip_with_readback_simple(&d->cmdBuffer,
+                        cmd->tdiBytes, cmd->numBytes, cmd->tdo + cmd->tdoBitIdx / 8, cmd->numBytes);
+        }
+        case MPSSE_CMD_CONST_TDI_BYTES: {
+            ALWAYS_ASSERT(cmd->numTdoBits == 0 || cmd->numTdoBits == cmd->numBytes * 8);
+            /* TAP is in a shift state so TMS is low, TDI is held via GPIO while either only
+             * reading or, if TDO is not needed, just clocking.
+             */
+            const uint8_t op[] = {
+                OP_SET_DBUS_LOBYTE,
+                (d->gpioLevels & ~(PIN_TCK | PIN_TDI | PIN_TMS)) | (cmd->tdi ? PIN_TDI : 0),
+                d->gpioDirections,
+                cmd->numTdoBits ? OP_SHIFT_RD_TDO_FLAG | OP_SHIFT_LSB_FIRST_FLAG : OP_CLOCK_BYTES,
+                ((cmd->numBytes - 1) >> 0) & 0xff,
+                ((cmd->numBytes - 1) >> 8) & 0xff,
+            };
+            if (!cmd->numTdoBits) {
+                return ft_buffer_add_write_to_chip(&d->cmdBuffer, op, sizeof(op));
+            }
+            return ft_buffer_add_write_to_chip_with_readback_simple(&d->cmdBuffer,
+                    op, sizeof(op), cmd->tdo + cmd->tdoBitIdx / 8, cmd->numBytes);
+        }
+        case MPSSE_CMD_CLOCKS: {
+            /* TCK only, TMS and TDI wires keep their levels */
+            for (int numClocks = cmd->numBits; numClocks > 0;) {
+                if (numClocks >= 8) {
+                    const int numOctets = min(numClocks / 8, 0x10000);
+                    const uint8_t op[] = {
+                        OP_CLOCK_BYTES,
+                        ((numOctets - 1) >> 0) & 0xff,
+                        ((numOctets - 1) >> 8) & 0xff,
+                    };
+                    if (!ft_buffer_add_write_to_chip(&d->cmdBuffer, op, 3)) {
+                        return false;
+                    }
+                    numClocks -= numOctets * 8;
+                } else {
+                    const uint8_t op[] = {
+                        OP_CLOCK_BITS,
+                        numClocks - 1,
+                    };
+                    if (!ft_buffer_add_write_to_chip(&d->cmdBuffer, op, 2)) {
+                        return false;
+                    }
+                    numClocks = 0;
+                }
+            }
+            return true;
+        }
+        default:
+            TXVC_UNREACHABLE();
+    }
+}
+
+static bool mpsse_flush_pending(struct driver *d) {
+    const bool res = mpsse_cmd_encode(d, &d->pendingCmd);
+    d->pendingCmd.kind = MPSSE_CMD_NONE;
+    return res;
+}
+
+static bool mpsse_can_append_tms_bit(const struct mpsse_cmd *cmd,
+        bool tms, bool tdi, const uint8_t *tdo, int tdoBitIdx) {
+    if (cmd->kind != MPSSE_CMD_TMS || cmd->tdi != tdi) {
+        return false;
+    }
+    /* Read bits must form a contiguous leading part of a command */
+    if (tdo && (cmd->numTdoBits != cmd->numBits
+                || (cmd->numTdoBits && (cmd->tdo != tdo
+                        || cmd->tdoBitIdx + cmd->numTdoBits != tdoBitIdx)))) {
+        return false;
+    }
+    /* The 7th bit fits only if it leaves TMS wire at the same level as TDI (see encoder) */
+    return cmd->numBits < 6 || (cmd->numBits == 6 && tms == tdi);
+}
+
+static bool mpsse_append_tms_bit(struct driver *d,
+        bool tms, bool tdi, uint8_t *tdo, int tdoBitIdx) {
+    struct mpsse_cmd *cmd = &d->pendingCmd;
+    if (!mpsse_can_append_tms_bit(cmd, tms, tdi, tdo, tdoBitIdx)) {
+        if (!mpsse_flush_pending(d)) {
+            return false;
+        }
+        cmd->kind = MPSSE_CMD_TMS;
+        cmd->numBits = 0;
+        cmd->bits = 0;
+        cmd->tdi = tdi;
+        cmd->tdo = tdo;
+        cmd->tdoBitIdx = tdoBitIdx;
+        cmd->numTdoBits = 0;
+    }
+    cmd->bits |= tms << cmd->numBits;
+    cmd->numBits++;
+    if (tdo) {
+        cmd->numTdoBits++;
+    }
+    return true;
+}
+
+static bool mpsse_append(struct driver *d, const struct mpsse_cmd *cmd) {
+    /* Only TMS commands are merged, anything else just goes after a pending one */
+    return mpsse_flush_pending(d) && mpsse_cmd_encode(d, cmd);
+}
+
+/* Returns index of the first bit in [fromBitIdx, toBitIdx) that differs from `bit` */
+static int find_other_bit(const uint8_t *p, int fromBitIdx, int toBitIdx, bool bit) {
+    const uint8_t sameOctet = bit ? 0xffu : 0x00u;
+    int i = fromBitIdx;
+    while (i < toBitIdx) {
+        if (i % 8 == 0 && toBitIdx - i >= 8 && p[i / 8] == sameOctet) {
+            i += 8;
+        } else if (get_bit(p, i) == bit) {
+            i++;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
 static bool append_tms_shift_to_transaction(struct driver *d,
         const uint8_t* tms, int fromBitIdx, int toBitIdx) {
     ALWAYS_ASSERT(fromBitIdx >= 0);
     ALWAYS_ASSERT(toBitIdx >= 0);
     ALWAYS_ASSERT(toBitIdx > fromBitIdx);
 
-    while (fromBitIdx < toBitIdx) {
-        /* In theory it is possible to send up to 7 TMS bits per command but we reserve one to
-         * duplicate the last bit which is needed to guarantee that TMS wire level is unchanged
-         * after command is completed.
-         */
-        const int maxTmsBitsPerCommand = 6;
-        const int bitsToTransfer = min(toBitIdx - fromBitIdx, maxTmsBitsPerCommand);
-        uint8_t cmd[] = {
-            OP_SHIFT_WR_TMS_FLAG | OP_SHIFT_LSB_FIRST_FLAG
-                | OP_SHIFT_BITMODE_FLAG | OP_SHIFT_WR_FALLING_FLAG,
-            bitsToTransfer - 1,
-            (!!d->lastTdi) << 7,
-        };
-        copy_bits(tms, fromBitIdx, &cmd[2], 0, bitsToTransfer, true);
-        fromBitIdx += bitsToTransfer;
-        if (!ft_buffer_add_write_to_chip(&d->cmdBuffer, cmd, 3)) {
-            return false;
+    /* Long runs of the same TMS level, e.g. waits in RUN_TEST_IDLE or PAUSE_*, are cheaper to
+     * send with clock-only commands once TMS wire is at this level. TDI does not matter here
+     * since TAP is not in a shift state.
+     */
+    const int minClockOnlyRunBits = 16;
+    for (int i = fromBitIdx; i < toBitIdx;) {
+        const bool bit = get_bit(tms, i);
+        const int runEndIdx = find_other_bit(tms, i, toBitIdx, bit);
+        if (runEndIdx - i < minClockOnlyRunBits) {
+            for (; i < runEndIdx; i++) {
+                if (!mpsse_append_tms_bit(d, bit, d->lastTdi, NULL, 0)) {
+                    return false;
+                }
+            }
+        } else {
+            const struct mpsse_cmd cmd = {
+                .kind = MPSSE_CMD_CLOCKS,
+                .numBits = runEndIdx - i - 1,
+            };
+            /* The first bit moves TMS wire to the needed level */
+            if (!mpsse_append_tms_bit(d, bit, d->lastTdi, NULL, 0)
+                    || !mpsse_append(d, &cmd)) {
+                return false;
+            }
+            i = runEndIdx;
         }
     }
     return true;
 }
 
+/*
+ * Constant TDI detection, done a word at a time.
+ * Read-only commands need the same 3 bytes header as write-read ones plus 3 bytes to set TDI
+ * level, so only runs that are long enough are worth it.
+ */
+#define MIN_READ_ONLY_OCTETS 8
+
+static inline uint64_t load_word(const uint8_t *p) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+/* Returns number of leading octets in `p` that are equal to `octet` */
+static int count_same_octets(const uint8_t *p, int numOctets, uint8_t octet) {
+    const uint64_t sameWord = octet * UINT64_C(0x0101010101010101);
+    int i = 0;
+    while (i + 8 <= numOctets && load_word(p + i) == sameWord) {
+        i += 8;
+    }
+    while (i < numOctets && p[i] == octet) {
+        i++;
+    }
+    return i;
+}
+
+/*
+ * Returns offset of the first whole word of either 0x00 or 0xff octets, counting words from
+ * the beginning of `p`, or `numOctets` if there is none. Never returns 0.
+ */
+static int find_constant_octets(const uint8_t *p, int numOctets) {
+    for (int i = 8; i + 8 <= numOctets; i += 8) {
+        const uint64_t w = load_word(p + i);
+        if (w == 0 || w == ~UINT64_C(0)) {
+            return i;
+        }
+    }
+    return numOctets;
+}
+
+/* `tdo` is NULL for write-only shifts */
 static bool append_tdi_shift_to_transaction(struct driver *d,
         const uint8_t* tdi, uint8_t* tdo, int fromBitIdx, int toBitIdx, bool lastTmsBitHigh) {
     ALWAYS_ASSERT(fromBitIdx >= 0);
@@ -458,111 +1235,324 @@ static bool append_tdi_shift_to_transaction(struct driver *d,
      * memcpy(3) can be used to transfer data to/from ft_buffer..
      * Ranges are:
      * - leading, 0 to 7 bits. Length is chosen in a such way that it ends at octet
-     *   boundary except for when last bit (see below) falls into leading range.
+     *   boundary except for when regular bits end earlier.
      *   It's length is 0 if vectors start at octet boundary.
      * - inner, 0 or more whole octets. These are all whole vector octets between end of
-     *   a leading range and the last vector bit.
-     * - trailing, 0 to 7 bits. All bits between end of inner range and the last bit.
-     * - last bit, 1 bit. This one is always present and must be separated because it is send
-     *   via TMS command that is needed e.g. when we are exiting shift state.
+     *   a leading range and the end of regular bits.
+     * - trailing, 0 to 7 bits. All regular bits after the inner range.
+     * - last bit, 1 bit. This one is present only if TAP leaves shift state and must be separated
+     *   because it is sent via TMS command. Compiler merges it with the following TMS path.
      */
 
-    const int lastBitIdx = toBitIdx - 1;
-    const int numRegularBits = lastBitIdx - fromBitIdx;
-    const int numFirstOctetBits = 8 - fromBitIdx % 8;
-    const int numLeadingBits = min(numFirstOctetBits == 8 ? 0 : numFirstOctetBits, numRegularBits);
-    const bool leadingOnly = numLeadingBits == numRegularBits;
-    const int innerBeginIdx = leadingOnly ? -1 : fromBitIdx + numLeadingBits;
-    const int innerEndIdx = leadingOnly ? -1 : lastBitIdx - lastBitIdx % 8;
-    const int numTrailingBits = leadingOnly ? 0 : lastBitIdx % 8;
-
-    for (int curIdx = fromBitIdx; curIdx < toBitIdx;) {
-        if (curIdx == fromBitIdx && numLeadingBits > 0) {
-            const uint8_t cmd[] = {
-                OP_SHIFT_RD_TDO_FLAG | OP_SHIFT_WR_TDI_FLAG | OP_SHIFT_LSB_FIRST_FLAG
-                    | OP_SHIFT_BITMODE_FLAG | OP_SHIFT_WR_FALLING_FLAG,
-                numLeadingBits - 1,
-                tdi[fromBitIdx / 8] >> (fromBitIdx % 8),
-            };
-            struct bit_copier_rx_observer_extra *e =
-                txvc_mempool_alloc_object(&d->pool, struct bit_copier_rx_observer_extra);
-            e->fromBit = 8 - numLeadingBits;
-            e->dst = tdo;
-            e->toBit = fromBitIdx;
-            e->numBits = numLeadingBits;
-            if (!ft_buffer_add_write_to_chip_with_readback(&d->cmdBuffer,
-                        cmd, 3, bit_copier_rx_observer_fn, e, 1)) {
-                return false;
-            }
-            curIdx += numLeadingBits;
-        }
-        if (curIdx < lastBitIdx) {
-            if (curIdx < innerEndIdx) {
-                ALWAYS_ASSERT(innerBeginIdx % 8 == 0);
-                ALWAYS_ASSERT(innerEndIdx % 8 == 0);
-                ALWAYS_ASSERT(curIdx % 8 == 0);
-                const int innerOctetsToSend = min((innerEndIdx - curIdx) / 8, d->chipBufferBytes);
-                const uint8_t cmd[] = {
-                    OP_SHIFT_RD_TDO_FLAG | OP_SHIFT_WR_TDI_FLAG
-                        | OP_SHIFT_LSB_FIRST_FLAG | OP_SHIFT_WR_FALLING_FLAG,
-                    ((innerOctetsToSend - 1) >> 0) & 0xff,
-                    ((innerOctetsToSend - 1) >> 8) & 0xff,
-                };
-                if (!ft_buffer_add_write_to_chip(&d->cmdBuffer, cmd, 3)) {
-                    return false;
-                }
-                if (!ft_buffer_add_write_to_chip_with_readback_simple(&d->cmdBuffer,
-                            tdi + curIdx / 8, innerOctetsToSend,
-                            tdo + curIdx / 8, innerOctetsToSend)) {
-                    return false;
-                }
-                curIdx += innerOctetsToSend * 8;
-            }
-            if (curIdx == innerEndIdx && numTrailingBits > 0) {
-                const uint8_t cmd[] = {
-                    OP_SHIFT_RD_TDO_FLAG | OP_SHIFT_WR_TDI_FLAG | OP_SHIFT_LSB_FIRST_FLAG
-                        | OP_SHIFT_BITMODE_FLAG | OP_SHIFT_WR_FALLING_FLAG,
-                    numTrailingBits - 1,
-                    tdi[innerEndIdx / 8],
-                };
-                struct bit_copier_rx_observer_extra *e =
-                    txvc_mempool_alloc_object(&d->pool, struct bit_copier_rx_observer_extra);
-                e->fromBit = 8 - numTrailingBits;
-                e->dst = tdo;
-                e->toBit = innerEndIdx;
-                e->numBits = numTrailingBits;
-                if (!ft_buffer_add_write_to_chip_with_readback(&d->cmdBuffer,
-                            cmd, 3, bit_copier_rx_observer_fn, e, 1)) {
-                    return false;
-                }
-                curIdx += numTrailingBits;
-            }
+    const int regularEndIdx = lastTmsBitHigh ? toBitIdx - 1 : toBitIdx;
+    int curIdx = fromBitIdx;
+
+    const int numLeadingBits = min((8 - curIdx % 8) % 8, regularEndIdx - curIdx);
+    if (numLeadingBits > 0) {
+        const struct mpsse_cmd cmd = {
+            .kind = MPSSE_CMD_TDI_BITS,
+            .numBits = numLeadingBits,
+            .bits = tdi[curIdx / 8] >> (curIdx % 8),
+            .tdo = tdo,
+            .tdoBitIdx = curIdx,
+            .numTdoBits = tdo ? numLeadingBits : 0,
+        };
+        if (!mpsse_append(d, &cmd)) {
+            return false;
+        }
+        curIdx += numLeadingBits;
+    }
+    while (regularEndIdx - curIdx >= 8) {
+        ALWAYS_ASSERT(curIdx % 8 == 0);
+        /* Readbacks usually shift constant TDI, there is no need to send it then */
+        const uint8_t *innerTdi = tdi + curIdx / 8;
+        const int maxInnerOctets = min((regularEndIdx - curIdx) / 8, d->chipBufferBytes);
+        const int numConstantOctets = innerTdi[0] == 0x00u || innerTdi[0] == 0xffu
+            ? count_same_octets(innerTdi, maxInnerOctets, innerTdi[0]) : 0;
+        const bool readOnly = numConstantOctets >= MIN_READ_ONLY_OCTETS;
+        const int innerOctetsToSend = readOnly
+            ? numConstantOctets : find_constant_octets(innerTdi, maxInnerOctets);
+        const struct mpsse_cmd cmd = {
+            .kind = readOnly ? MPSSE_CMD_CONST_TDI_BYTES : MPSSE_CMD_TDI_BYTES,
+            .tdi = innerTdi[0] & 1u,
+            .tdiBytes = innerTdi,
+            .numBytes = innerOctetsToSend,
+            .tdo = tdo,
+            .tdoBitIdx = curIdx,
+            .numTdoBits = tdo ? innerOctetsToSend * 8 : 0,
+        };
+        if (!mpsse_append(d, &cmd)) {
+            return false;
+        }
+        curIdx += innerOctetsToSend * 8;
+    }
+    if (curIdx < regularEndIdx) {
+        ALWAYS_ASSERT(curIdx % 8 == 0);
+        const struct mpsse_cmd cmd = {
+            .kind = MPSSE_CMD_TDI_BITS,
+            .numBits = regularEndIdx - curIdx,
+            .bits = tdi[curIdx / 8],
+            .tdo = tdo,
+            .tdoBitIdx = curIdx,
+            .numTdoBits = tdo ? regularEndIdx - curIdx : 0,
+        };
+        if (!mpsse_append(d, &cmd)) {
+            return false;
+        }
+        curIdx = regularEndIdx;
+    }
+    if (lastTmsBitHigh) {
+        const bool lastTdiBit = get_bit(tdi, curIdx);
+        if (!mpsse_append_tms_bit(d, true, lastTdiBit, tdo, curIdx)) {
+            return false;
         }
+        /* Let future TMS commands use proper TDI value when enqueued. */
+        d->lastTdi = lastTdiBit;
+    }
+    return true;
+}
 
-        if (curIdx == lastBitIdx) {
-            const int lastTdiBit = !!get_bit(tdi, lastBitIdx);
-            const int lastTmsBit = !!lastTmsBitHigh;
-            const uint8_t cmd[] = {
-                OP_SHIFT_WR_TMS_FLAG | OP_SHIFT_RD_TDO_FLAG | OP_SHIFT_LSB_FIRST_FLAG
-                    | OP_SHIFT_BITMODE_FLAG | OP_SHIFT_WR_FALLING_FLAG,
-                0x00, /* Send 1 bit */
-                (lastTdiBit << 7) | (lastTmsBit << 1) | lastTmsBit,
-            };
-            struct bit_copier_rx_observer_extra *e =
-                txvc_mempool_alloc_object(&d->pool, struct bit_copier_rx_observer_extra);
-            e->fromBit = 7; /* TDO is shifted in from the right side */
-            e->dst = tdo;
-            e->toBit = lastBitIdx;
-            e->numBits = 1;
-            if (!ft_buffer_add_write_to_chip_with_readback(&d->cmdBuffer,
-                        cmd, 3, bit_copier_rx_observer_fn, e, 1)) {
-                return false;
+/*
+ * Write-only DR shifts.
+ * Configuration loads are the largest transfers and their TDO is of no use, so when user names
+ * instructions that are used for them, these DR shifts are sent without reading TDO back. This
+ * also saves waiting for the chip to return read data.
+ */
+static bool is_write_only_shift(struct driver *d, const struct txvc_jtag_split_segment *s) {
+    if (!s->irKnown) {
+        return false;
+    }
+    const struct int_list *opcodes = &d->params.wo_opcodes;
+    for (int pos = 0; pos < d->params.wo_ir_lengths.numItems; pos++) {
+        const unsigned ir = txvc_jtag_splitter_device_ir(&d->jtagSplitter, s, pos);
+        for (int i = 0; i < opcodes->numItems; i++) {
+            if (ir == (unsigned) opcodes->items[i]) {
+                return true;
             }
-            /* Let future TMS commands use proper TDI value when enqueued. */
-            d->lastTdi = lastTdiBit;
-            curIdx += 1;
         }
     }
+    return false;
+}
+
+static void fill_tdo(uint8_t *tdo, int fromBitIdx, int toBitIdx, uint8_t fill) {
+    for (int i = fromBitIdx; i < toBitIdx;) {
+        if (i % 8 == 0 && toBitIdx - i >= 8) {
+            const int numOctets = (toBitIdx - i) / 8;
+            memset(tdo + i / 8, fill, numOctets);
+            i += numOctets * 8;
+        } else {
+            set_bit(tdo, i, (fill >> (i % 8)) & 1u);
+            i++;
+        }
+    }
+}
+
+static void vector_cache_init(struct vector_cache *c, size_t maxBytes, const struct ft_buffer *b) {
+    memset(c, 0, sizeof(*c));
+    c->maxBytes = maxBytes;
+    if (!maxBytes) {
+        return;
+    }
+    struct vector_recording *r = &c->recording;
+    r->maxTxBytes = VECTOR_CACHE_MAX_TRANSFERS * b->maxTxBufferBytes;
+    r->maxRxChunks = b->maxRxBufferBytes;
+    r->tx = malloc(r->maxTxBytes);
+    r->rxChunks = malloc(r->maxRxChunks * sizeof(*r->rxChunks));
+    if (!r->tx || !r->rxChunks) {
+        FATAL("Can not allocate vector cache\n");
+    }
+}
+
+static void vector_cache_remove(struct vector_cache *c, struct cache_entry *e) {
+    struct cache_entry **link = &c->buckets[e->hash % VECTOR_CACHE_NUM_BUCKETS];
+    while (*link != e) {
+        link = &(*link)->bucketNext;
+    }
+    *link = e->bucketNext;
+    if (e->lruPrev) e->lruPrev->lruNext = e->lruNext;
+    else c->lruFirst = e->lruNext;
+    if (e->lruNext) e->lruNext->lruPrev = e->lruPrev;
+    else c->lruLast = e->lruPrev;
+    c->numBytes -= e->numBytes;
+    c->numEntries--;
+    free(e);
+}
+
+static void vector_cache_clear(struct vector_cache *c) {
+    while (c->lruFirst) {
+        vector_cache_remove(c, c->lruFirst);
+    }
+}
+
+static void vector_cache_deinit(struct vector_cache *c) {
+    vector_cache_clear(c);
+    free(c->recording.tx);
+    free(c->recording.rxChunks);
+}
+
+/* Bits past the vector end in its last octet are ignored */
+static uint64_t hash_vector(uint64_t h, int numBits, const uint8_t *p) {
+    const uint64_t fnvPrime = UINT64_C(0x100000001b3);
+    for (int i = 0; i < numBits / 8; i++) {
+        h = (h ^ p[i]) * fnvPrime;
+    }
+    if (numBits % 8) {
+        h = (h ^ (p[numBits / 8] & ((1u << (numBits % 8)) - 1u))) * fnvPrime;
+    }
+    return h;
+}
+
+static bool same_vectors(int numBits, const uint8_t *a, const uint8_t *b) {
+    const uint8_t lastMask = (1u << (numBits % 8)) - 1u;
+    return memcmp(a, b, numBits / 8) == 0
+        && (numBits % 8 == 0 || ((a[numBits / 8] ^ b[numBits / 8]) & lastMask) == 0);
+}
+
+static uint64_t vector_cache_hash(int numBits, const uint8_t *tms, const uint8_t *tdi) {
+    const uint64_t fnvOffsetBasis = UINT64_C(0xcbf29ce484222325);
+    return hash_vector(hash_vector(fnvOffsetBasis ^ (uint64_t) numBits, numBits, tms),
+            numBits, tdi);
+}
+
+static struct cache_entry *vector_cache_find(struct vector_cache *c, uint64_t hash,
+        int numBits, const uint8_t *tms, const uint8_t *tdi,
+        const struct txvc_jtag_splitter *splitter, bool lastTdi) {
+    struct cache_entry *e = c->buckets[hash % VECTOR_CACHE_NUM_BUCKETS];
+    for (; e; e = e->bucketNext) {
+        if (e->hash == hash && e->numBits == numBits && e->lastTdiBefore == lastTdi
+                && txvc_jtag_splitter_same_state(&e->splitterBefore, splitter)
+                && same_vectors(numBits, e->tms, tms)
+                && same_vectors(numBits, e->tdi, tdi)) {
+            break;
+        }
+    }
+    if (e && e != c->lruFirst) {
+        /* Move to the front of LRU list */
+        e->lruPrev->lruNext = e->lruNext;
+        if (e->lruNext) e->lruNext->lruPrev = e->lruPrev;
+        else c->lruLast = e->lruPrev;
+        e->lruPrev = NULL;
+        e->lruNext = c->lruFirst;
+        c->lruFirst->lruPrev = e;
+        c->lruFirst = e;
+    }
+    return e;
+}
+
+static void vector_recording_start(struct vector_recording *r, uint8_t *tdo, int numBits,
+        const struct ft_buffer *b) {
+    r->active = true;
+    r->failed = false;
+    r->skipTxBytes = b->transfers[b->fillingIdx].txNumBytes;
+    r->skipRxChunks = b->transfers[b->fillingIdx].numRxChunks;
+    r->tdo = tdo;
+    r->tdoNumBytes = (numBits + 7) / 8;
+    r->numTransfers = 0;
+    r->txNumBytes = 0;
+    r->numRxChunks = 0;
+}
+
+static void vector_recording_observer_fn(const struct ft_transfer *t, void *extra) {
+    struct vector_recording *r = extra;
+    if (!r->active || r->failed) {
+        return;
+    }
+    const uint8_t *txData = t->txBuffer + r->skipTxBytes;
+    const int txNumBytes = t->txNumBytes - r->skipTxBytes;
+    const struct rx_chunk *rxChunks = t->rxChunks + r->skipRxChunks;
+    const int numRxChunks = t->numRxChunks - r->skipRxChunks;
+    r->skipTxBytes = 0;
+    r->skipRxChunks = 0;
+    if (txNumBytes == 0 && numRxChunks == 0) {
+        return;
+    }
+    if (r->numTransfers == VECTOR_CACHE_MAX_TRANSFERS
+            || r->txNumBytes + txNumBytes > r->maxTxBytes
+            || r->numRxChunks + numRxChunks > r->maxRxChunks) {
+        r->failed = true;
+        return;
+    }
+    for (int i = 0; i < numRxChunks; i++) {
+        const struct rx_chunk *c = &rxChunks[i];
+        /* Only data that goes to TDO vector can be replayed */
+        if (c->dst < r->tdo || c->dst >= r->tdo + r->tdoNumBytes) {
+            r->failed = true;
+            return;
+        }
+        struct cached_rx_chunk *cc = &r->rxChunks[r->numRxChunks + i];
+        cc->chunk = *c;
+        cc->chunk.dst = NULL;
+        cc->dstOffset = (int) (c->dst - r->tdo);
+    }
+    memcpy(r->tx + r->txNumBytes, txData, txNumBytes);
+    r->txNumBytes += txNumBytes;
+    r->numRxChunks += numRxChunks;
+    r->transfers[r->numTransfers].txNumBytes = txNumBytes;
+    r->transfers[r->numTransfers].numRxChunks = numRxChunks;
+    r->numTransfers++;
+}
+
+static void vector_cache_insert(struct vector_cache *c, uint64_t hash,
+        int numBits, const uint8_t *tms, const uint8_t *tdi,
+        const struct txvc_jtag_splitter *splitterBefore, bool lastTdiBefore,
+        const struct txvc_jtag_splitter *splitterAfter, bool lastTdiAfter) {
+    const struct vector_recording *r = &c->recording;
+    const int vectorBytes = (numBits + 7) / 8;
+    const size_t numBytes = sizeof(struct cache_entry)
+        + r->numRxChunks * sizeof(struct cached_rx_chunk) + 2 * vectorBytes + r->txNumBytes;
+    if (numBytes > c->maxBytes) {
+        return;
+    }
+    while (c->numBytes + numBytes > c->maxBytes) {
+        vector_cache_remove(c, c->lruLast);
+    }
+    struct cache_entry *e = malloc(numBytes);
+    if (!e) {
+        return;
+    }
+    e->hash = hash;
+    e->numBytes = numBytes;
+    e->splitterBefore = *splitterBefore;
+    e->splitterAfter = *splitterAfter;
+    e->lastTdiBefore = lastTdiBefore;
+    e->lastTdiAfter = lastTdiAfter;
+    e->numBits = numBits;
+    e->numTransfers = r->numTransfers;
+    memcpy(e->transfers, r->transfers, r->numTransfers * sizeof(r->transfers[0]));
+    /* Chunks go first to keep them aligned, then byte arrays */
+    e->rxChunks = (struct cached_rx_chunk *) (e + 1);
+    memcpy(e->rxChunks, r->rxChunks, r->numRxChunks * sizeof(r->rxChunks[0]));
+    e->tms = (uint8_t *) (e->rxChunks + r->numRxChunks);
+    memcpy(e->tms, tms, vectorBytes);
+    e->tdi = e->tms + vectorBytes;
+    memcpy(e->tdi, tdi, vectorBytes);
+    e->tx = e->tdi + vectorBytes;
+    memcpy(e->tx, r->tx, r->txNumBytes);
+
+    struct cache_entry **bucket = &c->buckets[hash % VECTOR_CACHE_NUM_BUCKETS];
+    e->bucketNext = *bucket;
+    *bucket = e;
+    e->lruPrev = NULL;
+    e->lruNext = c->lruFirst;
+    if (c->lruFirst) c->lruFirst->lruPrev = e;
+    else c->lruLast = e;
+    c->lruFirst = e;
+    c->numBytes += numBytes;
+    c->numEntries++;
+}
+
+static bool vector_cache_replay(struct driver *d, const struct cache_entry *e, uint8_t *tdo) {
+    const uint8_t *tx = e->tx;
+    const struct cached_rx_chunk *rx = e->rxChunks;
+    for (int i = 0; i < e->numTransfers; i++) {
+        const struct cached_transfer *t = &e->transfers[i];
+        if (!ft_buffer_append_recorded(&d->cmdBuffer, tx, t->txNumBytes, rx, t->numRxChunks, tdo)
+                || (i + 1 < e->numTransfers && !ft_buffer_submit(&d->cmdBuffer))) {
+            return false;
+        }
+        tx += t->txNumBytes;
+        rx += t->numRxChunks;
+    }
     return true;
 }
 
@@ -584,16 +1574,19 @@ static bool jtag_splitter_callback(const struct txvc_jtag_split_event *event, vo
     {
         const struct txvc_jtag_split_flush_all *e = txvc_jtag_split_cast_to_flush_all(event);
         if (e) {
-            bool res = ft_buffer_flush(&d->cmdBuffer);
-            txvc_mempool_reclaim_all(&d->pool);
+            bool res = mpsse_flush_pending(d) && ft_buffer_flush(&d->cmdBuffer);
+            if (!res) {
+                ft_buffer_discard(&d->cmdBuffer);
+                d->pendingCmd.kind = MPSSE_CMD_NONE;
+            }
             return res;
         }
     }
     TXVC_UNREACHABLE();
 }
 
-static bool activate(int numArgs, const char **argNames, const char **argValues){
-    struct driver *d = &gFtdi;
+static bool activate(void *ctx, int numArgs, const char **argNames, const char **argValues){
+    struct driver *d = ctx;
 
     if (!load_config(numArgs, argNames, argValues, &d->params)) goto bail_noop;
     char channelSelector = d->params.channel;
@@ -636,52 +1629,70 @@ static bool activate(int numArgs, const char **argNames, const char **argValues)
     INFO("Using d2xx driver v.%x.%x.%x\n",
             (ver >> 16) & 0xffu, (ver >> 8) & 0xffu, (ver >> 0) & 0xffu);
     REQUIRE_D2XX_SUCCESS_(FT_SetVIDPID(d->params.vid,d->params.pid), bail_noop);
-    FT_DEVICE_LIST_INFO_NODE connectedDevices[4];
-    DWORD numConnectedDevices = sizeof(connectedDevices) / sizeof(connectedDevices[0]);
+    DWORD numConnectedDevices = 0;
     REQUIRE_D2XX_SUCCESS_(FT_CreateDeviceInfoList(&numConnectedDevices), bail_noop);
-    REQUIRE_D2XX_SUCCESS_(FT_GetDeviceInfoList(connectedDevices, &numConnectedDevices), bail_noop);
+    FT_DEVICE_LIST_INFO_NODE *connectedDevices =
+        calloc(numConnectedDevices ? numConnectedDevices : 1, sizeof(*connectedDevices));
+    if (!connectedDevices) {
+        ERROR("Can not allocate list of %u devices\n", (unsigned) numConnectedDevices);
+        goto bail_noop;
+    }
+    REQUIRE_D2XX_SUCCESS_(FT_GetDeviceInfoList(connectedDevices, &numConnectedDevices),
+            bail_free_device_list);
     FT_DEVICE_LIST_INFO_NODE *selectedDevice = NULL;
-    if (numConnectedDevices) {
-        if (!channelSelector) {
-            selectedDevice = &connectedDevices[0];
-        } else {
-            for (DWORD i = 0; i < numConnectedDevices; i++) {
-                char *curSerial = connectedDevices[i].SerialNumber;
-                size_t curSerialLen = strlen(curSerial);
-                if (channelSelector == curSerial[curSerialLen - 1]) {
-                    selectedDevice = & connectedDevices[i];
-                    break;
-                }
+    for (DWORD i = 0; i < numConnectedDevices && !selectedDevice; i++) {
+        const char *curSerial = connectedDevices[i].SerialNumber;
+        size_t curSerialLen = strlen(curSerial);
+        if (channelSelector) {
+            /* Channels of a multi-port chip have its serial number followed by channel name */
+            if (curSerialLen == 0 || channelSelector != curSerial[curSerialLen - 1]) {
+                continue;
             }
+            curSerialLen--;
+        }
+        if (*d->params.serial && (strlen(d->params.serial) != curSerialLen
+                    || strncmp(d->params.serial, curSerial, curSerialLen) != 0)) {
+            continue;
         }
+        selectedDevice = &connectedDevices[i];
     }
     if (!selectedDevice) {
         ERROR("No matching device was found\n");
-        goto bail_noop;
+        goto bail_free_device_list;
     }
     INFO("Using device \"%s\" (serial number: \"%s\")\n",
             selectedDevice->Description, selectedDevice->SerialNumber);
+    char serialNumber[sizeof(selectedDevice->SerialNumber)];
+    memcpy(serialNumber, selectedDevice->SerialNumber, sizeof(serialNumber));
+    free(connectedDevices);
+    connectedDevices = NULL;
     if (numConnectedDevices == 1) {
         REQUIRE_D2XX_SUCCESS_(FT_Open(0, &d->ftHandle), bail_cant_open);
     } else {
-        REQUIRE_D2XX_SUCCESS_(FT_OpenEx(selectedDevice->SerialNumber, FT_OPEN_BY_SERIAL_NUMBER,
+        REQUIRE_D2XX_SUCCESS_(FT_OpenEx(serialNumber, FT_OPEN_BY_SERIAL_NUMBER,
                     &d->ftHandle), bail_cant_open);
     }
     REQUIRE_D2XX_SUCCESS_(FT_Purge(d->ftHandle, FT_PURGE_RX | FT_PURGE_TX),  bail_usb_close);
     REQUIRE_D2XX_SUCCESS_(FT_SetChars(d->ftHandle, 0, 0, 0, 0), bail_usb_close);
     REQUIRE_D2XX_SUCCESS_(FT_SetFlowControl(d->ftHandle, FT_FLOW_RTS_CTS, 0, 0), bail_usb_close);
-    VERBOSE("Set latency timer to %dms\n", d->params.read_latency_millis);
-    REQUIRE_D2XX_SUCCESS_(FT_SetLatencyTimer(d->ftHandle, d->params.read_latency_millis),
-            bail_usb_close);
     REQUIRE_D2XX_SUCCESS_(FT_SetBitMode(d->ftHandle, 0x00, FT_BITMODE_RESET), bail_usb_close);
     REQUIRE_D2XX_SUCCESS_(FT_SetBitMode(d->ftHandle, 0x00, FT_BITMODE_MPSSE), bail_usb_close);
 
 #undef REQUIRE_D2XX_SUCCESS_
 
-    txvc_mempool_init(&d->pool, 64 * 1024);
-    ft_buffer_init(&d->cmdBuffer, d->ftHandle, d->chipBufferBytes);
+    /* Vectors are decoded at once, size segments for the worst case of the longest one */
+    d->maxSegments = TXVC_JTAG_SPLIT_MAX_SEGMENTS(d->chipBufferBytes * 8);
+    d->segments = malloc(d->maxSegments * sizeof(*d->segments));
+    if (!d->segments) {
+        ERROR("Can not allocate %d segments\n", d->maxSegments);
+        goto bail_usb_close;
+    }
+    ft_buffer_init(&d->cmdBuffer, d->ftHandle, d->chipBufferBytes, d->params.io_thread);
+    vector_cache_init(&d->cache, (size_t) d->params.cache_kbytes * 1024, &d->cmdBuffer);
 
     d->lastTdi = 0;
+    d->pendingCmd.kind = MPSSE_CMD_NONE;
+    d->numShiftedBits = 0;
     uint8_t setupCmds[] = {
         OP_SET_DBUS_LOBYTE,
         0x08, /* Initial levels: TCK=0, TDI=0, TMS=1 */
@@ -704,17 +1715,43 @@ static bool activate(int numArgs, const char **argNames, const char **argValues)
                 TXVC_UNREACHABLE();
         }
     }
+    d->gpioLevels = setupCmds[1];
+    d->gpioDirections = setupCmds[2];
     if (!ft_buffer_add_write_to_chip(&d->cmdBuffer, setupCmds, 3)
-            || !check_device_in_sync(d)) {
+            || !check_device_in_sync(d)
+            || !tune_usb(d)) {
         ERROR("Failed to setup device\n");
         goto bail_reset_mode;
     }
+    /* Report round trips of JTAG traffic only */
+    d->cmdBuffer.numRoundTrips = 0;
+    d->cmdBuffer.totalRoundTripUs = 0;
+    if (d->cache.maxBytes) {
+        d->cmdBuffer.submitObserver = vector_recording_observer_fn;
+        d->cmdBuffer.submitObserverExtra = &d->cache.recording;
+    }
     if (!txvc_jtag_splitter_init(&d->jtagSplitter, jtag_splitter_callback, d)) {
         goto bail_reset_mode;
     }
+    if (d->params.wo_ir_lengths.numItems) {
+        if (!txvc_jtag_splitter_track_ir(&d->jtagSplitter,
+                    d->params.wo_ir_lengths.numItems, d->params.wo_ir_lengths.items)) {
+            goto bail_splitter_deinit;
+        }
+        if (!d->params.wo_opcodes.numItems) {
+            WARN("No \"wo_opcodes\" given, all DR shifts will read TDO\n");
+        }
+    }
     return true;
 
+bail_splitter_deinit:
+    txvc_jtag_splitter_deinit(&d->jtagSplitter);
+
 bail_reset_mode:
+    ft_buffer_deinit(&d->cmdBuffer);
+    vector_cache_deinit(&d->cache);
+    free(d->segments);
+    d->segments = NULL;
     FT_SetBitMode(d->ftHandle, 0x00, FT_BITMODE_RESET);
 bail_usb_close:
     FT_Close(d->ftHandle);
@@ -724,26 +1761,45 @@ bail_cant_open:
         ERROR(" Did you forget to \"sudo rmmod ftdi_sio\"?\n");
         ERROR("--------------------------------------------\n");
     }
+bail_free_device_list:
+    free(connectedDevices);
 bail_noop:
     return false;
 }
 
-static bool deactivate(void){
-    struct driver *d = &gFtdi;
+static bool deactivate(void *ctx){
+    struct driver *d = ctx;
     txvc_jtag_splitter_deinit(&d->jtagSplitter);
     ft_buffer_deinit(&d->cmdBuffer);
-    txvc_mempool_deinit(&d->pool);
+    if (d->numShiftedBits) {
+        INFO("Sent %llu bytes for %llu JTAG bits, %.3f bytes per bit\n",
+                d->cmdBuffer.totalTxBytes, d->numShiftedBits,
+                (double) d->cmdBuffer.totalTxBytes / d->numShiftedBits);
+    }
+    if (d->cmdBuffer.numRoundTrips) {
+        INFO("Made %llu round trips to chip, %lldus on average, %lldus min, %lldus max\n",
+                d->cmdBuffer.numRoundTrips,
+                d->cmdBuffer.totalRoundTripUs / (long long) d->cmdBuffer.numRoundTrips,
+                d->cmdBuffer.minRoundTripUs, d->cmdBuffer.maxRoundTripUs);
+    }
+    if (d->cache.maxBytes) {
+        INFO("Vector cache: %llu hits, %llu misses, %d entries in %zu bytes\n",
+                d->cache.numHits, d->cache.numMisses, d->cache.numEntries, d->cache.numBytes);
+    }
+    vector_cache_deinit(&d->cache);
+    free(d->segments);
+    d->segments = NULL;
     FT_SetBitMode(d->ftHandle, 0x00, FT_BITMODE_RESET);
     FT_Close(d->ftHandle);
     return true;
 }
 
-static int max_vector_bits(void){
-    struct driver *d = &gFtdi;
+static int max_vector_bits(void *ctx){
+    struct driver *d = ctx;
     return d->chipBufferBytes * 8;
 }
 
-static int set_tck_period(int tckPeriodNs){
+static int set_tck_period(void *ctx, int tckPeriodNs){
     /*
      * Find out needed divider by using official formula from FTDI docs:
      * TCK/SK period = 12MHz / (( 1 +[(0xValueH * 256) OR 0xValueL] ) * 2)
@@ -751,7 +1807,7 @@ static int set_tck_period(int tckPeriodNs){
      * TCK period = 60MHz / (( 1 +[ (0xValueH * 256) OR 0xValueL] ) * 2)
      * Strictly speaking these formulae yield frequency, not a period.
      */
-    struct driver *d = &gFtdi;
+    struct driver *d = ctx;
     const int maxFreqMHz = d->highSpeedCapable ? 30 : 6;
     /* Use nearest greater period if there is no exact match */
     int divider = (maxFreqMHz * tckPeriodNs) / 1000 - (!((maxFreqMHz * tckPeriodNs) % 1000));
@@ -768,6 +1824,8 @@ static int set_tck_period(int tckPeriodNs){
     if (divider == 0xffff) {
         WARN("Using maximal available period: %dns\n", actualPeriodNs);
     }
+    /* Let new settings take effect for all vectors, even if they are encoded the same way */
+    vector_cache_clear(&d->cache);
     const uint8_t cmd[] = {
         OP_SET_TCK_DIVISOR,
         divider & 0xff,
@@ -782,10 +1840,106 @@ static int set_tck_period(int tckPeriodNs){
     return actualPeriodNs;
 }
 
-static bool shift_bits(int numBits, const uint8_t *tmsVector, const uint8_t *tdiVector,
+static bool shift_bits_encoded(struct driver *d, int numBits, const uint8_t *tmsVector,
+        const uint8_t *tdiVector, uint8_t *tdoVector) {
+    const int numSegments = txvc_jtag_splitter_decode(&d->jtagSplitter,
+            numBits, tmsVector, tdiVector, d->segments, d->maxSegments);
+    if (numSegments < 0) {
+        return false;
+    }
+    bool res = true;
+    for (int i = 0; res && i < numSegments; i++) {
+        const struct txvc_jtag_split_segment *s = &d->segments[i];
+        switch (s->kind) {
+            case JTAG_SPLIT_shift_tms:
+                res = append_tms_shift_to_transaction(d, tmsVector, s->fromBitIdx, s->toBitIdx);
+                break;
+            case JTAG_SPLIT_shift_tdi:
+                if (is_write_only_shift(d, s)) {
+                    /* TDO is filled right here, not by transfers */
+                    d->cache.recording.failed = true;
+                    fill_tdo(tdoVector, s->fromBitIdx, s->toBitIdx, d->params.wo_tdo_fill);
+                    res = append_tdi_shift_to_transaction(d, tdiVector, NULL,
+                            s->fromBitIdx, s->toBitIdx, !s->incomplete);
+                } else {
+                    res = append_tdi_shift_to_transaction(d, tdiVector, tdoVector,
+                            s->fromBitIdx, s->toBitIdx, !s->incomplete);
+                }
+                break;
+            default:
+                TXVC_UNREACHABLE();
+        }
+    }
+    return res && mpsse_flush_pending(d);
+}
+
+static bool shift_bits_cached(struct driver *d, int numBits, const uint8_t *tmsVector,
+        const uint8_t *tdiVector, uint8_t *tdoVector) {
+    struct vector_cache *c = &d->cache;
+    const uint64_t hash = vector_cache_hash(numBits, tmsVector, tdiVector);
+    const struct cache_entry *e = vector_cache_find(c, hash, numBits, tmsVector, tdiVector,
+            &d->jtagSplitter, d->lastTdi);
+    if (e) {
+        c->numHits++;
+        if (!vector_cache_replay(d, e, tdoVector)) {
+            return false;
+        }
+        d->jtagSplitter = e->splitterAfter;
+        d->lastTdi = e->lastTdiAfter;
+        return true;
+    }
+    c->numMisses++;
+    const struct txvc_jtag_splitter splitterBefore = d->jtagSplitter;
+    const bool lastTdiBefore = d->lastTdi;
+    vector_recording_start(&c->recording, tdoVector, numBits, &d->cmdBuffer);
+    const bool res = shift_bits_encoded(d, numBits, tmsVector, tdiVector, tdoVector);
+    /* The last transfer is not submitted yet */
+    vector_recording_observer_fn(ft_buffer_filling(&d->cmdBuffer), &c->recording);
+    c->recording.active = false;
+    if (res && !c->recording.failed) {
+        vector_cache_insert(c, hash, numBits, tmsVector, tdiVector,
+                &splitterBefore, lastTdiBefore, &d->jtagSplitter, d->lastTdi);
+    }
+    return res;
+}
+
+/*
+ * Appends vector to the command buffer, it is guaranteed to be sent and its TDO to be stored
+ * only after the next ft_buffer_sync().
+ */
+static bool append_shift(struct driver *d, int numBits, const uint8_t *tmsVector,
+        const uint8_t *tdiVector, uint8_t *tdoVector) {
+    d->numShiftedBits += numBits;
+    return d->cache.maxBytes
+        ? shift_bits_cached(d, numBits, tmsVector, tdiVector, tdoVector)
+        : shift_bits_encoded(d, numBits, tmsVector, tdiVector, tdoVector);
+}
+
+static bool complete_shifts(struct driver *d, bool appended) {
+    const bool res = appended && ft_buffer_sync(&d->cmdBuffer, d->params.write_behind);
+    if (!res) {
+        /* Transfers that are still in flight refer to vectors of this call */
+        ft_buffer_discard(&d->cmdBuffer);
+        d->pendingCmd.kind = MPSSE_CMD_NONE;
+        txvc_jtag_splitter_reset(&d->jtagSplitter);
+    }
+    return res;
+}
+
+static bool shift_bits(void *ctx, int numBits, const uint8_t *tmsVector, const uint8_t *tdiVector,
         uint8_t *tdoVector){
-    struct driver *d = &gFtdi;
-    return txvc_jtag_splitter_process(&d->jtagSplitter, numBits, tmsVector, tdiVector, tdoVector);
+    struct driver *d = ctx;
+    return complete_shifts(d, append_shift(d, numBits, tmsVector, tdiVector, tdoVector));
+}
+
+static bool shift_bits_batch(void *ctx, int numShifts, const struct txvc_shift *shifts){
+    struct driver *d = ctx;
+    bool res = true;
+    for (int i = 0; res && i < numShifts; i++) {
+        const struct txvc_shift *s = &shifts[i];
+        res = append_shift(d, s->numBits, s->tmsVector, s->tdiVector, s->tdoVector);
+    }
+    return complete_shifts(d, res);
 }
 
 const struct txvc_driver driver_ftdi_generic = {
@@ -813,10 +1967,12 @@ const struct txvc_driver driver_ftdi_generic = {
         FTDI_SUPPORTED_DEVICES_LIST_ITEMS(AS_HELP_STRING)
 #undef AS_HELP_STRING
         ,
+    .contextSize = sizeof(struct driver),
     .activate = activate,
     .deactivate = deactivate,
     .max_vector_bits = max_vector_bits,
     .set_tck_period = set_tck_period,
     .shift_bits = shift_bits,
+    .shift_bits_batch = shift_bits_batch,
 };
 
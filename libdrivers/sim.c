@@ -0,0 +1,397 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "txvc/driver.h"
+#include "txvc/defs.h"
+#include "txvc/jtag_sim.h"
+#include "txvc/log.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+TXVC_DEFAULT_LOG_TAG(sim);
+
+/*
+ * Driver configuration loader.
+ */
+
+/* Up to TXVC_JTAG_SIM_MAX_DEVICES numbers, separated by '/' */
+struct u32_list {
+    int numItems; /* -1 if list is malformed */
+    uint32_t items[TXVC_JTAG_SIM_MAX_DEVICES];
+};
+
+static struct u32_list str_to_u32_list(const char *s, int base) {
+    struct u32_list res = { .numItems = 0 };
+    while (*s) {
+        char *endp;
+        unsigned long item = strtoul(s, &endp, base);
+        if (endp == s || (*endp != '\0' && *endp != '/') || item > 0xfffffffful
+                || res.numItems == TXVC_JTAG_SIM_MAX_DEVICES) {
+            res.numItems = -1;
+            break;
+        }
+        res.items[res.numItems++] = (uint32_t) item;
+        s = *endp ? endp + 1 : endp;
+    }
+    return res;
+}
+
+static struct u32_list str_to_dec_list(const char *s) {
+    return str_to_u32_list(s, 10);
+}
+
+static struct u32_list str_to_hex_list(const char *s) {
+    return str_to_u32_list(s, 16);
+}
+
+static int str_to_flag(const char *s) {
+    return strcmp(s, "1") == 0 ? 1 : strcmp(s, "0") == 0 ? 0 : -1;
+}
+
+static int str_to_int(const char *s, long min, long max) {
+    char *endp;
+    long res = strtol(s, &endp, 10);
+    return *endp != '\0' || res < min || res > max ? -1 : (int) res;
+}
+
+static int str_to_user_dr_bits(const char *s) {
+    return str_to_int(s, 1l, 64l);
+}
+
+static int str_to_vector_bits(const char *s) {
+    return str_to_int(s, 8l, 1024l * 1024l * 8l);
+}
+
+static int str_to_micros(const char *s) {
+    return str_to_int(s, 0l, 1000l * 1000l);
+}
+
+#define NO_ITEMS ((struct u32_list) { .numItems = 0 })
+
+#define PARAM_LIST_ITEMS(X)                                                                        \
+    X("ir_lengths", ir_lengths, str_to_dec_list, .numItems >= 0, NO_ITEMS,                         \
+            "IR lengths of chain devices, starting from the closest to TDO, separated by '/'."     \
+            " If none of chain parameters is given, a single XC7A35T is simulated")                \
+    X("idcodes", idcodes, str_to_hex_list, .numItems >= 0, NO_ITEMS,                               \
+            "IDCODEs (hex) of chain devices, separated by '/', 0 for a device without one")        \
+    X("idcode_opcodes", idcode_opcodes, str_to_hex_list, .numItems >= 0, NO_ITEMS,                 \
+            "Instructions (hex) that select IDCODE of chain devices, separated by '/'")            \
+    X("xilinx", xilinx, str_to_dec_list, .numItems >= 0, NO_ITEMS,                                 \
+            "Whether chain devices (1) or not (0) have USER1-USER4 registers and configuration"    \
+            " engine that accepts CFG_IN data and sets DONE, with 7 series instructions")          \
+    X("user_dr_bits", user_dr_bits, str_to_user_dr_bits, > 0, 32,                                  \
+            "Length of USER1-USER4 registers")                                                     \
+    X("max_vector_bits", max_vector_bits, str_to_vector_bits, > 0, 32768,                          \
+            "Longest vector that is shifted at once")                                              \
+    X("tck_timing", tck_timing, str_to_flag, >= 0, 0,                                              \
+            "Whether shifts take as long as TCK of the requested period would (1) or complete"     \
+            " as fast as possible (0, default)")                                                   \
+    X("round_trip_us", round_trip_us, str_to_micros, >= 0, 0,                                      \
+            "Time that every shift additionally takes, to emulate USB round trips (default: 0)")   \
+
+struct sim_params {
+    struct u32_list ir_lengths;
+    struct u32_list idcodes;
+    struct u32_list idcode_opcodes;
+    struct u32_list xilinx;
+    int user_dr_bits;
+    int max_vector_bits;
+    int tck_timing;
+    int round_trip_us;
+};
+
+static bool load_config(int numArgs, const char **argNames, const char **argValues,
+                            struct sim_params *out) {
+#define APPLY_DEFAULTS(name, configField, converterFunc, validation, defVal, descr)                \
+    out->configField = defVal;
+    PARAM_LIST_ITEMS(APPLY_DEFAULTS)
+#undef APPLY_DEFAULTS
+
+    for (int i = 0; i < numArgs; i++) {
+#define CONVERT_AND_SET_IF_MATCHES(name, configField, converterFunc, validation, defVal, descr)    \
+        if (strcmp(name, argNames[i]) == 0) {                                                      \
+            out->configField = converterFunc(argValues[i]);                                        \
+            continue;                                                                              \
+        }
+        PARAM_LIST_ITEMS(CONVERT_AND_SET_IF_MATCHES)
+#undef CONVERT_AND_SET_IF_MATCHES
+        WARN("Unknown parameter: \"%s\"=\"%s\"\n", argNames[i], argValues[i]);
+    }
+
+#define BAIL_IF_NOT_VALID(name, configField, converterFunc, validation, defVal, descr)             \
+    if (!(out->configField validation)) {                                                          \
+        ERROR("Bad or missing \"%s\"\n", name);                                                    \
+        return false;                                                                              \
+    }
+    PARAM_LIST_ITEMS(BAIL_IF_NOT_VALID)
+#undef BAIL_IF_NOT_VALID
+    return true;
+}
+
+static void apply_default_chain(struct sim_params *p) {
+    if (p->ir_lengths.numItems || p->idcodes.numItems || p->idcode_opcodes.numItems
+            || p->xilinx.numItems) {
+        return;
+    }
+    p->ir_lengths = str_to_dec_list("6");
+    p->idcodes = str_to_hex_list("0362d093");
+    p->idcode_opcodes = str_to_hex_list("09");
+    p->xilinx = str_to_dec_list("1");
+}
+
+/* 7 series USER1-USER4 */
+static const uint32_t gUserOpcodes[TXVC_JTAG_SIM_MAX_USER_DRS] = { 0x02u, 0x03u, 0x22u, 0x23u, };
+
+/* Other lists describe the same devices as "ir_lengths", items they lack take defaults */
+static bool params_to_devices(const struct sim_params *p,
+        struct txvc_jtag_sim_device *devices) {
+    const int numDevices = p->ir_lengths.numItems;
+    if (!numDevices) {
+        ERROR("Bad or missing \"ir_lengths\"\n");
+        return false;
+    }
+    if (p->idcodes.numItems > numDevices || p->idcode_opcodes.numItems > numDevices
+            || p->xilinx.numItems > numDevices) {
+        ERROR("More device properties than devices\n");
+        return false;
+    }
+    for (int i = 0; i < numDevices; i++) {
+        struct txvc_jtag_sim_device *d = &devices[i];
+        memset(d, 0, sizeof(*d));
+        d->irLength = (int) p->ir_lengths.items[i];
+        if (i < p->idcodes.numItems && i < p->idcode_opcodes.numItems) {
+            d->idcode = p->idcodes.items[i];
+            d->idcodeOpcode = p->idcode_opcodes.items[i];
+        } else if (i < p->idcodes.numItems && p->idcodes.items[i]) {
+            ERROR("No IDCODE instruction for device %d\n", i);
+            return false;
+        }
+        if (i < p->xilinx.numItems && p->xilinx.items[i] > 1) {
+            ERROR("Bad \"xilinx\" flag for device %d\n", i);
+            return false;
+        }
+        if (i < p->xilinx.numItems && p->xilinx.items[i]) {
+            d->numUserDrs = TXVC_JTAG_SIM_MAX_USER_DRS;
+            for (int j = 0; j < TXVC_JTAG_SIM_MAX_USER_DRS; j++) {
+                d->userDrs[j].opcode = gUserOpcodes[j];
+                d->userDrs[j].length = p->user_dr_bits;
+            }
+            d->hasConfigEngine = true;
+        }
+    }
+    return true;
+}
+
+/*
+ * Driver implementation.
+ */
+
+struct sim {
+    struct sim_params params;
+    struct txvc_jtag_sim_device devices[TXVC_JTAG_SIM_MAX_DEVICES];
+    struct txvc_jtag_sim chain;
+    int tckPeriodNs;
+    /* Operations since the last flush, for the timing model */
+    long long opsStartNs;
+    unsigned long long timedClocks;
+    unsigned long long numShifts;
+};
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+/* Timing model, makes work done since `startNs` take as long as it would with real hardware */
+static void spend_time(struct sim *s, long long startNs) {
+    const unsigned long long numClocks = txvc_jtag_sim_num_clocks(&s->chain) - s->timedClocks;
+    s->timedClocks += numClocks;
+    long long durationNs = s->params.round_trip_us * 1000ll;
+    if (s->params.tck_timing) {
+        durationNs += (long long) numClocks * s->tckPeriodNs;
+    }
+    if (!durationNs) {
+        return;
+    }
+    const long long deadlineNs = startNs + durationNs;
+    const struct timespec ts = {
+        .tv_sec = deadlineNs / 1000000000ll,
+        .tv_nsec = deadlineNs % 1000000000ll,
+    };
+    int res;
+    /* Error is returned rather than set to errno */
+    while ((res = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) == EINTR) {
+    }
+    if (res != 0) {
+        WARN("Can not wait for simulated transfer: %s\n", strerror(res));
+    }
+}
+
+static bool is_timed(const struct sim *s) {
+    return s->params.round_trip_us || s->params.tck_timing;
+}
+
+static bool activate(void *ctx, int numArgs, const char **argNames, const char **argValues){
+    struct sim *s = ctx;
+    if (!load_config(numArgs, argNames, argValues, &s->params)) {
+        return false;
+    }
+    apply_default_chain(&s->params);
+    if (!params_to_devices(&s->params, s->devices)
+            || !txvc_jtag_sim_init(&s->chain, s->params.ir_lengths.numItems, s->devices)) {
+        return false;
+    }
+    s->tckPeriodNs = 100;
+    s->opsStartNs = 0;
+    s->timedClocks = 0;
+    s->numShifts = 0;
+    INFO("Simulating chain of %d devices\n", s->params.ir_lengths.numItems);
+    return true;
+}
+
+static bool deactivate(void *ctx){
+    struct sim *s = ctx;
+    INFO("Made %llu shifts, %llu TCK cycles\n",
+            s->numShifts, txvc_jtag_sim_num_clocks(&s->chain));
+    for (int i = 0; i < s->params.ir_lengths.numItems; i++) {
+        if (s->devices[i].hasConfigEngine) {
+            INFO("Device %d: %llu configuration bits, DONE=%d\n", i,
+                    txvc_jtag_sim_config_bits(&s->chain, i),
+                    txvc_jtag_sim_device_done(&s->chain, i));
+        }
+    }
+    return true;
+}
+
+static int max_vector_bits(void *ctx){
+    struct sim *s = ctx;
+    return s->params.max_vector_bits;
+}
+
+static int set_tck_period(void *ctx, int tckPeriodNs){
+    struct sim *s = ctx;
+    s->tckPeriodNs = tckPeriodNs > 0 ? tckPeriodNs : 1;
+    return s->tckPeriodNs;
+}
+
+static bool shift_bits(void *ctx, int numBits, const uint8_t *tmsVector, const uint8_t *tdiVector,
+        uint8_t *tdoVector){
+    struct sim *s = ctx;
+    const long long startNs = is_timed(s) ? now_ns() : 0;
+    txvc_jtag_sim_shift(&s->chain, numBits, tmsVector, tdiVector, tdoVector);
+    s->numShifts++;
+    if (startNs) {
+        spend_time(s, startNs);
+    }
+    return true;
+}
+
+static inline bool get_bit(const uint8_t* p, int idx) {
+    return !!(p[idx / 8] & (1 << (idx % 8)));
+}
+
+static inline void set_bit(uint8_t* p, int idx, bool value) {
+    if (value) {
+        p[idx / 8] |= (uint8_t) (1 << (idx % 8));
+    } else {
+        p[idx / 8] &= (uint8_t) ~(1 << (idx % 8));
+    }
+}
+
+static void ops_start(struct sim *s) {
+    if (is_timed(s) && !s->opsStartNs) {
+        s->opsStartNs = now_ns();
+    }
+}
+
+static bool tms_path(void *ctx, const uint8_t *tmsVector, int fromBitIdx, int toBitIdx){
+    struct sim *s = ctx;
+    ops_start(s);
+    for (int i = fromBitIdx; i < toBitIdx; i++) {
+        txvc_jtag_sim_clock(&s->chain, get_bit(tmsVector, i), false);
+    }
+    return true;
+}
+
+static bool idle_clocks(void *ctx, int numClocks){
+    struct sim *s = ctx;
+    ops_start(s);
+    for (int i = 0; i < numClocks; i++) {
+        txvc_jtag_sim_clock(&s->chain, false, false);
+    }
+    return true;
+}
+
+static bool scan(void *ctx, const uint8_t *tdiVector, uint8_t *tdoVector,
+        int fromBitIdx, int toBitIdx, bool exitShift){
+    struct sim *s = ctx;
+    ops_start(s);
+    for (int i = fromBitIdx; i < toBitIdx; i++) {
+        const bool tms = exitShift && i == toBitIdx - 1;
+        set_bit(tdoVector, i, txvc_jtag_sim_clock(&s->chain, tms, get_bit(tdiVector, i)));
+    }
+    return true;
+}
+
+static bool flush(void *ctx){
+    struct sim *s = ctx;
+    s->numShifts++;
+    if (s->opsStartNs) {
+        spend_time(s, s->opsStartNs);
+        s->opsStartNs = 0;
+    }
+    return true;
+}
+
+const struct txvc_driver driver_sim = {
+    .name = "sim",
+    .help =
+        "Simulates a chain of JTAG devices, with IDCODE, BYPASS and, for Xilinx devices, user"
+        " registers and a configuration engine. No real device is involved\n"
+        "Parameters:\n"
+#define AS_HELP_STRING(name, configField, converterFunc, validation, defVal, descr)                \
+        "  \"" name "\" - " descr "\n"
+        PARAM_LIST_ITEMS(AS_HELP_STRING)
+#undef AS_HELP_STRING
+        ,
+    .contextSize = sizeof(struct sim),
+    .activate = activate,
+    .deactivate = deactivate,
+    .max_vector_bits = max_vector_bits,
+    .set_tck_period = set_tck_period,
+    .shift_bits = shift_bits,
+    .tms_path = tms_path,
+    .idle_clocks = idle_clocks,
+    .scan_ir = scan,
+    .scan_dr = scan,
+    .flush = flush,
+};
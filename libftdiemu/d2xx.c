@@ -0,0 +1,495 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ftdiemu/ftdi_emu.h"
+#include "mpsse.h"
+
+#include "txvc/defs.h"
+#include "txvc/log.h"
+
+#include <ftd2xx.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+TXVC_DEFAULT_LOG_TAG(ftdiEmu);
+
+#define EMU_MAX_CHANNELS 2
+#define EMU_FTDI_VID 0x0403u
+#define EMU_FT2232H_PID 0x6010u
+#define EMU_FT232H_PID 0x6014u
+#define EMU_LIBRARY_VERSION 0x010427u
+#define EMU_DEFAULT_LATENCY_MILLIS 16
+
+struct channel {
+    struct mpsse mpsse;
+    bool isOpen;
+    bool isMpsse;
+    int latencyTimerMillis;
+    unsigned long readTimeoutMillis;
+    /* Time when chip completes commands received so far */
+    long long chipIdleAtNs;
+    /* Read data that has been moved to host by the last IN transfer, and when it arrived */
+    size_t numDeliveredRxBytes;
+    long long deliveredAtNs;
+    bool failNextWrite;
+    struct txvc_ftdi_emu_stats stats;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    bool isPlugged;
+    enum txvc_ftdi_emu_chip chip;
+    char serialNumber[15];
+    struct txvc_ftdi_emu_timing timing;
+    int numChannels;
+    struct channel channels[EMU_MAX_CHANNELS];
+} gEmu = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+static void sleep_until_ns(long long deadlineNs) {
+    const struct timespec ts = {
+        .tv_sec = deadlineNs / 1000000000ll,
+        .tv_nsec = deadlineNs % 1000000000ll,
+    };
+    int res;
+    /* Error is returned rather than set to errno */
+    while ((res = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) == EINTR) {
+    }
+    if (res != 0) {
+        WARN("Can not wait for emulated transfer: %s\n", strerror(res));
+    }
+}
+
+static long long usb_transfer_ns(size_t numBytes) {
+    long long res = gEmu.timing.usbLatencyUs * 1000ll;
+    if (gEmu.timing.usbBytesPerSec > 0) {
+        res += (long long) numBytes * 1000000000ll / gEmu.timing.usbBytesPerSec;
+    }
+    return res;
+}
+
+static bool is_timed(void) {
+    return gEmu.timing.usbLatencyUs || gEmu.timing.usbBytesPerSec || gEmu.timing.clockTck;
+}
+
+/* Looks up an open channel, must be called under lock */
+static struct channel *handle_to_channel(FT_HANDLE ftHandle) {
+    for (int i = 0; gEmu.isPlugged && i < gEmu.numChannels; i++) {
+        if (ftHandle == &gEmu.channels[i] && gEmu.channels[i].isOpen) {
+            return &gEmu.channels[i];
+        }
+    }
+    return NULL;
+}
+
+static void channel_serial_number(int idx, char *dst, size_t size) {
+    if (gEmu.chip == TXVC_FTDI_EMU_FT2232H) {
+        snprintf(dst, size, "%s%c", gEmu.serialNumber, 'A' + idx);
+    } else {
+        snprintf(dst, size, "%s", gEmu.serialNumber);
+    }
+}
+
+static void channel_description(int idx, char *dst, size_t size) {
+    if (gEmu.chip == TXVC_FTDI_EMU_FT2232H) {
+        snprintf(dst, size, "Dual RS232-HS %c", 'A' + idx);
+    } else {
+        snprintf(dst, size, "Single RS232-HS");
+    }
+}
+
+bool txvc_ftdi_emu_plug(const struct txvc_ftdi_emu_options *options) {
+    bool res = false;
+    pthread_mutex_lock(&gEmu.lock);
+    if (gEmu.isPlugged) {
+        ERROR("Chip is plugged already\n");
+        goto bail_unlock;
+    }
+    if (!options->serialNumber || strlen(options->serialNumber) + 2 > sizeof(gEmu.serialNumber)) {
+        ERROR("Bad serial number\n");
+        goto bail_unlock;
+    }
+    struct txvc_jtag_sim chain;
+    if (!txvc_jtag_sim_init(&chain, options->numDevices, options->devices)) {
+        goto bail_unlock;
+    }
+    switch (options->chip) {
+        case TXVC_FTDI_EMU_FT2232H:
+            gEmu.numChannels = 2;
+            break;
+        case TXVC_FTDI_EMU_FT232H:
+            gEmu.numChannels = 1;
+            break;
+        default:
+            ERROR("Unknown chip\n");
+            goto bail_unlock;
+    }
+    gEmu.chip = options->chip;
+    strcpy(gEmu.serialNumber, options->serialNumber);
+    gEmu.timing = options->timing;
+    for (int i = 0; i < gEmu.numChannels; i++) {
+        struct channel *c = &gEmu.channels[i];
+        memset(c, 0, sizeof(*c));
+        mpsse_init(&c->mpsse, &chain);
+        c->latencyTimerMillis = EMU_DEFAULT_LATENCY_MILLIS;
+    }
+    gEmu.isPlugged = true;
+    res = true;
+
+bail_unlock:
+    pthread_mutex_unlock(&gEmu.lock);
+    return res;
+}
+
+void txvc_ftdi_emu_unplug(void) {
+    pthread_mutex_lock(&gEmu.lock);
+    for (int i = 0; gEmu.isPlugged && i < gEmu.numChannels; i++) {
+        if (gEmu.channels[i].isOpen) {
+            WARN("Channel %d is unplugged while open\n", i);
+        }
+        mpsse_deinit(&gEmu.channels[i].mpsse);
+    }
+    gEmu.isPlugged = false;
+    pthread_mutex_unlock(&gEmu.lock);
+}
+
+void txvc_ftdi_emu_get_stats(int channel, struct txvc_ftdi_emu_stats *stats) {
+    pthread_mutex_lock(&gEmu.lock);
+    const struct channel *c = &gEmu.channels[channel];
+    *stats = c->stats;
+    stats->numClocks = txvc_jtag_sim_num_clocks(&c->mpsse.chain);
+    stats->numBadCommands = c->mpsse.numBadCommands;
+    pthread_mutex_unlock(&gEmu.lock);
+}
+
+void txvc_ftdi_emu_get_chain(int channel, struct txvc_jtag_sim *chain) {
+    pthread_mutex_lock(&gEmu.lock);
+    *chain = gEmu.channels[channel].mpsse.chain;
+    pthread_mutex_unlock(&gEmu.lock);
+}
+
+void txvc_ftdi_emu_fail_next_write(int channel) {
+    pthread_mutex_lock(&gEmu.lock);
+    gEmu.channels[channel].failNextWrite = true;
+    pthread_mutex_unlock(&gEmu.lock);
+}
+
+/*
+ * d2xx API
+ */
+
+FT_STATUS FT_GetLibraryVersion(LPDWORD lpdwVersion) {
+    *lpdwVersion = EMU_LIBRARY_VERSION;
+    return FT_OK;
+}
+
+FT_STATUS FT_SetVIDPID(DWORD dwVID, DWORD dwPID) {
+    /* Emulated chip always has its default IDs and is listed regardless */
+    VERBOSE("Custom VID:PID %04x:%04x\n", (unsigned) dwVID, (unsigned) dwPID);
+    return FT_OK;
+}
+
+FT_STATUS FT_CreateDeviceInfoList(LPDWORD lpdwNumDevs) {
+    pthread_mutex_lock(&gEmu.lock);
+    *lpdwNumDevs = gEmu.isPlugged ? (DWORD) gEmu.numChannels : 0;
+    pthread_mutex_unlock(&gEmu.lock);
+    return FT_OK;
+}
+
+FT_STATUS FT_GetDeviceInfoList(FT_DEVICE_LIST_INFO_NODE *pDest, LPDWORD lpdwNumDevs) {
+    pthread_mutex_lock(&gEmu.lock);
+    const int numDevs = gEmu.isPlugged ? gEmu.numChannels : 0;
+    for (int i = 0; i < numDevs; i++) {
+        FT_DEVICE_LIST_INFO_NODE *node = &pDest[i];
+        const struct channel *c = &gEmu.channels[i];
+        const bool dualChannel = gEmu.chip == TXVC_FTDI_EMU_FT2232H;
+        memset(node, 0, sizeof(*node));
+        node->Flags = c->isOpen ? 1 : 0;
+        node->Type = dualChannel ? FT_DEVICE_2232H : FT_DEVICE_232H;
+        node->ID = EMU_FTDI_VID << 16 | (dualChannel ? EMU_FT2232H_PID : EMU_FT232H_PID);
+        node->LocId = (DWORD) i + 1;
+        channel_serial_number(i, node->SerialNumber, sizeof(node->SerialNumber));
+        channel_description(i, node->Description, sizeof(node->Description));
+        node->ftHandle = c->isOpen ? (FT_HANDLE) c : NULL;
+    }
+    *lpdwNumDevs = (DWORD) numDevs;
+    pthread_mutex_unlock(&gEmu.lock);
+    return FT_OK;
+}
+
+static FT_STATUS open_channel(int idx, FT_HANDLE *pHandle) {
+    if (idx < 0 || idx >= gEmu.numChannels || !gEmu.isPlugged) {
+        return FT_DEVICE_NOT_FOUND;
+    }
+    struct channel *c = &gEmu.channels[idx];
+    if (c->isOpen) {
+        return FT_DEVICE_NOT_OPENED;
+    }
+    c->isOpen = true;
+    c->isMpsse = false;
+    c->latencyTimerMillis = EMU_DEFAULT_LATENCY_MILLIS;
+    c->readTimeoutMillis = 0;
+    c->chipIdleAtNs = 0;
+    c->numDeliveredRxBytes = 0;
+    *pHandle = c;
+    return FT_OK;
+}
+
+FT_STATUS FT_Open(int deviceNumber, FT_HANDLE *pHandle) {
+    pthread_mutex_lock(&gEmu.lock);
+    const FT_STATUS status = open_channel(deviceNumber, pHandle);
+    pthread_mutex_unlock(&gEmu.lock);
+    return status;
+}
+
+FT_STATUS FT_OpenEx(PVOID pArg1, DWORD Flags, FT_HANDLE *pHandle) {
+    pthread_mutex_lock(&gEmu.lock);
+    int idx = -1;
+    for (int i = 0; gEmu.isPlugged && i < gEmu.numChannels && idx < 0; i++) {
+        char name[64];
+        if (Flags == FT_OPEN_BY_SERIAL_NUMBER) {
+            channel_serial_number(i, name, sizeof(name));
+        } else if (Flags == FT_OPEN_BY_DESCRIPTION) {
+            channel_description(i, name, sizeof(name));
+        } else {
+            continue;
+        }
+        if (strcmp(name, pArg1) == 0) {
+            idx = i;
+        }
+    }
+    const FT_STATUS status = open_channel(idx, pHandle);
+    pthread_mutex_unlock(&gEmu.lock);
+    return status;
+}
+
+FT_STATUS FT_Close(FT_HANDLE ftHandle) {
+    pthread_mutex_lock(&gEmu.lock);
+    struct channel *c = handle_to_channel(ftHandle);
+    if (c) {
+        c->isOpen = false;
+        mpsse_purge(&c->mpsse);
+    }
+    pthread_mutex_unlock(&gEmu.lock);
+    return c ? FT_OK : FT_INVALID_HANDLE;
+}
+
+FT_STATUS FT_Purge(FT_HANDLE ftHandle, ULONG Mask) {
+    pthread_mutex_lock(&gEmu.lock);
+    struct channel *c = handle_to_channel(ftHandle);
+    if (c && (Mask & (FT_PURGE_RX | FT_PURGE_TX))) {
+        mpsse_purge(&c->mpsse);
+        c->numDeliveredRxBytes = 0;
+    }
+    pthread_mutex_unlock(&gEmu.lock);
+    return c ? FT_OK : FT_INVALID_HANDLE;
+}
+
+FT_STATUS FT_SetChars(FT_HANDLE ftHandle, UCHAR EventChar, UCHAR EventCharEnabled,
+        UCHAR ErrorChar, UCHAR ErrorCharEnabled) {
+    TXVC_UNUSED(EventChar);
+    TXVC_UNUSED(EventCharEnabled);
+    TXVC_UNUSED(ErrorChar);
+    TXVC_UNUSED(ErrorCharEnabled);
+    pthread_mutex_lock(&gEmu.lock);
+    const bool isValid = handle_to_channel(ftHandle);
+    pthread_mutex_unlock(&gEmu.lock);
+    return isValid ? FT_OK : FT_INVALID_HANDLE;
+}
+
+FT_STATUS FT_SetFlowControl(FT_HANDLE ftHandle, USHORT FlowControl, UCHAR XonChar,
+        UCHAR XoffChar) {
+    TXVC_UNUSED(FlowControl);
+    TXVC_UNUSED(XonChar);
+    TXVC_UNUSED(XoffChar);
+    pthread_mutex_lock(&gEmu.lock);
+    const bool isValid = handle_to_channel(ftHandle);
+    pthread_mutex_unlock(&gEmu.lock);
+    return isValid ? FT_OK : FT_INVALID_HANDLE;
+}
+
+FT_STATUS FT_SetBitMode(FT_HANDLE ftHandle, UCHAR ucMask, UCHAR ucEnable) {
+    TXVC_UNUSED(ucMask);
+    FT_STATUS status = FT_OK;
+    pthread_mutex_lock(&gEmu.lock);
+    struct channel *c = handle_to_channel(ftHandle);
+    if (!c) {
+        status = FT_INVALID_HANDLE;
+    } else if (ucEnable == FT_BITMODE_RESET) {
+        c->isMpsse = false;
+    } else if (ucEnable == FT_BITMODE_MPSSE) {
+        c->isMpsse = true;
+        mpsse_reset(&c->mpsse);
+    } else {
+        status = FT_NOT_SUPPORTED;
+    }
+    pthread_mutex_unlock(&gEmu.lock);
+    return status;
+}
+
+FT_STATUS FT_SetLatencyTimer(FT_HANDLE ftHandle, UCHAR ucLatency) {
+    pthread_mutex_lock(&gEmu.lock);
+    struct channel *c = handle_to_channel(ftHandle);
+    if (c) {
+        c->latencyTimerMillis = ucLatency;
+    }
+    pthread_mutex_unlock(&gEmu.lock);
+    return c ? FT_OK : FT_INVALID_HANDLE;
+}
+
+FT_STATUS FT_GetLatencyTimer(FT_HANDLE ftHandle, PUCHAR pucLatency) {
+    pthread_mutex_lock(&gEmu.lock);
+    struct channel *c = handle_to_channel(ftHandle);
+    if (c) {
+        *pucLatency = (UCHAR) c->latencyTimerMillis;
+    }
+    pthread_mutex_unlock(&gEmu.lock);
+    return c ? FT_OK : FT_INVALID_HANDLE;
+}
+
+FT_STATUS FT_SetUSBParameters(FT_HANDLE ftHandle, ULONG ulInTransferSize,
+        ULONG ulOutTransferSize) {
+    /* Transfer sizes are not modeled, every transfer costs the same latency */
+    TXVC_UNUSED(ulInTransferSize);
+    TXVC_UNUSED(ulOutTransferSize);
+    pthread_mutex_lock(&gEmu.lock);
+    const bool isValid = handle_to_channel(ftHandle);
+    pthread_mutex_unlock(&gEmu.lock);
+    return isValid ? FT_OK : FT_INVALID_HANDLE;
+}
+
+FT_STATUS FT_SetTimeouts(FT_HANDLE ftHandle, ULONG ReadTimeout, ULONG WriteTimeout) {
+    TXVC_UNUSED(WriteTimeout);
+    pthread_mutex_lock(&gEmu.lock);
+    struct channel *c = handle_to_channel(ftHandle);
+    if (c) {
+        c->readTimeoutMillis = ReadTimeout;
+    }
+    pthread_mutex_unlock(&gEmu.lock);
+    return c ? FT_OK : FT_INVALID_HANDLE;
+}
+
+FT_STATUS FT_GetQueueStatus(FT_HANDLE ftHandle, DWORD *dwRxBytes) {
+    pthread_mutex_lock(&gEmu.lock);
+    struct channel *c = handle_to_channel(ftHandle);
+    if (c) {
+        *dwRxBytes = (DWORD) mpsse_num_rx_bytes(&c->mpsse);
+    }
+    pthread_mutex_unlock(&gEmu.lock);
+    return c ? FT_OK : FT_INVALID_HANDLE;
+}
+
+FT_STATUS FT_Write(FT_HANDLE ftHandle, LPVOID lpBuffer, DWORD dwBytesToWrite,
+        LPDWORD lpBytesWritten) {
+    pthread_mutex_lock(&gEmu.lock);
+    struct channel *c = handle_to_channel(ftHandle);
+    if (!c) {
+        pthread_mutex_unlock(&gEmu.lock);
+        return FT_INVALID_HANDLE;
+    }
+    if (c->failNextWrite) {
+        c->failNextWrite = false;
+        pthread_mutex_unlock(&gEmu.lock);
+        return FT_IO_ERROR;
+    }
+    long long transferDoneNs = 0;
+    if (is_timed()) {
+        transferDoneNs = now_ns() + usb_transfer_ns(dwBytesToWrite);
+    }
+    if (c->isMpsse) {
+        const unsigned long long clocksBefore = txvc_jtag_sim_num_clocks(&c->mpsse.chain);
+        mpsse_write(&c->mpsse, lpBuffer, dwBytesToWrite);
+        if (is_timed()) {
+            /* Chip starts on commands once they arrive and it is done with previous ones */
+            const unsigned long long numClocks =
+                txvc_jtag_sim_num_clocks(&c->mpsse.chain) - clocksBefore;
+            long long busyNs = 0;
+            if (gEmu.timing.clockTck) {
+                busyNs = (long long) (numClocks * 1000000000ull / mpsse_tck_hz(&c->mpsse));
+            }
+            c->chipIdleAtNs = (c->chipIdleAtNs > transferDoneNs
+                    ? c->chipIdleAtNs : transferDoneNs) + busyNs;
+        }
+    }
+    c->stats.numWrites++;
+    c->stats.numTxBytes += dwBytesToWrite;
+    *lpBytesWritten = dwBytesToWrite;
+    pthread_mutex_unlock(&gEmu.lock);
+    if (transferDoneNs) {
+        sleep_until_ns(transferDoneNs);
+    }
+    return FT_OK;
+}
+
+FT_STATUS FT_Read(FT_HANDLE ftHandle, LPVOID lpBuffer, DWORD dwBytesToRead,
+        LPDWORD lpBytesReturned) {
+    pthread_mutex_lock(&gEmu.lock);
+    struct channel *c = handle_to_channel(ftHandle);
+    if (!c) {
+        pthread_mutex_unlock(&gEmu.lock);
+        return FT_INVALID_HANDLE;
+    }
+    const size_t numAvailable = mpsse_num_rx_bytes(&c->mpsse);
+    long long readyAtNs = 0;
+    if (numAvailable < dwBytesToRead) {
+        /* Everything chip will ever send is queued already, so only timeout may end the wait */
+        if (c->readTimeoutMillis && is_timed()) {
+            readyAtNs = now_ns() + (long long) c->readTimeoutMillis * 1000000ll;
+        }
+    } else if (is_timed()) {
+        if (c->numDeliveredRxBytes < dwBytesToRead) {
+            /* Single IN transfer brings everything chip has for host by now */
+            const size_t numNewBytes = numAvailable - c->numDeliveredRxBytes;
+            c->deliveredAtNs = c->chipIdleAtNs + usb_transfer_ns(numNewBytes);
+            if (dwBytesToRead > mpsse_num_immediate_rx_bytes(&c->mpsse)) {
+                c->deliveredAtNs += c->latencyTimerMillis * 1000000ll;
+            }
+            c->numDeliveredRxBytes = numAvailable;
+        }
+        readyAtNs = c->deliveredAtNs;
+    }
+    *lpBytesReturned = (DWORD) mpsse_read(&c->mpsse, lpBuffer, dwBytesToRead);
+    c->numDeliveredRxBytes = c->numDeliveredRxBytes > *lpBytesReturned
+        ? c->numDeliveredRxBytes - *lpBytesReturned : 0;
+    c->stats.numReads++;
+    c->stats.numRxBytes += *lpBytesReturned;
+    pthread_mutex_unlock(&gEmu.lock);
+    if (readyAtNs) {
+        sleep_until_ns(readyAtNs);
+    }
+    return FT_OK;
+}
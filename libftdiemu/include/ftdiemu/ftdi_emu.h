@@ -0,0 +1,87 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "txvc/jtag_sim.h"
+
+#include <stdbool.h>
+
+/*
+ * FTDI chip emulator.
+ * Implements the part of d2xx API that ftdi_generic driver uses on top of a software model of
+ * MPSSE-capable chip, so that the driver can be tested and benchmarked without hardware. Link
+ * this library instead of libftd2xx. Every channel of emulated chip interprets MPSSE commands,
+ * including bad command responses, TCK divisor and bit mode shifts, and clocks its own simulated
+ * JTAG chain. Chip is visible to d2xx calls between `txvc_ftdi_emu_plug` and
+ * `txvc_ftdi_emu_unplug`.
+ */
+
+enum txvc_ftdi_emu_chip {
+    TXVC_FTDI_EMU_FT2232H,
+    TXVC_FTDI_EMU_FT232H,
+};
+
+/**
+ * Optional timing model, zeroes make every call complete as fast as possible.
+ * Writes take `usbLatencyUs` plus the time to move their bytes at `usbBytesPerSec`, reads wait
+ * for chip to clock TCK at the rate set by divisor commands and then take the same USB time.
+ * Read data that is not followed by SEND_IMMEDIATE is also held by the latency timer.
+ */
+struct txvc_ftdi_emu_timing {
+    int usbLatencyUs;
+    long usbBytesPerSec;
+    bool clockTck;
+};
+
+struct txvc_ftdi_emu_options {
+    enum txvc_ftdi_emu_chip chip;
+    const char *serialNumber;
+    /* Chain that is connected to every channel, device 0 is the closest to TDO */
+    int numDevices;
+    const struct txvc_jtag_sim_device *devices;
+    struct txvc_ftdi_emu_timing timing;
+};
+
+/** Per-channel counters. */
+struct txvc_ftdi_emu_stats {
+    unsigned long long numWrites;
+    unsigned long long numReads;
+    unsigned long long numTxBytes;
+    unsigned long long numRxBytes;
+    unsigned long long numClocks;
+    unsigned long long numBadCommands;
+};
+
+extern bool txvc_ftdi_emu_plug(const struct txvc_ftdi_emu_options *options);
+extern void txvc_ftdi_emu_unplug(void);
+
+/** Channels are numbered from 0, which is channel A. */
+extern void txvc_ftdi_emu_get_stats(int channel, struct txvc_ftdi_emu_stats *stats);
+extern void txvc_ftdi_emu_get_chain(int channel, struct txvc_jtag_sim *chain);
+
+/** Makes the next write to a channel fail with FT_IO_ERROR, without passing it to the chip. */
+extern void txvc_ftdi_emu_fail_next_write(int channel);
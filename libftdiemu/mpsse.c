@@ -0,0 +1,309 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mpsse.h"
+
+#include "txvc/log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+TXVC_DEFAULT_LOG_TAG(mpsse);
+
+#define SHIFT_WR_FALLING_FLAG (1u << 0)
+#define SHIFT_BITMODE_FLAG (1u << 1)
+#define SHIFT_RD_FALLING_FLAG (1u << 2)
+#define SHIFT_LSB_FIRST_FLAG (1u << 3)
+#define SHIFT_WR_TDI_FLAG (1u << 4)
+#define SHIFT_RD_TDO_FLAG (1u << 5)
+#define SHIFT_WR_TMS_FLAG (1u << 6)
+
+#define PIN_TDI (1u << 1)
+#define PIN_TMS (1u << 3)
+
+enum {
+    OP_SET_DBUS_LOBYTE = 0x80,
+    OP_READ_DBUS_LOBYTE = 0x81,
+    OP_SET_DBUS_HIBYTE = 0x82,
+    OP_READ_DBUS_HIBYTE = 0x83,
+    OP_LOOPBACK_ON = 0x84,
+    OP_LOOPBACK_OFF = 0x85,
+    OP_SET_TCK_DIVISOR = 0x86,
+    OP_SEND_IMMEDIATE = 0x87,
+    OP_WAIT_IO_HIGH = 0x88,
+    OP_WAIT_IO_LOW = 0x89,
+    OP_DISABLE_CLK_DIVIDE_BY_5 = 0x8a,
+    OP_ENABLE_CLK_DIVIDE_BY_5 = 0x8b,
+    OP_ENABLE_3_PHASE_CLOCKING = 0x8c,
+    OP_DISABLE_3_PHASE_CLOCKING = 0x8d,
+    OP_CLOCK_BITS = 0x8e,
+    OP_CLOCK_BYTES = 0x8f,
+    OP_CLOCK_UNTIL_IO_HIGH = 0x94,
+    OP_CLOCK_UNTIL_IO_LOW = 0x95,
+    OP_ENABLE_ADAPTIVE_CLOCKING = 0x96,
+    OP_DISABLE_ADAPTIVE_CLOCKING = 0x97,
+    OP_CLOCK_BYTES_UNTIL_IO_HIGH = 0x9c,
+    OP_CLOCK_BYTES_UNTIL_IO_LOW = 0x9d,
+    OP_BAD_COMMANDS = 0xfa,
+};
+
+static bool is_valid_shift(uint8_t op) {
+    if (op & SHIFT_WR_TMS_FLAG) {
+        /* Only LSB first bit mode, TDI level is taken from bit 7 of data */
+        return (op & SHIFT_BITMODE_FLAG) && (op & SHIFT_LSB_FIRST_FLAG)
+            && !(op & SHIFT_WR_TDI_FLAG);
+    }
+    return op & (SHIFT_WR_TDI_FLAG | SHIFT_RD_TDO_FLAG);
+}
+
+/* Number of bytes in a command, not counting data of byte mode shifts */
+static size_t cmd_length(uint8_t op) {
+    if (!(op & 0x80u)) {
+        if (!is_valid_shift(op)) {
+            return 1;
+        }
+        if (op & SHIFT_WR_TMS_FLAG) {
+            return 3;
+        }
+        if (op & SHIFT_BITMODE_FLAG) {
+            return op & SHIFT_WR_TDI_FLAG ? 3 : 2;
+        }
+        return 3;
+    }
+    switch (op) {
+        case OP_SET_DBUS_LOBYTE:
+        case OP_SET_DBUS_HIBYTE:
+        case OP_SET_TCK_DIVISOR:
+        case OP_CLOCK_BYTES:
+        case OP_CLOCK_BYTES_UNTIL_IO_HIGH:
+        case OP_CLOCK_BYTES_UNTIL_IO_LOW:
+            return 3;
+        case OP_CLOCK_BITS:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+static void rx_push(struct mpsse *m, uint8_t byte) {
+    if (m->rxEnd == m->rxCapacity) {
+        if (m->rxBegin) {
+            memmove(m->rx, m->rx + m->rxBegin, m->rxEnd - m->rxBegin);
+            m->rxEnd -= m->rxBegin;
+            m->rxImmediateEnd = m->rxImmediateEnd > m->rxBegin
+                ? m->rxImmediateEnd - m->rxBegin : 0;
+            m->rxBegin = 0;
+        } else {
+            const size_t capacity = m->rxCapacity ? m->rxCapacity * 2 : 4096;
+            uint8_t *rx = realloc(m->rx, capacity);
+            if (!rx) {
+                FATAL("Can not grow read buffer to %zu bytes\n", capacity);
+            }
+            m->rx = rx;
+            m->rxCapacity = capacity;
+        }
+    }
+    m->rx[m->rxEnd++] = byte;
+}
+
+static bool clock_tck(struct mpsse *m, bool tms, bool tdi) {
+    m->lowLevels = (uint8_t) ((m->lowLevels & ~(PIN_TMS | PIN_TDI))
+            | (tms ? PIN_TMS : 0) | (tdi ? PIN_TDI : 0));
+    const bool tdo = txvc_jtag_sim_clock(&m->chain, tms, tdi);
+    return m->loopback ? tdi : tdo;
+}
+
+/*
+ * Clocks up to 8 bits of a shift command. LSB first read data is shifted in from the top, as
+ * real chip does, so that partial bytes have their bits in MSBs.
+ */
+static uint8_t shift(struct mpsse *m, uint8_t op, int numBits, uint8_t data) {
+    uint8_t tdoBits = 0;
+    for (int i = 0; i < numBits; i++) {
+        bool tms = m->lowLevels & PIN_TMS;
+        bool tdi = m->lowLevels & PIN_TDI;
+        if (op & SHIFT_WR_TMS_FLAG) {
+            tms = (data >> i) & 1u;
+            tdi = (data >> 7) & 1u;
+        } else if (op & SHIFT_WR_TDI_FLAG) {
+            tdi = op & SHIFT_LSB_FIRST_FLAG ? (data >> i) & 1u : (data >> (7 - i)) & 1u;
+        }
+        const bool tdo = clock_tck(m, tms, tdi);
+        tdoBits = op & SHIFT_LSB_FIRST_FLAG
+            ? (uint8_t) ((tdoBits >> 1) | (tdo << 7))
+            : (uint8_t) ((tdoBits << 1) | tdo);
+    }
+    if (op & SHIFT_RD_TDO_FLAG) {
+        rx_push(m, tdoBits);
+    }
+    return tdoBits;
+}
+
+static void clock_idle(struct mpsse *m, unsigned long numClocks) {
+    const bool tms = m->lowLevels & PIN_TMS;
+    const bool tdi = m->lowLevels & PIN_TDI;
+    while (numClocks--) {
+        clock_tck(m, tms, tdi);
+    }
+}
+
+static void execute(struct mpsse *m) {
+    const uint8_t op = m->cmd[0];
+    const unsigned arg = m->cmd[1] | (unsigned) m->cmd[2] << 8;
+    if (!(op & 0x80u)) {
+        if (!is_valid_shift(op)) {
+            goto bad_command;
+        }
+        if (op & SHIFT_WR_TMS_FLAG) {
+            /* Chip takes at most 7 TMS bits at a time */
+            shift(m, op, m->cmd[1] < 7 ? m->cmd[1] + 1 : 7, m->cmd[2]);
+        } else if (op & SHIFT_BITMODE_FLAG) {
+            shift(m, op, (m->cmd[1] & 0x7u) + 1, op & SHIFT_WR_TDI_FLAG ? m->cmd[2] : 0);
+        } else if (op & SHIFT_WR_TDI_FLAG) {
+            /* Data bytes are shifted as they come */
+            m->numDataBytesLeft = arg + 1u;
+        } else {
+            for (unsigned i = 0; i <= arg; i++) {
+                shift(m, op, 8, 0);
+            }
+        }
+        return;
+    }
+    switch (op) {
+        case OP_SET_DBUS_LOBYTE:
+            m->lowLevels = m->cmd[1];
+            m->lowDirections = m->cmd[2];
+            break;
+        case OP_READ_DBUS_LOBYTE:
+            rx_push(m, m->lowLevels);
+            break;
+        case OP_SET_DBUS_HIBYTE:
+            m->highLevels = m->cmd[1];
+            m->highDirections = m->cmd[2];
+            break;
+        case OP_READ_DBUS_HIBYTE:
+            rx_push(m, m->highLevels);
+            break;
+        case OP_LOOPBACK_ON:
+        case OP_LOOPBACK_OFF:
+            m->loopback = op == OP_LOOPBACK_ON;
+            break;
+        case OP_SET_TCK_DIVISOR:
+            m->divisor = arg;
+            break;
+        case OP_SEND_IMMEDIATE:
+            m->rxImmediateEnd = m->rxEnd;
+            break;
+        case OP_DISABLE_CLK_DIVIDE_BY_5:
+        case OP_ENABLE_CLK_DIVIDE_BY_5:
+            m->divideBy5 = op == OP_ENABLE_CLK_DIVIDE_BY_5;
+            break;
+        case OP_CLOCK_BITS:
+            clock_idle(m, m->cmd[1] + 1ul);
+            break;
+        case OP_CLOCK_BYTES:
+        case OP_CLOCK_BYTES_UNTIL_IO_HIGH:
+        case OP_CLOCK_BYTES_UNTIL_IO_LOW:
+            /* GPIOL1 is never asserted, so conditional clocking always runs to the end */
+            clock_idle(m, (arg + 1ul) * 8);
+            break;
+        case OP_WAIT_IO_HIGH:
+        case OP_WAIT_IO_LOW:
+        case OP_ENABLE_3_PHASE_CLOCKING:
+        case OP_DISABLE_3_PHASE_CLOCKING:
+        case OP_CLOCK_UNTIL_IO_HIGH:
+        case OP_CLOCK_UNTIL_IO_LOW:
+        case OP_ENABLE_ADAPTIVE_CLOCKING:
+        case OP_DISABLE_ADAPTIVE_CLOCKING:
+            /* Accepted but have no effect on emulated chain */
+            break;
+        default:
+            goto bad_command;
+    }
+    return;
+
+bad_command:
+    VERBOSE("Bad command 0x%02x\n", op);
+    m->numBadCommands++;
+    rx_push(m, OP_BAD_COMMANDS);
+    rx_push(m, op);
+}
+
+void mpsse_init(struct mpsse *m, const struct txvc_jtag_sim *chain) {
+    memset(m, 0, sizeof(*m));
+    m->chain = *chain;
+    mpsse_reset(m);
+}
+
+void mpsse_deinit(struct mpsse *m) {
+    free(m->rx);
+    m->rx = NULL;
+    m->rxCapacity = 0;
+}
+
+void mpsse_reset(struct mpsse *m) {
+    m->lowLevels = m->lowDirections = 0;
+    m->highLevels = m->highDirections = 0;
+    m->loopback = false;
+    m->divideBy5 = true;
+    m->divisor = 0;
+    mpsse_purge(m);
+}
+
+void mpsse_write(struct mpsse *m, const uint8_t *data, size_t numBytes) {
+    for (size_t i = 0; i < numBytes; i++) {
+        if (m->numDataBytesLeft) {
+            shift(m, m->cmd[0], 8, data[i]);
+            m->numDataBytesLeft--;
+            continue;
+        }
+        m->cmd[m->numCmdBytes++] = data[i];
+        if (m->numCmdBytes == cmd_length(m->cmd[0])) {
+            m->numCmdBytes = 0;
+            execute(m);
+        }
+    }
+}
+
+size_t mpsse_read(struct mpsse *m, uint8_t *dst, size_t numBytes) {
+    const size_t n = numBytes < mpsse_num_rx_bytes(m) ? numBytes : mpsse_num_rx_bytes(m);
+    memcpy(dst, m->rx + m->rxBegin, n);
+    m->rxBegin += n;
+    if (m->rxBegin == m->rxEnd) {
+        m->rxBegin = m->rxEnd = m->rxImmediateEnd = 0;
+    }
+    return n;
+}
+
+void mpsse_purge(struct mpsse *m) {
+    m->numCmdBytes = 0;
+    m->numDataBytesLeft = 0;
+    m->rxBegin = m->rxEnd = m->rxImmediateEnd = 0;
+}
+
+unsigned long mpsse_tck_hz(const struct mpsse *m) {
+    return (m->divideBy5 ? 12000000ul : 60000000ul) / ((1ul + m->divisor) * 2ul);
+}
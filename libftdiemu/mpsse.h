@@ -0,0 +1,82 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "txvc/jtag_sim.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * MPSSE engine of an emulated chip channel.
+ * Commands are interpreted as soon as their bytes arrive, so that they may be split between
+ * writes arbitrarily. Read data is queued until host takes it.
+ */
+struct mpsse {
+    struct txvc_jtag_sim chain;
+    uint8_t lowLevels;
+    uint8_t lowDirections;
+    uint8_t highLevels;
+    uint8_t highDirections;
+    bool loopback;
+    bool divideBy5;
+    unsigned divisor;
+    /* Bytes of a command that is not complete yet */
+    uint8_t cmd[3];
+    size_t numCmdBytes;
+    /* Data bytes that remain to be shifted by the current byte mode command */
+    size_t numDataBytesLeft;
+    /* Read data, bytes before `rxImmediateEnd` are to be sent to host without delay */
+    uint8_t *rx;
+    size_t rxCapacity;
+    size_t rxBegin;
+    size_t rxEnd;
+    size_t rxImmediateEnd;
+    unsigned long long numBadCommands;
+};
+
+extern void mpsse_init(struct mpsse *m, const struct txvc_jtag_sim *chain);
+extern void mpsse_deinit(struct mpsse *m);
+/** Bring engine to its state after MPSSE mode is entered, chain is left as is. */
+extern void mpsse_reset(struct mpsse *m);
+/** Interpret command bytes. */
+extern void mpsse_write(struct mpsse *m, const uint8_t *data, size_t numBytes);
+/** Take up to `numBytes` of read data, returns number of bytes taken. */
+extern size_t mpsse_read(struct mpsse *m, uint8_t *dst, size_t numBytes);
+/** Drop read data and incomplete command. */
+extern void mpsse_purge(struct mpsse *m);
+/** TCK frequency as set by divisor commands. */
+extern unsigned long mpsse_tck_hz(const struct mpsse *m);
+
+static inline size_t mpsse_num_rx_bytes(const struct mpsse *m) {
+    return m->rxEnd - m->rxBegin;
+}
+
+static inline size_t mpsse_num_immediate_rx_bytes(const struct mpsse *m) {
+    return m->rxImmediateEnd > m->rxBegin ? m->rxImmediateEnd - m->rxBegin : 0;
+}
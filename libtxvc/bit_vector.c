@@ -32,6 +32,7 @@
 #include <fcntl.h>
 
 #include <stdint.h>
+#include <string.h>
 
 TXVC_DEFAULT_LOG_TAG(bitVector);
 
@@ -39,6 +40,14 @@ static inline bool get_bit(const uint8_t* p, int idx) {
     return !!(p[idx / 8] & (1 << (idx % 8)));
 }
 
+static inline void set_bit(uint8_t* p, int idx, bool value) {
+    if (value) {
+        p[idx / 8] |= (uint8_t) (1 << (idx % 8));
+    } else {
+        p[idx / 8] &= (uint8_t) ~(1 << (idx % 8));
+    }
+}
+
 void txvc_bit_vector_random(uint8_t* out, int outSz) {
     int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
     ALWAYS_ASSERT(fd >= 0);
@@ -59,6 +68,30 @@ bool txvc_bit_vector_equal(
     return true;
 }
 
+void txvc_bit_vector_copy(uint8_t* dst, int dstStart,
+        const uint8_t* src, int srcStart, int srcEnd) {
+    /* Bit by bit up to an octet boundary of destination, then by whole octets */
+    while (srcStart < srcEnd && dstStart % 8) {
+        set_bit(dst, dstStart++, get_bit(src, srcStart++));
+    }
+    const int numOctets = (srcEnd - srcStart) / 8;
+    const int shift = srcStart % 8;
+    const uint8_t* s = src + srcStart / 8;
+    uint8_t* d = dst + dstStart / 8;
+    if (shift == 0) {
+        memcpy(d, s, (size_t) numOctets);
+    } else {
+        for (int i = 0; i < numOctets; i++) {
+            d[i] = (uint8_t) ((s[i] >> shift) | (s[i + 1] << (8 - shift)));
+        }
+    }
+    srcStart += numOctets * 8;
+    dstStart += numOctets * 8;
+    while (srcStart < srcEnd) {
+        set_bit(dst, dstStart++, get_bit(src, srcStart++));
+    }
+}
+
 int txvc_bit_vector_format_lsb(char* out, int outSz, const uint8_t* vector, int start, int end) {
     char* p = out;
     int avail = outSz;
@@ -37,6 +37,13 @@ extern bool txvc_bit_vector_equal(
         const uint8_t* lhs, int lhsStart, int lhsEnd,
         const uint8_t* rhs, int rhsStart, int rhsEnd);
 
+/**
+ * Copies bits `srcStart`..`srcEnd` of `src` to `dst` starting at bit `dstStart`.
+ * Other bits of `dst` are left intact.
+ */
+extern void txvc_bit_vector_copy(uint8_t* dst, int dstStart,
+        const uint8_t* src, int srcStart, int srcEnd);
+
 extern int txvc_bit_vector_format_lsb(char* out, int outSz, const uint8_t* vector, int start, int end);
 extern int txvc_bit_vector_format_msb(char* out, int outSz, const uint8_t* vector, int start, int end);
 
@@ -29,21 +29,69 @@
 #include "defs.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/** Single vector of a batched shift, see `shift_bits_batch` below. */
+struct txvc_shift {
+    int numBits;
+    const uint8_t *tmsVector;
+    const uint8_t *tdiVector;
+    uint8_t *tdoVector;
+};
+
+/**
+ * Driver is a table of functions, state of every device it drives is kept in a context that
+ * is passed to all of them. Context of `contextSize` bytes is allocated and zeroed by the caller
+ * before `activate`, so that a single process may drive many devices at once.
+ */
 struct txvc_driver {
     const char *name;
     const char *help;
+    size_t contextSize;
 
-    bool (*activate)(int numArg, const char **argNames, const char **argValues);
-    bool (*deactivate)(void);
+    bool (*activate)(void *ctx, int numArg, const char **argNames, const char **argValues);
+    bool (*deactivate)(void *ctx);
 
-    int (*max_vector_bits)(void);
-    int (*set_tck_period)(int tckPeriodNs);
-    bool (*shift_bits)(int numBits,
+    int (*max_vector_bits)(void *ctx);
+    int (*set_tck_period)(void *ctx, int tckPeriodNs);
+    bool (*shift_bits)(void *ctx, int numBits,
             const uint8_t *tmsVector,
             const uint8_t *tdiVector,
             uint8_t *tdoVector
             );
-};
+    /**
+     * Optional. Same as calling `shift_bits` for every vector in order, but lets driver
+     * issue them to the hardware at once. None of vectors is longer than `max_vector_bits`.
+     */
+    bool (*shift_bits_batch)(void *ctx, int numShifts, const struct txvc_shift *shifts);
+
+    /**
+     * Optional, all three or none. Asynchronous shifts that let caller prepare next vectors
+     * while driver works on previous ones. `submit_shift` starts a shift no longer than
+     * `max_vector_bits`, vectors of which must stay intact until it completes. At most
+     * `max_shifts_in_flight` shifts may be submitted but not completed at a time.
+     * `complete_shifts` returns number of shifts completed since its previous call, they always
+     * complete in order of submission. If `wait` is set, it blocks until at least one completes.
+     * Returns -1 on failure, all shifts in flight are failed then.
+     */
+    int (*max_shifts_in_flight)(void *ctx);
+    bool (*submit_shift)(void *ctx, const struct txvc_shift *shift);
+    int (*complete_shifts)(void *ctx, bool wait);
 
+    /**
+     * Optional, all five or none. JTAG operations, for drivers that issue scans and idle clocks
+     * to the hardware as whole operations. Server decodes vectors into operations once and calls
+     * these instead of `shift_bits`, see `struct txvc_jtag_op` in jtag_splitter.h. Operations
+     * take bits `fromBitIdx` to `toBitIdx` of the vectors, which stay valid until `flush`
+     * returns. TDO of scans is written by then, TDO of other bits is left as is.
+     * `exitShift` tells that the last bit of a scan is shifted with TMS=1.
+     */
+    bool (*tms_path)(void *ctx, const uint8_t *tmsVector, int fromBitIdx, int toBitIdx);
+    bool (*idle_clocks)(void *ctx, int numClocks);
+    bool (*scan_ir)(void *ctx, const uint8_t *tdiVector, uint8_t *tdoVector,
+            int fromBitIdx, int toBitIdx, bool exitShift);
+    bool (*scan_dr)(void *ctx, const uint8_t *tdiVector, uint8_t *tdoVector,
+            int fromBitIdx, int toBitIdx, bool exitShift);
+    bool (*flush)(void *ctx);
+};
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * JTAG chain simulation.
+ * Model of devices that are chained behind a TAP, for testing and benchmarking of drivers and
+ * server without hardware. Every device has instruction register of its own length, BYPASS
+ * register that is selected by all-ones and unknown instructions, and IDCODE register, unless
+ * its IDCODE is 0. IDCODE, or BYPASS if there is none, is selected after reset. Devices may also
+ * have user data registers, which keep what is shifted into them, and Xilinx 7 series style
+ * configuration engine, see below.
+ * Devices are given starting from the one closest to TDO, as in jtag_splitter.h.
+ * User MUST NOT directly access any of fields with leading underscore.
+ */
+
+/** Maximal number of devices in a simulated chain */
+#define TXVC_JTAG_SIM_MAX_DEVICES 8
+
+/** Maximal number of user data registers of a device */
+#define TXVC_JTAG_SIM_MAX_USER_DRS 4
+
+/**
+ * Configuration engine.
+ * Loosely follows 7 series FPGAs. JPROGRAM clears configuration, CFG_IN data is searched for the
+ * sync word, and once it is found, JSTART followed by enough clocks in RUN_TEST_IDLE sets DONE.
+ * DONE and INIT_COMPLETE are reported in bits 5 and 4 of the captured instruction register, so
+ * device must have at least 6 bits of it.
+ */
+#define TXVC_JTAG_SIM_CFG_IN 0x05u
+#define TXVC_JTAG_SIM_JPROGRAM 0x0bu
+#define TXVC_JTAG_SIM_JSTART 0x0cu
+#define TXVC_JTAG_SIM_SYNC_WORD 0xaa995566u
+#define TXVC_JTAG_SIM_STARTUP_CLOCKS 12
+
+/** User data register, selected by its own instruction. */
+struct txvc_jtag_sim_user_dr {
+    uint32_t opcode;
+    int length; /** Up to 64 bits. */
+};
+
+/** Simulated device. */
+struct txvc_jtag_sim_device {
+    int irLength; /** Length of instruction register, up to 32 bits. */
+    uint32_t idcode; /** Value of IDCODE register, 0 if device has none. */
+    uint32_t idcodeOpcode; /** Instruction that selects IDCODE register. */
+    int numUserDrs;
+    struct txvc_jtag_sim_user_dr userDrs[TXVC_JTAG_SIM_MAX_USER_DRS];
+    bool hasConfigEngine; /** Whether device has configuration engine, see above. */
+};
+
+/* Configuration engine state */
+struct txvc_jtag_sim_config {
+    uint32_t syncWindow;
+    bool isSynced;
+    bool isDone;
+    int numStartupClocks;
+    unsigned long long numDataBits;
+};
+
+struct txvc_jtag_sim {
+    int _state;
+    int _numDevices;
+    struct txvc_jtag_sim_device _devices[TXVC_JTAG_SIM_MAX_DEVICES];
+    uint32_t _ir[TXVC_JTAG_SIM_MAX_DEVICES];
+    uint64_t _shiftReg[TXVC_JTAG_SIM_MAX_DEVICES];
+    int _shiftBits[TXVC_JTAG_SIM_MAX_DEVICES];
+    int _selectedDr[TXVC_JTAG_SIM_MAX_DEVICES];
+    uint64_t _userDrs[TXVC_JTAG_SIM_MAX_DEVICES][TXVC_JTAG_SIM_MAX_USER_DRS];
+    struct txvc_jtag_sim_config _config[TXVC_JTAG_SIM_MAX_DEVICES];
+    unsigned long long _numClocks;
+};
+
+/** Initialize chain of `numDevices` in TEST_LOGIC_RESET. */
+extern bool txvc_jtag_sim_init(struct txvc_jtag_sim *sim,
+        int numDevices, const struct txvc_jtag_sim_device *devices);
+
+/** Clock TAP once with given TMS and TDI, returns TDO as sampled on the rising edge of TCK. */
+extern bool txvc_jtag_sim_clock(struct txvc_jtag_sim *sim, bool tms, bool tdi);
+
+/** Clock TAP with combined JTAG vectors, like a driver would do. */
+extern void txvc_jtag_sim_shift(struct txvc_jtag_sim *sim, int numBits,
+        const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo);
+
+/** Instruction of a device at `position` as of the last Update-IR or reset. */
+extern uint32_t txvc_jtag_sim_device_ir(const struct txvc_jtag_sim *sim, int position);
+
+/** Value of a user data register as of the last Update-DR with it selected, initially 0. */
+extern uint64_t txvc_jtag_sim_user_dr(const struct txvc_jtag_sim *sim, int position, int drIdx);
+
+/** Whether configuration engine of a device has set DONE. */
+extern bool txvc_jtag_sim_device_done(const struct txvc_jtag_sim *sim, int position);
+
+/** Number of bits that were shifted into configuration engine of a device since JPROGRAM. */
+extern unsigned long long txvc_jtag_sim_config_bits(const struct txvc_jtag_sim *sim, int position);
+
+/** Whether TAP is in TEST_LOGIC_RESET. */
+extern bool txvc_jtag_sim_in_reset(const struct txvc_jtag_sim *sim);
+
+/** Number of TCK cycles since initialization. */
+extern unsigned long long txvc_jtag_sim_num_clocks(const struct txvc_jtag_sim *sim);
@@ -39,6 +39,11 @@
  * combined JTAG stream and separately notifies user about TMS and TDI shifts.
  */
 
+/** Maximal number of devices in a chain that splitter can track instructions for */
+#define TXVC_JTAG_SPLIT_MAX_DEVICES 8
+/** Maximal total length of chain instruction register that splitter can track */
+#define TXVC_JTAG_SPLIT_MAX_IR_BITS 64
+
 /** JTAG stream decoding event, see definition below */
 struct txvc_jtag_split_event;
 /** Callback that receives decoding events. Returns `true` if event was processed successfully */
@@ -52,6 +57,13 @@ struct txvc_jtag_splitter {
     int _state;
     txvc_jtag_splitter_callback _cb;
     void *_cbExtra;
+    int _irNumDevices;
+    int _irLengths[TXVC_JTAG_SPLIT_MAX_DEVICES];
+    int _irTotalBits;
+    uint64_t _irShift;
+    int _irNumShifted;
+    uint64_t _ir;
+    bool _irValid;
 };
 
 /** Initialize splitter instance and reset TAP. */
@@ -59,9 +71,17 @@ extern bool txvc_jtag_splitter_init(struct txvc_jtag_splitter *splitter,
         txvc_jtag_splitter_callback cb, void *cbExtra);
 /** Release splitter resources and reset TAP. */
 extern bool txvc_jtag_splitter_deinit(struct txvc_jtag_splitter *splitter);
+/** Reset TAP, e.g. when user failed to apply decoded vector (see below). */
+extern bool txvc_jtag_splitter_reset(struct txvc_jtag_splitter *splitter);
 /** Process combined JTAG stream */
 extern bool txvc_jtag_splitter_process(struct txvc_jtag_splitter *splitter,
         int numBits, const uint8_t* tms, const uint8_t* tdi, uint8_t* tdo);
+/**
+ * Same as above but decodes TMS vector bit by bit instead of using lookup tables.
+ * Much slower, this is a reference implementation that is kept for testing.
+ */
+extern bool txvc_jtag_splitter_process_bitwise(struct txvc_jtag_splitter *splitter,
+        int numBits, const uint8_t* tms, const uint8_t* tdi, uint8_t* tdo);
 
 /**
  * JTAG stream decoding events.
@@ -129,3 +149,207 @@ TXVC_JTAG_SPLIT_EVENTS(AS_EVENT_CAST)
 
 #undef TXVC_JTAG_SPLIT_EVENTS
 
+/**
+ * Batched decoding.
+ * Instead of notifying user about every shift via callback, splitter can decode the whole vector
+ * into an array of TMS and TDI sub-vectors at once, so that user can plan how to issue them
+ * to a TAP. This shares TAP state with callback based processing so both can be mixed, however
+ * there are no flush events - user is responsible to apply decoded segments by their own.
+ * Callback is still used by splitter to reset TAP.
+ */
+struct txvc_jtag_split_segment {
+    enum txvc_jtag_split_event_kind kind; /** Either JTAG_SPLIT_shift_tms or JTAG_SPLIT_shift_tdi */
+    int fromBitIdx; /** First bit of a sub-vector. */
+    int toBitIdx; /** One past the last bit of a sub-vector. */
+    bool incomplete; /** Same as in `shift_tdi` event. Always `false` for TMS segments. */
+    bool irKnown; /** IR tracking only. Whether chain instruction is known for a DR shift. */
+    uint64_t ir; /** IR tracking only. Chain instruction for a DR shift, if known. */
+};
+
+/** Maximal number of segments that a vector of `numBits` bits can be decoded to. */
+#define TXVC_JTAG_SPLIT_MAX_SEGMENTS(numBits) ((numBits) / 2 + 2)
+
+/**
+ * Decode combined JTAG stream into `segments`, in the order they must be shifted.
+ * Returns number of decoded segments or -1 if `maxSegments` is too small, in which case splitter
+ * state is not changed. Use TXVC_JTAG_SPLIT_MAX_SEGMENTS() to size `segments` safely.
+ * `tdi` is only needed for IR tracking (see below) and may be NULL otherwise.
+ */
+extern int txvc_jtag_splitter_decode(struct txvc_jtag_splitter *splitter,
+        int numBits, const uint8_t* tms, const uint8_t* tdi,
+        struct txvc_jtag_split_segment *segments, int maxSegments);
+
+/**
+ * Operation decoding.
+ * Decodes combined JTAG stream into JTAG operations, for users that issue scans and idle clocks
+ * to a TAP as whole operations rather than as bit vectors. Like batched decoding, this shares
+ * TAP state with other processing and leaves applying operations to the user. Instructions
+ * are not tracked.
+ */
+enum txvc_jtag_op_kind {
+    TXVC_JTAG_OP_TMS_PATH, /** Shift TMS bits, TDI and TDO do not matter. */
+    TXVC_JTAG_OP_IDLE_CLOCKS, /** Stay in RUN_TEST_IDLE for a bit count of TCK cycles. */
+    TXVC_JTAG_OP_SCAN_IR, /** Shift TDI/TDO bits in SHIFT_IR. */
+    TXVC_JTAG_OP_SCAN_DR, /** Shift TDI/TDO bits in SHIFT_DR. */
+};
+
+struct txvc_jtag_op {
+    enum txvc_jtag_op_kind kind;
+    int fromBitIdx; /** First bit of a sub-vector. */
+    int toBitIdx; /** One past the last bit of a sub-vector. */
+    bool exitShift; /** Scans only. The last bit is shifted with TMS=1, moving TAP to EXIT1. */
+};
+
+/** Shorter runs of TMS=0 in RUN_TEST_IDLE are left in TMS paths */
+#define TXVC_JTAG_MIN_IDLE_CLOCKS 8
+
+/** Maximal number of operations that a vector of `numBits` bits can be decoded to. */
+#define TXVC_JTAG_MAX_OPS(numBits) \
+    (TXVC_JTAG_SPLIT_MAX_SEGMENTS(numBits) + 2 * (numBits) / TXVC_JTAG_MIN_IDLE_CLOCKS)
+
+/**
+ * Decode combined JTAG stream into `ops`, in the order they must be issued.
+ * Returns number of decoded operations or -1 if `maxOps` is too small, in which case splitter
+ * state is not changed. Use TXVC_JTAG_MAX_OPS() to size `ops` safely.
+ */
+extern int txvc_jtag_splitter_decode_ops(struct txvc_jtag_splitter *splitter,
+        int numBits, const uint8_t* tms, struct txvc_jtag_op *ops, int maxOps);
+
+/**
+ * Instruction tracking.
+ * Once enabled, batched decoding follows instructions that are shifted into the chain and marks
+ * DR shifts with the instruction they are done with, so that user can e.g. treat
+ * configuration data loads specially. Instruction becomes unknown when TAP is reset or when
+ * not enough bits were shifted to fill instruction registers of the whole chain.
+ * `irLengths` are given starting from the device closest to TDO, i.e. the one that receives
+ * the first shifted bits.
+ */
+extern bool txvc_jtag_splitter_track_ir(struct txvc_jtag_splitter *splitter,
+        int numDevices, const int *irLengths);
+/** Instruction of a chain device at `position` as of a DR shift `segment` with a known IR. */
+extern unsigned txvc_jtag_splitter_device_ir(const struct txvc_jtag_splitter *splitter,
+        const struct txvc_jtag_split_segment *segment, int position);
+
+/**
+ * Whether decoding any vector would yield the same segments and leave splitters in the same state.
+ * Allows user to reuse results of a previous decoding, e.g. by keeping a copy of splitter
+ * (splitters can be copied by assignment) as it was before decoding, along with the one after.
+ */
+extern bool txvc_jtag_splitter_same_state(const struct txvc_jtag_splitter *a,
+        const struct txvc_jtag_splitter *b);
+
+/**
+ * TAP state tracking.
+ * Lightweight companion to splitter for users that only need to follow TAP state, e.g. to find
+ * points where TAP may be left alone for a while. Trackers can be copied by assignment.
+ * User MUST NOT directly access any of fields in this struct.
+ */
+struct txvc_jtag_tap {
+    int _state;
+};
+
+/** Start tracking TAP that is in TEST_LOGIC_RESET. */
+extern void txvc_jtag_tap_init(struct txvc_jtag_tap *tap);
+/** Follow TMS vector. */
+extern void txvc_jtag_tap_follow(struct txvc_jtag_tap *tap, int numBits, const uint8_t *tms);
+/** Whether TAP is in a stable state, that is TEST_LOGIC_RESET or RUN_TEST_IDLE. */
+extern bool txvc_jtag_tap_is_stable(const struct txvc_jtag_tap *tap);
+/** Whether both trackers are in the same state. */
+extern bool txvc_jtag_tap_same_state(const struct txvc_jtag_tap *a, const struct txvc_jtag_tap *b);
+/**
+ * Build TMS vector that moves TAP from one stable state to another, into `tms` of at least
+ * one octet. Returns number of bits in the vector, which may be 0, or -1 if either state
+ * is not stable.
+ */
+extern int txvc_jtag_tap_move(const struct txvc_jtag_tap *from, const struct txvc_jtag_tap *to,
+        uint8_t *tms);
+
+/**
+ * Virtual devices.
+ * Presents every device of a chain to its own user as if it was alone in the chain, with users
+ * taking turns to use the chain. Scans of a user are padded with bits for other devices, which
+ * are kept in BYPASS, and bits that are shifted out of other devices are dropped from TDO.
+ * Chain tracks instructions that devices actually have, while every user has a view of their
+ * device that is restored when user gets the chain back.
+ * Padding is shifted through user's device too, so only scans that go from Capture to Update
+ * without pausing and fill the whole register are supported. Bits that are shifted past the end
+ * of a register come out of TDO as they would from a lone device as long as register length is
+ * known, i.e. for IR, BYPASS and DR after reset. For other registers other devices delay them.
+ * User MUST NOT directly access any of fields in these structs, they can be copied by assignment.
+ */
+struct txvc_jtag_chain {
+    int _state;
+    int _numDevices;
+    int _irLengths[TXVC_JTAG_SPLIT_MAX_DEVICES];
+    int _resetDrBits[TXVC_JTAG_SPLIT_MAX_DEVICES];
+    bool _inReset;
+    int _selected;
+    uint32_t _ir;
+};
+
+struct txvc_jtag_view {
+    int _position;
+    int _state;
+    bool _irReset;
+    uint32_t _ir;
+    uint32_t _irShift;
+    int _irNumShifted;
+    int _scanBits;
+    int _scanRegisterBits;
+    uint64_t _scanHistory;
+};
+
+/**
+ * Bits that are inserted into user's vector. Pads with non-zero `echoDelay` are not inserted,
+ * they instead tell that TDO of `numBits` user bits starting from `atBitIdx` is made of TDI
+ * that was shifted `echoDelay` bits earlier, as if it has passed through a lone register.
+ */
+struct txvc_jtag_pad {
+    int atBitIdx; /** User's bit that padding goes before. */
+    int numBits; /** Number of padding bits. */
+    bool tdi; /** TDI value of padding bits. */
+    bool exits; /** Whether padding ends a scan, taking TMS=1 over from the preceding bit. */
+    int echoDelay; /** Length of a register that TDI is echoed through, 0 for regular pads. */
+    uint64_t echoHistory; /** TDI of the same scan before `atBitIdx`, the latest bit in MSB. */
+};
+
+/** Size of vectors that are built by chain and view APIs below. */
+#define TXVC_JTAG_CHAIN_MAX_CONTROL_BITS (9 + 32 * TXVC_JTAG_SPLIT_MAX_DEVICES + 8 + 4)
+
+/**
+ * Initialize chain of `numDevices` with `irLengths` given starting from the device closest
+ * to TDO, as in instruction tracking above. TAP is expected to be in TEST_LOGIC_RESET.
+ */
+extern bool txvc_jtag_chain_init(struct txvc_jtag_chain *chain, int numDevices, const int *irLengths);
+/**
+ * Build vector that resets TAP and reads data registers that devices have after reset,
+ * i.e. IDCODE or BYPASS. Returns number of bits in the vector.
+ */
+extern int txvc_jtag_chain_identify_vector(const struct txvc_jtag_chain *chain,
+        uint8_t *tms, uint8_t *tdi);
+/** Learn DR lengths after reset from TDO of the vector above, `false` if chain does not match. */
+extern bool txvc_jtag_chain_identify(struct txvc_jtag_chain *chain, const uint8_t *tdo);
+
+/** Initialize view of a device at `position` in the chain, starting in TEST_LOGIC_RESET. */
+extern void txvc_jtag_view_init(struct txvc_jtag_view *view, int position);
+/**
+ * Build vector that brings chain to the view: resets TAP if it is not in a stable state, loads
+ * instructions if needed and moves TAP to the state of the view. Returns number of bits in
+ * the vector, which may be 0, or -1 if the view is not in a stable state.
+ */
+extern int txvc_jtag_view_restore(const struct txvc_jtag_view *view, struct txvc_jtag_chain *chain,
+        uint8_t *tms, uint8_t *tdi);
+/**
+ * Decode user's vector into `pads` that need to be inserted into it, in order of their
+ * positions. Returns number of pads or -1 if `maxPads` is too small, in which case neither
+ * view nor chain are changed.
+ */
+extern int txvc_jtag_view_decode_pads(struct txvc_jtag_view *view, struct txvc_jtag_chain *chain,
+        int numBits, const uint8_t *tms, const uint8_t *tdi,
+        struct txvc_jtag_pad *pads, int maxPads);
+/** Insert `pads` into user's vectors, output vectors are longer by the total of padding bits. */
+extern void txvc_jtag_apply_pads(const struct txvc_jtag_pad *pads, int numPads,
+        int numBits, const uint8_t *tms, const uint8_t *tdi, uint8_t *outTms, uint8_t *outTdi);
+/** Drop bits that were shifted out during padding from `paddedTdo`, `tdi` is user's one. */
+extern void txvc_jtag_strip_pads(const struct txvc_jtag_pad *pads, int numPads,
+        int numBits, const uint8_t *tdi, const uint8_t *paddedTdo, uint8_t *tdo);
@@ -28,8 +28,75 @@
 
 #include "driver.h"
 
+#include <netinet/in.h>
 #include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
 
-extern void txvc_run_server(const char *address,
-        const struct txvc_driver *driver, volatile sig_atomic_t *shouldTerminate);
+/** Priority of a client in cable sharing, see below. */
+struct txvc_server_priority {
+    struct in_addr addr;
+    unsigned priority;
+};
+
+/** Server tuning. */
+struct txvc_server_options {
+    /**
+     * Vector size to advertise to clients if it is larger than the one supported by the driver,
+     * longer vectors are then shifted by the driver in multiple chunks.
+     */
+    size_t maxVectorBits;
+    /**
+     * Responses that are at least this large are sent with MSG_ZEROCOPY, which saves copying
+     * them to the kernel but has a fixed cost of pinning pages and receiving completions.
+     * 0 disables zero-copy sends.
+     */
+    size_t zeroCopyMinBytes;
+    /**
+     * Use io_uring for socket I/O, which sends responses and receives next commands with
+     * a single system call. Blocking socket calls are used if io_uring is not available.
+     */
+    bool useIoUring;
+    /**
+     * Shift vectors on a thread of their own, with up to this many shifts queued, so that
+     * receiving next commands and sending responses overlap with the driver work. Needs a driver
+     * with asynchronous shifts, not used together with io_uring or virtual cables.
+     * 0 disables pipelining.
+     */
+    size_t pipelineDepth;
+    /**
+     * Clients that send nothing for this long are disconnected, unless they wait for
+     * the cable. This keeps a stalled client from blocking the cable for everyone.
+     * 0 disables idle timeouts.
+     */
+    size_t idleTimeoutMs;
+    /**
+     * Let clients share the cable in time slices of this length, instead of serving them one
+     * after another. Cable changes hands only when TAP is in TEST_LOGIC_RESET or RUN_TEST_IDLE,
+     * each client sees TAP in the state it has left it in. 0 disables sharing.
+     */
+    size_t timeSliceMs;
+    /**
+     * Priorities of clients by their addresses, others have priority 1. Clients get shares of
+     * TCK time proportional to their priorities.
+     */
+    const struct txvc_server_priority *priorities;
+    size_t numPriorities;
+    /**
+     * IR lengths of devices in the chain, starting from the one closest to TDO. If they are set,
+     * every device is served as a virtual cable of its own, at consecutive ports starting from
+     * the server one. Clients of all devices share the cable in time slices, see above.
+     */
+    const int *chainIrLengths;
+    size_t numChainDevices;
+};
 
+/**
+ * Serve XVC clients at `address` until `shouldTerminate` is set.
+ * Many clients may be connected at once, they take turns to use the driver in order of arrival.
+ * Driver is called with `driverCtx`, so servers of different devices may run on their own threads.
+ */
+extern void txvc_run_server(const char *address,
+        const struct txvc_driver *driver, void *driverCtx,
+        const struct txvc_server_options *options,
+        volatile sig_atomic_t *shouldTerminate);
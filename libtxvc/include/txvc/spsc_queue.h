@@ -0,0 +1,60 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Lock-free queue of fixed size items between exactly one producer and one consumer thread.
+ * Capacity is rounded up to a power of two. Indices are on separate cache lines, so that
+ * producer and consumer do not contend for them.
+ *
+ * User MUST NOT access any field directly.
+ */
+struct txvc_spsc_queue {
+    unsigned char *items;
+    size_t itemSize;
+    size_t mask;
+    alignas(64) atomic_size_t head;
+    alignas(64) atomic_size_t tail;
+};
+
+extern bool txvc_spsc_queue_init(struct txvc_spsc_queue *q, size_t capacity, size_t itemSize);
+extern void txvc_spsc_queue_deinit(struct txvc_spsc_queue *q);
+
+/** Producer side. Returns `false` if queue is full. */
+extern bool txvc_spsc_queue_push(struct txvc_spsc_queue *q, const void *item);
+
+/** Consumer side. Returns `false` if queue is empty. */
+extern bool txvc_spsc_queue_pop(struct txvc_spsc_queue *q, void *item);
+
+/** Number of queued items, exact only when called by producer or consumer. */
+extern size_t txvc_spsc_queue_size(struct txvc_spsc_queue *q);
+
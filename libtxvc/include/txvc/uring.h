@@ -0,0 +1,86 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/**
+ * Minimal io_uring wrapper.
+ * Covers only what the server needs: reads and writes from/to registered buffers, optionally
+ * linked together. Kernel interface is used directly, so there is no dependency on liburing.
+ *
+ * User MUST NOT access any field directly.
+ */
+struct txvc_uring {
+    int fd;
+    unsigned char *sqRing;
+    size_t sqRingSz;
+    unsigned char *cqRing;
+    size_t cqRingSz;
+    struct io_uring_sqe *sqes;
+    size_t sqesSz;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned sqNumEntries;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned numUnsubmitted;
+    bool buffersRegistered;
+};
+
+/** Returns `false` if io_uring is not available, e.g. on older kernels, `errno` tells why. */
+extern bool txvc_uring_init(struct txvc_uring *uring, unsigned numEntries);
+extern void txvc_uring_deinit(struct txvc_uring *uring);
+
+/** Registers buffers for fixed reads and writes, replacing previously registered ones. */
+extern bool txvc_uring_register_buffers(struct txvc_uring *uring,
+        const struct iovec *buffers, unsigned numBuffers);
+
+/**
+ * Queues read (or write) of `len` bytes from `fd` into (from) `buf`, which must be within
+ * registered buffer `bufIndex`. If `linkNext` is set, the next queued operation starts only after
+ * this one completes in full. Returns `false` if submission queue is full.
+ */
+extern bool txvc_uring_prep_rw_fixed(struct txvc_uring *uring, bool isWrite, int fd,
+        void *buf, unsigned len, unsigned bufIndex, uint64_t userData, bool linkNext);
+
+/**
+ * Submits queued operations and waits until at least `minComplete` operations complete.
+ * This is the only system call made in a steady state. Returns `false` on failure,
+ * `errno` tells why. Note that waiting can be interrupted by a signal (EINTR).
+ */
+extern bool txvc_uring_submit_and_wait(struct txvc_uring *uring, unsigned minComplete);
+
+/** Pops the next completion, if any. `res` is operation result as in read(2)/write(2) or -errno */
+extern bool txvc_uring_pop_completion(struct txvc_uring *uring, uint64_t *userData, int *res);
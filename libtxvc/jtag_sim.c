@@ -0,0 +1,296 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "txvc/jtag_sim.h"
+
+#include "txvc/log.h"
+
+#include <string.h>
+
+TXVC_DEFAULT_LOG_TAG(jtagSim);
+
+enum sim_state {
+    TEST_LOGIC_RESET,
+    RUN_TEST_IDLE,
+    SELECT_DR_SCAN,
+    CAPTURE_DR,
+    SHIFT_DR,
+    EXIT_1_DR,
+    PAUSE_DR,
+    EXIT_2_DR,
+    UPDATE_DR,
+    SELECT_IR_SCAN,
+    CAPTURE_IR,
+    SHIFT_IR,
+    EXIT_1_IR,
+    PAUSE_IR,
+    EXIT_2_IR,
+    UPDATE_IR,
+};
+
+static const uint8_t gNextState[16][2] = {
+    [TEST_LOGIC_RESET] = { RUN_TEST_IDLE, TEST_LOGIC_RESET },
+    [RUN_TEST_IDLE] = { RUN_TEST_IDLE, SELECT_DR_SCAN },
+    [SELECT_DR_SCAN] = { CAPTURE_DR, SELECT_IR_SCAN },
+    [CAPTURE_DR] = { SHIFT_DR, EXIT_1_DR },
+    [SHIFT_DR] = { SHIFT_DR, EXIT_1_DR },
+    [EXIT_1_DR] = { PAUSE_DR, UPDATE_DR },
+    [PAUSE_DR] = { PAUSE_DR, EXIT_2_DR },
+    [EXIT_2_DR] = { SHIFT_DR, UPDATE_DR },
+    [UPDATE_DR] = { RUN_TEST_IDLE, SELECT_DR_SCAN },
+    [SELECT_IR_SCAN] = { CAPTURE_IR, TEST_LOGIC_RESET },
+    [CAPTURE_IR] = { SHIFT_IR, EXIT_1_IR },
+    [SHIFT_IR] = { SHIFT_IR, EXIT_1_IR },
+    [EXIT_1_IR] = { PAUSE_IR, UPDATE_IR },
+    [PAUSE_IR] = { PAUSE_IR, EXIT_2_IR },
+    [EXIT_2_IR] = { SHIFT_IR, UPDATE_IR },
+    [UPDATE_IR] = { RUN_TEST_IDLE, SELECT_DR_SCAN },
+};
+
+/* Data register selected by the current instruction, non-negative values are user DRs */
+enum {
+    DR_BYPASS = -1,
+    DR_IDCODE = -2,
+    DR_CFG_IN = -3,
+};
+
+static inline bool get_bit(const uint8_t* p, int idx) {
+    return !!(p[idx / 8] & (1 << (idx % 8)));
+}
+
+static inline void set_bit(uint8_t* p, int idx, bool value) {
+    if (value) {
+        p[idx / 8] |= (uint8_t) (1 << (idx % 8));
+    } else {
+        p[idx / 8] &= (uint8_t) ~(1 << (idx % 8));
+    }
+}
+
+static uint32_t bypass_opcode(const struct txvc_jtag_sim_device *d) {
+    return (uint32_t) ((UINT64_C(1) << d->irLength) - 1u);
+}
+
+static uint32_t reset_opcode(const struct txvc_jtag_sim_device *d) {
+    return d->idcode ? d->idcodeOpcode : bypass_opcode(d);
+}
+
+static bool is_good_opcode(const struct txvc_jtag_sim_device *d, uint32_t opcode) {
+    return opcode != bypass_opcode(d) && (d->irLength == 32 || !(opcode >> d->irLength));
+}
+
+static bool is_good_device(const struct txvc_jtag_sim_device *d) {
+    if (d->irLength < 2 || d->irLength > 32) {
+        ERROR("Bad IR length: %d\n", d->irLength);
+        return false;
+    }
+    if (d->idcode && !is_good_opcode(d, d->idcodeOpcode)) {
+        ERROR("Bad IDCODE instruction: 0x%x\n", d->idcodeOpcode);
+        return false;
+    }
+    if (d->numUserDrs < 0 || d->numUserDrs > TXVC_JTAG_SIM_MAX_USER_DRS) {
+        ERROR("Bad number of user DRs: %d\n", d->numUserDrs);
+        return false;
+    }
+    for (int i = 0; i < d->numUserDrs; i++) {
+        const struct txvc_jtag_sim_user_dr *dr = &d->userDrs[i];
+        if (dr->length < 1 || dr->length > 64 || !is_good_opcode(d, dr->opcode)) {
+            ERROR("Bad user DR: %d bits, instruction 0x%x\n", dr->length, dr->opcode);
+            return false;
+        }
+    }
+    if (d->hasConfigEngine && d->irLength < 6) {
+        ERROR("Configuration engine needs at least 6 bits of IR\n");
+        return false;
+    }
+    return true;
+}
+
+static int select_dr(const struct txvc_jtag_sim_device *d, uint32_t ir) {
+    if (d->idcode && ir == d->idcodeOpcode) {
+        return DR_IDCODE;
+    }
+    for (int i = 0; i < d->numUserDrs; i++) {
+        if (ir == d->userDrs[i].opcode) {
+            return i;
+        }
+    }
+    if (d->hasConfigEngine && ir == TXVC_JTAG_SIM_CFG_IN) {
+        return DR_CFG_IN;
+    }
+    return DR_BYPASS;
+}
+
+static void config_feed(struct txvc_jtag_sim_config *cfg, bool bit) {
+    cfg->syncWindow = cfg->syncWindow << 1 | bit;
+    cfg->numDataBits++;
+    if (cfg->syncWindow == TXVC_JTAG_SIM_SYNC_WORD) {
+        cfg->isSynced = true;
+    }
+}
+
+static void config_idle_clock(struct txvc_jtag_sim_config *cfg) {
+    if (cfg->isSynced && !cfg->isDone
+            && ++cfg->numStartupClocks >= TXVC_JTAG_SIM_STARTUP_CLOCKS) {
+        cfg->isDone = true;
+    }
+}
+
+bool txvc_jtag_sim_init(struct txvc_jtag_sim *sim,
+        int numDevices, const struct txvc_jtag_sim_device *devices) {
+    if (numDevices < 1 || numDevices > TXVC_JTAG_SIM_MAX_DEVICES) {
+        ERROR("Can not simulate chain of %d devices\n", numDevices);
+        return false;
+    }
+    memset(sim, 0, sizeof(*sim));
+    for (int i = 0; i < numDevices; i++) {
+        const struct txvc_jtag_sim_device *d = &devices[i];
+        if (!is_good_device(d)) {
+            return false;
+        }
+        sim->_devices[i] = *d;
+        sim->_ir[i] = reset_opcode(d);
+        sim->_selectedDr[i] = DR_BYPASS;
+    }
+    sim->_state = TEST_LOGIC_RESET;
+    sim->_numDevices = numDevices;
+    return true;
+}
+
+/* Registers are updated on entering states, as if it happens on the falling edge of TCK */
+static void enter_state(struct txvc_jtag_sim *sim, enum sim_state state) {
+    for (int i = 0; i < sim->_numDevices; i++) {
+        const struct txvc_jtag_sim_device *d = &sim->_devices[i];
+        switch (state) {
+            case TEST_LOGIC_RESET:
+                sim->_ir[i] = reset_opcode(d);
+                break;
+            case CAPTURE_IR:
+                /* Two LSBs are mandated by the standard */
+                sim->_shiftReg[i] = 0x1u;
+                if (d->hasConfigEngine) {
+                    sim->_shiftReg[i] |= 0x10u | (sim->_config[i].isDone ? 0x20u : 0);
+                }
+                sim->_shiftBits[i] = d->irLength;
+                break;
+            case CAPTURE_DR:
+                sim->_selectedDr[i] = select_dr(d, sim->_ir[i]);
+                switch (sim->_selectedDr[i]) {
+                    case DR_IDCODE:
+                        sim->_shiftReg[i] = d->idcode;
+                        sim->_shiftBits[i] = 32;
+                        break;
+                    case DR_BYPASS:
+                    case DR_CFG_IN:
+                        sim->_shiftReg[i] = 0;
+                        sim->_shiftBits[i] = 1;
+                        break;
+                    default:
+                        sim->_shiftReg[i] = sim->_userDrs[i][sim->_selectedDr[i]];
+                        sim->_shiftBits[i] = d->userDrs[sim->_selectedDr[i]].length;
+                        break;
+                }
+                break;
+            case UPDATE_DR:
+                if (sim->_selectedDr[i] >= 0) {
+                    sim->_userDrs[i][sim->_selectedDr[i]] = sim->_shiftReg[i];
+                }
+                break;
+            case UPDATE_IR:
+                sim->_ir[i] = (uint32_t) sim->_shiftReg[i] & bypass_opcode(d);
+                if (d->hasConfigEngine && sim->_ir[i] == TXVC_JTAG_SIM_JPROGRAM) {
+                    memset(&sim->_config[i], 0, sizeof(sim->_config[i]));
+                }
+                if (d->hasConfigEngine && sim->_ir[i] == TXVC_JTAG_SIM_JSTART) {
+                    sim->_config[i].numStartupClocks = 0;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    sim->_state = state;
+}
+
+bool txvc_jtag_sim_clock(struct txvc_jtag_sim *sim, bool tms, bool tdi) {
+    bool tdo = false;
+    if (sim->_state == SHIFT_DR || sim->_state == SHIFT_IR) {
+        /* Every device shifts in what the previous one has shifted out */
+        bool in = tdi;
+        for (int i = sim->_numDevices - 1; i >= 0; i--) {
+            if (sim->_state == SHIFT_DR && sim->_selectedDr[i] == DR_CFG_IN) {
+                config_feed(&sim->_config[i], in);
+            }
+            const bool out = sim->_shiftReg[i] & 1u;
+            sim->_shiftReg[i] = (sim->_shiftReg[i] >> 1)
+                | ((uint64_t) in << (sim->_shiftBits[i] - 1));
+            in = out;
+        }
+        tdo = in;
+    } else if (sim->_state == RUN_TEST_IDLE) {
+        for (int i = 0; i < sim->_numDevices; i++) {
+            if (sim->_devices[i].hasConfigEngine && sim->_ir[i] == TXVC_JTAG_SIM_JSTART) {
+                config_idle_clock(&sim->_config[i]);
+            }
+        }
+    }
+    const enum sim_state next = gNextState[sim->_state][tms];
+    if ((int) next != sim->_state) {
+        enter_state(sim, next);
+    }
+    sim->_numClocks++;
+    return tdo;
+}
+
+void txvc_jtag_sim_shift(struct txvc_jtag_sim *sim, int numBits,
+        const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo) {
+    for (int i = 0; i < numBits; i++) {
+        set_bit(tdo, i, txvc_jtag_sim_clock(sim, get_bit(tms, i), get_bit(tdi, i)));
+    }
+}
+
+uint32_t txvc_jtag_sim_device_ir(const struct txvc_jtag_sim *sim, int position) {
+    return sim->_ir[position];
+}
+
+uint64_t txvc_jtag_sim_user_dr(const struct txvc_jtag_sim *sim, int position, int drIdx) {
+    return sim->_userDrs[position][drIdx];
+}
+
+bool txvc_jtag_sim_device_done(const struct txvc_jtag_sim *sim, int position) {
+    return sim->_config[position].isDone;
+}
+
+unsigned long long txvc_jtag_sim_config_bits(const struct txvc_jtag_sim *sim, int position) {
+    return sim->_config[position].numDataBits;
+}
+
+bool txvc_jtag_sim_in_reset(const struct txvc_jtag_sim *sim) {
+    return sim->_state == TEST_LOGIC_RESET;
+}
+
+unsigned long long txvc_jtag_sim_num_clocks(const struct txvc_jtag_sim *sim) {
+    return sim->_numClocks;
+}
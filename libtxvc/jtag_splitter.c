@@ -29,6 +29,8 @@
 #include "txvc/log.h"
 #include "txvc/bit_vector.h"
 
+#include <string.h>
+
 TXVC_DEFAULT_LOG_TAG(jtagSplit);
 
 #define JTAG_STATES(X) \
@@ -65,28 +67,137 @@ static const char* jtag_state_name(enum jtag_state state) {
     }
 }
 
+/*
+ * TAP state transitions, TAP_NEXT_<state>_<tms>.
+ * These are spelled out as separate macros so that the preprocessor can "walk" TAP graph
+ * when it generates octet lookup tables below.
+ */
+#define TAP_NEXT_TEST_LOGIC_RESET_0 RUN_TEST_IDLE
+#define TAP_NEXT_TEST_LOGIC_RESET_1 TEST_LOGIC_RESET
+#define TAP_NEXT_RUN_TEST_IDLE_0 RUN_TEST_IDLE
+#define TAP_NEXT_RUN_TEST_IDLE_1 SELECT_DR_SCAN
+#define TAP_NEXT_SELECT_DR_SCAN_0 CAPTURE_DR
+#define TAP_NEXT_SELECT_DR_SCAN_1 SELECT_IR_SCAN
+#define TAP_NEXT_CAPTURE_DR_0 SHIFT_DR
+#define TAP_NEXT_CAPTURE_DR_1 EXIT_1_DR
+#define TAP_NEXT_SHIFT_DR_0 SHIFT_DR
+#define TAP_NEXT_SHIFT_DR_1 EXIT_1_DR
+#define TAP_NEXT_EXIT_1_DR_0 PAUSE_DR
+#define TAP_NEXT_EXIT_1_DR_1 UPDATE_DR
+#define TAP_NEXT_PAUSE_DR_0 PAUSE_DR
+#define TAP_NEXT_PAUSE_DR_1 EXIT_2_DR
+#define TAP_NEXT_EXIT_2_DR_0 SHIFT_DR
+#define TAP_NEXT_EXIT_2_DR_1 UPDATE_DR
+#define TAP_NEXT_UPDATE_DR_0 RUN_TEST_IDLE
+#define TAP_NEXT_UPDATE_DR_1 SELECT_DR_SCAN
+#define TAP_NEXT_SELECT_IR_SCAN_0 CAPTURE_IR
+#define TAP_NEXT_SELECT_IR_SCAN_1 TEST_LOGIC_RESET
+#define TAP_NEXT_CAPTURE_IR_0 SHIFT_IR
+#define TAP_NEXT_CAPTURE_IR_1 EXIT_1_IR
+#define TAP_NEXT_SHIFT_IR_0 SHIFT_IR
+#define TAP_NEXT_SHIFT_IR_1 EXIT_1_IR
+#define TAP_NEXT_EXIT_1_IR_0 PAUSE_IR
+#define TAP_NEXT_EXIT_1_IR_1 UPDATE_IR
+#define TAP_NEXT_PAUSE_IR_0 PAUSE_IR
+#define TAP_NEXT_PAUSE_IR_1 EXIT_2_IR
+#define TAP_NEXT_EXIT_2_IR_0 SHIFT_IR
+#define TAP_NEXT_EXIT_2_IR_1 UPDATE_IR
+#define TAP_NEXT_UPDATE_IR_0 RUN_TEST_IDLE
+#define TAP_NEXT_UPDATE_IR_1 SELECT_DR_SCAN
+
+#define TAP_NEXT(state, tms) TAP_NEXT_(state, tms)
+#define TAP_NEXT_(state, tms) TAP_NEXT_ ## state ## _ ## tms
+
+#define IS_SHIFT_STATE(state) ((state) == SHIFT_DR || (state) == SHIFT_IR)
+
 static enum jtag_state next_state(enum jtag_state curState, bool tmsHigh) {
     switch (curState) {
-        case TEST_LOGIC_RESET: return tmsHigh ? TEST_LOGIC_RESET : RUN_TEST_IDLE;
-        case RUN_TEST_IDLE: return tmsHigh ? SELECT_DR_SCAN : RUN_TEST_IDLE;
-        case SELECT_DR_SCAN: return tmsHigh ? SELECT_IR_SCAN : CAPTURE_DR;
-        case CAPTURE_DR: return tmsHigh ? EXIT_1_DR : SHIFT_DR;
-        case SHIFT_DR: return tmsHigh ? EXIT_1_DR : SHIFT_DR;
-        case EXIT_1_DR: return tmsHigh ? UPDATE_DR : PAUSE_DR;
-        case PAUSE_DR: return tmsHigh ? EXIT_2_DR : PAUSE_DR;
-        case EXIT_2_DR: return tmsHigh ? UPDATE_DR : SHIFT_DR;
-        case UPDATE_DR: return tmsHigh ? SELECT_DR_SCAN : RUN_TEST_IDLE;
-        case SELECT_IR_SCAN: return tmsHigh ? TEST_LOGIC_RESET : CAPTURE_IR;
-        case CAPTURE_IR: return tmsHigh ? EXIT_1_IR : SHIFT_IR;
-        case SHIFT_IR: return tmsHigh ? EXIT_1_IR : SHIFT_IR;
-        case EXIT_1_IR: return tmsHigh ? UPDATE_IR : PAUSE_IR;
-        case PAUSE_IR: return tmsHigh ? EXIT_2_IR : PAUSE_IR;
-        case EXIT_2_IR: return tmsHigh ? UPDATE_IR : SHIFT_IR;
-        case UPDATE_IR: return tmsHigh ? SELECT_DR_SCAN : RUN_TEST_IDLE;
+#define AS_TRANSITION_CASE(name) case name: return tmsHigh ? TAP_NEXT(name, 1) : TAP_NEXT(name, 0);
+        JTAG_STATES(AS_TRANSITION_CASE)
+#undef AS_TRANSITION_CASE
     }
     TXVC_UNREACHABLE();
 }
 
+static inline bool is_shift_state(enum jtag_state state) {
+    return IS_SHIFT_STATE(state);
+}
+
+/*
+ * Octet lookup table.
+ * For every TAP state and every TMS octet it holds the state that TAP ends up in after all 8 TMS
+ * bits are applied, as well as a mask of bits that enter or leave a shift state (i.e. those that
+ * terminate a pending TMS or TDI shift).
+ * Table is generated by preprocessor: for every starting state it recursively follows both
+ * TMS values at each of 8 bit positions, accumulating octet value and event mask on the way.
+ */
+struct tap_octet_step {
+    uint8_t endState;
+    uint8_t events;
+};
+
+#define STEP_EVENT(state, tms, bitPos) \
+    ((IS_SHIFT_STATE(state) != IS_SHIFT_STATE(TAP_NEXT(state, tms))) << (bitPos))
+
+#define OCTET_STEP_BIT0(state) OCTET_STEP_BIT1(state, state, 0, 0)
+#define OCTET_STEP_BIT1(s, state, o, e) \
+    OCTET_STEP_BIT2(s, TAP_NEXT(state, 0), o, e | STEP_EVENT(state, 0, 0)) \
+    OCTET_STEP_BIT2(s, TAP_NEXT(state, 1), o | (1 << 0), e | STEP_EVENT(state, 1, 0))
+#define OCTET_STEP_BIT2(s, state, o, e) \
+    OCTET_STEP_BIT3(s, TAP_NEXT(state, 0), o, e | STEP_EVENT(state, 0, 1)) \
+    OCTET_STEP_BIT3(s, TAP_NEXT(state, 1), o | (1 << 1), e | STEP_EVENT(state, 1, 1))
+#define OCTET_STEP_BIT3(s, state, o, e) \
+    OCTET_STEP_BIT4(s, TAP_NEXT(state, 0), o, e | STEP_EVENT(state, 0, 2)) \
+    OCTET_STEP_BIT4(s, TAP_NEXT(state, 1), o | (1 << 2), e | STEP_EVENT(state, 1, 2))
+#define OCTET_STEP_BIT4(s, state, o, e) \
+    OCTET_STEP_BIT5(s, TAP_NEXT(state, 0), o, e | STEP_EVENT(state, 0, 3)) \
+    OCTET_STEP_BIT5(s, TAP_NEXT(state, 1), o | (1 << 3), e | STEP_EVENT(state, 1, 3))
+#define OCTET_STEP_BIT5(s, state, o, e) \
+    OCTET_STEP_BIT6(s, TAP_NEXT(state, 0), o, e | STEP_EVENT(state, 0, 4)) \
+    OCTET_STEP_BIT6(s, TAP_NEXT(state, 1), o | (1 << 4), e | STEP_EVENT(state, 1, 4))
+#define OCTET_STEP_BIT6(s, state, o, e) \
+    OCTET_STEP_BIT7(s, TAP_NEXT(state, 0), o, e | STEP_EVENT(state, 0, 5)) \
+    OCTET_STEP_BIT7(s, TAP_NEXT(state, 1), o | (1 << 5), e | STEP_EVENT(state, 1, 5))
+#define OCTET_STEP_BIT7(s, state, o, e) \
+    OCTET_STEP_BIT8(s, TAP_NEXT(state, 0), o, e | STEP_EVENT(state, 0, 6)) \
+    OCTET_STEP_BIT8(s, TAP_NEXT(state, 1), o | (1 << 6), e | STEP_EVENT(state, 1, 6))
+#define OCTET_STEP_BIT8(s, state, o, e) \
+    OCTET_STEP_DONE(s, TAP_NEXT(state, 0), o, e | STEP_EVENT(state, 0, 7)) \
+    OCTET_STEP_DONE(s, TAP_NEXT(state, 1), o | (1 << 7), e | STEP_EVENT(state, 1, 7))
+#define OCTET_STEP_DONE(s, state, o, e) [s][o] = { .endState = state, .events = e, },
+
+static const struct tap_octet_step gOctetSteps[16][256] = {
+#define AS_OCTET_STEPS(name) OCTET_STEP_BIT0(name)
+    JTAG_STATES(AS_OCTET_STEPS)
+#undef AS_OCTET_STEPS
+};
+
+#undef OCTET_STEP_DONE
+#undef OCTET_STEP_BIT8
+#undef OCTET_STEP_BIT7
+#undef OCTET_STEP_BIT6
+#undef OCTET_STEP_BIT5
+#undef OCTET_STEP_BIT4
+#undef OCTET_STEP_BIT3
+#undef OCTET_STEP_BIT2
+#undef OCTET_STEP_BIT1
+#undef OCTET_STEP_BIT0
+#undef STEP_EVENT
+
+static inline bool get_bit(const uint8_t* p, int idx) {
+    return !!(p[idx / 8] & (1 << (idx % 8)));
+}
+
+/* Loads 64 vector bits so that vector bit order is preserved in a resulting word. */
+static inline uint64_t load_le64(const uint8_t *p) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
 static bool tapReset(txvc_jtag_splitter_callback cb, void *cbExtra) {
     const uint8_t tmsTapResetVector = 0x1f;
     struct txvc_jtag_split_event e1;
@@ -122,6 +233,9 @@ bool txvc_jtag_splitter_init(struct txvc_jtag_splitter *splitter,
     splitter->_state = TEST_LOGIC_RESET;
     splitter->_cb = cb;
     splitter->_cbExtra = cbExtra;
+    splitter->_irNumDevices = 0;
+    splitter->_irTotalBits = 0;
+    splitter->_irValid = false;
     return true;
 }
 
@@ -136,7 +250,44 @@ bool txvc_jtag_splitter_deinit(struct txvc_jtag_splitter *splitter) {
     return true;
 }
 
-bool txvc_jtag_splitter_process(struct txvc_jtag_splitter *splitter,
+/*
+ * Notifies user about a completed sub-vector. "isShift" tells whether the sub-vector was shifted
+ * in one of shift states, "leavingShift" - whether its last bit moves TAP out of a shift state.
+ */
+static bool emit_shift(struct txvc_jtag_splitter *splitter,
+        const uint8_t* tms, const uint8_t* tdi, uint8_t* tdo,
+        int fromBitIdx, int toBitIdx, bool isShift, bool leavingShift) {
+    struct txvc_jtag_split_event e;
+    if (isShift) {
+        logSubVector(leavingShift ? "shift in" : "incomplete shift in",
+                tdi, fromBitIdx, toBitIdx);
+        e._kind = JTAG_SPLIT_shift_tdi;
+        e._info._shift_tdi.tdi = tdi;
+        e._info._shift_tdi.tdo = tdo;
+        e._info._shift_tdi.fromBitIdx = fromBitIdx;
+        e._info._shift_tdi.toBitIdx = toBitIdx;
+        e._info._shift_tdi.incomplete = !leavingShift;
+        if (!splitter->_cb(&e, splitter->_cbExtra)) {
+            return false;
+        }
+        logSubVector(leavingShift ? "shift out" : "incomplete shift out",
+                tdo, fromBitIdx, toBitIdx);
+    } else {
+        e._kind = JTAG_SPLIT_shift_tms;
+        e._info._shift_tms.tms = tms;
+        e._info._shift_tms.fromBitIdx = fromBitIdx;
+        e._info._shift_tms.toBitIdx = toBitIdx;
+        if (!splitter->_cb(&e, splitter->_cbExtra)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Reference decoder, walks TAP graph bit by bit.
+ */
+static bool decode_bitwise(struct txvc_jtag_splitter *splitter,
         int numBits, const uint8_t* tms, const uint8_t* tdi, uint8_t* tdo) {
     int firstPendingBitIdx = 0;
     enum jtag_state jtagState = splitter->_state;
@@ -146,8 +297,8 @@ bool txvc_jtag_splitter_process(struct txvc_jtag_splitter *splitter,
         for (; bitIdx < thisRoundEndBitIdx; tmsByte >>= 1, bitIdx++) {
             const bool tmsBit = tmsByte & 1;
             const enum jtag_state nextJtagState = next_state(jtagState, tmsBit);
-            const bool isShift = jtagState == SHIFT_DR || jtagState == SHIFT_IR;
-            const bool nextIsShift = nextJtagState == SHIFT_DR || nextJtagState == SHIFT_IR;
+            const bool isShift = is_shift_state(jtagState);
+            const bool nextIsShift = is_shift_state(nextJtagState);
             const bool enteringShift = !isShift && nextIsShift;
             if (enteringShift) ALWAYS_ASSERT(!tmsBit);
             const bool leavingShift = isShift && !nextIsShift;
@@ -156,30 +307,9 @@ bool txvc_jtag_splitter_process(struct txvc_jtag_splitter *splitter,
             const bool event = endOfVector || enteringShift || leavingShift;
             if (event) {
                 const int nextPendingBitIdx = bitIdx + 1;
-                if (isShift) {
-                    logSubVector(leavingShift ? "shift in" : "incomplete shift in",
-                            tdi, firstPendingBitIdx, nextPendingBitIdx);
-                    struct txvc_jtag_split_event e;
-                    e._kind = JTAG_SPLIT_shift_tdi;
-                    e._info._shift_tdi.tdi = tdi;
-                    e._info._shift_tdi.tdo = tdo;
-                    e._info._shift_tdi.fromBitIdx = firstPendingBitIdx;
-                    e._info._shift_tdi.toBitIdx = nextPendingBitIdx;
-                    e._info._shift_tdi.incomplete = !leavingShift;
-                    if (!splitter->_cb(&e, splitter->_cbExtra)) {
-                        goto bail_reset;
-                    }
-                    logSubVector(leavingShift ? "shift out" : "incomplete shift out",
-                            tdo, firstPendingBitIdx, nextPendingBitIdx);
-                } else {
-                    struct txvc_jtag_split_event e;
-                    e._kind = JTAG_SPLIT_shift_tms;
-                    e._info._shift_tms.tms = tms;
-                    e._info._shift_tms.fromBitIdx = firstPendingBitIdx;
-                    e._info._shift_tms.toBitIdx = nextPendingBitIdx;
-                    if (!splitter->_cb(&e, splitter->_cbExtra)) {
-                        goto bail_reset;
-                    }
+                if (!emit_shift(splitter, tms, tdi, tdo, firstPendingBitIdx, nextPendingBitIdx,
+                            isShift, leavingShift)) {
+                    return false;
                 }
                 firstPendingBitIdx = nextPendingBitIdx;
             }
@@ -189,17 +319,813 @@ bool txvc_jtag_splitter_process(struct txvc_jtag_splitter *splitter,
             jtagState = nextJtagState;
         }
     }
+    splitter->_state = jtagState;
+    return true;
+}
+
+/*
+ * Fast decoder.
+ * Consumes TMS vector octet by octet using precomputed table. While TAP is in a shift state
+ * runs of all-zero TMS (that keep TAP where it is) are skipped 64 bits at a time.
+ * Trailing bits that do not form a whole octet are walked one by one.
+ *
+ * Decoder is resumable: it stops when output array has no room for a whole octet worth of
+ * segments, so that caller can consume decoded segments and call it again.
+ */
+struct octetwise_decoder {
+    enum jtag_state state;
+    /* Every event toggles shift/non-shift, so kind of a pending sub-vector is tracked cheaply */
+    bool pendingIsShift;
+    int firstPendingBitIdx;
+    int octetIdx;
+    bool done;
+};
+
+static void octetwise_decoder_init(struct octetwise_decoder *dec, enum jtag_state state) {
+    dec->state = state;
+    dec->pendingIsShift = is_shift_state(state);
+    dec->firstPendingBitIdx = 0;
+    dec->octetIdx = 0;
+    dec->done = false;
+}
+
+static inline void add_segment(struct octetwise_decoder *dec,
+        struct txvc_jtag_split_segment *segment, int toBitIdx, bool leavingShift) {
+    segment->kind = dec->pendingIsShift ? JTAG_SPLIT_shift_tdi : JTAG_SPLIT_shift_tms;
+    segment->fromBitIdx = dec->firstPendingBitIdx;
+    segment->toBitIdx = toBitIdx;
+    segment->incomplete = dec->pendingIsShift && !leavingShift;
+    segment->irKnown = false;
+    segment->ir = 0;
+    dec->firstPendingBitIdx = toBitIdx;
+    dec->pendingIsShift = !dec->pendingIsShift;
+}
+
+static int decode_octetwise(struct octetwise_decoder *dec, int numBits, const uint8_t* tms,
+        struct txvc_jtag_split_segment *segments, int maxSegments) {
+    int numSegments = 0;
+    const int numWholeOctets = numBits / 8;
+    while (dec->octetIdx < numWholeOctets) {
+        if (is_shift_state(dec->state) && dec->octetIdx + 8 <= numWholeOctets) {
+            const uint64_t tmsWord = load_le64(tms + dec->octetIdx);
+            if (!tmsWord) {
+                dec->octetIdx += 8;
+                continue;
+            }
+            dec->octetIdx += __builtin_ctzll(tmsWord) / 8;
+        }
+        const struct tap_octet_step *step = &gOctetSteps[dec->state][tms[dec->octetIdx]];
+        if (numSegments + __builtin_popcount(step->events) > maxSegments) {
+            return numSegments;
+        }
+        for (unsigned events = step->events; events; events &= events - 1) {
+            add_segment(dec, &segments[numSegments++],
+                    dec->octetIdx * 8 + __builtin_ctz(events) + 1, true);
+        }
+        dec->state = step->endState;
+        dec->octetIdx++;
+    }
+
+    /* Up to 7 trailing bits plus incomplete last segment */
+    struct txvc_jtag_split_segment tail[8];
+    int numTailSegments = 0;
+    struct octetwise_decoder tailDec = *dec;
+    for (int bitIdx = numWholeOctets * 8; bitIdx < numBits; bitIdx++) {
+        const enum jtag_state nextJtagState = next_state(tailDec.state, get_bit(tms, bitIdx));
+        if (is_shift_state(tailDec.state) != is_shift_state(nextJtagState)) {
+            add_segment(&tailDec, &tail[numTailSegments++], bitIdx + 1, true);
+        }
+        tailDec.state = nextJtagState;
+    }
+    if (tailDec.firstPendingBitIdx < numBits) {
+        add_segment(&tailDec, &tail[numTailSegments++], numBits, false);
+    }
+    if (numSegments + numTailSegments > maxSegments) {
+        return numSegments;
+    }
+    memcpy(&segments[numSegments], tail, numTailSegments * sizeof(tail[0]));
+    *dec = tailDec;
+    dec->done = true;
+    return numSegments + numTailSegments;
+}
+
+static bool emit_octetwise(struct txvc_jtag_splitter *splitter,
+        int numBits, const uint8_t* tms, const uint8_t* tdi, uint8_t* tdo) {
+    struct txvc_jtag_split_segment segments[64];
+    struct octetwise_decoder dec;
+    octetwise_decoder_init(&dec, splitter->_state);
+    do {
+        const int numSegments = decode_octetwise(&dec, numBits, tms,
+                segments, sizeof(segments) / sizeof(segments[0]));
+        for (int i = 0; i < numSegments; i++) {
+            const struct txvc_jtag_split_segment *s = &segments[i];
+            if (!emit_shift(splitter, tms, tdi, tdo, s->fromBitIdx, s->toBitIdx,
+                        s->kind == JTAG_SPLIT_shift_tdi, !s->incomplete)) {
+                return false;
+            }
+        }
+    } while (!dec.done);
+    splitter->_state = dec.state;
+    return true;
+}
+
+typedef bool (*decoder_fn)(struct txvc_jtag_splitter *splitter,
+        int numBits, const uint8_t* tms, const uint8_t* tdi, uint8_t* tdo);
+
+static bool process_with(decoder_fn decoder, struct txvc_jtag_splitter *splitter,
+        int numBits, const uint8_t* tms, const uint8_t* tdi, uint8_t* tdo) {
+    if (!decoder(splitter, numBits, tms, tdi, tdo)) {
+        goto bail_reset;
+    }
     struct txvc_jtag_split_event e;
     e._kind = JTAG_SPLIT_flush_all;
     if (!splitter->_cb(&e, splitter->_cbExtra)) {
         goto bail_reset;
     }
-    splitter->_state = jtagState;
     return true;
 
 bail_reset:
+    txvc_jtag_splitter_reset(splitter);
+    return false;
+}
+
+bool txvc_jtag_splitter_process(struct txvc_jtag_splitter *splitter,
+        int numBits, const uint8_t* tms, const uint8_t* tdi, uint8_t* tdo) {
+    /* Only bitwise decoder can trace every TAP state change */
+    return process_with(VERBOSE_ENABLED ? decode_bitwise : emit_octetwise,
+            splitter, numBits, tms, tdi, tdo);
+}
+
+bool txvc_jtag_splitter_process_bitwise(struct txvc_jtag_splitter *splitter,
+        int numBits, const uint8_t* tms, const uint8_t* tdi, uint8_t* tdo) {
+    return process_with(decode_bitwise, splitter, numBits, tms, tdi, tdo);
+}
+
+/*
+ * Instruction tracking.
+ * Goes over already decoded segments, TMS ones are walked bit by bit since they are
+ * usually short and every TAP state matters here.
+ */
+static void track_ir(struct txvc_jtag_splitter *splitter, enum jtag_state state,
+        const uint8_t* tms, const uint8_t* tdi,
+        struct txvc_jtag_split_segment *segments, int numSegments) {
+    const int irTotalBits = splitter->_irTotalBits;
+    for (int i = 0; i < numSegments; i++) {
+        struct txvc_jtag_split_segment *s = &segments[i];
+        if (s->kind == JTAG_SPLIT_shift_tdi) {
+            if (state == SHIFT_IR) {
+                /* Only the last bits remain in instruction registers */
+                const int numBits = s->toBitIdx - s->fromBitIdx;
+                for (int bitIdx = numBits > irTotalBits ? s->toBitIdx - irTotalBits : s->fromBitIdx;
+                        bitIdx < s->toBitIdx; bitIdx++) {
+                    splitter->_irShift = (splitter->_irShift >> 1)
+                        | ((uint64_t) get_bit(tdi, bitIdx) << (irTotalBits - 1));
+                }
+                if (splitter->_irNumShifted < irTotalBits) {
+                    splitter->_irNumShifted += numBits;
+                }
+            } else {
+                ALWAYS_ASSERT(state == SHIFT_DR);
+                s->irKnown = splitter->_irValid;
+                s->ir = splitter->_ir;
+            }
+            if (!s->incomplete) {
+                state = next_state(state, true);
+            }
+            continue;
+        }
+        for (int bitIdx = s->fromBitIdx; bitIdx < s->toBitIdx; bitIdx++) {
+            state = next_state(state, get_bit(tms, bitIdx));
+            switch (state) {
+                case TEST_LOGIC_RESET:
+                    splitter->_irValid = false;
+                    break;
+                case CAPTURE_IR:
+                    splitter->_irNumShifted = 0;
+                    break;
+                case UPDATE_IR:
+                    splitter->_irValid = splitter->_irNumShifted >= irTotalBits;
+                    splitter->_ir = splitter->_irShift;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+int txvc_jtag_splitter_decode(struct txvc_jtag_splitter *splitter,
+        int numBits, const uint8_t* tms, const uint8_t* tdi,
+        struct txvc_jtag_split_segment *segments, int maxSegments) {
+    struct octetwise_decoder dec;
+    octetwise_decoder_init(&dec, splitter->_state);
+    const int numSegments = decode_octetwise(&dec, numBits, tms, segments, maxSegments);
+    if (!dec.done) {
+        ERROR("Not enough room for decoded segments: %d\n", maxSegments);
+        return -1;
+    }
+    if (splitter->_irTotalBits) {
+        track_ir(splitter, splitter->_state, tms, tdi, segments, numSegments);
+    }
+    splitter->_state = dec.state;
+    return numSegments;
+}
+
+/*
+ * Operation decoding.
+ * Scans are decoded segments as they are, TMS segments are walked bit by bit to cut long runs
+ * of idle clocks out of them.
+ */
+static bool add_op(struct txvc_jtag_op *ops, int *numOps, int maxOps,
+        const struct txvc_jtag_op *op) {
+    if (op->fromBitIdx == op->toBitIdx) {
+        return true;
+    }
+    if (*numOps == maxOps) {
+        return false;
+    }
+    ops[(*numOps)++] = *op;
+    return true;
+}
+
+static bool add_tms_ops(enum jtag_state *state, const uint8_t *tms, int fromBitIdx, int toBitIdx,
+        struct txvc_jtag_op *ops, int *numOps, int maxOps) {
+    int pathFromBitIdx = fromBitIdx;
+    int bitIdx = fromBitIdx;
+    while (bitIdx < toBitIdx) {
+        if (*state != RUN_TEST_IDLE || get_bit(tms, bitIdx)) {
+            *state = next_state(*state, get_bit(tms, bitIdx));
+            bitIdx++;
+            continue;
+        }
+        int idleToBitIdx = bitIdx + 1;
+        while (idleToBitIdx < toBitIdx && !get_bit(tms, idleToBitIdx)) {
+            idleToBitIdx++;
+        }
+        if (idleToBitIdx - bitIdx >= TXVC_JTAG_MIN_IDLE_CLOCKS) {
+            if (!add_op(ops, numOps, maxOps, &(struct txvc_jtag_op) {
+                        .kind = TXVC_JTAG_OP_TMS_PATH,
+                        .fromBitIdx = pathFromBitIdx,
+                        .toBitIdx = bitIdx,
+                    })
+                    || !add_op(ops, numOps, maxOps, &(struct txvc_jtag_op) {
+                        .kind = TXVC_JTAG_OP_IDLE_CLOCKS,
+                        .fromBitIdx = bitIdx,
+                        .toBitIdx = idleToBitIdx,
+                    })) {
+                return false;
+            }
+            pathFromBitIdx = idleToBitIdx;
+        }
+        bitIdx = idleToBitIdx;
+    }
+    return add_op(ops, numOps, maxOps, &(struct txvc_jtag_op) {
+                .kind = TXVC_JTAG_OP_TMS_PATH,
+                .fromBitIdx = pathFromBitIdx,
+                .toBitIdx = toBitIdx,
+            });
+}
+
+int txvc_jtag_splitter_decode_ops(struct txvc_jtag_splitter *splitter,
+        int numBits, const uint8_t* tms, struct txvc_jtag_op *ops, int maxOps) {
+    enum jtag_state state = splitter->_state;
+    int numOps = 0;
+    struct txvc_jtag_split_segment segments[64];
+    struct octetwise_decoder dec;
+    octetwise_decoder_init(&dec, state);
+    do {
+        const int numSegments = decode_octetwise(&dec, numBits, tms,
+                segments, sizeof(segments) / sizeof(segments[0]));
+        for (int i = 0; i < numSegments; i++) {
+            const struct txvc_jtag_split_segment *s = &segments[i];
+            if (s->kind == JTAG_SPLIT_shift_tms) {
+                if (!add_tms_ops(&state, tms, s->fromBitIdx, s->toBitIdx, ops, &numOps, maxOps)) {
+                    goto bail_no_room;
+                }
+                continue;
+            }
+            ALWAYS_ASSERT(state == SHIFT_IR || state == SHIFT_DR);
+            if (!add_op(ops, &numOps, maxOps, &(struct txvc_jtag_op) {
+                        .kind = state == SHIFT_IR ? TXVC_JTAG_OP_SCAN_IR : TXVC_JTAG_OP_SCAN_DR,
+                        .fromBitIdx = s->fromBitIdx,
+                        .toBitIdx = s->toBitIdx,
+                        .exitShift = !s->incomplete,
+                    })) {
+                goto bail_no_room;
+            }
+            if (!s->incomplete) {
+                state = next_state(state, true);
+            }
+        }
+    } while (!dec.done);
+    ALWAYS_ASSERT(state == dec.state);
+    splitter->_state = dec.state;
+    return numOps;
+
+bail_no_room:
+    ERROR("Not enough room for decoded operations: %d\n", maxOps);
+    return -1;
+}
+
+static bool check_ir_lengths(int numDevices, const int *irLengths, int *irTotalBits) {
+    if (numDevices < 1 || numDevices > TXVC_JTAG_SPLIT_MAX_DEVICES) {
+        ERROR("Can not track instructions of %d devices\n", numDevices);
+        return false;
+    }
+    *irTotalBits = 0;
+    for (int i = 0; i < numDevices; i++) {
+        if (irLengths[i] < 1 || irLengths[i] > 32) {
+            ERROR("Bad IR length: %d\n", irLengths[i]);
+            return false;
+        }
+        *irTotalBits += irLengths[i];
+    }
+    if (*irTotalBits > TXVC_JTAG_SPLIT_MAX_IR_BITS) {
+        ERROR("Too long chain IR: %d bits\n", *irTotalBits);
+        return false;
+    }
+    return true;
+}
+
+bool txvc_jtag_splitter_track_ir(struct txvc_jtag_splitter *splitter,
+        int numDevices, const int *irLengths) {
+    int irTotalBits;
+    if (!check_ir_lengths(numDevices, irLengths, &irTotalBits)) {
+        return false;
+    }
+    memcpy(splitter->_irLengths, irLengths, numDevices * sizeof(irLengths[0]));
+    splitter->_irNumDevices = numDevices;
+    splitter->_irTotalBits = irTotalBits;
+    splitter->_irShift = 0;
+    splitter->_irNumShifted = 0;
+    splitter->_irValid = false;
+    return true;
+}
+
+unsigned txvc_jtag_splitter_device_ir(const struct txvc_jtag_splitter *splitter,
+        const struct txvc_jtag_split_segment *segment, int position) {
+    ALWAYS_ASSERT(position >= 0 && position < splitter->_irNumDevices);
+    int offset = 0;
+    for (int i = 0; i < position; i++) {
+        offset += splitter->_irLengths[i];
+    }
+    const int len = splitter->_irLengths[position];
+    return (segment->ir >> offset) & ((UINT64_C(1) << len) - 1u);
+}
+
+bool txvc_jtag_splitter_same_state(const struct txvc_jtag_splitter *a,
+        const struct txvc_jtag_splitter *b) {
+    if (a->_state != b->_state || a->_irTotalBits != b->_irTotalBits) {
+        return false;
+    }
+    if (!a->_irTotalBits) {
+        return true;
+    }
+    return a->_irNumDevices == b->_irNumDevices
+        && memcmp(a->_irLengths, b->_irLengths, a->_irNumDevices * sizeof(a->_irLengths[0])) == 0
+        && a->_irShift == b->_irShift
+        && a->_irNumShifted == b->_irNumShifted
+        && a->_irValid == b->_irValid
+        && (!a->_irValid || a->_ir == b->_ir);
+}
+
+bool txvc_jtag_splitter_reset(struct txvc_jtag_splitter *splitter) {
     WARN("Resetting TAP\n");
-    tapReset(splitter->_cb, splitter->_cbExtra);
     splitter->_state = TEST_LOGIC_RESET;
-    return false;
+    splitter->_irValid = false;
+    return tapReset(splitter->_cb, splitter->_cbExtra);
+}
+
+void txvc_jtag_tap_init(struct txvc_jtag_tap *tap) {
+    tap->_state = TEST_LOGIC_RESET;
+}
+
+void txvc_jtag_tap_follow(struct txvc_jtag_tap *tap, int numBits, const uint8_t *tms) {
+    enum jtag_state state = tap->_state;
+    const int numWholeOctets = numBits / 8;
+    for (int i = 0; i < numWholeOctets; i++) {
+        state = gOctetSteps[state][tms[i]].endState;
+    }
+    for (int bitIdx = numWholeOctets * 8; bitIdx < numBits; bitIdx++) {
+        state = next_state(state, get_bit(tms, bitIdx));
+    }
+    tap->_state = state;
+}
+
+bool txvc_jtag_tap_is_stable(const struct txvc_jtag_tap *tap) {
+    return tap->_state == TEST_LOGIC_RESET || tap->_state == RUN_TEST_IDLE;
+}
+
+bool txvc_jtag_tap_same_state(const struct txvc_jtag_tap *a, const struct txvc_jtag_tap *b) {
+    return a->_state == b->_state;
+}
+
+int txvc_jtag_tap_move(const struct txvc_jtag_tap *from, const struct txvc_jtag_tap *to,
+        uint8_t *tms) {
+    if (!txvc_jtag_tap_is_stable(from) || !txvc_jtag_tap_is_stable(to)) {
+        return -1;
+    }
+    if (from->_state == to->_state) {
+        return 0;
+    }
+    if (to->_state == RUN_TEST_IDLE) {
+        /* TEST_LOGIC_RESET -> RUN_TEST_IDLE */
+        tms[0] = 0x00;
+        return 1;
+    }
+    /* RUN_TEST_IDLE -> SELECT_DR_SCAN -> SELECT_IR_SCAN -> TEST_LOGIC_RESET */
+    tms[0] = 0x07;
+    return 3;
+}
+
+/*
+ * Virtual devices.
+ * Pads are found the same way as instructions are tracked: decoded TMS segments are walked
+ * bit by bit, while long TDI segments are only looked at their ends.
+ */
+static inline void set_bit(uint8_t* p, int idx, bool value) {
+    if (value) {
+        p[idx / 8] |= (uint8_t) (1 << (idx % 8));
+    } else {
+        p[idx / 8] &= (uint8_t) ~(1 << (idx % 8));
+    }
+}
+
+/* Appends `numBits` bits with the same TMS and TDI to vectors, returns index of the next bit */
+static int append_bits(uint8_t *tms, uint8_t *tdi, int bitIdx, int numBits, bool tmsHigh,
+        bool tdiHigh) {
+    for (int i = 0; i < numBits; i++) {
+        set_bit(tms, bitIdx + i, tmsHigh);
+        set_bit(tdi, bitIdx + i, tdiHigh);
+    }
+    return bitIdx + numBits;
+}
+
+static void chain_reset(struct txvc_jtag_chain *chain) {
+    chain->_inReset = true;
+    chain->_selected = -1;
+}
+
+bool txvc_jtag_chain_init(struct txvc_jtag_chain *chain, int numDevices, const int *irLengths) {
+    int irTotalBits;
+    if (!check_ir_lengths(numDevices, irLengths, &irTotalBits)) {
+        return false;
+    }
+    chain->_state = TEST_LOGIC_RESET;
+    chain->_numDevices = numDevices;
+    memcpy(chain->_irLengths, irLengths, numDevices * sizeof(irLengths[0]));
+    for (int i = 0; i < numDevices; i++) {
+        chain->_resetDrBits[i] = 1;
+    }
+    chain_reset(chain);
+    chain->_ir = 0;
+    return true;
+}
+
+/* Identification pushes IDCODEs of all devices out of the chain, followed by a few TDI bits */
+#define IDENTIFY_FIRST_SHIFT_BIT 9
+#define IDCODE_BITS 32
+
+static int identify_shift_bits(const struct txvc_jtag_chain *chain) {
+    return IDCODE_BITS * chain->_numDevices + 8;
+}
+
+int txvc_jtag_chain_identify_vector(const struct txvc_jtag_chain *chain,
+        uint8_t *tms, uint8_t *tdi) {
+    int bitIdx = 0;
+    /* TEST_LOGIC_RESET, RUN_TEST_IDLE, SELECT_DR_SCAN, CAPTURE_DR, SHIFT_DR */
+    bitIdx = append_bits(tms, tdi, bitIdx, 5, true, true);
+    bitIdx = append_bits(tms, tdi, bitIdx, 1, false, true);
+    bitIdx = append_bits(tms, tdi, bitIdx, 1, true, true);
+    bitIdx = append_bits(tms, tdi, bitIdx, 2, false, true);
+    ALWAYS_ASSERT(bitIdx == IDENTIFY_FIRST_SHIFT_BIT);
+    bitIdx = append_bits(tms, tdi, bitIdx, identify_shift_bits(chain), false, true);
+    /* EXIT_1_DR, UPDATE_DR, SELECT_DR_SCAN, SELECT_IR_SCAN, TEST_LOGIC_RESET */
+    set_bit(tms, bitIdx - 1, true);
+    return append_bits(tms, tdi, bitIdx, 4, true, true);
+}
+
+bool txvc_jtag_chain_identify(struct txvc_jtag_chain *chain, const uint8_t *tdo) {
+    chain->_state = TEST_LOGIC_RESET;
+    chain_reset(chain);
+    int bitIdx = IDENTIFY_FIRST_SHIFT_BIT;
+    for (int i = 0; i < chain->_numDevices; i++) {
+        /* IDCODE always has its LSB set, while BYPASS captures 0 */
+        chain->_resetDrBits[i] = get_bit(tdo, bitIdx) ? IDCODE_BITS : 1;
+        bitIdx += chain->_resetDrBits[i];
+    }
+    /* TDI ones follow, unless there are more devices than expected */
+    if (!get_bit(tdo, bitIdx)) {
+        ERROR("Chain has more than %d devices\n", chain->_numDevices);
+        return false;
+    }
+    for (int i = 0; i < chain->_numDevices; i++) {
+        INFO("Device %d: %d bits of IR, %d bits of DR after reset\n",
+                i, chain->_irLengths[i], chain->_resetDrBits[i]);
+    }
+    return true;
+}
+
+void txvc_jtag_view_init(struct txvc_jtag_view *view, int position) {
+    view->_position = position;
+    view->_state = TEST_LOGIC_RESET;
+    view->_irReset = true;
+    view->_ir = 0;
+    view->_irShift = 0;
+    view->_irNumShifted = 0;
+    view->_scanBits = 0;
+    view->_scanRegisterBits = 0;
+    view->_scanHistory = 0;
+}
+
+static inline bool is_stable_state(enum jtag_state state) {
+    return state == TEST_LOGIC_RESET || state == RUN_TEST_IDLE;
+}
+
+int txvc_jtag_view_restore(const struct txvc_jtag_view *view, struct txvc_jtag_chain *chain,
+        uint8_t *tms, uint8_t *tdi) {
+    if (!is_stable_state(view->_state)) {
+        return -1;
+    }
+    int bitIdx = 0;
+    if (!is_stable_state(chain->_state)) {
+        /* Previous user has gone in the middle of a scan */
+        bitIdx = append_bits(tms, tdi, bitIdx, 5, true, false);
+        chain->_state = TEST_LOGIC_RESET;
+        chain_reset(chain);
+    }
+    if (view->_irReset && !chain->_inReset) {
+        /* Reset instruction can only be loaded by resetting the whole chain */
+        if (chain->_state == RUN_TEST_IDLE) {
+            /* SELECT_DR_SCAN, SELECT_IR_SCAN, TEST_LOGIC_RESET */
+            bitIdx = append_bits(tms, tdi, bitIdx, 3, true, false);
+        }
+        chain->_state = TEST_LOGIC_RESET;
+        chain_reset(chain);
+    } else if (!view->_irReset && (chain->_inReset || chain->_selected != view->_position
+                || chain->_ir != view->_ir)) {
+        if (chain->_state == TEST_LOGIC_RESET) {
+            bitIdx = append_bits(tms, tdi, bitIdx, 1, false, false);
+        }
+        /* SELECT_DR_SCAN, SELECT_IR_SCAN, CAPTURE_IR, SHIFT_IR */
+        bitIdx = append_bits(tms, tdi, bitIdx, 2, true, false);
+        bitIdx = append_bits(tms, tdi, bitIdx, 2, false, false);
+        for (int i = 0; i < chain->_numDevices; i++) {
+            for (int j = 0; j < chain->_irLengths[i]; j++) {
+                /* Other devices get BYPASS, i.e. all ones */
+                const bool tdiHigh = i != view->_position || ((view->_ir >> j) & 1u);
+                bitIdx = append_bits(tms, tdi, bitIdx, 1, false, tdiHigh);
+            }
+        }
+        /* EXIT_1_IR, UPDATE_IR, RUN_TEST_IDLE */
+        set_bit(tms, bitIdx - 1, true);
+        bitIdx = append_bits(tms, tdi, bitIdx, 1, true, false);
+        bitIdx = append_bits(tms, tdi, bitIdx, 1, false, false);
+        chain->_state = RUN_TEST_IDLE;
+        chain->_inReset = false;
+        chain->_selected = view->_position;
+        chain->_ir = view->_ir;
+    }
+    if (chain->_state != view->_state) {
+        if (view->_state == RUN_TEST_IDLE) {
+            bitIdx = append_bits(tms, tdi, bitIdx, 1, false, false);
+        } else {
+            bitIdx = append_bits(tms, tdi, bitIdx, 3, true, false);
+            chain_reset(chain);
+        }
+        chain->_state = view->_state;
+    }
+    return bitIdx;
+}
+
+/*
+ * Bits that devices before and after the one at `position` have in the register being shifted,
+ * with `inReset` telling whether chain was reset since the last instruction update.
+ */
+static void other_devices_bits(const struct txvc_jtag_chain *chain, bool inReset, int position,
+        enum jtag_state shiftState, int *numBitsBefore, int *numBitsAfter) {
+    *numBitsBefore = 0;
+    *numBitsAfter = 0;
+    for (int i = 0; i < chain->_numDevices; i++) {
+        if (i == position) {
+            continue;
+        }
+        int numBits;
+        if (shiftState == SHIFT_IR) {
+            numBits = chain->_irLengths[i];
+        } else {
+            numBits = inReset ? chain->_resetDrBits[i] : 1;
+        }
+        *(i < position ? numBitsBefore : numBitsAfter) += numBits;
+    }
+}
+
+/* Length of user's device register that is shifted in `shiftState`, 0 if it is not known */
+static int register_bits(const struct txvc_jtag_chain *chain, bool inReset,
+        const struct txvc_jtag_view *view, enum jtag_state shiftState) {
+    const int irLength = chain->_irLengths[view->_position];
+    if (shiftState == SHIFT_IR) {
+        return irLength;
+    }
+    if (inReset) {
+        return chain->_resetDrBits[view->_position];
+    }
+    const uint32_t bypass = (uint32_t) ((UINT64_C(1) << irLength) - 1u);
+    return !view->_irReset && view->_ir == bypass ? 1 : 0;
+}
+
+static bool add_pad(struct txvc_jtag_pad *pads, int *numPads, int maxPads,
+        const struct txvc_jtag_pad *pad) {
+    if (pad->numBits == 0) {
+        return true;
+    }
+    if (*numPads == maxPads) {
+        return false;
+    }
+    pads[(*numPads)++] = *pad;
+    return true;
+}
+
+int txvc_jtag_view_decode_pads(struct txvc_jtag_view *view, struct txvc_jtag_chain *chain,
+        int numBits, const uint8_t *tms, const uint8_t *tdi,
+        struct txvc_jtag_pad *pads, int maxPads) {
+    /* View and chain state are updated on copies, to be left intact if pads do not fit */
+    struct txvc_jtag_view v = *view;
+    bool inReset = chain->_inReset;
+    int selected = chain->_selected;
+    uint32_t chainIr = chain->_ir;
+    const int irLength = chain->_irLengths[v._position];
+    enum jtag_state state = v._state;
+    int numPads = 0;
+    int numBitsBefore;
+    int numBitsAfter;
+
+    struct txvc_jtag_split_segment segments[64];
+    struct octetwise_decoder dec;
+    octetwise_decoder_init(&dec, state);
+    do {
+        const int numSegments = decode_octetwise(&dec, numBits, tms,
+                segments, sizeof(segments) / sizeof(segments[0]));
+        for (int i = 0; i < numSegments; i++) {
+            const struct txvc_jtag_split_segment *s = &segments[i];
+            if (s->kind == JTAG_SPLIT_shift_tdi) {
+                const int segmentBits = s->toBitIdx - s->fromBitIdx;
+                const int m = v._scanRegisterBits;
+                if (m && v._scanBits + segmentBits > m) {
+                    /* Bits past the register would otherwise come through other devices */
+                    const int firstEchoBitIdx = v._scanBits >= m
+                        ? s->fromBitIdx : s->fromBitIdx + m - v._scanBits;
+                    uint64_t echoHistory = v._scanHistory;
+                    for (int bitIdx = s->fromBitIdx; bitIdx < firstEchoBitIdx; bitIdx++) {
+                        echoHistory = (echoHistory >> 1) | ((uint64_t) get_bit(tdi, bitIdx) << 63);
+                    }
+                    if (!add_pad(pads, &numPads, maxPads, &(struct txvc_jtag_pad) {
+                                .atBitIdx = firstEchoBitIdx,
+                                .numBits = s->toBitIdx - firstEchoBitIdx,
+                                .echoDelay = m,
+                                .echoHistory = echoHistory,
+                            })) {
+                        return -1;
+                    }
+                }
+                for (int bitIdx = segmentBits > 64 ? s->toBitIdx - 64 : s->fromBitIdx;
+                        bitIdx < s->toBitIdx; bitIdx++) {
+                    v._scanHistory = (v._scanHistory >> 1)
+                        | ((uint64_t) get_bit(tdi, bitIdx) << 63);
+                }
+                v._scanBits = v._scanBits + segmentBits > m ? m + 1 : v._scanBits + segmentBits;
+                if (state == SHIFT_IR) {
+                    /* Only the last bits remain in instruction register */
+                    for (int bitIdx = segmentBits > irLength
+                                ? s->toBitIdx - irLength : s->fromBitIdx;
+                            bitIdx < s->toBitIdx; bitIdx++) {
+                        v._irShift = (v._irShift >> 1)
+                            | ((uint32_t) get_bit(tdi, bitIdx) << (irLength - 1));
+                    }
+                    v._irNumShifted = v._irNumShifted + segmentBits > irLength
+                        ? irLength + 1 : v._irNumShifted + segmentBits;
+                }
+                if (!s->incomplete) {
+                    /* Push user bits through devices that are closer to TDI */
+                    other_devices_bits(chain, inReset, v._position, state,
+                            &numBitsBefore, &numBitsAfter);
+                    if (!add_pad(pads, &numPads, maxPads, &(struct txvc_jtag_pad) {
+                                .atBitIdx = s->toBitIdx,
+                                .numBits = numBitsAfter,
+                                .tdi = state == SHIFT_IR,
+                                .exits = true,
+                            })) {
+                        return -1;
+                    }
+                    state = next_state(state, true);
+                }
+                continue;
+            }
+            for (int bitIdx = s->fromBitIdx; bitIdx < s->toBitIdx; bitIdx++) {
+                const enum jtag_state prevState = state;
+                state = next_state(state, get_bit(tms, bitIdx));
+                switch (state) {
+                    case TEST_LOGIC_RESET:
+                        v._irReset = true;
+                        inReset = true;
+                        selected = -1;
+                        break;
+                    case CAPTURE_IR:
+                        v._irNumShifted = 0;
+                        break;
+                    case UPDATE_IR:
+                        v._irReset = false;
+                        v._ir = v._irShift;
+                        /* Other devices keep BYPASS only if the scan was as long as user's IR */
+                        inReset = false;
+                        selected = v._irNumShifted == irLength ? v._position : -1;
+                        chainIr = v._ir;
+                        break;
+                    case SHIFT_DR:
+                    case SHIFT_IR:
+                        if (prevState == CAPTURE_DR || prevState == CAPTURE_IR) {
+                            v._scanBits = 0;
+                            v._scanRegisterBits = register_bits(chain, inReset, &v, state);
+                            v._scanHistory = 0;
+                            /* Let captured bits of user's device reach TDO */
+                            other_devices_bits(chain, inReset, v._position, state,
+                                    &numBitsBefore, &numBitsAfter);
+                            if (!add_pad(pads, &numPads, maxPads, &(struct txvc_jtag_pad) {
+                                        .atBitIdx = bitIdx + 1,
+                                        .numBits = numBitsBefore,
+                                        .tdi = state == SHIFT_IR,
+                                    })) {
+                                return -1;
+                            }
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+    } while (!dec.done);
+    v._state = state;
+    *view = v;
+    chain->_state = state;
+    chain->_inReset = inReset;
+    chain->_selected = selected;
+    chain->_ir = chainIr;
+    return numPads;
+}
+
+void txvc_jtag_apply_pads(const struct txvc_jtag_pad *pads, int numPads,
+        int numBits, const uint8_t *tms, const uint8_t *tdi, uint8_t *outTms, uint8_t *outTdi) {
+    int fromBitIdx = 0;
+    int outBitIdx = 0;
+    for (int i = 0; i < numPads; i++) {
+        const struct txvc_jtag_pad *p = &pads[i];
+        if (p->echoDelay) {
+            continue;
+        }
+        txvc_bit_vector_copy(outTms, outBitIdx, tms, fromBitIdx, p->atBitIdx);
+        txvc_bit_vector_copy(outTdi, outBitIdx, tdi, fromBitIdx, p->atBitIdx);
+        outBitIdx += p->atBitIdx - fromBitIdx;
+        fromBitIdx = p->atBitIdx;
+        if (p->exits) {
+            set_bit(outTms, outBitIdx - 1, false);
+        }
+        outBitIdx = append_bits(outTms, outTdi, outBitIdx, p->numBits, false, p->tdi);
+        if (p->exits) {
+            set_bit(outTms, outBitIdx - 1, true);
+        }
+    }
+    txvc_bit_vector_copy(outTms, outBitIdx, tms, fromBitIdx, numBits);
+    txvc_bit_vector_copy(outTdi, outBitIdx, tdi, fromBitIdx, numBits);
+}
+
+void txvc_jtag_strip_pads(const struct txvc_jtag_pad *pads, int numPads,
+        int numBits, const uint8_t *tdi, const uint8_t *paddedTdo, uint8_t *tdo) {
+    int fromBitIdx = 0;
+    int paddedBitIdx = 0;
+    for (int i = 0; i < numPads; i++) {
+        const struct txvc_jtag_pad *p = &pads[i];
+        if (p->echoDelay) {
+            continue;
+        }
+        const int numUserBits = p->atBitIdx - fromBitIdx;
+        txvc_bit_vector_copy(tdo, fromBitIdx, paddedTdo, paddedBitIdx, paddedBitIdx + numUserBits);
+        paddedBitIdx += numUserBits + p->numBits;
+        fromBitIdx = p->atBitIdx;
+    }
+    txvc_bit_vector_copy(tdo, fromBitIdx,
+            paddedTdo, paddedBitIdx, paddedBitIdx + numBits - fromBitIdx);
+    for (int i = 0; i < numPads; i++) {
+        const struct txvc_jtag_pad *p = &pads[i];
+        if (!p->echoDelay) {
+            continue;
+        }
+        const int toBitIdx = p->atBitIdx + p->numBits;
+        const int numHistoryBits = p->numBits < p->echoDelay ? p->numBits : p->echoDelay;
+        for (int i = 0; i < numHistoryBits; i++) {
+            set_bit(tdo, p->atBitIdx + i, (p->echoHistory >> (64 - p->echoDelay + i)) & 1u);
+        }
+        txvc_bit_vector_copy(tdo, p->atBitIdx + numHistoryBits,
+                tdi, p->atBitIdx, toBitIdx - numHistoryBits);
+    }
 }
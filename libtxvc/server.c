@@ -27,18 +27,30 @@
 #include "txvc/server.h"
 
 #include "txvc/driver.h"
+#include "txvc/jtag_splitter.h"
 #include "txvc/log.h"
+#include "txvc/spsc_queue.h"
+#include "txvc/uring.h"
 
 #include <arpa/inet.h>
 #include <asm-generic/socket.h>
+#include <linux/errqueue.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/ip.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
 #include <stddef.h>
@@ -46,36 +58,277 @@
 
 TXVC_DEFAULT_LOG_TAG(server);
 
+struct server;
+
+/* Buffer of responses that kernel may still read for zero-copy sends */
+struct retired_buffer {
+    struct retired_buffer *next;
+    uint8_t *data;
+    /* Buffer is freed once this many zero-copy sends are completed */
+    size_t numZeroCopySent;
+};
+
 struct connection {
+    struct server *server;
     int socket;
+    struct sockaddr_in peerAddr;
+    int epollFd;
     const struct txvc_driver *driver;
+    void *driverCtx;
     volatile sig_atomic_t *shouldTerminate;
-    size_t vectorNumBytes;
-    uint8_t *tmsVector;
-    uint8_t *tdiVector;
-    uint8_t *tdoVector;
+    size_t maxVectorBits;
+    size_t zeroCopyMinBytes;
+    /* Only one client at a time may use the driver, see event loop below */
+    bool ownsCable;
+    /* Commands that need the cable are held until the client gets it */
+    bool isHeld;
+    uint64_t lastReceiveMs;
+    /*
+     * Cable sharing, see event loop below. Client's own view of TAP state and TCK period,
+     * and its share of TCK time.
+     */
+    unsigned priority;
+    struct txvc_jtag_tap tap;
+    bool tapKnown;
+    int tckPeriodNs;
+    uint64_t tckTimeNs;
+    uint64_t weightedTckTimeNs;
+    uint64_t sliceStartMs;
+    /* Virtual cable the client is connected to, see event loop below */
+    struct txvc_jtag_view view;
+    /* Bytes of the current command that are needed to proceed */
+    size_t numWanted;
+    /*
+     * Received data. Commands are decoded right from here, unconsumed bytes are between
+     * `rxBegin` and `rxEnd`.
+     */
+    uint8_t *rxBuffer;
+    size_t rxCapacity;
+    size_t rxBegin;
+    size_t rxEnd;
+    /*
+     * Responses. They are queued between `txBegin` and `txEnd` until there are no more
+     * commands to process, and then are sent at once. Bytes before `txBegin` may still be used
+     * by the kernel for zero-copy sends that are not completed yet. Buffers that were replaced
+     * meanwhile are retired until kernel is done with them.
+     */
+    uint8_t *txBuffer;
+    size_t txCapacity;
+    size_t txBegin;
+    size_t txEnd;
+    size_t numZeroCopySent;
+    size_t numZeroCopyDone;
+    struct retired_buffer *retiredBuffers;
+    /*
+     * Client does not take responses, the rest of them is sent once socket is writable.
+     * Commands are not read nor executed meanwhile, `lastSendMs` is when client has taken
+     * some of responses or has stopped taking them.
+     */
+    bool isSendBlocked;
+    uint64_t lastSendMs;
+    /*
+     * Ring of the io_uring engine, `uring` is NULL if regular socket calls are used.
+     * Buffers that are currently registered with the ring are remembered to detect
+     * when they are moved or grown.
+     */
+    struct txvc_uring ring;
+    struct txvc_uring *uring;
+    const uint8_t *uringRxBuffer;
+    size_t uringRxCapacity;
+    const uint8_t *uringTxBuffer;
+    size_t uringTxCapacity;
+    bool uringNeedReceive;
+    int uringNumPending;
+    size_t numCommands;
+    size_t numReads;
+    size_t numWrites;
+    size_t numSubmits;
+    /* Pipeline statistics, see below */
+    size_t numPipelined;
+    size_t pipelineDepthSum;
+    size_t pipelineMaxDepth;
+    uint64_t pipelineQueuedNs;
+    uint64_t pipelineDriverNs;
+    uint64_t pipelineResponseNs;
 };
 
-static void deallocate_vectors(struct connection *conn) {
-#define DEALLOC_VECTOR(name) if (conn->name) { free(conn->name); }
-    DEALLOC_VECTOR(tmsVector);
-    DEALLOC_VECTOR(tdiVector);
-    DEALLOC_VECTOR(tdoVector);
-#undef DEALLOC_VECTOR
-    conn->vectorNumBytes = 0;
-}
-
-static void allocate_vectors(struct connection *conn, size_t numBytes) {
-    deallocate_vectors(conn);
-#define ALLOC_VECTOR(name) conn->name = malloc(numBytes); if (!conn->name) { goto bail; }
-    ALLOC_VECTOR(tmsVector);
-    ALLOC_VECTOR(tdiVector);
-    ALLOC_VECTOR(tdoVector);
-#undef ALLOC_VECTOR
-    conn->vectorNumBytes = numBytes;
-    return;
-bail:
-    FATAL("Can not allocate %zu bytes\n", numBytes);
+/* Shift that is passed through the pipeline, see below */
+struct pipeline_slot {
+    struct txvc_shift shift;
+    uint8_t *vectors;
+    bool ok;
+    uint64_t queuedNs;
+    uint64_t startNs;
+    uint64_t doneNs;
+};
+
+struct pipeline {
+    /* Pipelining is disabled if depth is 0 */
+    size_t depth;
+    const struct txvc_driver *driver;
+    void *driverCtx;
+    size_t maxVectorBits;
+    /* Slots are taken in a ring, as shifts complete in order */
+    struct pipeline_slot *slots;
+    uint8_t *vectors;
+    size_t numSubmitted;
+    size_t numInFlight;
+    /* Slots go to the worker through `requests` and come back through `completions` */
+    struct txvc_spsc_queue requests;
+    struct txvc_spsc_queue completions;
+    /* Worker sleeps on `wakeFd` when it is idle, event loop polls `doneFd` */
+    int wakeFd;
+    int doneFd;
+    atomic_bool isWorkerIdle;
+    atomic_bool shouldStop;
+    /* Slots that are submitted to the driver, owned by the worker */
+    struct pipeline_slot **inDriver;
+    pthread_t worker;
+};
+
+#define MAX_CONNECTIONS 16
+
+struct server {
+    /* Listening sockets, one per virtual cable or a single one if the chain is not split */
+    int sockets[TXVC_JTAG_SPLIT_MAX_DEVICES];
+    size_t numSockets;
+    int epollFd;
+    const struct txvc_driver *driver;
+    void *driverCtx;
+    const struct txvc_server_options *options;
+    volatile sig_atomic_t *shouldTerminate;
+    size_t timeSliceMs;
+    /* Connections in order of their arrival */
+    struct connection *connections[MAX_CONNECTIONS];
+    size_t numConnections;
+    struct connection *owner;
+    /* Actual TAP state and TCK period, as left by the last owner */
+    struct txvc_jtag_tap tap;
+    int tckPeriodNs;
+    /*
+     * Virtual cables. Instructions that devices actually have, and buffers for padded vectors
+     * which are only used by the owner.
+     */
+    bool isVirtual;
+    struct txvc_jtag_chain chain;
+    struct txvc_jtag_pad *pads;
+    int maxPads;
+    uint8_t *paddedVectors;
+    size_t paddedCapacity;
+    struct pipeline pipeline;
+    /*
+     * Drivers with JTAG operations, see below. Splitter follows TAP of the cable,
+     * `ops` is NULL if the driver has no operations.
+     */
+    struct txvc_jtag_splitter splitter;
+    struct txvc_jtag_op *ops;
+    int maxOps;
+};
+
+/* Reads from a socket are at least this large, unless the whole command was received */
+#define RX_MIN_READ_BYTES 4096
+#define RX_INITIAL_CAPACITY (64 * 1024)
+/* Queued responses are sent once they grow this large, even if there are more commands */
+#define TX_MAX_QUEUED_BYTES (256 * 1024)
+#define TX_INITIAL_CAPACITY (64 * 1024)
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+/* Selects socket events that event loop is notified about, as the connection state requires */
+static bool set_interest(struct connection *conn) {
+    uint32_t events;
+    if (conn->isSendBlocked) {
+        /* Ring lets the event loop know once its send completes */
+        events = conn->uring && conn->uringNumPending ? 0 : EPOLLOUT | EPOLLRDHUP;
+    } else if (conn->isHeld) {
+        /* Stop reading, client will be blocked by TCP flow control */
+        events = EPOLLRDHUP;
+    } else {
+        /* Receives are done by the ring, if it is used */
+        events = conn->uring ? 0 : EPOLLIN | EPOLLRDHUP;
+    }
+    struct epoll_event ev = { .events = events, .data.ptr = conn, };
+    if (epoll_ctl(conn->epollFd, EPOLL_CTL_MOD, conn->socket, &ev)) {
+        ERROR("Can not update socket events: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static void deallocate_buffers(struct connection *conn) {
+#define DEALLOC_BUFFER(name) if (conn->name) { free(conn->name); conn->name = NULL; }
+    DEALLOC_BUFFER(rxBuffer);
+    DEALLOC_BUFFER(txBuffer);
+#undef DEALLOC_BUFFER
+    while (conn->retiredBuffers) {
+        struct retired_buffer *retired = conn->retiredBuffers;
+        conn->retiredBuffers = retired->next;
+        free(retired->data);
+        free(retired);
+    }
+    conn->rxCapacity = 0;
+    conn->rxBegin = 0;
+    conn->rxEnd = 0;
+    conn->txCapacity = 0;
+    conn->txBegin = 0;
+    conn->txEnd = 0;
+}
+
+/* Makes room for at least `numBytes` of unconsumed data */
+static void reserve_rx(struct connection *conn, size_t numBytes) {
+    if (conn->rxBegin > 0 && (conn->rxBegin + numBytes > conn->rxCapacity
+                || conn->rxCapacity - conn->rxEnd < RX_MIN_READ_BYTES)) {
+        memmove(conn->rxBuffer, conn->rxBuffer + conn->rxBegin, conn->rxEnd - conn->rxBegin);
+        conn->rxEnd -= conn->rxBegin;
+        conn->rxBegin = 0;
+    }
+    if (numBytes > conn->rxCapacity) {
+        size_t capacity = conn->rxCapacity ? conn->rxCapacity : RX_INITIAL_CAPACITY;
+        while (capacity < numBytes) {
+            capacity *= 2;
+        }
+        uint8_t *p = realloc(conn->rxBuffer, capacity);
+        if (!p) {
+            FATAL("Can not allocate %zu bytes\n", capacity);
+        }
+        conn->rxBuffer = p;
+        conn->rxCapacity = capacity;
+    }
+}
+
+/*
+ * Receives whatever is available, if anything. Sockets are left blocking, as io_uring fails reads
+ * from non-blocking ones right away rather than waiting for data. Regular calls don't wait.
+ */
+static bool receive_more(struct connection *conn, size_t numWanted) {
+    reserve_rx(conn, numWanted);
+    ssize_t res = recv(conn->socket, conn->rxBuffer + conn->rxEnd,
+            conn->rxCapacity - conn->rxEnd, MSG_DONTWAIT);
+    conn->numReads++;
+    if (res == 0) {
+        INFO("Connection was closed by peer\n");
+        return false;
+    }
+    if (res < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return true;
+        }
+        ERROR("Can not read from socket: %s\n", strerror(errno));
+        return false;
+    }
+    conn->rxEnd += (size_t) res;
+    conn->lastReceiveMs = now_ms();
+    return true;
 }
 
 static void log_vector(const char* name, const uint8_t* data, size_t numBits) {
@@ -97,152 +350,1616 @@ static void log_vector(const char* name, const uint8_t* data, size_t numBits) {
     }
 }
 
-static bool send_data(int s, const void* buf, size_t sz) {
-    ssize_t res = send(s, buf, sz, 0);
-    size_t sent = res > 0 ? (size_t) res : 0;
-    if (res < 0) {
-        ERROR("Can not send %zu bytes: %s\n", sz, strerror(errno));
-    } else if (sent < sz) {
-        ERROR("Can not send %zu bytes in full\n", sz);
+/* Picks up notifications of completed zero-copy sends, frees buffers that are not used anymore */
+static bool tx_reap_zero_copy(struct connection *conn) {
+    while (conn->numZeroCopyDone != conn->numZeroCopySent) {
+        char control[128];
+        struct msghdr msg = {
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+        /* Error queue is never waited for */
+        if (recvmsg(conn->socket, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR && !*conn->shouldTerminate) {
+                continue;
+            }
+            ERROR("Can not receive zero-copy completion: %s\n", strerror(errno));
+            return false;
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            const struct sock_extended_err *err = (const void *) CMSG_DATA(cm);
+            if (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR
+                    && err->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                /* Notification covers a range of send calls */
+                conn->numZeroCopyDone += err->ee_data - err->ee_info + 1;
+            }
+        }
+    }
+    for (struct retired_buffer **p = &conn->retiredBuffers; *p; ) {
+        struct retired_buffer *retired = *p;
+        if (conn->numZeroCopyDone >= retired->numZeroCopySent) {
+            *p = retired->next;
+            free(retired->data);
+            free(retired);
+        } else {
+            p = &retired->next;
+        }
     }
-    return sent == sz;
+    return true;
 }
 
-static bool recv_data(int s, void* buf, size_t sz) {
-    ssize_t res = recv(s, buf, sz, MSG_WAITALL);
-    size_t read = res > 0 ? (size_t) res : 0;
-    if (res < 0) {
-        ERROR("Can not receive %zu bytes: %s\n", sz, strerror(errno));
-    } else if (read < sz) {
-        ERROR("Can not receive %zu bytes in full\n", sz);
+/* Returns room for `numBytes` of response data, which is queued by tx_commit() */
+static uint8_t *tx_reserve(struct connection *conn, size_t numBytes) {
+    if (conn->txBegin == conn->txEnd || conn->txEnd + numBytes > conn->txCapacity) {
+        /* Buffer is about to be reused or moved */
+        if (!tx_reap_zero_copy(conn)) {
+            return NULL;
+        }
+        const size_t numQueued = conn->txEnd - conn->txBegin;
+        if (conn->numZeroCopyDone == conn->numZeroCopySent) {
+            memmove(conn->txBuffer, conn->txBuffer + conn->txBegin, numQueued);
+        } else if (conn->txEnd + numBytes > conn->txCapacity) {
+            /*
+             * Kernel still reads from the buffer. Rather than waiting for the client to take
+             * responses, queued ones are moved to a new buffer and this one is retired.
+             */
+            size_t capacity = conn->txCapacity;
+            while (capacity < numQueued + numBytes) {
+                capacity *= 2;
+            }
+            struct retired_buffer *retired = malloc(sizeof(*retired));
+            uint8_t *p = malloc(capacity);
+            if (!retired || !p) {
+                FATAL("Can not allocate %zu bytes\n", capacity);
+            }
+            memcpy(p, conn->txBuffer + conn->txBegin, numQueued);
+            *retired = (struct retired_buffer) {
+                .next = conn->retiredBuffers,
+                .data = conn->txBuffer,
+                .numZeroCopySent = conn->numZeroCopySent,
+            };
+            conn->retiredBuffers = retired;
+            conn->txBuffer = p;
+            conn->txCapacity = capacity;
+        } else {
+            /* Queued responses stay in place, new ones are appended */
+            return conn->txBuffer + conn->txEnd;
+        }
+        conn->txEnd = numQueued;
+        conn->txBegin = 0;
+    }
+    if (conn->txEnd + numBytes > conn->txCapacity) {
+        size_t capacity = conn->txCapacity ? conn->txCapacity : TX_INITIAL_CAPACITY;
+        while (capacity < conn->txEnd + numBytes) {
+            capacity *= 2;
+        }
+        uint8_t *p = realloc(conn->txBuffer, capacity);
+        if (!p) {
+            FATAL("Can not allocate %zu bytes\n", capacity);
+        }
+        conn->txBuffer = p;
+        conn->txCapacity = capacity;
     }
-    return read == sz;
+    return conn->txBuffer + conn->txEnd;
 }
 
-static int recv_xvc_int(int s) {
-    uint8_t payload[4];
-    if (recv_data(s, payload, 4)) {
-        return (payload[3] << 24) | (payload[2] << 16) | (payload[1] << 8) | (payload[0] << 0);
+static void tx_commit(struct connection *conn, size_t numBytes) {
+    conn->txEnd += numBytes;
+}
+
+static bool tx_queue(struct connection *conn, const void *data, size_t numBytes) {
+    uint8_t *p = tx_reserve(conn, numBytes);
+    if (!p) {
+        return false;
     }
-    return -1;
+    memcpy(p, data, numBytes);
+    tx_commit(conn, numBytes);
+    return true;
+}
+
+/*
+ * Sends queued responses. Those that client does not take now stay queued, and are sent by
+ * the event loop once socket is writable.
+ */
+static bool tx_flush(struct connection *conn) {
+    while (conn->txBegin < conn->txEnd) {
+        const size_t numBytes = conn->txEnd - conn->txBegin;
+        const bool zeroCopy = conn->zeroCopyMinBytes && numBytes >= conn->zeroCopyMinBytes;
+        ssize_t res = send(conn->socket, conn->txBuffer + conn->txBegin, numBytes,
+                MSG_DONTWAIT | (zeroCopy ? MSG_ZEROCOPY : 0));
+        conn->numWrites++;
+        if (res < 0) {
+            if (errno == EINTR && !*conn->shouldTerminate) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (conn->isSendBlocked) {
+                    return true;
+                }
+                /* Client has the idle timeout to take previous responses */
+                conn->isSendBlocked = true;
+                conn->lastSendMs = now_ms();
+                return set_interest(conn);
+            }
+            if (errno == ENOBUFS && zeroCopy) {
+                /* Out of memory to pin pages, this is not fatal */
+                WARN("Zero-copy send failed, falling back to regular sends\n");
+                conn->zeroCopyMinBytes = 0;
+                continue;
+            }
+            ERROR("Can not send %zu bytes: %s\n", numBytes, strerror(errno));
+            return false;
+        }
+        if (zeroCopy) {
+            conn->numZeroCopySent++;
+        }
+        if (conn->isSendBlocked) {
+            conn->lastSendMs = now_ms();
+        }
+        /* Short writes are possible, e.g. when interrupted by a signal */
+        conn->txBegin += (size_t) res;
+    }
+    if (conn->isSendBlocked) {
+        /* Client has taken all responses, its commands may be read again */
+        conn->isSendBlocked = false;
+        return set_interest(conn);
+    }
+    return true;
+}
+
+/*
+ * io_uring engine.
+ * Sending queued responses and receiving the next commands are submitted as linked operations
+ * by a single system call, completions are then picked up by the event loop which polls the ring.
+ * Both operations use buffers that are registered with the ring, so that kernel does not map them
+ * on every call.
+ */
+enum uring_slot {
+    URING_TX,
+    URING_RX,
+};
+
+static bool uring_update_buffers(struct connection *conn) {
+    if (conn->uringRxBuffer == conn->rxBuffer && conn->uringRxCapacity == conn->rxCapacity
+            && conn->uringTxBuffer == conn->txBuffer && conn->uringTxCapacity == conn->txCapacity) {
+        return true;
+    }
+    const struct iovec buffers[] = {
+        [URING_TX] = { .iov_base = conn->txBuffer, .iov_len = conn->txCapacity, },
+        [URING_RX] = { .iov_base = conn->rxBuffer, .iov_len = conn->rxCapacity, },
+    };
+    if (!txvc_uring_register_buffers(conn->uring, buffers, sizeof(buffers) / sizeof(buffers[0]))) {
+        return false;
+    }
+    conn->uringRxBuffer = conn->rxBuffer;
+    conn->uringRxCapacity = conn->rxCapacity;
+    conn->uringTxBuffer = conn->txBuffer;
+    conn->uringTxCapacity = conn->txCapacity;
+    return true;
+}
+
+static bool uring_stop(struct connection *conn) {
+    /* Closing the ring also removes it from the event loop */
+    txvc_uring_deinit(&conn->ring);
+    conn->uring = NULL;
+    return set_interest(conn);
+}
+
+/* Prepares to send all queued responses and, unless `numWanted` is 0, to receive more */
+static bool uring_begin(struct connection *conn, size_t numWanted) {
+    if (numWanted) {
+        reserve_rx(conn, numWanted);
+    }
+    if (!uring_update_buffers(conn)) {
+        /* E.g. locked memory limit is too low */
+        WARN("Falling back to regular socket calls\n");
+        return uring_stop(conn) && tx_flush(conn);
+    }
+    if (conn->zeroCopyMinBytes && !tx_flush(conn)) {
+        /* Zero-copy sends are not supported by the ring */
+        return false;
+    }
+    conn->uringNeedReceive = numWanted > 0;
+    return true;
+}
+
+static bool uring_is_done(const struct connection *conn) {
+    return conn->uringNumPending == 0 && conn->txBegin == conn->txEnd && !conn->uringNeedReceive;
+}
+
+/* Submits operations that are still needed, their completions are polled by the event loop */
+static bool uring_submit(struct connection *conn) {
+    if (conn->uringNumPending == 0) {
+        const bool needSend = conn->txBegin < conn->txEnd;
+        const bool needReceive = conn->uringNeedReceive;
+        /* Receive is started only once all responses are sent, as the client may wait for them */
+        if (needSend) {
+            txvc_uring_prep_rw_fixed(conn->uring, true, conn->socket,
+                    conn->txBuffer + conn->txBegin, (unsigned) (conn->txEnd - conn->txBegin),
+                    URING_TX, URING_TX, needReceive);
+        }
+        if (needReceive) {
+            txvc_uring_prep_rw_fixed(conn->uring, false, conn->socket,
+                    conn->rxBuffer + conn->rxEnd, (unsigned) (conn->rxCapacity - conn->rxEnd),
+                    URING_RX, URING_RX, false);
+        }
+        conn->uringNumPending = needSend + needReceive;
+    }
+    if (conn->uringNumPending == 0) {
+        return true;
+    }
+    while (!txvc_uring_submit_and_wait(conn->uring, 0)) {
+        if (errno == EINTR && !*conn->shouldTerminate) {
+            continue;
+        }
+        ERROR("Can not submit socket operations: %s\n", strerror(errno));
+        return false;
+    }
+    conn->numSubmits++;
+    return true;
+}
+
+/* Handles completed operations */
+static bool uring_reap(struct connection *conn) {
+    uint64_t slot;
+    int res;
+    while (txvc_uring_pop_completion(conn->uring, &slot, &res)) {
+        conn->uringNumPending--;
+        if (slot == URING_TX) {
+            conn->numWrites++;
+            if (res < 0 && res != -EINTR) {
+                ERROR("Can not send %zu bytes: %s\n",
+                        conn->txEnd - conn->txBegin, strerror(-res));
+                return false;
+            }
+            /* Short writes are possible, the linked receive is cancelled then */
+            conn->txBegin += res > 0 ? (size_t) res : 0;
+            if (conn->isSendBlocked && res > 0) {
+                conn->lastSendMs = now_ms();
+            }
+        } else {
+            conn->numReads++;
+            if (res == -ECANCELED || res == -EINTR) {
+                continue;
+            }
+            if (res == 0) {
+                INFO("Connection was closed by peer\n");
+                return false;
+            }
+            if (res < 0) {
+                ERROR("Can not read from socket: %s\n", strerror(-res));
+                return false;
+            }
+            conn->rxEnd += (size_t) res;
+            conn->lastReceiveMs = now_ms();
+            conn->uringNeedReceive = false;
+        }
+    }
+    return true;
 }
 
-static bool cmd_getinfo(struct connection *conn) {
-    int maxVectorBits = conn->driver->max_vector_bits();
-    if (maxVectorBits <= 0) {
-        ERROR("Bad max vector bits: %d\n", maxVectorBits);
+/* Same as tx_flush(), the send that client does not take right away is completed by the ring */
+static bool uring_flush(struct connection *conn) {
+    if (!uring_begin(conn, 0)) {
         return false;
     }
-    VERBOSE("%s: responding with vector size %d\n", __func__, maxVectorBits);
+    while (conn->uring && !conn->isSendBlocked && conn->txBegin < conn->txEnd) {
+        if (!uring_submit(conn) || !uring_reap(conn)) {
+            return false;
+        }
+        if (conn->uringNumPending) {
+            conn->isSendBlocked = true;
+            conn->lastSendMs = now_ms();
+            return set_interest(conn);
+        }
+    }
+    return true;
+}
+
+static bool flush_responses(struct connection *conn) {
+    return conn->uring ? uring_flush(conn) : tx_flush(conn);
+}
+
+/* Lets the event loop know that connection waits for more commands */
+static bool wait_for_commands(struct connection *conn) {
+    /* Client may wait for responses before sending more */
+    if (conn->uring) {
+        return uring_begin(conn, conn->numWanted)
+            && (!conn->uring || conn->isSendBlocked || uring_submit(conn));
+    }
+    return tx_flush(conn);
+}
+
+static int xvc_int_from_bytes(const uint8_t *p) {
+    return (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | (p[0] << 0);
+}
+
+/*
+ * Command handlers.
+ * Handler is given command arguments that are received so far. If they are incomplete,
+ * it sets `*numArgBytes` to the number of bytes it needs at least to proceed, otherwise
+ * it executes the command and sets `*numArgBytes` to the number of consumed bytes.
+ */
+enum cmd_status {
+    CMD_FAILED,
+    CMD_INCOMPLETE,
+    CMD_DONE,
+};
+
+/* Vector size that is advertised to the client, 0 if driver has failed to report its own */
+static size_t advertised_vector_bits(struct connection *conn) {
+    int driverMaxVectorBits = conn->driver->max_vector_bits(conn->driverCtx);
+    if (driverMaxVectorBits <= 0) {
+        ERROR("Bad max vector bits: %d\n", driverMaxVectorBits);
+        return 0;
+    }
+    size_t maxVectorBits = (size_t) driverMaxVectorBits;
+    if (conn->maxVectorBits > maxVectorBits) {
+        /* Longer vectors are split by shift_and_stream_tdo(), see below */
+        maxVectorBits = conn->maxVectorBits;
+    }
+    return maxVectorBits;
+}
+
+static enum cmd_status cmd_getinfo(struct connection *conn,
+        const uint8_t *args, size_t numAvailable, size_t *numArgBytes) {
+    TXVC_UNUSED(args);
+    TXVC_UNUSED(numAvailable);
+    size_t maxVectorBits = advertised_vector_bits(conn);
+    if (maxVectorBits == 0) {
+        return CMD_FAILED;
+    }
+    VERBOSE("%s: responding with vector size %zu\n", __func__, maxVectorBits);
     char response[64];
-    int len = snprintf(response, sizeof(response), "xvcServer_v1.0:%d\n", maxVectorBits);
-    return send_data(conn->socket, response, (size_t) len);
+    int len = snprintf(response, sizeof(response), "xvcServer_v1.0:%zu\n", maxVectorBits);
+    *numArgBytes = 0;
+    return tx_queue(conn, response, (size_t) len) ? CMD_DONE : CMD_FAILED;
 }
 
-static bool cmd_settck(struct connection *conn) {
-    int suggestedTckPeriod = recv_xvc_int(conn->socket);
+static enum cmd_status cmd_settck(struct connection *conn,
+        const uint8_t *args, size_t numAvailable, size_t *numArgBytes) {
+    *numArgBytes = 4;
+    if (numAvailable < 4) {
+        return CMD_INCOMPLETE;
+    }
+    int suggestedTckPeriod = xvc_int_from_bytes(args);
     if (suggestedTckPeriod < 0) {
-        return false;
+        ERROR("%s: bad suggested period: %dns\n", __func__, suggestedTckPeriod);
+        return CMD_FAILED;
     }
-    int tckPeriod = conn->driver->set_tck_period(suggestedTckPeriod);
+    int tckPeriod = conn->driver->set_tck_period(conn->driverCtx, suggestedTckPeriod);
     if (tckPeriod <= 0) {
         ERROR("%s: bad period: %dns\n", __func__, tckPeriod);
-        return false;
+        return CMD_FAILED;
     }
     VERBOSE("%s: suggested TCK period: %dns, actual: %dns\n", __func__, suggestedTckPeriod, tckPeriod);
+    conn->tckPeriodNs = tckPeriod;
+    conn->server->tckPeriodNs = tckPeriod;
     uint8_t response[4] = {
         (uint8_t) (tckPeriod >> 0),
         (uint8_t) (tckPeriod >> 8),
         (uint8_t) (tckPeriod >> 16),
         (uint8_t) (tckPeriod >> 24)
     };
-    return send_data(conn->socket, response, 4);
+    return tx_queue(conn, response, 4) ? CMD_DONE : CMD_FAILED;
 }
 
-static bool cmd_shift(struct connection *conn) {
-    int numBits = recv_xvc_int(conn->socket);
-    if (numBits <= 0) {
-        ERROR("Bad vector size: %d\n", numBits);
+static size_t bytes_per_vector(size_t numBits) {
+    return numBits / 8 + !!(numBits % 8);
+}
+
+/* Keeps client's view of TAP and its share of TCK time up to date */
+static void account_shift(struct connection *conn, size_t numBits, const uint8_t *tmsVector) {
+    /* Cycles are counted until client sets TCK period */
+    const uint64_t tckTimeNs = numBits * (uint64_t) (conn->tckPeriodNs > 0 ? conn->tckPeriodNs : 1);
+    conn->tckTimeNs += tckTimeNs;
+    conn->weightedTckTimeNs += tckTimeNs / conn->priority;
+    if (conn->server->timeSliceMs) {
+        txvc_jtag_tap_follow(&conn->tap, (int) numBits, tmsVector);
+    }
+}
+
+/*
+ * JTAG operations.
+ * Vectors are decoded into operations right here for drivers that provide them, so every shift
+ * of such drivers goes through here, including the ones that server does on its own.
+ */
+static bool reset_with_ops(const struct txvc_jtag_split_event *event, void *extra) {
+    struct server *srv = extra;
+    /* TAP is already reset when splitter is initialized, as drivers do it on activation */
+    if (!srv->ops) {
+        return true;
+    }
+    const struct txvc_jtag_split_shift_tms *tms = txvc_jtag_split_cast_to_shift_tms(event);
+    if (tms) {
+        return srv->driver->tms_path(srv->driverCtx, tms->tms, tms->fromBitIdx, tms->toBitIdx);
+    }
+    return !txvc_jtag_split_cast_to_flush_all(event) || srv->driver->flush(srv->driverCtx);
+}
+
+static bool ops_start(struct server *srv) {
+    int driverMaxVectorBits = srv->driver->max_vector_bits(srv->driverCtx);
+    if (driverMaxVectorBits <= 0) {
+        ERROR("Bad max vector bits: %d\n", driverMaxVectorBits);
         return false;
     }
-    VERBOSE("%s: shifting %d bits\n", __func__, numBits);
-    size_t bytesPerVector = (size_t) numBits / 8 + !!((size_t) numBits % 8);
-    if (bytesPerVector > conn->vectorNumBytes) {
-        allocate_vectors(conn, bytesPerVector);
+    if (!txvc_jtag_splitter_init(&srv->splitter, reset_with_ops, srv)) {
+        return false;
+    }
+    /* Server's own vectors may be longer than the driver supports */
+    const int maxBits = driverMaxVectorBits > TXVC_JTAG_CHAIN_MAX_CONTROL_BITS
+        ? driverMaxVectorBits : TXVC_JTAG_CHAIN_MAX_CONTROL_BITS;
+    srv->maxOps = TXVC_JTAG_MAX_OPS(maxBits);
+    srv->ops = malloc((size_t) srv->maxOps * sizeof(srv->ops[0]));
+    if (!srv->ops) {
+        FATAL("Can not allocate %zu bytes\n", (size_t) srv->maxOps * sizeof(srv->ops[0]));
     }
-    if (!recv_data(conn->socket, conn->tmsVector, bytesPerVector)
-            || !recv_data(conn->socket, conn->tdiVector, bytesPerVector)) {
+    INFO("Shifting vectors as JTAG operations\n");
+    return true;
+}
+
+static bool shift_ops(struct server *srv, const struct txvc_shift *shift) {
+    const struct txvc_driver *d = srv->driver;
+    const int numOps = txvc_jtag_splitter_decode_ops(&srv->splitter,
+            shift->numBits, shift->tmsVector, srv->ops, srv->maxOps);
+    if (numOps < 0) {
         return false;
     }
-    log_vector("TMS", conn->tmsVector, numBits);
-    log_vector("TDI", conn->tdiVector, numBits);
-    if (!conn->driver->shift_bits(numBits,
-                conn->tmsVector, conn->tdiVector, conn->tdoVector)) {
+    /* Bits outside scans are not written by the driver */
+    memset(shift->tdoVector, 0, bytes_per_vector((size_t) shift->numBits));
+    for (int i = 0; i < numOps; i++) {
+        const struct txvc_jtag_op *op = &srv->ops[i];
+        bool ok = false;
+        switch (op->kind) {
+            case TXVC_JTAG_OP_TMS_PATH:
+                ok = d->tms_path(srv->driverCtx, shift->tmsVector, op->fromBitIdx, op->toBitIdx);
+                break;
+            case TXVC_JTAG_OP_IDLE_CLOCKS:
+                ok = d->idle_clocks(srv->driverCtx, op->toBitIdx - op->fromBitIdx);
+                break;
+            case TXVC_JTAG_OP_SCAN_IR:
+                ok = d->scan_ir(srv->driverCtx, shift->tdiVector, shift->tdoVector,
+                        op->fromBitIdx, op->toBitIdx, op->exitShift);
+                break;
+            case TXVC_JTAG_OP_SCAN_DR:
+                ok = d->scan_dr(srv->driverCtx, shift->tdiVector, shift->tdoVector,
+                        op->fromBitIdx, op->toBitIdx, op->exitShift);
+                break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Shifts vectors that are no longer than the driver supports, in order */
+static bool driver_shift(struct server *srv, int numShifts, const struct txvc_shift *shifts) {
+    const struct txvc_driver *d = srv->driver;
+    if (!srv->ops) {
+        if (numShifts > 1 && d->shift_bits_batch) {
+            return d->shift_bits_batch(srv->driverCtx, numShifts, shifts);
+        }
+        for (int i = 0; i < numShifts; i++) {
+            const struct txvc_shift *s = &shifts[i];
+            if (!d->shift_bits(srv->driverCtx,
+                        s->numBits, s->tmsVector, s->tdiVector, s->tdoVector)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    for (int i = 0; i < numShifts; i++) {
+        if (!shift_ops(srv, &shifts[i])) {
+            goto bail_reset;
+        }
+    }
+    if (!d->flush(srv->driverCtx)) {
+        goto bail_reset;
+    }
+    return true;
+
+bail_reset:
+    txvc_jtag_splitter_reset(&srv->splitter);
+    return false;
+}
+
+static bool driver_shift_one(struct server *srv, int numBits,
+        const uint8_t *tmsVector, const uint8_t *tdiVector, uint8_t *tdoVector) {
+    const struct txvc_shift shift = {
+        .numBits = numBits,
+        .tmsVector = tmsVector,
+        .tdiVector = tdiVector,
+        .tdoVector = tdoVector,
+    };
+    return driver_shift(srv, 1, &shift);
+}
+
+/* Responses to long vectors are sent in parts once they accumulate at least this many bytes */
+#define STREAM_MIN_SEND_BYTES 4096
+
+static bool shift_and_stream_tdo(struct connection *conn, size_t numBits,
+        const uint8_t *tmsVector, const uint8_t *tdiVector, size_t driverMaxBits) {
+    /*
+     * Chunks are split at octet boundaries so that they can be passed to the driver right from
+     * the vectors. TAP state is retained by the driver between calls, so the chain sees the same
+     * sequence of TCK cycles as if the whole vector was shifted at once.
+     * TDO octets of a chunk are final once the driver returns, they are sent to the client
+     * early to let network transfer them while the next chunks are being shifted.
+     */
+    const size_t maxChunkBits = driverMaxBits & ~(size_t) 7;
+    if (maxChunkBits == 0) {
+        ERROR("Can not split %zu bits into chunks of %zu bits\n", numBits, driverMaxBits);
+        return false;
+    }
+    uint8_t *tdoVector = tx_reserve(conn, bytes_per_vector(numBits));
+    if (!tdoVector) {
+        return false;
+    }
+    /* Let parts go zero-copy if it is enabled */
+    const size_t minSendBytes = conn->zeroCopyMinBytes > STREAM_MIN_SEND_BYTES
+        ? conn->zeroCopyMinBytes : STREAM_MIN_SEND_BYTES;
+    for (size_t doneBits = 0; doneBits < numBits; ) {
+        size_t chunkBits = numBits - doneBits;
+        if (chunkBits > maxChunkBits) {
+            chunkBits = maxChunkBits;
+        }
+        size_t offset = doneBits / 8;
+        if (!driver_shift_one(conn->server, (int) chunkBits,
+                    tmsVector + offset, tdiVector + offset, tdoVector + offset)) {
+            return false;
+        }
+        account_shift(conn, chunkBits, tmsVector + offset);
+        doneBits += chunkBits;
+        tx_commit(conn, bytes_per_vector(chunkBits));
+        if (doneBits < numBits && conn->txEnd - conn->txBegin >= minSendBytes
+                && !flush_responses(conn)) {
+            return false;
+        }
+    }
+    log_vector("TDO", tdoVector, numBits);
+    return true;
+}
+
+/*
+ * Virtual cables.
+ * Client's vectors are padded with bits for other devices in the chain, padded vectors are shifted
+ * in chunks like long vectors above, and then bits of other devices are dropped from TDO.
+ */
+static bool shift_virtual(struct connection *conn, size_t numBits,
+        const uint8_t *tmsVector, const uint8_t *tdiVector, size_t driverMaxBits) {
+    struct server *srv = conn->server;
+    int numPads;
+    while ((numPads = txvc_jtag_view_decode_pads(&conn->view, &srv->chain, (int) numBits,
+                    tmsVector, tdiVector, srv->pads, srv->maxPads)) < 0) {
+        int maxPads = srv->maxPads ? srv->maxPads * 2 : 64;
+        struct txvc_jtag_pad *p = realloc(srv->pads, (size_t) maxPads * sizeof(p[0]));
+        if (!p) {
+            FATAL("Can not allocate %zu bytes\n", (size_t) maxPads * sizeof(p[0]));
+        }
+        srv->pads = p;
+        srv->maxPads = maxPads;
+    }
+    size_t numPaddedBits = numBits;
+    for (int i = 0; i < numPads; i++) {
+        if (!srv->pads[i].echoDelay) {
+            numPaddedBits += (size_t) srv->pads[i].numBits;
+        }
+    }
+    const size_t paddedBytes = bytes_per_vector(numPaddedBits);
+    if (srv->paddedCapacity < 3 * paddedBytes) {
+        uint8_t *p = realloc(srv->paddedVectors, 3 * paddedBytes);
+        if (!p) {
+            FATAL("Can not allocate %zu bytes\n", 3 * paddedBytes);
+        }
+        srv->paddedVectors = p;
+        srv->paddedCapacity = 3 * paddedBytes;
+    }
+    uint8_t *paddedTms = srv->paddedVectors;
+    uint8_t *paddedTdi = paddedTms + paddedBytes;
+    uint8_t *paddedTdo = paddedTdi + paddedBytes;
+    txvc_jtag_apply_pads(srv->pads, numPads, (int) numBits, tmsVector, tdiVector,
+            paddedTms, paddedTdi);
+
+    const size_t maxChunkBits = driverMaxBits & ~(size_t) 7;
+    if (maxChunkBits == 0) {
+        ERROR("Can not split %zu bits into chunks of %zu bits\n", numPaddedBits, driverMaxBits);
+        return false;
+    }
+    for (size_t doneBits = 0; doneBits < numPaddedBits; ) {
+        size_t chunkBits = numPaddedBits - doneBits;
+        if (chunkBits > maxChunkBits) {
+            chunkBits = maxChunkBits;
+        }
+        size_t offset = doneBits / 8;
+        if (!driver_shift_one(srv, (int) chunkBits,
+                    paddedTms + offset, paddedTdi + offset, paddedTdo + offset)) {
+            return false;
+        }
+        doneBits += chunkBits;
+    }
+    account_shift(conn, numPaddedBits, paddedTms);
+
+    const size_t tdoBytes = bytes_per_vector(numBits);
+    uint8_t *tdoVector = tx_reserve(conn, tdoBytes);
+    if (!tdoVector) {
         return false;
     }
-    log_vector("TDO", conn->tdoVector, numBits);
-    return send_data(conn->socket, conn->tdoVector, bytesPerVector);
+    /* Bits past the end of vector are not written by stripping */
+    tdoVector[tdoBytes - 1] = 0;
+    txvc_jtag_strip_pads(srv->pads, numPads, (int) numBits, tdiVector, paddedTdo, tdoVector);
+    log_vector("TDO", tdoVector, numBits);
+    tx_commit(conn, tdoBytes);
+    return true;
+}
+
+/*
+ * Pipelining.
+ * Shifts are passed to a worker thread that submits them to the driver, while the event loop
+ * receives next commands and sends responses to completed shifts. Vectors are copied to slots
+ * of the pipeline, as receive buffer may be moved before they are shifted. Commands other than
+ * shifts that fit the driver wait until shifts in flight complete, and so does handing the cable
+ * over, so that responses are sent in order and only the worker calls the driver meanwhile.
+ */
+enum reap_mode {
+    REAP_AVAILABLE,
+    REAP_ONE,
+    REAP_ALL,
+};
+
+static void *pipeline_worker(void *arg) {
+    struct pipeline *p = arg;
+    int maxInFlight = p->driver->max_shifts_in_flight(p->driverCtx);
+    if (maxInFlight < 1 || (size_t) maxInFlight > p->depth) {
+        maxInFlight = (int) p->depth;
+    }
+    size_t first = 0;
+    int numInDriver = 0;
+    while (!atomic_load(&p->shouldStop)) {
+        struct pipeline_slot *slot;
+        bool isFailed = false;
+        while (numInDriver < maxInFlight && txvc_spsc_queue_pop(&p->requests, &slot)) {
+            slot->startNs = now_ns();
+            p->inDriver[(first + (size_t) numInDriver) % p->depth] = slot;
+            numInDriver++;
+            if (!p->driver->submit_shift(p->driverCtx, &slot->shift)) {
+                isFailed = true;
+                break;
+            }
+        }
+        if (numInDriver == 0) {
+            /* Requests may have been queued since the last check */
+            atomic_store(&p->isWorkerIdle, true);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (txvc_spsc_queue_size(&p->requests) == 0 && !atomic_load(&p->shouldStop)) {
+                uint64_t count;
+                if (read(p->wakeFd, &count, sizeof(count)) < 0 && errno != EINTR) {
+                    FATAL("Can not wait for shifts: %s\n", strerror(errno));
+                }
+            }
+            atomic_store(&p->isWorkerIdle, false);
+            continue;
+        }
+        /* Block only if there is nothing to submit */
+        const bool wait = numInDriver == maxInFlight || txvc_spsc_queue_size(&p->requests) == 0;
+        int numCompleted = isFailed ? -1 : p->driver->complete_shifts(p->driverCtx, wait);
+        if (numCompleted < 0 || numCompleted > numInDriver) {
+            isFailed = true;
+            numCompleted = numInDriver;
+        }
+        const uint64_t doneNs = now_ns();
+        for (int i = 0; i < numCompleted; i++) {
+            slot = p->inDriver[first];
+            first = (first + 1) % p->depth;
+            numInDriver--;
+            slot->ok = !isFailed;
+            slot->doneNs = doneNs;
+            /* Never full, as there are no more shifts in flight than slots */
+            txvc_spsc_queue_push(&p->completions, &slot);
+        }
+        const uint64_t one = 1;
+        if (numCompleted && write(p->doneFd, &one, sizeof(one)) < 0) {
+            FATAL("Can not notify about completed shifts: %s\n", strerror(errno));
+        }
+    }
+    return NULL;
 }
 
-static void run_connectin(struct connection *conn) {
+/* Queues responses to completed shifts, returns `false` if any of them failed */
+static bool pipeline_reap(struct server *srv, enum reap_mode mode) {
+    struct pipeline *p = &srv->pipeline;
+    struct connection *conn = srv->owner;
+    if (!p->depth) {
+        return true;
+    }
+    bool ok = true;
+    for (;;) {
+        /* Notification is cleared before checking the queue, so that none is missed */
+        uint64_t count;
+        if (read(p->doneFd, &count, sizeof(count)) < 0 && errno != EAGAIN && errno != EINTR) {
+            ERROR("Can not get completed shifts: %s\n", strerror(errno));
+            return false;
+        }
+        size_t numReaped = 0;
+        struct pipeline_slot *slot;
+        while (txvc_spsc_queue_pop(&p->completions, &slot)) {
+            numReaped++;
+            p->numInFlight--;
+            if (!slot->ok) {
+                ERROR("Can not shift %d bits\n", slot->shift.numBits);
+                ok = false;
+                continue;
+            }
+            if (!conn) {
+                continue;
+            }
+            const uint64_t nowNs = now_ns();
+            conn->pipelineQueuedNs += slot->startNs - slot->queuedNs;
+            conn->pipelineDriverNs += slot->doneNs - slot->startNs;
+            conn->pipelineResponseNs += nowNs - slot->doneNs;
+            const size_t numBits = (size_t) slot->shift.numBits;
+            log_vector("TDO", slot->shift.tdoVector, numBits);
+            if (!tx_queue(conn, slot->shift.tdoVector, bytes_per_vector(numBits))) {
+                ok = false;
+            }
+        }
+        if (mode == REAP_AVAILABLE || p->numInFlight == 0 || (mode == REAP_ONE && numReaped)) {
+            return ok;
+        }
+        struct pollfd pfd = { .fd = p->doneFd, .events = POLLIN, .revents = 0, };
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+            ERROR("Can not wait for completed shifts: %s\n", strerror(errno));
+            return false;
+        }
+    }
+}
+
+/* Completes shifts of the client that are in flight and sends their responses */
+static bool pipeline_drain(struct connection *conn) {
+    if (!conn->ownsCable || conn->server->pipeline.numInFlight == 0) {
+        return true;
+    }
+    return pipeline_reap(conn->server, REAP_ALL) && flush_responses(conn);
+}
+
+static bool pipeline_submit(struct connection *conn, size_t numBits,
+        const uint8_t *tmsVector, const uint8_t *tdiVector) {
+    struct pipeline *p = &conn->server->pipeline;
+    if (p->numInFlight == p->depth && !pipeline_reap(conn->server, REAP_ONE)) {
+        return false;
+    }
+    /* Shifts complete in order, so the slot after the last submitted one is free */
+    struct pipeline_slot *slot = &p->slots[p->numSubmitted % p->depth];
+    const size_t numBytes = bytes_per_vector(numBits);
+    memcpy(slot->vectors, tmsVector, numBytes);
+    memcpy(slot->vectors + bytes_per_vector(p->maxVectorBits), tdiVector, numBytes);
+    slot->shift.numBits = (int) numBits;
+    slot->queuedNs = now_ns();
+    txvc_spsc_queue_push(&p->requests, &slot);
+    p->numSubmitted++;
+    p->numInFlight++;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&p->isWorkerIdle, false)) {
+        const uint64_t one = 1;
+        if (write(p->wakeFd, &one, sizeof(one)) < 0) {
+            ERROR("Can not wake pipeline worker: %s\n", strerror(errno));
+            return false;
+        }
+    }
+    const size_t depth = txvc_spsc_queue_size(&p->requests);
+    conn->numPipelined++;
+    conn->pipelineDepthSum += depth;
+    if (depth > conn->pipelineMaxDepth) {
+        conn->pipelineMaxDepth = depth;
+    }
+    account_shift(conn, numBits, tmsVector);
+    return true;
+}
+
+static bool pipeline_start(struct server *srv) {
+    struct pipeline *p = &srv->pipeline;
+    const size_t depth = srv->options->pipelineDepth;
+    if (!srv->driver->submit_shift) {
+        WARN("Driver does not support asynchronous shifts, pipelining is disabled\n");
+        return true;
+    }
+    if (srv->options->useIoUring || srv->isVirtual || srv->ops) {
+        WARN("Pipelining is not used with io_uring, virtual cables or JTAG operations\n");
+        return true;
+    }
+    int driverMaxVectorBits = srv->driver->max_vector_bits(srv->driverCtx);
+    if (driverMaxVectorBits <= 0) {
+        ERROR("Bad max vector bits: %d\n", driverMaxVectorBits);
+        return false;
+    }
+    *p = (struct pipeline) {
+        .depth = 0,
+        .driver = srv->driver,
+        .driverCtx = srv->driverCtx,
+        .maxVectorBits = (size_t) driverMaxVectorBits,
+        .slots = calloc(depth, sizeof(p->slots[0])),
+        .vectors = malloc(depth * 3 * bytes_per_vector((size_t) driverMaxVectorBits)),
+        .numSubmitted = 0,
+        .numInFlight = 0,
+        .wakeFd = eventfd(0, 0),
+        .doneFd = eventfd(0, EFD_NONBLOCK),
+        .inDriver = calloc(depth, sizeof(p->inDriver[0])),
+    };
+    atomic_init(&p->isWorkerIdle, false);
+    atomic_init(&p->shouldStop, false);
+    if (!p->slots || !p->vectors || !p->inDriver) {
+        FATAL("Can not allocate pipeline of %zu shifts\n", depth);
+    }
+    if (p->wakeFd < 0 || p->doneFd < 0) {
+        ERROR("Can not create event file descriptor: %s\n", strerror(errno));
+        goto bail_free;
+    }
+    if (!txvc_spsc_queue_init(&p->requests, depth, sizeof(struct pipeline_slot *))
+            || !txvc_spsc_queue_init(&p->completions, depth, sizeof(struct pipeline_slot *))) {
+        FATAL("Can not allocate pipeline of %zu shifts\n", depth);
+    }
+    const size_t vectorBytes = bytes_per_vector(p->maxVectorBits);
+    for (size_t i = 0; i < depth; i++) {
+        struct pipeline_slot *slot = &p->slots[i];
+        slot->vectors = p->vectors + i * 3 * vectorBytes;
+        slot->shift.tmsVector = slot->vectors;
+        slot->shift.tdiVector = slot->vectors + vectorBytes;
+        slot->shift.tdoVector = slot->vectors + 2 * vectorBytes;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = p, };
+    if (epoll_ctl(srv->epollFd, EPOLL_CTL_ADD, p->doneFd, &ev)) {
+        ERROR("Can not poll pipeline: %s\n", strerror(errno));
+        goto bail_deinit_queues;
+    }
+    p->depth = depth;
+    if (pthread_create(&p->worker, NULL, pipeline_worker, p)) {
+        ERROR("Can not start pipeline worker\n");
+        p->depth = 0;
+        goto bail_deinit_queues;
+    }
+    INFO("Pipelining up to %zu shifts\n", depth);
+    return true;
+
+bail_deinit_queues:
+    txvc_spsc_queue_deinit(&p->requests);
+    txvc_spsc_queue_deinit(&p->completions);
+bail_free:
+    if (p->wakeFd >= 0) {
+        close(p->wakeFd);
+    }
+    if (p->doneFd >= 0) {
+        close(p->doneFd);
+    }
+    free(p->slots);
+    free(p->vectors);
+    free(p->inDriver);
+    return false;
+}
+
+static void pipeline_stop(struct server *srv) {
+    struct pipeline *p = &srv->pipeline;
+    if (!p->depth) {
+        return;
+    }
+    /* Shifts in flight are completed by the event loop */
+    atomic_store(&p->shouldStop, true);
+    const uint64_t one = 1;
+    if (write(p->wakeFd, &one, sizeof(one)) < 0) {
+        FATAL("Can not stop pipeline worker: %s\n", strerror(errno));
+    }
+    pthread_join(p->worker, NULL);
+    txvc_spsc_queue_deinit(&p->requests);
+    txvc_spsc_queue_deinit(&p->completions);
+    close(p->wakeFd);
+    close(p->doneFd);
+    free(p->slots);
+    free(p->vectors);
+    free(p->inDriver);
+    p->depth = 0;
+}
+
+/*
+ * Read-ahead.
+ * Clients may send several shifts without waiting for responses. Those of them that are already
+ * received in full are shifted along with the current one as a batch, to let driver issue them
+ * to the hardware at once.
+ */
+#define SHIFT_PREFIX "shift:"
+#define SHIFT_PREFIX_BYTES (sizeof(SHIFT_PREFIX) - 1)
+#define MAX_BATCH_SHIFTS 64
+#define MAX_BATCH_BYTES (64 * 1024)
+
+/* Size of a shift command arguments, if enough of them is available, 0 otherwise */
+static size_t shift_args_bytes(const uint8_t *args, size_t numAvailable, size_t *numBits) {
+    if (numAvailable < 4) {
+        return 0;
+    }
+    int rawNumBits = xvc_int_from_bytes(args);
+    *numBits = rawNumBits > 0 ? (size_t) rawNumBits : 0;
+    return 4 + 2 * bytes_per_vector(*numBits);
+}
+
+static enum cmd_status cmd_shift(struct connection *conn,
+        const uint8_t *args, size_t numAvailable, size_t *numArgBytes) {
+    size_t numBits;
+    size_t argsBytes = shift_args_bytes(args, numAvailable, &numBits);
+    if (argsBytes == 0) {
+        *numArgBytes = 4;
+        return CMD_INCOMPLETE;
+    }
+    size_t maxVectorBits = advertised_vector_bits(conn);
+    if (maxVectorBits == 0) {
+        return CMD_FAILED;
+    }
+    if (numBits == 0 || numBits > maxVectorBits) {
+        /* Client is not allowed to make server buffer more than it has advertised */
+        ERROR("Bad vector size: %d\n", xvc_int_from_bytes(args));
+        return CMD_FAILED;
+    }
+    *numArgBytes = argsBytes;
+    if (numAvailable < argsBytes) {
+        return CMD_INCOMPLETE;
+    }
+    struct pipeline *p = &conn->server->pipeline;
+    if (p->depth && numBits <= p->maxVectorBits) {
+        VERBOSE("%s: queueing %zu bits\n", __func__, numBits);
+        log_vector("TMS", args + 4, numBits);
+        log_vector("TDI", args + 4 + bytes_per_vector(numBits), numBits);
+        return pipeline_submit(conn, numBits, args + 4, args + 4 + bytes_per_vector(numBits))
+            ? CMD_DONE : CMD_FAILED;
+    }
+    if (!pipeline_drain(conn)) {
+        return CMD_FAILED;
+    }
+    int driverMaxVectorBits = conn->driver->max_vector_bits(conn->driverCtx);
+    if (driverMaxVectorBits <= 0) {
+        ERROR("Bad max vector bits: %d\n", driverMaxVectorBits);
+        return CMD_FAILED;
+    }
+    const size_t driverMaxBits = (size_t) driverMaxVectorBits;
+    VERBOSE("%s: shifting %zu bits\n", __func__, numBits);
+    const uint8_t *tmsVector = args + 4;
+    const uint8_t *tdiVector = tmsVector + bytes_per_vector(numBits);
+    log_vector("TMS", tmsVector, numBits);
+    log_vector("TDI", tdiVector, numBits);
+    if (conn->server->isVirtual) {
+        return shift_virtual(conn, numBits, tmsVector, tdiVector, driverMaxBits)
+            ? CMD_DONE : CMD_FAILED;
+    }
+    if (numBits > driverMaxBits) {
+        return shift_and_stream_tdo(conn, numBits, tmsVector, tdiVector, driverMaxBits)
+            ? CMD_DONE : CMD_FAILED;
+    }
+
+    struct txvc_shift shifts[MAX_BATCH_SHIFTS];
+    size_t tdoOffsets[MAX_BATCH_SHIFTS];
+    int numShifts = 0;
+    size_t tdoBytes = 0;
+    size_t consumed = 0;
+    for (;;) {
+        shifts[numShifts] = (struct txvc_shift) {
+            .numBits = (int) numBits,
+            .tmsVector = tmsVector,
+            .tdiVector = tdiVector,
+            .tdoVector = NULL,
+        };
+        tdoOffsets[numShifts] = tdoBytes;
+        numShifts++;
+        tdoBytes += bytes_per_vector(numBits);
+        consumed += argsBytes;
+
+        const uint8_t *next = args + consumed;
+        size_t nextAvailable = numAvailable - consumed;
+        if (numShifts == MAX_BATCH_SHIFTS
+                || nextAvailable < SHIFT_PREFIX_BYTES
+                || memcmp(next, SHIFT_PREFIX, SHIFT_PREFIX_BYTES) != 0) {
+            break;
+        }
+        argsBytes = shift_args_bytes(next + SHIFT_PREFIX_BYTES,
+                nextAvailable - SHIFT_PREFIX_BYTES, &numBits);
+        if (argsBytes == 0 || numBits == 0 || numBits > driverMaxBits
+                || SHIFT_PREFIX_BYTES + argsBytes > nextAvailable
+                || tdoBytes + bytes_per_vector(numBits) > MAX_BATCH_BYTES) {
+            /* Leave it to regular processing */
+            break;
+        }
+        consumed += SHIFT_PREFIX_BYTES;
+        tmsVector = args + consumed + 4;
+        tdiVector = tmsVector + bytes_per_vector(numBits);
+        VERBOSE("%s: shifting %zu more bits\n", __func__, numBits);
+        log_vector("TMS", tmsVector, numBits);
+        log_vector("TDI", tdiVector, numBits);
+    }
+    uint8_t *tdoVector = tx_reserve(conn, tdoBytes);
+    if (!tdoVector) {
+        return CMD_FAILED;
+    }
+    for (int i = 0; i < numShifts; i++) {
+        shifts[i].tdoVector = tdoVector + tdoOffsets[i];
+    }
+    if (!driver_shift(conn->server, numShifts, shifts)) {
+        return CMD_FAILED;
+    }
+    for (int i = 0; i < numShifts; i++) {
+        account_shift(conn, (size_t) shifts[i].numBits, shifts[i].tmsVector);
+        log_vector("TDO", shifts[i].tdoVector, (size_t) shifts[i].numBits);
+    }
+    conn->numCommands += numShifts - 1;
+    *numArgBytes = consumed;
+    tx_commit(conn, tdoBytes);
+    return CMD_DONE;
+}
+
+/*
+ * Whether the owner should let others use the cable. Cable is shared only if TAP is in a stable
+ * state, so that other clients don't interfere with owner's scans.
+ */
+static bool should_yield(const struct connection *conn) {
+    const struct server *srv = conn->server;
+    if (!srv->timeSliceMs || !txvc_jtag_tap_is_stable(&conn->tap)
+            || now_ms() - conn->sliceStartMs < srv->timeSliceMs) {
+        return false;
+    }
+    for (size_t i = 0; i < srv->numConnections; i++) {
+        if (srv->connections[i]->isHeld) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void release_cable(struct connection *conn) {
+    VERBOSE("Client %s:%d released the cable\n", inet_ntoa(conn->peerAddr.sin_addr),
+            ntohs(conn->peerAddr.sin_port));
+    conn->ownsCable = false;
+    conn->server->owner = NULL;
+    if (conn->tapKnown) {
+        conn->server->tap = conn->tap;
+    }
+}
+
+/* Executes received commands until more bytes are needed, returns `false` to close connection */
+static bool process_commands(struct connection *conn) {
     const struct {
         size_t prefixSz;
         const char *prefix;
-        bool (*handler)(struct connection *conn);
+        bool needsCable;
+        bool isPipelined;
+        enum cmd_status (*handler)(struct connection *conn,
+                const uint8_t *args, size_t numAvailable, size_t *numArgBytes);
     } commands[] = {
-#define CMD(name) { sizeof (#name ":") - 1, #name ":", cmd_ ## name }
-        CMD(getinfo),
-        CMD(settck),
-        CMD(shift),
+#define CMD(name, needsCable, isPipelined) \
+        { sizeof (#name ":") - 1, #name ":", needsCable, isPipelined, cmd_ ## name }
+        CMD(getinfo, false, false),
+        CMD(settck, true, false),
+        CMD(shift, true, true),
 #undef CMD
     };
 
     while (!*conn->shouldTerminate) {
-        char command[16] = { 0 };
-        ssize_t sockRes = recv(conn->socket, command, sizeof(command), MSG_PEEK);
-        if (sockRes == 0) {
-            INFO("Connection was closed by peer\n");
-            return;
+        if (conn->isSendBlocked) {
+            /* Resumed by the event loop once client takes responses */
+            return true;
         }
-        if (sockRes < 0) {
-            ERROR("Can not read from socket: %s\n", strerror(errno));
-            return;
+        if (conn->rxEnd - conn->rxBegin < conn->numWanted) {
+            return wait_for_commands(conn);
         }
-        size_t sockRead = (size_t) sockRes;
+        const uint8_t *command = conn->rxBuffer + conn->rxBegin;
+        const size_t numAvailable = conn->rxEnd - conn->rxBegin;
 
-        bool shouldContinue = false;
+        bool isIncomplete = false;
+        bool isRecognized = false;
         for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
             size_t prefixSz = commands[i].prefixSz;
-            if (sockRead < prefixSz) {
-                shouldContinue = true;
-            } else if (strncmp(commands[i].prefix, command, prefixSz) == 0) {
-                ssize_t res = recv(conn->socket, command, prefixSz, MSG_WAITALL);
-                size_t read = res > 0 ? (size_t) res : 0;
-                if (read != prefixSz) {
-                    ERROR("Can not pop from socket queue\n");
-                    return;
+            if (numAvailable < prefixSz) {
+                if (memcmp(commands[i].prefix, command, numAvailable) == 0) {
+                    isIncomplete = true;
+                    conn->numWanted = prefixSz;
                 }
-                if (!commands[i].handler(conn)) {
-                    return;
+            } else if (memcmp(commands[i].prefix, command, prefixSz) == 0) {
+                if (commands[i].needsCable && conn->ownsCable && should_yield(conn)) {
+                    if (!pipeline_drain(conn)) {
+                        return false;
+                    }
+                    release_cable(conn);
                 }
-                shouldContinue = true;
+                if (commands[i].needsCable && !conn->ownsCable) {
+                    conn->isHeld = true;
+                    return set_interest(conn) && flush_responses(conn);
+                }
+                /* Responses to shifts in flight go first */
+                if (!commands[i].isPipelined && !pipeline_drain(conn)) {
+                    return false;
+                }
+                size_t numArgBytes = 0;
+                enum cmd_status status = commands[i].handler(conn,
+                        command + prefixSz, numAvailable - prefixSz, &numArgBytes);
+                if (status == CMD_FAILED) {
+                    return false;
+                }
+                if (status == CMD_INCOMPLETE) {
+                    isIncomplete = true;
+                    conn->numWanted = prefixSz + numArgBytes;
+                } else {
+                    conn->numCommands++;
+                    conn->rxBegin += prefixSz + numArgBytes;
+                    if (conn->rxBegin == conn->rxEnd) {
+                        conn->rxBegin = 0;
+                        conn->rxEnd = 0;
+                    }
+                    conn->numWanted = 1;
+                    if (conn->txEnd - conn->txBegin >= TX_MAX_QUEUED_BYTES
+                            && !flush_responses(conn)) {
+                        return false;
+                    }
+                }
+                isRecognized = true;
                 break;
             }
         }
 
-        if (!shouldContinue) {
+        if (!isRecognized && !isIncomplete) {
             ERROR("No command recognized\n");
+            return false;
+        }
+    }
+    return false;
+}
+
+/*
+ * Event loop.
+ * By default clients are served in order of their arrival: the first one owns the cable until it
+ * disconnects or becomes idle, others wait in a queue. Waiting clients are answered with server
+ * info, but their commands that need the cable are held until they get it.
+ *
+ * If time slices are configured, cable is shared instead. Owner keeps it for a time slice and then
+ * hands it over before its next command, once TAP is in a stable state. The next owner is
+ * the client that has used the least of TCK time, weighted by its priority, so that e.g.
+ * a frequent status poller can not starve a bitstream download and vice versa. Every client
+ * sees TAP in the state it has left it in and gets its own TCK period back. Instruction registers
+ * are not restored, clients are expected to load them before data scans.
+ *
+ * If IR lengths of the chain are configured, every device is served as a virtual cable at its own
+ * port, and clients of all devices share the cable as above, in default time slices unless they
+ * are configured. Each client sees its device alone in the chain, with others in BYPASS, and
+ * gets its instruction back along with TAP state.
+ */
+/* Idle timeouts and termination flag, that may be set by another thread, are checked this often */
+#define EVENT_LOOP_TICK_MS 100
+
+static void destroy_connection(struct connection *conn) {
+    INFO("Client %s:%d is gone\n", inet_ntoa(conn->peerAddr.sin_addr),
+            ntohs(conn->peerAddr.sin_port));
+    /* Pages of zero-copy sends that are still in flight are pinned by kernel */
+    if (conn->uring) {
+        INFO("Served %zu commands with %zu socket reads and %zu writes"
+                " in %zu io_uring submissions\n",
+                conn->numCommands, conn->numReads, conn->numWrites, conn->numSubmits);
+    } else {
+        INFO("Served %zu commands with %zu socket reads and %zu writes\n",
+                conn->numCommands, conn->numReads, conn->numWrites);
+    }
+    INFO("Used %" PRIu64 "ns of TCK time\n", conn->tckTimeNs);
+    if (conn->numPipelined) {
+        const size_t n = conn->numPipelined;
+        INFO("Pipelined %zu shifts, %zu.%02zu queued on average and %zu at most\n",
+                n, conn->pipelineDepthSum / n, conn->pipelineDepthSum % n * 100 / n,
+                conn->pipelineMaxDepth);
+        INFO("Shifts spent %" PRIu64 "ns queued, %" PRIu64 "ns in driver and %" PRIu64 "ns"
+                " before response on average\n", conn->pipelineQueuedNs / n,
+                conn->pipelineDriverNs / n, conn->pipelineResponseNs / n);
+    }
+    txvc_uring_deinit(&conn->ring);
+    deallocate_buffers(conn);
+    shutdown(conn->socket, SHUT_RDWR);
+    close(conn->socket);
+    free(conn);
+}
+
+/* Brings TAP and TCK period to what the client has seen when it used the cable last time */
+static bool restore_client_view(struct server *srv, struct connection *conn) {
+    uint8_t tms;
+    uint8_t tdi = 0;
+    uint8_t tdo;
+    if (srv->isVirtual) {
+        uint8_t tmsVector[TXVC_JTAG_CHAIN_MAX_CONTROL_BITS / 8 + 1] = { 0 };
+        uint8_t tdiVector[TXVC_JTAG_CHAIN_MAX_CONTROL_BITS / 8 + 1] = { 0 };
+        uint8_t tdoVector[TXVC_JTAG_CHAIN_MAX_CONTROL_BITS / 8 + 1];
+        int numBits = txvc_jtag_view_restore(&conn->view, &srv->chain, tmsVector, tdiVector);
+        if (numBits < 0) {
+            ERROR("Client's device is not in a stable state\n");
+            return false;
+        }
+        if (numBits > 0 && !driver_shift_one(srv, numBits, tmsVector, tdiVector, tdoVector)) {
+            return false;
+        }
+    } else if (!conn->tapKnown) {
+        conn->tap = srv->tap;
+        conn->tapKnown = true;
+    } else if (!txvc_jtag_tap_same_state(&srv->tap, &conn->tap)) {
+        if (!txvc_jtag_tap_is_stable(&srv->tap)) {
+            /* Previous owner has gone in the middle of a scan */
+            tms = 0x1f;
+            if (!driver_shift_one(srv, 5, &tms, &tdi, &tdo)) {
+                return false;
+            }
+            txvc_jtag_tap_follow(&srv->tap, 5, &tms);
+        }
+        int numBits = txvc_jtag_tap_move(&srv->tap, &conn->tap, &tms);
+        if (numBits > 0 && !driver_shift_one(srv, numBits, &tms, &tdi, &tdo)) {
+            return false;
+        }
+    }
+    if (conn->tckPeriodNs > 0 && conn->tckPeriodNs != srv->tckPeriodNs) {
+        int tckPeriod = srv->driver->set_tck_period(srv->driverCtx, conn->tckPeriodNs);
+        if (tckPeriod <= 0) {
+            ERROR("Can not restore TCK period: %dns\n", tckPeriod);
+            return false;
+        }
+        srv->tckPeriodNs = tckPeriod;
+    }
+    return true;
+}
+
+static bool take_cable(struct server *srv, struct connection *conn) {
+    INFO("Client %s:%d got the cable\n", inet_ntoa(conn->peerAddr.sin_addr),
+            ntohs(conn->peerAddr.sin_port));
+    srv->owner = conn;
+    conn->ownsCable = true;
+    conn->isHeld = false;
+    conn->lastReceiveMs = now_ms();
+    conn->sliceStartMs = conn->lastReceiveMs;
+    if (srv->timeSliceMs && !restore_client_view(srv, conn)) {
+        return false;
+    }
+    if (srv->options->useIoUring && conn->ring.fd < 0) {
+        /* Only a send and a receive are ever in flight */
+        if (txvc_uring_init(&conn->ring, 2)) {
+            conn->uring = &conn->ring;
+            /* Allocate buffers upfront to register them with the ring */
+            reserve_rx(conn, 1);
+            tx_reserve(conn, 1);
+            struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &conn->ring, };
+            if (epoll_ctl(srv->epollFd, EPOLL_CTL_ADD, conn->ring.fd, &ev)) {
+                WARN("Can not poll io_uring, falling back to regular socket calls: %s\n",
+                        strerror(errno));
+                txvc_uring_deinit(&conn->ring);
+                conn->uring = NULL;
+            }
+        } else {
+            WARN("Can not use io_uring, falling back to regular socket calls: %s\n",
+                    strerror(errno));
+        }
+    }
+    if (!set_interest(conn)) {
+        return false;
+    }
+    /* There may be commands that were held */
+    return process_commands(conn);
+}
+
+static void drop_connection(struct server *srv, struct connection *conn) {
+    size_t idx = 0;
+    while (srv->connections[idx] != conn) {
+        idx++;
+    }
+    memmove(&srv->connections[idx], &srv->connections[idx + 1],
+            (srv->numConnections - idx - 1) * sizeof(srv->connections[0]));
+    srv->numConnections--;
+    if (conn->ownsCable) {
+        /* Responses to shifts in flight are not needed anymore */
+        pipeline_reap(srv, REAP_ALL);
+        release_cable(conn);
+    }
+    destroy_connection(conn);
+}
+
+/* Client that should get the cable next, if any */
+static struct connection *next_owner(const struct server *srv) {
+    if (!srv->timeSliceMs) {
+        return srv->numConnections ? srv->connections[0] : NULL;
+    }
+    struct connection *next = NULL;
+    for (size_t i = 0; i < srv->numConnections; i++) {
+        struct connection *conn = srv->connections[i];
+        if (conn->isHeld && (!next || conn->weightedTckTimeNs < next->weightedTckTimeNs)) {
+            next = conn;
+        }
+    }
+    return next;
+}
+
+/* Hands the cable over if it is free or if owner's time slice is over */
+static void schedule(struct server *srv) {
+    if (srv->owner && should_yield(srv->owner)) {
+        if (pipeline_drain(srv->owner)) {
+            release_cable(srv->owner);
+        } else {
+            drop_connection(srv, srv->owner);
+        }
+    }
+    while (!srv->owner) {
+        struct connection *next = next_owner(srv);
+        if (!next || take_cable(srv, next)) {
+            break;
+        }
+        drop_connection(srv, next);
+    }
+}
+
+static void accept_connection(struct server *srv, size_t socketIdx) {
+    struct sockaddr_in peerAddr;
+    socklen_t length = sizeof(peerAddr);
+    int s = accept(srv->sockets[socketIdx], (struct sockaddr *) &peerAddr, &length);
+    if (s < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            ERROR("Failed to accept connection: %s\n", strerror(errno));
+        }
+        return;
+    }
+    if (peerAddr.sin_family != AF_INET) {
+        WARN("Ignored connection from family %d\n", peerAddr.sin_family);
+        goto bail_close;
+    }
+    if (srv->numConnections == MAX_CONNECTIONS) {
+        WARN("Too many clients, rejected connection from %s:%d\n", inet_ntoa(peerAddr.sin_addr),
+                ntohs(peerAddr.sin_port));
+        goto bail_close;
+    }
+    if (srv->isVirtual) {
+        INFO("Accepted connection from %s:%d to device %zu\n", inet_ntoa(peerAddr.sin_addr),
+                ntohs(peerAddr.sin_port), socketIdx);
+    } else {
+        INFO("Accepted connection from %s:%d\n", inet_ntoa(peerAddr.sin_addr),
+                ntohs(peerAddr.sin_port));
+    }
+    /*
+     * Responses to long vectors are sent in parts, don't let Nagle's algorithm
+     * hold their tails until previous parts are acknowledged.
+     */
+    int noDelay = 1;
+    if (setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay))) {
+        WARN("Can not disable Nagle's algorithm: %s\n", strerror(errno));
+    }
+    size_t zeroCopyMinBytes = srv->options->zeroCopyMinBytes;
+    int zeroCopy = 1;
+    if (zeroCopyMinBytes
+            && setsockopt(s, SOL_SOCKET, SO_ZEROCOPY, &zeroCopy, sizeof(zeroCopy))) {
+        WARN("Can not enable zero-copy sends: %s\n", strerror(errno));
+        zeroCopyMinBytes = 0;
+    }
+    unsigned priority = 1;
+    for (size_t i = 0; i < srv->options->numPriorities; i++) {
+        if (srv->options->priorities[i].addr.s_addr == peerAddr.sin_addr.s_addr) {
+            priority = srv->options->priorities[i].priority;
+        }
+    }
+    /* Newcomer starts on par with others, rather than taking the cable for a long time */
+    uint64_t weightedTckTimeNs = UINT64_MAX;
+    for (size_t i = 0; i < srv->numConnections; i++) {
+        if (srv->connections[i]->weightedTckTimeNs < weightedTckTimeNs) {
+            weightedTckTimeNs = srv->connections[i]->weightedTckTimeNs;
+        }
+    }
+    struct connection *conn = malloc(sizeof(*conn));
+    if (!conn) {
+        FATAL("Can not allocate %zu bytes\n", sizeof(*conn));
+    }
+    *conn = (struct connection) {
+        .server = srv,
+        .socket = s,
+        .peerAddr = peerAddr,
+        .epollFd = srv->epollFd,
+        .driver = srv->driver,
+        .driverCtx = srv->driverCtx,
+        .shouldTerminate = srv->shouldTerminate,
+        .maxVectorBits = srv->options->maxVectorBits,
+        .zeroCopyMinBytes = zeroCopyMinBytes,
+        .ownsCable = false,
+        .isHeld = false,
+        .lastReceiveMs = now_ms(),
+        .priority = priority ? priority : 1,
+        .tap = srv->tap,
+        .tapKnown = false,
+        .tckPeriodNs = 0,
+        .tckTimeNs = 0,
+        .weightedTckTimeNs = srv->numConnections ? weightedTckTimeNs : 0,
+        .sliceStartMs = 0,
+        .numWanted = 1,
+        .rxBuffer = NULL,
+        .rxCapacity = 0,
+        .rxBegin = 0,
+        .rxEnd = 0,
+        .txBuffer = NULL,
+        .txCapacity = 0,
+        .txBegin = 0,
+        .txEnd = 0,
+        .numZeroCopySent = 0,
+        .numZeroCopyDone = 0,
+        .retiredBuffers = NULL,
+        .isSendBlocked = false,
+        .lastSendMs = 0,
+        .ring = { .fd = -1, },
+        .uring = NULL,
+        .uringRxBuffer = NULL,
+        .uringRxCapacity = 0,
+        .uringTxBuffer = NULL,
+        .uringTxCapacity = 0,
+        .uringNeedReceive = false,
+        .uringNumPending = 0,
+        .numCommands = 0,
+        .numReads = 0,
+        .numWrites = 0,
+        .numSubmits = 0,
+        .numPipelined = 0,
+        .pipelineDepthSum = 0,
+        .pipelineMaxDepth = 0,
+        .pipelineQueuedNs = 0,
+        .pipelineDriverNs = 0,
+        .pipelineResponseNs = 0,
+    };
+    txvc_jtag_view_init(&conn->view, (int) socketIdx);
+    if (srv->isVirtual) {
+        /* Client's TAP starts where the view does */
+        txvc_jtag_tap_init(&conn->tap);
+    }
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = conn, };
+    if (epoll_ctl(srv->epollFd, EPOLL_CTL_ADD, s, &ev)) {
+        ERROR("Can not poll socket: %s\n", strerror(errno));
+        free(conn);
+        goto bail_close;
+    }
+    srv->connections[srv->numConnections++] = conn;
+    if (srv->owner) {
+        INFO("Client %s:%d waits for the cable\n", inet_ntoa(peerAddr.sin_addr),
+                ntohs(peerAddr.sin_port));
+    }
+    return;
+
+bail_close:
+    close(s);
+}
+
+/* Returns `false` to close connection */
+static bool handle_event(struct connection *conn, bool isRing, uint32_t events) {
+    if (isRing) {
+        if (!uring_reap(conn)) {
+            return false;
+        }
+        if (conn->uringNumPending) {
+            return true;
+        }
+        if (conn->isSendBlocked && conn->txBegin == conn->txEnd) {
+            /* Client has taken all responses, its commands may be executed again */
+            conn->isSendBlocked = false;
+            if (!set_interest(conn)) {
+                return false;
+            }
+        }
+        if (!uring_is_done(conn)) {
+            return uring_submit(conn);
+        }
+        return process_commands(conn);
+    }
+    if ((events & EPOLLERR) && conn->numZeroCopyDone != conn->numZeroCopySent) {
+        /* Completions of zero-copy sends are reported as socket errors */
+        if (!tx_reap_zero_copy(conn)) {
+            return false;
+        }
+        events &= ~(uint32_t) EPOLLERR;
+    }
+    if (events & EPOLLOUT) {
+        if (!tx_flush(conn)) {
+            return false;
+        }
+        if (!conn->isSendBlocked && !(events & EPOLLIN)) {
+            /* Commands that were received before client stopped taking responses */
+            return process_commands(conn);
+        }
+    }
+    if (events & EPOLLIN) {
+        return receive_more(conn, conn->numWanted) && process_commands(conn);
+    }
+    if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        INFO("Connection was closed by peer\n");
+        return false;
+    }
+    return true;
+}
+
+static void run_event_loop(struct server *srv) {
+    for (size_t i = 0; i < srv->numSockets; i++) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &srv->sockets[i], };
+        if (epoll_ctl(srv->epollFd, EPOLL_CTL_ADD, srv->sockets[i], &ev)) {
+            ERROR("Can not poll server socket: %s\n", strerror(errno));
             return;
         }
     }
+    while (!*srv->shouldTerminate) {
+        struct epoll_event events[MAX_CONNECTIONS + TXVC_JTAG_SPLIT_MAX_DEVICES + 2];
+        int numEvents = epoll_wait(srv->epollFd, events, sizeof(events) / sizeof(events[0]),
+                EVENT_LOOP_TICK_MS);
+        if (numEvents < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ERROR("Can not wait for events: %s\n", strerror(errno));
+            break;
+        }
+        bool canAccept[TXVC_JTAG_SPLIT_MAX_DEVICES] = { false };
+        for (int i = 0; i < numEvents && !*srv->shouldTerminate; i++) {
+            const int *socket = events[i].data.ptr;
+            if (socket >= srv->sockets && socket < srv->sockets + srv->numSockets) {
+                /* Accept after other events, connections may be freed while handling them */
+                canAccept[socket - srv->sockets] = true;
+                continue;
+            }
+            if (events[i].data.ptr == &srv->pipeline) {
+                /* Only the owner has shifts in flight */
+                struct connection *owner = srv->owner;
+                const bool ok = pipeline_reap(srv, REAP_AVAILABLE);
+                if (owner && (!ok || !flush_responses(owner))) {
+                    drop_connection(srv, owner);
+                }
+                continue;
+            }
+            for (size_t j = 0; j < srv->numConnections; j++) {
+                struct connection *conn = srv->connections[j];
+                const bool isRing = events[i].data.ptr == &conn->ring;
+                if (events[i].data.ptr == conn || isRing) {
+                    if (!handle_event(conn, isRing, events[i].events)) {
+                        drop_connection(srv, conn);
+                    }
+                    break;
+                }
+            }
+        }
+        for (size_t i = 0; i < srv->numSockets && !*srv->shouldTerminate; i++) {
+            if (canAccept[i]) {
+                accept_connection(srv, i);
+            }
+        }
+
+        const size_t idleTimeoutMs = srv->options->idleTimeoutMs;
+        const uint64_t nowMs = now_ms();
+        for (size_t j = 0; idleTimeoutMs && j < srv->numConnections; ) {
+            struct connection *conn = srv->connections[j];
+            /* Client that does not take responses is idle as well, even if it waits for cable */
+            const uint64_t lastActiveMs = conn->lastReceiveMs > conn->lastSendMs
+                ? conn->lastReceiveMs : conn->lastSendMs;
+            if ((!conn->isHeld || conn->isSendBlocked) && nowMs - lastActiveMs >= idleTimeoutMs) {
+                INFO("Client %s:%d is idle for too long\n", inet_ntoa(conn->peerAddr.sin_addr),
+                        ntohs(conn->peerAddr.sin_port));
+                /* Next connections are shifted in place of this one */
+                drop_connection(srv, conn);
+            } else {
+                j++;
+            }
+        }
+        schedule(srv);
+    }
+    if (srv->owner && srv->pipeline.numInFlight) {
+        pipeline_reap(srv, REAP_ALL);
+    }
+    while (srv->numConnections) {
+        destroy_connection(srv->connections[--srv->numConnections]);
+    }
 }
 
-static void run_with_address(struct in_addr inAddr, in_port_t port,
-        const struct txvc_driver *driver, volatile sig_atomic_t *shouldTerminate) {
-    int serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+/* Returns listening socket or -1 */
+static int listen_at(struct in_addr inAddr, in_port_t port) {
+    int serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
     if (serverSocket < 0) {
         ERROR("Can not create socket: %s\n", strerror(errno));
-        return;
+        return -1;
+    }
+    /* Idle clients are disconnected by server, don't let TIME_WAIT prevent restarts */
+    int reuseAddr = 1;
+    if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuseAddr, sizeof(reuseAddr))) {
+        WARN("Can not reuse address: %s\n", strerror(errno));
     }
     struct sockaddr_in addr = {
         .sin_family = AF_INET,
@@ -253,49 +1970,127 @@ static void run_with_address(struct in_addr inAddr, in_port_t port,
     if (bind(serverSocket, (const struct sockaddr *)&addr, sizeof(addr))) {
         ERROR("Can not bind socket to %s:%d: %s\n", inet_ntoa(addr.sin_addr),
             ntohs(addr.sin_port), strerror(errno));
-        close(serverSocket);
-        return;
+        goto bail_close_socket;
     }
-    if (listen(serverSocket, 0)) {
+    if (listen(serverSocket, MAX_CONNECTIONS)) {
         ERROR("Can not listen on socket: %s\n", strerror(errno));
-        close(serverSocket);
-        return;
+        goto bail_close_socket;
     }
-
     INFO("Listening for incoming connections at %s:%d...\n", inet_ntoa(addr.sin_addr),
             ntohs(addr.sin_port));
-    while (!*shouldTerminate) {
-        struct sockaddr_in peerAddr;
-        socklen_t length = sizeof(peerAddr);
-        int s = accept(serverSocket, (struct sockaddr *) &peerAddr, &length);
-        if (s < 0) {
-            ERROR("Failed to accept connection: %s\n", strerror(errno));
-            continue;
+    return serverSocket;
+
+bail_close_socket:
+    close(serverSocket);
+    return -1;
+}
+
+/* Learns what devices have after reset, so that their registers can be told apart */
+static bool identify_chain(struct server *srv) {
+    const struct txvc_server_options *options = srv->options;
+    if (!txvc_jtag_chain_init(&srv->chain, (int) options->numChainDevices,
+                options->chainIrLengths)) {
+        return false;
+    }
+    uint8_t tms[TXVC_JTAG_CHAIN_MAX_CONTROL_BITS / 8 + 1] = { 0 };
+    uint8_t tdi[TXVC_JTAG_CHAIN_MAX_CONTROL_BITS / 8 + 1] = { 0 };
+    uint8_t tdo[TXVC_JTAG_CHAIN_MAX_CONTROL_BITS / 8 + 1] = { 0 };
+    int numBits = txvc_jtag_chain_identify_vector(&srv->chain, tms, tdi);
+    int driverMaxVectorBits = srv->driver->max_vector_bits(srv->driverCtx);
+    if (numBits > driverMaxVectorBits) {
+        ERROR("Can not identify chain with vectors of %d bits\n", driverMaxVectorBits);
+        return false;
+    }
+    if (!driver_shift_one(srv, numBits, tms, tdi, tdo)) {
+        ERROR("Can not identify chain\n");
+        return false;
+    }
+    return txvc_jtag_chain_identify(&srv->chain, tdo);
+}
+
+/* Time slices of virtual cables, unless they are configured */
+#define VIRTUAL_DEFAULT_TIME_SLICE_MS 10
+
+static void run_with_address(struct in_addr inAddr, in_port_t port,
+        const struct txvc_driver *driver, void *driverCtx,
+        const struct txvc_server_options *options,
+        volatile sig_atomic_t *shouldTerminate) {
+    if (options->numChainDevices > TXVC_JTAG_SPLIT_MAX_DEVICES) {
+        ERROR("Can not split chain of more than %d devices\n", TXVC_JTAG_SPLIT_MAX_DEVICES);
+        return;
+    }
+    struct server srv = {
+        .numSockets = 0,
+        .epollFd = -1,
+        .driver = driver,
+        .driverCtx = driverCtx,
+        .options = options,
+        .shouldTerminate = shouldTerminate,
+        .timeSliceMs = options->timeSliceMs,
+        .connections = { NULL },
+        .numConnections = 0,
+        .owner = NULL,
+        .tckPeriodNs = 0,
+        .isVirtual = options->numChainDevices > 0,
+        .pads = NULL,
+        .maxPads = 0,
+        .paddedVectors = NULL,
+        .paddedCapacity = 0,
+        .pipeline = { .depth = 0, .wakeFd = -1, .doneFd = -1, },
+        .ops = NULL,
+        .maxOps = 0,
+    };
+    /* Drivers reset TAP when they are activated */
+    txvc_jtag_tap_init(&srv.tap);
+    if (driver->flush && !ops_start(&srv)) {
+        return;
+    }
+    if (srv.isVirtual) {
+        if (!identify_chain(&srv)) {
+            goto bail_free_ops;
         }
-        if (peerAddr.sin_family == AF_INET) {
-            INFO("Accepted connection from %s:%d\n", inet_ntoa(peerAddr.sin_addr),
-                    ntohs(peerAddr.sin_port));
-            struct connection conn = {
-                .socket = s,
-                .driver = driver,
-                .shouldTerminate = shouldTerminate,
-                .vectorNumBytes = 0,
-                .tmsVector = NULL,
-                .tdiVector = NULL,
-                .tdoVector = NULL,
-            };
-            run_connectin(&conn);
-            deallocate_vectors(&conn);
-        } else {
-            WARN("Ignored connection from family %d\n", peerAddr.sin_family);
+        if (!srv.timeSliceMs) {
+            srv.timeSliceMs = VIRTUAL_DEFAULT_TIME_SLICE_MS;
+        }
+    }
+
+    const size_t numSockets = srv.isVirtual ? options->numChainDevices : 1;
+    while (srv.numSockets < numSockets) {
+        int s = listen_at(inAddr, (in_port_t) (port + srv.numSockets));
+        if (s < 0) {
+            goto bail_close_sockets;
         }
-        shutdown(s, SHUT_RDWR);
-        close(s);
+        srv.sockets[srv.numSockets++] = s;
+    }
+    srv.epollFd = epoll_create1(0);
+    if (srv.epollFd < 0) {
+        ERROR("Can not create epoll instance: %s\n", strerror(errno));
+        goto bail_close_sockets;
+    }
+
+    if (options->pipelineDepth && !pipeline_start(&srv)) {
+        goto bail_close_epoll;
+    }
+    run_event_loop(&srv);
+    pipeline_stop(&srv);
+
+bail_close_epoll:
+    close(srv.epollFd);
+    free(srv.pads);
+    free(srv.paddedVectors);
+
+bail_close_sockets:
+    while (srv.numSockets) {
+        close(srv.sockets[--srv.numSockets]);
     }
+bail_free_ops:
+    free(srv.ops);
 }
 
 void txvc_run_server(const char *address,
-        const struct txvc_driver *driver, volatile sig_atomic_t *shouldTerminate) {
+        const struct txvc_driver *driver, void *driverCtx,
+        const struct txvc_server_options *options,
+        volatile sig_atomic_t *shouldTerminate) {
     char buf[128];
     strncpy(buf, address, sizeof(buf));
     buf[sizeof(buf) - 1] = '\0';
@@ -311,7 +2106,7 @@ void txvc_run_server(const char *address,
     in_port_t port = (in_port_t) strtol(portStr, &tmp, 0);
     if (*tmp) goto bail_bad_addrstr;
 
-    run_with_address(addr, port, driver,shouldTerminate);
+    run_with_address(addr, port, driver, driverCtx, options, shouldTerminate);
     return;
 
 bail_bad_addrstr:
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "txvc/spsc_queue.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool txvc_spsc_queue_init(struct txvc_spsc_queue *q, size_t capacity, size_t itemSize) {
+    size_t numItems = 1;
+    while (numItems < capacity) {
+        numItems <<= 1;
+    }
+    q->items = malloc(numItems * itemSize);
+    if (!q->items) {
+        return false;
+    }
+    q->itemSize = itemSize;
+    q->mask = numItems - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    return true;
+}
+
+void txvc_spsc_queue_deinit(struct txvc_spsc_queue *q) {
+    free(q->items);
+    q->items = NULL;
+}
+
+bool txvc_spsc_queue_push(struct txvc_spsc_queue *q, const void *item) {
+    const size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail - head > q->mask) {
+        return false;
+    }
+    memcpy(q->items + (tail & q->mask) * q->itemSize, item, q->itemSize);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool txvc_spsc_queue_pop(struct txvc_spsc_queue *q, void *item) {
+    const size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    const size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+    memcpy(item, q->items + (head & q->mask) * q->itemSize, q->itemSize);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return true;
+}
+
+size_t txvc_spsc_queue_size(struct txvc_spsc_queue *q) {
+    return atomic_load_explicit(&q->tail, memory_order_acquire)
+        - atomic_load_explicit(&q->head, memory_order_acquire);
+}
+
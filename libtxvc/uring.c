@@ -0,0 +1,185 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "txvc/uring.h"
+
+#include "txvc/log.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <string.h>
+
+TXVC_DEFAULT_LOG_TAG(uring);
+
+static void unmap_rings(struct txvc_uring *uring) {
+    if (uring->sqes) {
+        munmap(uring->sqes, uring->sqesSz);
+        uring->sqes = NULL;
+    }
+    if (uring->cqRing && uring->cqRing != uring->sqRing) {
+        munmap(uring->cqRing, uring->cqRingSz);
+    }
+    uring->cqRing = NULL;
+    if (uring->sqRing) {
+        munmap(uring->sqRing, uring->sqRingSz);
+        uring->sqRing = NULL;
+    }
+}
+
+static void *map_ring(int fd, size_t sz, off_t offset) {
+    void *p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+bool txvc_uring_init(struct txvc_uring *uring, unsigned numEntries) {
+    memset(uring, 0, sizeof(*uring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    uring->fd = (int) syscall(__NR_io_uring_setup, numEntries, &params);
+    if (uring->fd < 0) {
+        return false;
+    }
+
+    uring->sqRingSz = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cqRingSz = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap && uring->cqRingSz > uring->sqRingSz) {
+        uring->sqRingSz = uring->cqRingSz;
+    }
+    uring->sqRing = map_ring(uring->fd, uring->sqRingSz, IORING_OFF_SQ_RING);
+    if (!uring->sqRing) {
+        goto bail;
+    }
+    uring->cqRing = singleMmap
+        ? uring->sqRing : map_ring(uring->fd, uring->cqRingSz, IORING_OFF_CQ_RING);
+    if (!uring->cqRing) {
+        goto bail;
+    }
+    uring->sqesSz = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = map_ring(uring->fd, uring->sqesSz, IORING_OFF_SQES);
+    if (!uring->sqes) {
+        goto bail;
+    }
+
+    uring->sqHead = (unsigned *) (uring->sqRing + params.sq_off.head);
+    uring->sqTail = (unsigned *) (uring->sqRing + params.sq_off.tail);
+    uring->sqMask = *(unsigned *) (uring->sqRing + params.sq_off.ring_mask);
+    uring->sqNumEntries = params.sq_entries;
+    uring->sqArray = (unsigned *) (uring->sqRing + params.sq_off.array);
+    uring->cqHead = (unsigned *) (uring->cqRing + params.cq_off.head);
+    uring->cqTail = (unsigned *) (uring->cqRing + params.cq_off.tail);
+    uring->cqMask = *(unsigned *) (uring->cqRing + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) (uring->cqRing + params.cq_off.cqes);
+    return true;
+
+bail:;
+    int err = errno;
+    unmap_rings(uring);
+    close(uring->fd);
+    uring->fd = -1;
+    errno = err;
+    return false;
+}
+
+void txvc_uring_deinit(struct txvc_uring *uring) {
+    if (uring->fd < 0) {
+        return;
+    }
+    /* Closing the ring cancels all operations that are still in flight */
+    unmap_rings(uring);
+    close(uring->fd);
+    uring->fd = -1;
+}
+
+bool txvc_uring_register_buffers(struct txvc_uring *uring,
+        const struct iovec *buffers, unsigned numBuffers) {
+    if (uring->buffersRegistered) {
+        if (syscall(__NR_io_uring_register, uring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0) < 0) {
+            ERROR("Can not unregister buffers: %s\n", strerror(errno));
+            return false;
+        }
+        uring->buffersRegistered = false;
+    }
+    if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_BUFFERS,
+                buffers, numBuffers) < 0) {
+        ERROR("Can not register buffers: %s\n", strerror(errno));
+        return false;
+    }
+    uring->buffersRegistered = true;
+    return true;
+}
+
+bool txvc_uring_prep_rw_fixed(struct txvc_uring *uring, bool isWrite, int fd,
+        void *buf, unsigned len, unsigned bufIndex, uint64_t userData, bool linkNext) {
+    /* This is the only producer, kernel only advances head */
+    const unsigned tail = *uring->sqTail;
+    if (tail - __atomic_load_n(uring->sqHead, __ATOMIC_ACQUIRE) >= uring->sqNumEntries) {
+        return false;
+    }
+    const unsigned idx = tail & uring->sqMask;
+    struct io_uring_sqe *sqe = &uring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = isWrite ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->fd = fd;
+    sqe->flags = linkNext ? IOSQE_IO_LINK : 0;
+    /* Sockets are not seekable, use "current position" */
+    sqe->off = (uint64_t) -1;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = len;
+    sqe->buf_index = (uint16_t) bufIndex;
+    sqe->user_data = userData;
+    uring->sqArray[idx] = idx;
+    __atomic_store_n(uring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    uring->numUnsubmitted++;
+    return true;
+}
+
+bool txvc_uring_submit_and_wait(struct txvc_uring *uring, unsigned minComplete) {
+    long res = syscall(__NR_io_uring_enter, uring->fd, uring->numUnsubmitted, minComplete,
+            IORING_ENTER_GETEVENTS, NULL, 0);
+    if (res < 0) {
+        return false;
+    }
+    uring->numUnsubmitted -= (unsigned) res;
+    return true;
+}
+
+bool txvc_uring_pop_completion(struct txvc_uring *uring, uint64_t *userData, int *res) {
+    /* This is the only consumer, kernel only advances tail */
+    const unsigned head = *uring->cqHead;
+    if (head == __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    const struct io_uring_cqe *cqe = &uring->cqes[head & uring->cqMask];
+    *userData = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(uring->cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
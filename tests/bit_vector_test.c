@@ -29,6 +29,7 @@
 #include "txvc/bit_vector.h"
 
 #include <stdint.h>
+#include <string.h>
 
 TEST_SUITE(BitVector)
 
@@ -44,6 +45,30 @@ TEST_CASE(CompareVectors_ResultAsExpected) {
 #undef VEC
 }
 
+TEST_CASE(CopyVectorsAtDifferentOffsets_SameAsBitByBit) {
+    uint8_t src[40];
+    uint8_t dst[48];
+    txvc_bit_vector_random(src, sizeof(src));
+    for (int srcStart = 0; srcStart < 16; srcStart++) {
+        for (int dstStart = 0; dstStart < 16; dstStart++) {
+            for (int numBits = 0; numBits < 256; numBits += 7) {
+                txvc_bit_vector_random(dst, sizeof(dst));
+                uint8_t expected[sizeof(dst)];
+                memcpy(expected, dst, sizeof(dst));
+                for (int i = 0; i < numBits; i++) {
+                    const int dstIdx = dstStart + i;
+                    const int srcIdx = srcStart + i;
+                    expected[dstIdx / 8] &= (uint8_t) ~(1 << (dstIdx % 8));
+                    expected[dstIdx / 8] |= (uint8_t) (((src[srcIdx / 8] >> (srcIdx % 8)) & 1)
+                            << (dstIdx % 8));
+                }
+                txvc_bit_vector_copy(dst, dstStart, src, srcStart, srcStart + numBits);
+                ASSERT_EQ(SPAN(expected, sizeof(expected)), SPAN(dst, sizeof(dst)));
+            }
+        }
+    }
+}
+
 TEST_CASE(FormatVectorInDifferentDirections_ResultAsExpected) {
     char formatted[128];
 #define FORMAT_LSB(start, end, ...) \
@@ -0,0 +1,337 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ttest/test.h"
+
+#include "ftdiemu/ftdi_emu.h"
+#include "txvc/driver.h"
+#include "txvc/jtag_sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+TEST_SUITE(FtdiGeneric)
+
+extern const struct txvc_driver driver_ftdi_generic;
+
+static const struct txvc_jtag_sim_device gDevices[] = {
+    { .irLength = 6, .idcode = 0x13631093u, .idcodeOpcode = 0x09u, .hasConfigEngine = true, },
+    { .irLength = 4, .idcode = 0x4ba00477u, .idcodeOpcode = 0x0eu, },
+};
+
+#define NUM_DEVICES ((int) (sizeof(gDevices) / sizeof(gDevices[0])))
+#define MAX_VECTOR_BYTES 4096
+
+static void *gCtx;
+static struct txvc_jtag_sim gReference;
+static uint8_t gTms[MAX_VECTOR_BYTES];
+static uint8_t gTdi[MAX_VECTOR_BYTES];
+static uint8_t gTdo[MAX_VECTOR_BYTES];
+static uint8_t gExpectedTdo[MAX_VECTOR_BYTES];
+
+/* Activates driver with given parameters in addition to the ones that are always needed */
+static bool plug_and_activate_with(enum txvc_ftdi_emu_chip chip, const char *channel,
+        int numParams, const char **paramNames, const char **paramValues) {
+    const struct txvc_ftdi_emu_options options = {
+        .chip = chip,
+        .serialNumber = "FT0EMU",
+        .numDevices = NUM_DEVICES,
+        .devices = gDevices,
+    };
+    if (!txvc_ftdi_emu_plug(&options)) {
+        return false;
+    }
+    const char *names[16] = {
+        "device", "vid", "pid", "channel", "read_latency_millis",
+        "d4", "d5", "d6", "d7",
+    };
+    const char *values[16] = {
+        chip == TXVC_FTDI_EMU_FT2232H ? "ft2232h" : "ft232h",
+        "0403",
+        chip == TXVC_FTDI_EMU_FT2232H ? "6010" : "6014",
+        channel,
+        "1",
+        "ignored", "ignored", "ignored", "ignored",
+    };
+    int numNames = 9;
+    ASSERT_TRUE(numNames + numParams <= (int) (sizeof(names) / sizeof(names[0])));
+    for (int i = 0; i < numParams; i++) {
+        names[numNames] = paramNames[i];
+        values[numNames] = paramValues[i];
+        numNames++;
+    }
+    void *ctx = calloc(1, driver_ftdi_generic.contextSize);
+    if (!driver_ftdi_generic.activate(ctx, numNames, names, values)) {
+        free(ctx);
+        return false;
+    }
+    gCtx = ctx;
+    return true;
+}
+
+static bool plug_and_activate(enum txvc_ftdi_emu_chip chip, const char *channel,
+        const char *ioThread) {
+    return plug_and_activate_with(chip, channel, 1, (const char *[]) { "io_thread", },
+            (const char *[]) { ioThread, });
+}
+
+static void set_bits(uint8_t *vector, int fromBitIdx, const char *bits) {
+    for (int i = 0; bits[i]; i++) {
+        const int idx = fromBitIdx + i;
+        if (bits[i] == '1') {
+            vector[idx / 8] |= (uint8_t) (1u << (idx % 8));
+        } else {
+            vector[idx / 8] &= (uint8_t) ~(1u << (idx % 8));
+        }
+    }
+}
+
+/* Shifts the same vector through driver and reference chain */
+static void shift_and_compare(int numBits) {
+    const size_t numBytes = (size_t) (numBits + 7) / 8;
+    memset(gTdo, 0, numBytes);
+    memset(gExpectedTdo, 0, numBytes);
+    txvc_jtag_sim_shift(&gReference, numBits, gTms, gTdi, gExpectedTdo);
+    ASSERT_TRUE(driver_ftdi_generic.shift_bits(gCtx, numBits, gTms, gTdi, gTdo));
+    EXPECT_EQ(SPAN(gExpectedTdo, numBytes), SPAN(gTdo, numBytes));
+}
+
+DO_BEFORE_EACH_CASE() {
+    gCtx = NULL;
+    srand(1);
+    memset(gTms, 0, sizeof(gTms));
+    memset(gTdi, 0, sizeof(gTdi));
+    ASSERT_TRUE(txvc_jtag_sim_init(&gReference, NUM_DEVICES, gDevices));
+}
+
+DO_AFTER_EACH_CASE() {
+    if (gCtx) {
+        driver_ftdi_generic.deactivate(gCtx);
+        free(gCtx);
+    }
+    txvc_ftdi_emu_unplug();
+}
+
+TEST_CASE(Activate_ChipIsFoundAndInSync) {
+    ASSERT_TRUE(plug_and_activate(TXVC_FTDI_EMU_FT2232H, "B", "0"));
+    struct txvc_ftdi_emu_stats stats;
+    txvc_ftdi_emu_get_stats(1, &stats);
+    EXPECT_EQ(1ul, (unsigned long) stats.numBadCommands);
+    txvc_ftdi_emu_get_stats(0, &stats);
+    EXPECT_EQ(0ul, (unsigned long) stats.numWrites);
+}
+
+TEST_CASE(ActivateMissingChannel_Fails) {
+    const struct txvc_ftdi_emu_options options = {
+        .chip = TXVC_FTDI_EMU_FT232H,
+        .serialNumber = "FT0EMU",
+        .numDevices = NUM_DEVICES,
+        .devices = gDevices,
+    };
+    ASSERT_TRUE(txvc_ftdi_emu_plug(&options));
+    const char *names[] = {
+        "device", "vid", "pid", "channel", "read_latency_millis", "d4", "d5", "d6", "d7",
+    };
+    const char *values[] = {
+        "ft2232h", "0403", "6010", "A", "1", "ignored", "ignored", "ignored", "ignored",
+    };
+    void *ctx = calloc(1, driver_ftdi_generic.contextSize);
+    EXPECT_FALSE(driver_ftdi_generic.activate(ctx, sizeof(names) / sizeof(names[0]), names,
+                values));
+    free(ctx);
+}
+
+TEST_CASE(IdcodeScan_IdcodesAreRead) {
+    ASSERT_TRUE(plug_and_activate(TXVC_FTDI_EMU_FT232H, "A", "0"));
+    set_bits(gTms, 0, "111110100");
+    set_bits(gTms, 9 + 63, "110");
+    shift_and_compare(9 + 64 + 3);
+    for (int i = 0; i < NUM_DEVICES; i++) {
+        uint32_t idcode = 0;
+        for (int bit = 0; bit < 32; bit++) {
+            const int idx = 9 + i * 32 + bit;
+            idcode |= (uint32_t) ((gTdo[idx / 8] >> (idx % 8)) & 1u) << bit;
+        }
+        EXPECT_EQ((unsigned) gDevices[i].idcode, (unsigned) idcode);
+    }
+}
+
+TEST_CASE(LongScans_TdoAndChainStateMatchReference) {
+    ASSERT_TRUE(plug_and_activate(TXVC_FTDI_EMU_FT2232H, "A", "0"));
+    /* Load BYPASS into the first device and IDCODE into the second one */
+    set_bits(gTms, 0, "1111101100");
+    set_bits(gTdi, 10, "1111110111");
+    set_bits(gTms, 10, "0000000001");
+    set_bits(gTms, 20, "1100");
+    const int numBits = 8 * MAX_VECTOR_BYTES;
+    for (int i = 24; i < numBits - 2; i++) {
+        set_bits(gTdi, i, rand() & 1 ? "1" : "0");
+    }
+    set_bits(gTms, numBits - 3, "110");
+    shift_and_compare(numBits);
+    struct txvc_jtag_sim chain;
+    txvc_ftdi_emu_get_chain(0, &chain);
+    EXPECT_EQ(0x3fu, txvc_jtag_sim_device_ir(&chain, 0));
+    EXPECT_EQ(0x0eu, txvc_jtag_sim_device_ir(&chain, 1));
+}
+
+/*
+ * Loads `firstIr` into the first device and BYPASS into the second one, then shifts random DR
+ * that ends at `numBits`. DR is shifted from bit 24 to bit `numBits` - 2.
+ */
+static void set_dr_scan(const char *firstIr, int numBits) {
+    set_bits(gTms, 0, "1111101100");
+    set_bits(gTdi, 10, firstIr);
+    set_bits(gTdi, 16, "1111");
+    set_bits(gTms, 10, "0000000001");
+    set_bits(gTms, 20, "1100");
+    for (int i = 24; i < numBits - 2; i++) {
+        set_bits(gTdi, i, rand() & 1 ? "1" : "0");
+    }
+    set_bits(gTms, numBits - 3, "110");
+}
+
+static bool plug_and_activate_with_write_only_cfg_in(void) {
+    return plug_and_activate_with(TXVC_FTDI_EMU_FT2232H, "A", 3,
+            (const char *[]) { "wo_ir_lengths", "wo_opcodes", "wo_tdo_fill", },
+            (const char *[]) { "6/4", "05", "a5", });
+}
+
+TEST_CASE(WriteOnlyDrScan_TdoIsFilledAndChainStateMatchesReference) {
+    ASSERT_TRUE(plug_and_activate_with_write_only_cfg_in());
+    const int numBits = 8 * MAX_VECTOR_BYTES;
+    const size_t numBytes = MAX_VECTOR_BYTES;
+    set_dr_scan("101000", numBits);
+    memset(gTdo, 0, numBytes);
+    memset(gExpectedTdo, 0, numBytes);
+    txvc_jtag_sim_shift(&gReference, numBits, gTms, gTdi, gExpectedTdo);
+    for (int i = 24; i < numBits - 2; i++) {
+        set_bits(gExpectedTdo, i, (0xa5 >> (i % 8)) & 1 ? "1" : "0");
+    }
+    ASSERT_TRUE(driver_ftdi_generic.shift_bits(gCtx, numBits, gTms, gTdi, gTdo));
+    EXPECT_EQ(SPAN(gExpectedTdo, numBytes), SPAN(gTdo, numBytes));
+
+    /* Data has reached the chip, but was not read back */
+    struct txvc_jtag_sim chain;
+    txvc_ftdi_emu_get_chain(0, &chain);
+    EXPECT_EQ(TXVC_JTAG_SIM_CFG_IN, txvc_jtag_sim_device_ir(&chain, 0));
+    EXPECT_EQ(0x0fu, txvc_jtag_sim_device_ir(&chain, 1));
+    EXPECT_TRUE(txvc_jtag_sim_config_bits(&gReference, 0) > 0);
+    EXPECT_EQ((unsigned long) txvc_jtag_sim_config_bits(&gReference, 0),
+            (unsigned long) txvc_jtag_sim_config_bits(&chain, 0));
+    struct txvc_ftdi_emu_stats stats;
+    txvc_ftdi_emu_get_stats(0, &stats);
+    EXPECT_TRUE(stats.numRxBytes < numBytes / 8);
+}
+
+TEST_CASE(DrScanOfOtherInstruction_TdoIsRead) {
+    ASSERT_TRUE(plug_and_activate_with_write_only_cfg_in());
+    /* IDCODE */
+    set_dr_scan("100100", 8 * MAX_VECTOR_BYTES);
+    shift_and_compare(8 * MAX_VECTOR_BYTES);
+    struct txvc_jtag_sim chain;
+    txvc_ftdi_emu_get_chain(0, &chain);
+    EXPECT_EQ(0x09u, txvc_jtag_sim_device_ir(&chain, 0));
+}
+
+static bool plug_and_activate_with_write_behind(void) {
+    return plug_and_activate_with(TXVC_FTDI_EMU_FT2232H, "A", 1,
+            (const char *[]) { "write_behind", }, (const char *[]) { "1", });
+}
+
+/* Takes TAP from any state to Run-Test/Idle */
+static void set_reset_to_idle(void) {
+    set_bits(gTms, 0, "111110");
+}
+
+/* Reads IDCODEs that are selected after reset, starting from Run-Test/Idle */
+static void set_idcode_scan(void) {
+    set_bits(gTms, 0, "100");
+    set_bits(gTms, 3 + 63, "110");
+}
+
+TEST_CASE(TmsOnlyVectorWithWriteBehind_IsSentWithNextVector) {
+    ASSERT_TRUE(plug_and_activate_with_write_behind());
+    struct txvc_ftdi_emu_stats before;
+    txvc_ftdi_emu_get_stats(0, &before);
+
+    set_reset_to_idle();
+    shift_and_compare(6);
+    struct txvc_ftdi_emu_stats stats;
+    txvc_ftdi_emu_get_stats(0, &stats);
+    EXPECT_EQ((unsigned long) before.numWrites, (unsigned long) stats.numWrites);
+    EXPECT_EQ((unsigned long) before.numClocks, (unsigned long) stats.numClocks);
+
+    memset(gTms, 0, sizeof(gTms));
+    set_idcode_scan();
+    shift_and_compare(3 + 64 + 3);
+    txvc_ftdi_emu_get_stats(0, &stats);
+    EXPECT_EQ((unsigned long) before.numWrites + 1, (unsigned long) stats.numWrites);
+    EXPECT_EQ((unsigned long) (before.numClocks + txvc_jtag_sim_num_clocks(&gReference)),
+            (unsigned long) stats.numClocks);
+}
+
+TEST_CASE(WriteFailureWithWriteBehind_IsReportedByNextVector) {
+    ASSERT_TRUE(plug_and_activate_with_write_behind());
+    txvc_ftdi_emu_fail_next_write(0);
+
+    set_reset_to_idle();
+    EXPECT_TRUE(driver_ftdi_generic.shift_bits(gCtx, 6, gTms, gTdi, gTdo));
+
+    memset(gTms, 0, sizeof(gTms));
+    set_idcode_scan();
+    EXPECT_FALSE(driver_ftdi_generic.shift_bits(gCtx, 3 + 64 + 3, gTms, gTdi, gTdo));
+}
+
+TEST_CASE(WriteFailure_IsReportedRightAway) {
+    ASSERT_TRUE(plug_and_activate(TXVC_FTDI_EMU_FT2232H, "A", "0"));
+    txvc_ftdi_emu_fail_next_write(0);
+
+    set_reset_to_idle();
+    EXPECT_FALSE(driver_ftdi_generic.shift_bits(gCtx, 6, gTms, gTdi, gTdo));
+}
+
+static void random_vectors_match_reference(void) {
+    /* Random TMS walks through all states, TDO only matters in Shift-xR but is compared anyway */
+    for (int iter = 0; iter < 50; iter++) {
+        const int numBits = 1 + rand() % (8 * MAX_VECTOR_BYTES);
+        for (int i = 0; i < (numBits + 7) / 8; i++) {
+            gTms[i] = (uint8_t) (rand() & rand() & rand());
+            gTdi[i] = (uint8_t) rand();
+        }
+        shift_and_compare(numBits);
+    }
+}
+
+TEST_CASE(RandomVectors_TdoMatchesReference) {
+    ASSERT_TRUE(plug_and_activate(TXVC_FTDI_EMU_FT2232H, "A", "0"));
+    random_vectors_match_reference();
+}
+
+TEST_CASE(RandomVectorsWithIoThread_TdoMatchesReference) {
+    ASSERT_TRUE(plug_and_activate(TXVC_FTDI_EMU_FT232H, "A", "1"));
+    random_vectors_match_reference();
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ttest/test.h"
+
+#include "txvc/jtag_sim.h"
+
+#include <stdint.h>
+
+TEST_SUITE(JtagSim)
+
+static const struct txvc_jtag_sim_device gDevices[] = {
+    { .irLength = 6, .idcode = 0x13631093u, .idcodeOpcode = 0x09u, },
+    { .irLength = 4, .idcode = 0x4ba00477u, .idcodeOpcode = 0x0eu, },
+    { .irLength = 5, },
+};
+
+#define NUM_DEVICES ((int) (sizeof(gDevices) / sizeof(gDevices[0])))
+#define TOTAL_IR_LENGTH (6 + 4 + 5)
+
+static struct txvc_jtag_sim gSim;
+
+static void clock_tms(const char *path) {
+    for (const char *p = path; *p; p++) {
+        txvc_jtag_sim_clock(&gSim, *p == '1', false);
+    }
+}
+
+/* Shifts LSB first, if `exitShift` is set the last bit is shifted with TMS=1 */
+static unsigned long shift(int numBits, unsigned long tdi, bool exitShift) {
+    unsigned long tdo = 0;
+    for (int i = 0; i < numBits; i++) {
+        const bool tms = exitShift && i == numBits - 1;
+        const bool bit = txvc_jtag_sim_clock(&gSim, tms, (tdi >> i) & 1u);
+        tdo |= (unsigned long) bit << i;
+    }
+    return tdo;
+}
+
+static void load_instructions(unsigned long ir0, unsigned long ir1, unsigned long ir2) {
+    clock_tms("01100");
+    shift(TOTAL_IR_LENGTH, ir0 | ir1 << 6 | ir2 << 10, true);
+    clock_tms("10");
+}
+
+DO_BEFORE_EACH_CASE() {
+    ASSERT_TRUE(txvc_jtag_sim_init(&gSim, NUM_DEVICES, gDevices));
+    clock_tms("11111");
+}
+
+DO_AFTER_EACH_CASE() {
+}
+
+TEST_CASE(DrScanAfterReset_IdcodesAndBypassAreCaptured) {
+    clock_tms("0100");
+    EXPECT_EQ((unsigned long) gDevices[0].idcode, shift(32, ~0ul, false));
+    EXPECT_EQ((unsigned long) gDevices[1].idcode, shift(32, ~0ul, false));
+    /* Device without IDCODE is in BYPASS, then TDI comes through */
+    EXPECT_EQ(0x2ul, shift(2, ~0ul, true));
+}
+
+TEST_CASE(IrScan_MandatoryBitsAreCapturedAndInstructionsAreUpdated) {
+    clock_tms("01100");
+    EXPECT_EQ(0x1ul | 0x1ul << 6 | 0x1ul << 10,
+            shift(TOTAL_IR_LENGTH, 0x02ul | 0x05ul << 6 | 0x11ul << 10, true));
+    EXPECT_EQ(0x09u, txvc_jtag_sim_device_ir(&gSim, 0));
+    clock_tms("10");
+    EXPECT_EQ(0x02u, txvc_jtag_sim_device_ir(&gSim, 0));
+    EXPECT_EQ(0x05u, txvc_jtag_sim_device_ir(&gSim, 1));
+    EXPECT_EQ(0x11u, txvc_jtag_sim_device_ir(&gSim, 2));
+}
+
+TEST_CASE(DrScanInBypass_DataIsDelayedByOneBitPerDevice) {
+    load_instructions(0x3f, 0x0f, 0x1f);
+    clock_tms("100");
+    EXPECT_EQ(0xa5ul << NUM_DEVICES, shift(8 + NUM_DEVICES, 0xa5ul, true));
+}
+
+TEST_CASE(DrScanOfIdcodeInstruction_IdcodeIsCapturedAgain) {
+    load_instructions(0x3f, 0x0e, 0x1f);
+    clock_tms("100");
+    EXPECT_EQ((unsigned long) gDevices[1].idcode << 1, shift(1 + 32 + 1, 0ul, true));
+}
+
+TEST_CASE(FiveTmsHighFromShiftDr_ChainIsReset) {
+    load_instructions(0x3f, 0x0f, 0x1f);
+    clock_tms("100");
+    EXPECT_FALSE(txvc_jtag_sim_in_reset(&gSim));
+    clock_tms("11111");
+    EXPECT_TRUE(txvc_jtag_sim_in_reset(&gSim));
+    EXPECT_EQ(0x09u, txvc_jtag_sim_device_ir(&gSim, 0));
+    EXPECT_EQ(0x0eu, txvc_jtag_sim_device_ir(&gSim, 1));
+    EXPECT_EQ(0x1fu, txvc_jtag_sim_device_ir(&gSim, 2));
+}
+
+TEST_CASE(Clocks_AreCounted) {
+    EXPECT_EQ(5ul, (unsigned long) txvc_jtag_sim_num_clocks(&gSim));
+    clock_tms("0100");
+    EXPECT_EQ(9ul, (unsigned long) txvc_jtag_sim_num_clocks(&gSim));
+}
+
+TEST_CASE(BadDevices_InitFails) {
+    const struct txvc_jtag_sim_device shortIr = { .irLength = 1, };
+    const struct txvc_jtag_sim_device idcodeIsBypass = {
+        .irLength = 4, .idcode = 0x1u, .idcodeOpcode = 0xfu,
+    };
+    const struct txvc_jtag_sim_device idcodeIsTooLong = {
+        .irLength = 4, .idcode = 0x1u, .idcodeOpcode = 0x10u,
+    };
+    struct txvc_jtag_sim sim;
+    EXPECT_FALSE(txvc_jtag_sim_init(&sim, 0, gDevices));
+    EXPECT_FALSE(txvc_jtag_sim_init(&sim, 1, &shortIr));
+    EXPECT_FALSE(txvc_jtag_sim_init(&sim, 1, &idcodeIsBypass));
+    EXPECT_FALSE(txvc_jtag_sim_init(&sim, 1, &idcodeIsTooLong));
+}
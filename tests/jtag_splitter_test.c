@@ -26,30 +26,799 @@
 
 #include "ttest/test.h"
 
+#include "txvc/bit_vector.h"
 #include "txvc/jtag_splitter.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 TEST_SUITE(JtagSplitter)
 
-static struct txvc_jtag_splitter gUut;
+struct recorded_event {
+    enum txvc_jtag_split_event_kind kind;
+    int fromBitIdx;
+    int toBitIdx;
+    bool incomplete;
+};
+
+struct mock {
+    struct recorded_event events[4096];
+    int numEvents;
+};
 
-static struct mock {
-    int dummy;
-} gMock;
+static struct txvc_jtag_splitter gUut;
+static struct mock gMock;
+static struct txvc_jtag_splitter gReference;
+static struct mock gReferenceMock;
 
 static bool mock_splitter_callback(const struct txvc_jtag_split_event *event, void* extra) {
-    (void) event;
-    (void) extra;
+    struct mock *mock = extra;
+    if (mock->numEvents >= (int) (sizeof(mock->events) / sizeof(mock->events[0]))) {
+        return false;
+    }
+    struct recorded_event *r = &mock->events[mock->numEvents++];
+    memset(r, 0, sizeof(*r));
+    const struct txvc_jtag_split_shift_tms *tms = txvc_jtag_split_cast_to_shift_tms(event);
+    const struct txvc_jtag_split_shift_tdi *tdi = txvc_jtag_split_cast_to_shift_tdi(event);
+    if (tms) {
+        r->kind = JTAG_SPLIT_shift_tms;
+        r->fromBitIdx = tms->fromBitIdx;
+        r->toBitIdx = tms->toBitIdx;
+    } else if (tdi) {
+        r->kind = JTAG_SPLIT_shift_tdi;
+        r->fromBitIdx = tdi->fromBitIdx;
+        r->toBitIdx = tdi->toBitIdx;
+        r->incomplete = tdi->incomplete;
+    } else {
+        r->kind = JTAG_SPLIT_flush_all;
+    }
+    return true;
+}
+
+static void expect_same_events(const struct mock *expected, const struct mock *actual) {
+    ASSERT_EQ(expected->numEvents, actual->numEvents);
+    for (int i = 0; i < expected->numEvents; i++) {
+        const struct recorded_event *e = &expected->events[i];
+        const struct recorded_event *a = &actual->events[i];
+        EXPECT_EQ((int) e->kind, (int) a->kind);
+        EXPECT_EQ(e->fromBitIdx, a->fromBitIdx);
+        EXPECT_EQ(e->toBitIdx, a->toBitIdx);
+        EXPECT_EQ((int) e->incomplete, (int) a->incomplete);
+    }
+}
+
+static void expect_event(int idx, enum txvc_jtag_split_event_kind kind,
+        int fromBitIdx, int toBitIdx, bool incomplete) {
+    ASSERT_TRUE(idx < gMock.numEvents);
+    const struct recorded_event *a = &gMock.events[idx];
+    EXPECT_EQ((int) kind, (int) a->kind);
+    EXPECT_EQ(fromBitIdx, a->fromBitIdx);
+    EXPECT_EQ(toBitIdx, a->toBitIdx);
+    EXPECT_EQ((int) incomplete, (int) a->incomplete);
+}
+
+static inline void set_bit(uint8_t* p, int idx, bool bit) {
+    uint8_t* octet = p + idx / 8;
+    if (bit) *octet |= 1 << (idx % 8);
+    else *octet &= ~(1 << (idx % 8));
+}
+
+/*
+ * Fills TMS vector with alternating runs of random bits and zeros. Zero runs keep TAP in
+ * stable states (and shift states in particular) for a while, which resembles real traffic.
+ */
+static void random_tms(uint8_t *tms, int numBits) {
+    int bitIdx = 0;
+    while (bitIdx < numBits) {
+        for (int n = 1 + rand() % 12; n > 0 && bitIdx < numBits; n--) {
+            set_bit(tms, bitIdx++, rand() & 1);
+        }
+        for (int n = rand() % 300; n > 0 && bitIdx < numBits; n--) {
+            set_bit(tms, bitIdx++, false);
+        }
+    }
+}
+
+/* Builds vectors for scenarios that need particular TMS paths and TDI values */
+struct vector_builder {
+    uint8_t tms[1024];
+    uint8_t tdi[1024];
+    int numBits;
+};
+
+static void put_tms_path(struct vector_builder *b, const char *path) {
+    for (; *path; path++) {
+        set_bit(b->tms, b->numBits, *path == '1');
+        set_bit(b->tdi, b->numBits, false);
+        b->numBits++;
+    }
+}
+
+/* Shifts `numBits` of `value` LSB first and leaves shift state with the last bit */
+static void put_scan(struct vector_builder *b, unsigned value, int numBits) {
+    for (int i = 0; i < numBits; i++) {
+        set_bit(b->tms, b->numBits, i == numBits - 1);
+        set_bit(b->tdi, b->numBits, (value >> i) & 1u);
+        b->numBits++;
+    }
+}
+
+static int decode_with_ir(struct vector_builder *b, struct txvc_jtag_split_segment *segments,
+        int maxSegments) {
+    return txvc_jtag_splitter_decode(&gUut, b->numBits, b->tms, b->tdi, segments, maxSegments);
+}
+
+/* Records decoded segments in the same form as callback events, flush is implied */
+static bool decode_to_mock(struct txvc_jtag_splitter *splitter, int numBits, const uint8_t *tms,
+        struct mock *mock) {
+    static struct txvc_jtag_split_segment segments[TXVC_JTAG_SPLIT_MAX_SEGMENTS(4096 * 8)];
+    const int numSegments = txvc_jtag_splitter_decode(splitter, numBits, tms, NULL,
+            segments, TXVC_JTAG_SPLIT_MAX_SEGMENTS(numBits));
+    if (numSegments < 0) {
+        return false;
+    }
+    mock->numEvents = 0;
+    for (int i = 0; i < numSegments; i++) {
+        struct recorded_event *r = &mock->events[mock->numEvents++];
+        r->kind = segments[i].kind;
+        r->fromBitIdx = segments[i].fromBitIdx;
+        r->toBitIdx = segments[i].toBitIdx;
+        r->incomplete = segments[i].incomplete;
+    }
+    struct recorded_event *r = &mock->events[mock->numEvents++];
+    memset(r, 0, sizeof(*r));
+    r->kind = JTAG_SPLIT_flush_all;
     return true;
 }
 
 DO_BEFORE_EACH_CASE() {
     ASSERT_TRUE(txvc_jtag_splitter_init(&gUut, mock_splitter_callback, &gMock));
+    ASSERT_TRUE(txvc_jtag_splitter_init(&gReference, mock_splitter_callback, &gReferenceMock));
+    gMock.numEvents = 0;
+    gReferenceMock.numEvents = 0;
 }
 
 DO_AFTER_EACH_CASE() {
     ASSERT_TRUE(txvc_jtag_splitter_deinit(&gUut));
+    ASSERT_TRUE(txvc_jtag_splitter_deinit(&gReference));
+}
+
+TEST_CASE(ScanDr_TmsAndTdiShiftsAreSeparated) {
+    /* TLR -> RTI -> SELECT_DR -> CAPTURE_DR -> SHIFT_DR x 100 -> EXIT1_DR -> UPDATE_DR -> RTI */
+    uint8_t tms[16] = { 0 };
+    uint8_t tdi[16] = { 0 };
+    uint8_t tdo[16] = { 0 };
+    set_bit(tms, 1, true);
+    set_bit(tms, 103, true);
+    set_bit(tms, 104, true);
+    ASSERT_TRUE(txvc_jtag_splitter_process(&gUut, 106, tms, tdi, tdo));
+    ASSERT_EQ(4, gMock.numEvents);
+    expect_event(0, JTAG_SPLIT_shift_tms, 0, 4, false);
+    expect_event(1, JTAG_SPLIT_shift_tdi, 4, 104, false);
+    expect_event(2, JTAG_SPLIT_shift_tms, 104, 106, false);
+    expect_event(3, JTAG_SPLIT_flush_all, 0, 0, false);
+}
+
+TEST_CASE(ScanDrAcrossVectors_IncompleteShiftIsReported) {
+    uint8_t tms[16] = { 0 };
+    uint8_t tdi[16] = { 0 };
+    uint8_t tdo[16] = { 0 };
+    set_bit(tms, 1, true);
+    ASSERT_TRUE(txvc_jtag_splitter_process(&gUut, 77, tms, tdi, tdo));
+    ASSERT_EQ(3, gMock.numEvents);
+    expect_event(0, JTAG_SPLIT_shift_tms, 0, 4, false);
+    expect_event(1, JTAG_SPLIT_shift_tdi, 4, 77, true);
+    expect_event(2, JTAG_SPLIT_flush_all, 0, 0, false);
+
+    gMock.numEvents = 0;
+    memset(tms, 0, sizeof(tms));
+    set_bit(tms, 64, true);
+    ASSERT_TRUE(txvc_jtag_splitter_process(&gUut, 66, tms, tdi, tdo));
+    ASSERT_EQ(3, gMock.numEvents);
+    expect_event(0, JTAG_SPLIT_shift_tdi, 0, 65, false);
+    expect_event(1, JTAG_SPLIT_shift_tms, 65, 66, false);
+    expect_event(2, JTAG_SPLIT_flush_all, 0, 0, false);
+}
+
+TEST_CASE(RandomVectors_SameEventsAsBitwiseReference) {
+    static uint8_t tms[4096];
+    static uint8_t tdi[sizeof(tms)];
+    static uint8_t tdo[sizeof(tms)];
+    srand(42);
+    for (int round = 0; round < 200; round++) {
+        const int numBits = 1 + rand() % (int) (sizeof(tms) * 8);
+        random_tms(tms, numBits);
+        gMock.numEvents = 0;
+        gReferenceMock.numEvents = 0;
+        ASSERT_TRUE(txvc_jtag_splitter_process(&gUut, numBits, tms, tdi, tdo));
+        ASSERT_TRUE(txvc_jtag_splitter_process_bitwise(&gReference, numBits, tms, tdi, tdo));
+        expect_same_events(&gReferenceMock, &gMock);
+    }
+}
+
+TEST_CASE(ShortVectors_SameEventsAsBitwiseReference) {
+    uint8_t tms[2];
+    uint8_t tdi[sizeof(tms)] = { 0 };
+    uint8_t tdo[sizeof(tms)] = { 0 };
+    /* Every TMS combination of up to 16 bits, with TAP state carried over between vectors */
+    for (int numBits = 1; numBits <= 16; numBits++) {
+        for (unsigned pattern = 0; pattern < (1u << numBits); pattern++) {
+            tms[0] = pattern & 0xff;
+            tms[1] = (pattern >> 8) & 0xff;
+            gMock.numEvents = 0;
+            gReferenceMock.numEvents = 0;
+            ASSERT_TRUE(txvc_jtag_splitter_process(&gUut, numBits, tms, tdi, tdo));
+            ASSERT_TRUE(txvc_jtag_splitter_process_bitwise(&gReference, numBits, tms, tdi, tdo));
+            expect_same_events(&gReferenceMock, &gMock);
+        }
+    }
+}
+
+TEST_CASE(RandomVectors_DecodedSegmentsMatchCallbacks) {
+    static uint8_t tms[4096];
+    static uint8_t tdi[sizeof(tms)];
+    static uint8_t tdo[sizeof(tms)];
+    srand(7);
+    for (int round = 0; round < 200; round++) {
+        const int numBits = 1 + rand() % (int) (sizeof(tms) * 8);
+        random_tms(tms, numBits);
+        gReferenceMock.numEvents = 0;
+        ASSERT_TRUE(txvc_jtag_splitter_process(&gReference, numBits, tms, tdi, tdo));
+        ASSERT_TRUE(decode_to_mock(&gUut, numBits, tms, &gMock));
+        expect_same_events(&gReferenceMock, &gMock);
+    }
+}
+
+TEST_CASE(DenseVectors_FitIntoMaxSegments) {
+    /* Shortest possible TDI/TMS alternation: SHIFT -> EXIT1 -> PAUSE -> EXIT2 -> SHIFT */
+    uint8_t tms[64];
+    uint8_t tdi[sizeof(tms)] = { 0 };
+    uint8_t tdo[sizeof(tms)] = { 0 };
+    memset(tms, 0x55, sizeof(tms));
+    const uint8_t enterShiftDr = 0x02; /* TLR -> RTI -> SELECT_DR -> CAPTURE_DR -> SHIFT_DR */
+    ASSERT_TRUE(txvc_jtag_splitter_process(&gReference, 4, &enterShiftDr, tdi, tdo));
+    ASSERT_TRUE(txvc_jtag_splitter_process(&gUut, 4, &enterShiftDr, tdi, tdo));
+    for (int numBits = 1; numBits <= (int) sizeof(tms) * 8; numBits++) {
+        gReferenceMock.numEvents = 0;
+        ASSERT_TRUE(txvc_jtag_splitter_process(&gReference, numBits, tms, tdi, tdo));
+        ASSERT_TRUE(decode_to_mock(&gUut, numBits, tms, &gMock));
+        expect_same_events(&gReferenceMock, &gMock);
+    }
+}
+
+TEST_CASE(DecodeToSmallArray_FailsAndKeepsState) {
+    uint8_t tms[16] = { 0 };
+    uint8_t tdi[16] = { 0 };
+    uint8_t tdo[16] = { 0 };
+    struct txvc_jtag_split_segment segments[2];
+    set_bit(tms, 1, true);
+    set_bit(tms, 103, true);
+    set_bit(tms, 104, true);
+    ASSERT_EQ(-1, txvc_jtag_splitter_decode(&gUut, 106, tms, NULL, segments, 2));
+    ASSERT_TRUE(txvc_jtag_splitter_process(&gReference, 106, tms, tdi, tdo));
+    ASSERT_TRUE(decode_to_mock(&gUut, 106, tms, &gMock));
+    expect_same_events(&gReferenceMock, &gMock);
+}
+
+TEST_CASE(TrackIr_DrShiftIsMarkedWithLoadedInstructions) {
+    const int irLengths[] = { 6, 4 };
+    ASSERT_TRUE(txvc_jtag_splitter_track_ir(&gUut, 2, irLengths));
+    struct vector_builder b = { .numBits = 0 };
+    put_tms_path(&b, "01100"); /* TLR -> SHIFT_IR */
+    put_scan(&b, 0x05u | (0xau << 6), 10);
+    put_tms_path(&b, "10100"); /* EXIT_1_IR -> SHIFT_DR */
+    put_scan(&b, 0x1234u, 16);
+    put_tms_path(&b, "10");
+    struct txvc_jtag_split_segment segments[8];
+    ASSERT_EQ(5, decode_with_ir(&b, segments, 8));
+    EXPECT_EQ((int) JTAG_SPLIT_shift_tdi, (int) segments[1].kind);
+    EXPECT_EQ(0, (int) segments[1].irKnown);
+    EXPECT_EQ((int) JTAG_SPLIT_shift_tdi, (int) segments[3].kind);
+    EXPECT_EQ(1, (int) segments[3].irKnown);
+    EXPECT_EQ(0x05u, txvc_jtag_splitter_device_ir(&gUut, &segments[3], 0));
+    EXPECT_EQ(0xau, txvc_jtag_splitter_device_ir(&gUut, &segments[3], 1));
+}
+
+TEST_CASE(TrackIr_InstructionIsForgottenOnTapReset) {
+    const int irLengths[] = { 6 };
+    ASSERT_TRUE(txvc_jtag_splitter_track_ir(&gUut, 1, irLengths));
+    struct vector_builder b = { .numBits = 0 };
+    put_tms_path(&b, "01100");
+    put_scan(&b, 0x05u, 6);
+    put_tms_path(&b, "10" "111" "0100"); /* UPDATE_IR -> TLR -> SHIFT_DR */
+    put_scan(&b, 0u, 32);
+    struct txvc_jtag_split_segment segments[8];
+    ASSERT_EQ(4, decode_with_ir(&b, segments, 8));
+    EXPECT_EQ((int) JTAG_SPLIT_shift_tdi, (int) segments[3].kind);
+    EXPECT_EQ(0, (int) segments[3].irKnown);
+}
+
+TEST_CASE(TrackIr_ShortIrShiftLeavesInstructionUnknown) {
+    const int irLengths[] = { 6, 6 };
+    ASSERT_TRUE(txvc_jtag_splitter_track_ir(&gUut, 2, irLengths));
+    struct vector_builder b = { .numBits = 0 };
+    put_tms_path(&b, "01100");
+    put_scan(&b, 0x05u, 6);
+    put_tms_path(&b, "10100");
+    put_scan(&b, 0u, 8);
+    put_tms_path(&b, "10");
+    struct txvc_jtag_split_segment segments[8];
+    ASSERT_EQ(5, decode_with_ir(&b, segments, 8));
+    EXPECT_EQ(0, (int) segments[3].irKnown);
+}
+
+TEST_CASE(SameState_CopyBeforeDecodingMatchesOnlyUntilInstructionChanges) {
+    const int irLengths[] = { 6 };
+    ASSERT_TRUE(txvc_jtag_splitter_track_ir(&gUut, 1, irLengths));
+    struct vector_builder b = { .numBits = 0 };
+    put_tms_path(&b, "01100");
+    put_scan(&b, 0x05u, 6);
+    put_tms_path(&b, "1011111"); /* UPDATE_IR -> RTI -> TLR */
+    struct txvc_jtag_split_segment segments[8];
+    const struct txvc_jtag_splitter before = gUut;
+    EXPECT_EQ(1, (int) txvc_jtag_splitter_same_state(&before, &gUut));
+    ASSERT_EQ(3, decode_with_ir(&b, segments, 8));
+    /* Back in TLR, but the last shifted instruction is still there */
+    EXPECT_EQ(0, (int) txvc_jtag_splitter_same_state(&before, &gUut));
+    const struct txvc_jtag_splitter after = gUut;
+    ASSERT_EQ(3, decode_with_ir(&b, segments, 8));
+    EXPECT_EQ(1, (int) txvc_jtag_splitter_same_state(&after, &gUut));
+}
+
+static void expect_op(const struct txvc_jtag_op *op, enum txvc_jtag_op_kind kind,
+        int fromBitIdx, int toBitIdx, bool exitShift) {
+    EXPECT_EQ((int) kind, (int) op->kind);
+    EXPECT_EQ(fromBitIdx, op->fromBitIdx);
+    EXPECT_EQ(toBitIdx, op->toBitIdx);
+    EXPECT_EQ((int) exitShift, (int) op->exitShift);
+}
+
+TEST_CASE(DecodeOps_ScansAndLongIdleRunsAreSeparated) {
+    struct vector_builder b = { .numBits = 0 };
+    put_tms_path(&b, "0" "0000000000" "100"); /* TLR -> RTI x 10 -> SHIFT_DR */
+    put_scan(&b, 0xa5u, 8);
+    put_tms_path(&b, "10" "0000" "1100"); /* EXIT1_DR -> RTI x 4 -> SHIFT_IR */
+    put_scan(&b, 0x05u, 6);
+    put_tms_path(&b, "10");
+    struct txvc_jtag_op ops[8];
+    ASSERT_EQ(7, txvc_jtag_splitter_decode_ops(&gUut, b.numBits, b.tms, ops, 8));
+    expect_op(&ops[0], TXVC_JTAG_OP_TMS_PATH, 0, 1, false);
+    expect_op(&ops[1], TXVC_JTAG_OP_IDLE_CLOCKS, 1, 11, false);
+    expect_op(&ops[2], TXVC_JTAG_OP_TMS_PATH, 11, 14, false);
+    expect_op(&ops[3], TXVC_JTAG_OP_SCAN_DR, 14, 22, true);
+    expect_op(&ops[4], TXVC_JTAG_OP_TMS_PATH, 22, 32, false);
+    expect_op(&ops[5], TXVC_JTAG_OP_SCAN_IR, 32, 38, true);
+    expect_op(&ops[6], TXVC_JTAG_OP_TMS_PATH, 38, 40, false);
+}
+
+TEST_CASE(DecodeOpsScanAcrossVectors_ShiftIsNotExited) {
+    struct vector_builder b = { .numBits = 0 };
+    put_tms_path(&b, "0100" "0000");
+    struct txvc_jtag_op ops[4];
+    ASSERT_EQ(2, txvc_jtag_splitter_decode_ops(&gUut, b.numBits, b.tms, ops, 4));
+    expect_op(&ops[0], TXVC_JTAG_OP_TMS_PATH, 0, 4, false);
+    expect_op(&ops[1], TXVC_JTAG_OP_SCAN_DR, 4, 8, false);
+    b.numBits = 0;
+    put_scan(&b, 0u, 20);
+    put_tms_path(&b, "1");
+    ASSERT_EQ(2, txvc_jtag_splitter_decode_ops(&gUut, b.numBits, b.tms, ops, 4));
+    expect_op(&ops[0], TXVC_JTAG_OP_SCAN_DR, 0, 20, true);
+    expect_op(&ops[1], TXVC_JTAG_OP_TMS_PATH, 20, 21, false);
+}
+
+TEST_CASE(DecodeOpsRandomVectors_OpsCoverVectorAndScansMatchSegments) {
+    static uint8_t tms[4096];
+    static struct txvc_jtag_op ops[TXVC_JTAG_MAX_OPS(sizeof(tms) * 8)];
+    static struct txvc_jtag_split_segment segments[TXVC_JTAG_SPLIT_MAX_SEGMENTS(sizeof(tms) * 8)];
+    srand(3);
+    for (int round = 0; round < 20; round++) {
+        const int numBits = 1 + rand() % (int) (sizeof(tms) * 8);
+        random_tms(tms, numBits);
+        const int numOps = txvc_jtag_splitter_decode_ops(&gUut, numBits, tms,
+                ops, TXVC_JTAG_MAX_OPS(numBits));
+        const int numSegments = txvc_jtag_splitter_decode(&gReference, numBits, tms, NULL,
+                segments, TXVC_JTAG_SPLIT_MAX_SEGMENTS(numBits));
+        ASSERT_TRUE(numOps > 0);
+        ASSERT_TRUE(numSegments > 0);
+        ASSERT_TRUE(txvc_jtag_splitter_same_state(&gReference, &gUut));
+        int bitIdx = 0;
+        int segmentIdx = 0;
+        for (int i = 0; i < numOps; i++) {
+            const struct txvc_jtag_op *op = &ops[i];
+            ASSERT_EQ(bitIdx, op->fromBitIdx);
+            ASSERT_TRUE(op->toBitIdx > op->fromBitIdx);
+            bitIdx = op->toBitIdx;
+            if (op->kind == TXVC_JTAG_OP_IDLE_CLOCKS) {
+                ASSERT_TRUE(op->toBitIdx - op->fromBitIdx >= TXVC_JTAG_MIN_IDLE_CLOCKS);
+                for (int j = op->fromBitIdx; j < op->toBitIdx; j++) {
+                    ASSERT_EQ(0, (tms[j / 8] >> (j % 8)) & 1);
+                }
+            }
+            if (op->kind != TXVC_JTAG_OP_SCAN_IR && op->kind != TXVC_JTAG_OP_SCAN_DR) {
+                continue;
+            }
+            while (segments[segmentIdx].kind != JTAG_SPLIT_shift_tdi) {
+                segmentIdx++;
+            }
+            const struct txvc_jtag_split_segment *s = &segments[segmentIdx++];
+            EXPECT_EQ(s->fromBitIdx, op->fromBitIdx);
+            EXPECT_EQ(s->toBitIdx, op->toBitIdx);
+            EXPECT_EQ((int) !s->incomplete, (int) op->exitShift);
+        }
+        ASSERT_EQ(numBits, bitIdx);
+        for (; segmentIdx < numSegments; segmentIdx++) {
+            EXPECT_EQ((int) JTAG_SPLIT_shift_tms, (int) segments[segmentIdx].kind);
+        }
+    }
+}
+
+TEST_CASE(DecodeOpsToSmallArray_FailsAndKeepsState) {
+    struct vector_builder b = { .numBits = 0 };
+    put_tms_path(&b, "0100");
+    put_scan(&b, 0u, 8);
+    put_tms_path(&b, "10");
+    struct txvc_jtag_op ops[3];
+    ASSERT_EQ(-1, txvc_jtag_splitter_decode_ops(&gUut, b.numBits, b.tms, ops, 2));
+    ASSERT_EQ(3, txvc_jtag_splitter_decode_ops(&gUut, b.numBits, b.tms, ops, 3));
+    expect_op(&ops[0], TXVC_JTAG_OP_TMS_PATH, 0, 4, false);
+}
+
+TEST_CASE(TapFollow_OnlyResetAndIdleAreStable) {
+    struct txvc_jtag_tap tap;
+    txvc_jtag_tap_init(&tap);
+    EXPECT_TRUE(txvc_jtag_tap_is_stable(&tap));
+    struct vector_builder b = { .numBits = 0 };
+    put_tms_path(&b, "0100"); /* TLR -> SHIFT_DR */
+    txvc_jtag_tap_follow(&tap, b.numBits, b.tms);
+    EXPECT_FALSE(txvc_jtag_tap_is_stable(&tap));
+    b.numBits = 0;
+    put_tms_path(&b, "110"); /* SHIFT_DR -> RTI */
+    txvc_jtag_tap_follow(&tap, b.numBits, b.tms);
+    EXPECT_TRUE(txvc_jtag_tap_is_stable(&tap));
+}
+
+TEST_CASE(TapFollowRandomVectors_SameAsBitByBit) {
+    static uint8_t tms[4096];
+    random_tms(tms, sizeof(tms) * 8);
+    struct txvc_jtag_tap whole;
+    struct txvc_jtag_tap bitwise;
+    txvc_jtag_tap_init(&whole);
+    txvc_jtag_tap_init(&bitwise);
+    for (int numBits = 1; numBits < 2000; numBits += 7) {
+        txvc_jtag_tap_follow(&whole, numBits, tms);
+        for (int i = 0; i < numBits; i++) {
+            uint8_t bit = (tms[i / 8] >> (i % 8)) & 1;
+            txvc_jtag_tap_follow(&bitwise, 1, &bit);
+        }
+        ASSERT_TRUE(txvc_jtag_tap_same_state(&whole, &bitwise));
+    }
+}
+
+TEST_CASE(TapMove_ReachesTargetState) {
+    struct txvc_jtag_tap reset;
+    struct txvc_jtag_tap idle;
+    struct txvc_jtag_tap shift;
+    txvc_jtag_tap_init(&reset);
+    txvc_jtag_tap_init(&idle);
+    txvc_jtag_tap_init(&shift);
+    const uint8_t toIdle = 0x00;
+    const uint8_t toShiftDr = 0x02;
+    txvc_jtag_tap_follow(&idle, 1, &toIdle);
+    txvc_jtag_tap_follow(&shift, 4, &toShiftDr);
+
+    uint8_t tms;
+    struct txvc_jtag_tap tap = reset;
+    ASSERT_EQ(0, txvc_jtag_tap_move(&tap, &reset, &tms));
+    int numBits = txvc_jtag_tap_move(&tap, &idle, &tms);
+    ASSERT_TRUE(numBits > 0);
+    txvc_jtag_tap_follow(&tap, numBits, &tms);
+    EXPECT_TRUE(txvc_jtag_tap_same_state(&tap, &idle));
+    numBits = txvc_jtag_tap_move(&tap, &reset, &tms);
+    ASSERT_TRUE(numBits > 0);
+    txvc_jtag_tap_follow(&tap, numBits, &tms);
+    EXPECT_TRUE(txvc_jtag_tap_same_state(&tap, &reset));
+    EXPECT_EQ(-1, txvc_jtag_tap_move(&tap, &shift, &tms));
 }
 
 /*
- * TODO implement tests
+ * Chain model for virtual device tests. Devices have IDCODE (unless it is 0), BYPASS and a user
+ * instruction that selects a data register which keeps its value.
  */
+enum sim_state {
+    S_TLR, S_RTI, S_SEL_DR, S_CAP_DR, S_SHIFT_DR, S_EX1_DR, S_PAUSE_DR, S_EX2_DR, S_UPD_DR,
+    S_SEL_IR, S_CAP_IR, S_SHIFT_IR, S_EX1_IR, S_PAUSE_IR, S_EX2_IR, S_UPD_IR,
+};
+
+static const uint8_t gSimNextState[16][2] = {
+    [S_TLR] = { S_RTI, S_TLR },
+    [S_RTI] = { S_RTI, S_SEL_DR },
+    [S_SEL_DR] = { S_CAP_DR, S_SEL_IR },
+    [S_CAP_DR] = { S_SHIFT_DR, S_EX1_DR },
+    [S_SHIFT_DR] = { S_SHIFT_DR, S_EX1_DR },
+    [S_EX1_DR] = { S_PAUSE_DR, S_UPD_DR },
+    [S_PAUSE_DR] = { S_PAUSE_DR, S_EX2_DR },
+    [S_EX2_DR] = { S_SHIFT_DR, S_UPD_DR },
+    [S_UPD_DR] = { S_RTI, S_SEL_DR },
+    [S_SEL_IR] = { S_CAP_IR, S_TLR },
+    [S_CAP_IR] = { S_SHIFT_IR, S_EX1_IR },
+    [S_SHIFT_IR] = { S_SHIFT_IR, S_EX1_IR },
+    [S_EX1_IR] = { S_PAUSE_IR, S_UPD_IR },
+    [S_PAUSE_IR] = { S_PAUSE_IR, S_EX2_IR },
+    [S_EX2_IR] = { S_SHIFT_IR, S_UPD_IR },
+    [S_UPD_IR] = { S_RTI, S_SEL_DR },
+};
+
+#define SIM_IDCODE 0x1u
+#define SIM_USER 0x2u
+#define SIM_USER_BITS 8
+
+struct sim_device {
+    int irLength;
+    uint32_t idcode;
+    uint32_t ir;
+    uint64_t shiftReg;
+    int shiftBits;
+    uint32_t userReg;
+};
+
+struct sim_chain {
+    int state;
+    int numDevices;
+    struct sim_device devices[4]; /* Starting from the closest to TDO */
+};
+
+static uint32_t sim_bypass(const struct sim_device *d) {
+    return (uint32_t) ((UINT64_C(1) << d->irLength) - 1u);
+}
+
+static void sim_add_device(struct sim_chain *sim, int irLength, uint32_t idcode) {
+    struct sim_device *d = &sim->devices[sim->numDevices++];
+    memset(d, 0, sizeof(*d));
+    d->irLength = irLength;
+    d->idcode = idcode;
+    d->ir = idcode ? SIM_IDCODE : sim_bypass(d);
+}
+
+static bool sim_clock(struct sim_chain *sim, bool tms, bool tdi) {
+    bool tdo = false;
+    if (sim->state == S_SHIFT_DR || sim->state == S_SHIFT_IR) {
+        bool in = tdi;
+        for (int i = sim->numDevices - 1; i >= 0; i--) {
+            struct sim_device *d = &sim->devices[i];
+            const bool out = d->shiftReg & 1u;
+            d->shiftReg = (d->shiftReg >> 1) | ((uint64_t) in << (d->shiftBits - 1));
+            in = out;
+        }
+        tdo = in;
+    }
+    sim->state = gSimNextState[sim->state][tms];
+    for (int i = 0; i < sim->numDevices; i++) {
+        struct sim_device *d = &sim->devices[i];
+        switch (sim->state) {
+            case S_TLR:
+                d->ir = d->idcode ? SIM_IDCODE : sim_bypass(d);
+                break;
+            case S_CAP_IR:
+                d->shiftReg = 0x1u;
+                d->shiftBits = d->irLength;
+                break;
+            case S_CAP_DR:
+                if (d->ir == SIM_IDCODE && d->idcode) {
+                    d->shiftReg = d->idcode;
+                    d->shiftBits = 32;
+                } else if (d->ir == SIM_USER) {
+                    d->shiftReg = d->userReg;
+                    d->shiftBits = SIM_USER_BITS;
+                } else {
+                    d->shiftReg = 0;
+                    d->shiftBits = 1;
+                }
+                break;
+            case S_UPD_IR:
+                d->ir = (uint32_t) d->shiftReg & sim_bypass(d);
+                break;
+            case S_UPD_DR:
+                if (d->ir == SIM_USER) {
+                    d->userReg = (uint32_t) d->shiftReg & ((1u << SIM_USER_BITS) - 1u);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return tdo;
+}
+
+static void sim_shift(struct sim_chain *sim, int numBits,
+        const uint8_t *tms, const uint8_t *tdi, uint8_t *tdo) {
+    for (int i = 0; i < numBits; i++) {
+        set_bit(tdo, i, sim_clock(sim, (tms[i / 8] >> (i % 8)) & 1, (tdi[i / 8] >> (i % 8)) & 1));
+    }
+}
+
+/* Random operations on a lone device, every one of them starts and ends in RTI */
+static void put_random_operations(struct vector_builder *b, const struct sim_device *device,
+        int maxBits) {
+    uint32_t ir = device->idcode ? SIM_IDCODE : sim_bypass(device);
+    bool inReset = true;
+    put_tms_path(b, "111110");
+    while (b->numBits < maxBits) {
+        switch (rand() % 5) {
+            case 0:
+                put_tms_path(b, "111110");
+                ir = device->idcode ? SIM_IDCODE : sim_bypass(device);
+                inReset = true;
+                break;
+            case 1: {
+                static const uint32_t instructions[] = { SIM_USER, 0xffffffffu, SIM_IDCODE };
+                ir = instructions[rand() % (device->idcode ? 3 : 2)] & sim_bypass(device);
+                inReset = false;
+                put_tms_path(b, "1100");
+                if (rand() % 4) {
+                    put_scan(b, ir, device->irLength);
+                } else {
+                    /* Longer scans fill the register with the last bits */
+                    ir = sim_bypass(device);
+                    put_scan(b, 0xffffffffu, device->irLength + rand() % 16);
+                }
+                put_tms_path(b, "10");
+                break;
+            }
+            case 2:
+            case 3: {
+                /*
+                 * User register is scanned whole, as padding passes through it. Length of
+                 * registers other than BYPASS and the ones after reset is not known to the chain,
+                 * bits past them would be delayed by other devices.
+                 */
+                int numBits = 1 + rand() % 48;
+                if (ir == SIM_USER) {
+                    numBits = SIM_USER_BITS;
+                } else if (ir != sim_bypass(device) && !inReset) {
+                    numBits = 1 + rand() % 32;
+                }
+                put_tms_path(b, "100");
+                put_scan(b, (unsigned) rand(), numBits);
+                put_tms_path(b, "10");
+                break;
+            }
+            default:
+                put_tms_path(b, "000");
+                break;
+        }
+    }
+}
+
+static struct sim_chain gSimChain;
+
+static void init_chain(struct txvc_jtag_chain *chain) {
+    memset(&gSimChain, 0, sizeof(gSimChain));
+    sim_add_device(&gSimChain, 6, 0x13631093u);
+    sim_add_device(&gSimChain, 4, 0);
+    sim_add_device(&gSimChain, 8, 0x0362d093u);
+    const int irLengths[] = { 6, 4, 8 };
+    ASSERT_TRUE(txvc_jtag_chain_init(chain, 3, irLengths));
+}
+
+static bool identify_chain(struct txvc_jtag_chain *chain) {
+    uint8_t tms[TXVC_JTAG_CHAIN_MAX_CONTROL_BITS / 8 + 1];
+    uint8_t tdi[sizeof(tms)];
+    uint8_t tdo[sizeof(tms)];
+    const int numBits = txvc_jtag_chain_identify_vector(chain, tms, tdi);
+    ASSERT_TRUE(numBits <= TXVC_JTAG_CHAIN_MAX_CONTROL_BITS);
+    sim_shift(&gSimChain, numBits, tms, tdi, tdo);
+    return txvc_jtag_chain_identify(chain, tdo);
+}
+
+TEST_CASE(ChainIdentify_MoreDevicesThanExpected_Fails) {
+    struct txvc_jtag_chain chain;
+    init_chain(&chain);
+    EXPECT_TRUE(identify_chain(&chain));
+    sim_add_device(&gSimChain, 5, 0);
+    EXPECT_FALSE(identify_chain(&chain));
+}
+
+TEST_CASE(ViewsTakingTurns_EveryUserSeesItsDeviceAlone) {
+    srand(1);
+    struct txvc_jtag_chain chain;
+    init_chain(&chain);
+    ASSERT_TRUE(identify_chain(&chain));
+
+    enum { NUM_USERS = 3 };
+    static struct vector_builder scenarios[NUM_USERS];
+    struct sim_chain lone[NUM_USERS];
+    struct txvc_jtag_view views[NUM_USERS];
+    struct txvc_jtag_tap taps[NUM_USERS];
+    int doneBits[NUM_USERS];
+    for (int u = 0; u < NUM_USERS; u++) {
+        const struct sim_device *d = &gSimChain.devices[u];
+        memset(&lone[u], 0, sizeof(lone[u]));
+        sim_add_device(&lone[u], d->irLength, d->idcode);
+        scenarios[u].numBits = 0;
+        put_random_operations(&scenarios[u], d, 6000);
+        txvc_jtag_view_init(&views[u], u);
+        txvc_jtag_tap_init(&taps[u]);
+        doneBits[u] = 0;
+    }
+
+    int owner = -1;
+    for (;;) {
+        int u = rand() % NUM_USERS;
+        if (owner >= 0 && owner != u && !txvc_jtag_tap_is_stable(&taps[owner])) {
+            u = owner;
+        }
+        if (doneBits[u] == scenarios[u].numBits) {
+            bool allDone = true;
+            for (int i = 0; i < NUM_USERS; i++) {
+                allDone = allDone && doneBits[i] == scenarios[i].numBits;
+            }
+            if (allDone) {
+                break;
+            }
+            continue;
+        }
+        uint8_t tms[256];
+        uint8_t tdi[256];
+        uint8_t tdo[256];
+        if (owner != u) {
+            const int numBits = txvc_jtag_view_restore(&views[u], &chain, tms, tdi);
+            ASSERT_TRUE(numBits >= 0 && numBits <= TXVC_JTAG_CHAIN_MAX_CONTROL_BITS);
+            sim_shift(&gSimChain, numBits, tms, tdi, tdo);
+            owner = u;
+        }
+        int numBits = 1 + rand() % 100;
+        if (numBits > scenarios[u].numBits - doneBits[u]) {
+            numBits = scenarios[u].numBits - doneBits[u];
+        }
+        txvc_bit_vector_copy(tms, 0, scenarios[u].tms, doneBits[u], doneBits[u] + numBits);
+        txvc_bit_vector_copy(tdi, 0, scenarios[u].tdi, doneBits[u], doneBits[u] + numBits);
+        doneBits[u] += numBits;
+        txvc_jtag_tap_follow(&taps[u], numBits, tms);
+        uint8_t expectedTdo[sizeof(tdo)];
+        sim_shift(&lone[u], numBits, tms, tdi, expectedTdo);
+
+        struct txvc_jtag_pad pads[256];
+        const int numPads = txvc_jtag_view_decode_pads(&views[u], &chain, numBits, tms, tdi,
+                pads, sizeof(pads) / sizeof(pads[0]));
+        ASSERT_TRUE(numPads >= 0);
+        int numPaddedBits = numBits;
+        for (int i = 0; i < numPads; i++) {
+            numPaddedBits += pads[i].echoDelay ? 0 : pads[i].numBits;
+        }
+        static uint8_t paddedTms[1024];
+        static uint8_t paddedTdi[1024];
+        static uint8_t paddedTdo[1024];
+        ASSERT_TRUE(numPaddedBits <= (int) sizeof(paddedTms) * 8);
+        txvc_jtag_apply_pads(pads, numPads, numBits, tms, tdi, paddedTms, paddedTdi);
+        sim_shift(&gSimChain, numPaddedBits, paddedTms, paddedTdi, paddedTdo);
+        txvc_jtag_strip_pads(pads, numPads, numBits, tdi, paddedTdo, tdo);
+        ASSERT_TRUE(txvc_bit_vector_equal(expectedTdo, 0, numBits, tdo, 0, numBits));
+    }
+    for (int u = 0; u < NUM_USERS; u++) {
+        EXPECT_EQ(lone[u].devices[0].userReg, gSimChain.devices[u].userReg);
+    }
+}
+
+TEST_CASE(DecodePadsToSmallArray_FailsAndKeepsState) {
+    struct txvc_jtag_chain chain;
+    init_chain(&chain);
+    struct txvc_jtag_view view;
+    txvc_jtag_view_init(&view, 1);
+    struct vector_builder b = { .numBits = 0 };
+    put_tms_path(&b, "01100");
+    put_scan(&b, SIM_USER, 4);
+    put_tms_path(&b, "10");
+    const struct txvc_jtag_chain chainBefore = chain;
+    const struct txvc_jtag_view viewBefore = view;
+    struct txvc_jtag_pad pads[4];
+    EXPECT_EQ(-1, txvc_jtag_view_decode_pads(&view, &chain, b.numBits, b.tms, b.tdi, pads, 1));
+    EXPECT_EQ(0, memcmp(&chainBefore, &chain, sizeof(chain)));
+    EXPECT_EQ(0, memcmp(&viewBefore, &view, sizeof(view)));
+    /* Devices before and after the user's one get BYPASS */
+    ASSERT_EQ(2, txvc_jtag_view_decode_pads(&view, &chain, b.numBits, b.tms, b.tdi, pads, 4));
+    EXPECT_EQ(5, pads[0].atBitIdx);
+    EXPECT_EQ(6, pads[0].numBits);
+    EXPECT_EQ(9, pads[1].atBitIdx);
+    EXPECT_EQ(8, pads[1].numBits);
+    EXPECT_TRUE(pads[1].exits);
+}
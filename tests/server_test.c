@@ -31,8 +31,11 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <arpa/inet.h>
 
+#include <malloc.h>
+
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -41,41 +44,51 @@
 
 TEST_SUITE(Server)
 
-static int mock_max_vector_bit(void);
-static int mock_set_tck_period(int tckPeriodNs);
-static bool mock_shift_bits(int numBits,
-        const uint8_t *tmsVector, const uint8_t *tdiVector, uint8_t *tdoVector);
-
-static struct {
+/* Mock keeps its state in the driver context, so that several servers may use own mocks */
+struct driver_mock {
     int callCountMaxVectorBit;
     int callCountSetTckPeriod;
     int callCountShiftBits;
-    const struct txvc_driver driver;
-} gDriverMock = {
-    .driver = {
-        .name = "mock",
-        .help = "",
-        .activate = 0,
-        .deactivate = 0,
-        .max_vector_bits = mock_max_vector_bit,
-        .set_tck_period = mock_set_tck_period,
-        .shift_bits = mock_shift_bits,
-    },
+    int shiftNumBits[8];
+    volatile int holdShiftCall;
+    int callCountShiftBitsBatch;
+    int batchNumShifts;
+    int callCountSubmitShift;
+    int numShiftsInFlight;
+    int callCountTmsPath;
+    int callCountIdleClocks;
+    int numIdleClocks;
+    int callCountScanIr;
+    int callCountScanDr;
+    int callCountFlush;
 };
 
-static int mock_max_vector_bit(void) {
-    gDriverMock.callCountMaxVectorBit++;
+static struct driver_mock gDriverMock;
+
+static int mock_max_vector_bit(void *ctx) {
+    struct driver_mock *m = ctx;
+    m->callCountMaxVectorBit++;
     return 123;
 }
 
-static int mock_set_tck_period(int tckPeriodNs) {
-    gDriverMock.callCountSetTckPeriod++;
+static int mock_set_tck_period(void *ctx, int tckPeriodNs) {
+    struct driver_mock *m = ctx;
+    m->callCountSetTckPeriod++;
     return tckPeriodNs + 10;
 }
 
-static bool mock_shift_bits(int numBits,
+static bool mock_shift_bits(void *ctx, int numBits,
         const uint8_t *tmsVector, const uint8_t *tdiVector, uint8_t *tdoVector) {
-    gDriverMock.callCountShiftBits++;
+    struct driver_mock *m = ctx;
+    if (m->callCountShiftBits < 8) {
+        m->shiftNumBits[m->callCountShiftBits] = numBits;
+    }
+    m->callCountShiftBits++;
+    if (m->callCountShiftBits == m->holdShiftCall) {
+        for (int i = 0; i < 100 && m->holdShiftCall; i++) {
+            usleep(10 * 1000);
+        }
+    }
     int numBytes = numBits / 8 + !!(numBits % 8);
     for (int i = 0; i < numBytes; i++) {
         tdoVector[i] = tmsVector[i] ^ tdiVector[i];
@@ -83,10 +96,141 @@ static bool mock_shift_bits(int numBits,
     return true;
 }
 
+static bool mock_shift_bits_batch(void *ctx, int numShifts, const struct txvc_shift *shifts) {
+    struct driver_mock *m = ctx;
+    m->callCountShiftBitsBatch++;
+    m->batchNumShifts = numShifts;
+    for (int i = 0; i < numShifts; i++) {
+        int numBytes = shifts[i].numBits / 8 + !!(shifts[i].numBits % 8);
+        for (int j = 0; j < numBytes; j++) {
+            shifts[i].tdoVector[j] = shifts[i].tmsVector[j] ^ shifts[i].tdiVector[j];
+        }
+    }
+    return true;
+}
+
+static int mock_max_shifts_in_flight(void *ctx) {
+    (void) ctx;
+    return 2;
+}
+
+static bool mock_submit_shift(void *ctx, const struct txvc_shift *shift) {
+    struct driver_mock *m = ctx;
+    m->callCountSubmitShift++;
+    m->numShiftsInFlight++;
+    int numBytes = shift->numBits / 8 + !!(shift->numBits % 8);
+    for (int i = 0; i < numBytes; i++) {
+        shift->tdoVector[i] = shift->tmsVector[i] ^ shift->tdiVector[i];
+    }
+    return m->numShiftsInFlight <= 2;
+}
+
+static int mock_complete_shifts(void *ctx, bool wait) {
+    (void) wait;
+    struct driver_mock *m = ctx;
+    int numCompleted = m->numShiftsInFlight;
+    m->numShiftsInFlight = 0;
+    return numCompleted;
+}
+
+static const struct txvc_driver gMockDriver = {
+    .name = "mock",
+    .help = "",
+    .contextSize = sizeof(struct driver_mock),
+    .activate = 0,
+    .deactivate = 0,
+    .max_vector_bits = mock_max_vector_bit,
+    .set_tck_period = mock_set_tck_period,
+    .shift_bits = mock_shift_bits,
+    .shift_bits_batch = mock_shift_bits_batch,
+    .max_shifts_in_flight = mock_max_shifts_in_flight,
+    .submit_shift = mock_submit_shift,
+    .complete_shifts = mock_complete_shifts,
+};
+
+static bool mock_tms_path(void *ctx, const uint8_t *tmsVector, int fromBitIdx, int toBitIdx) {
+    (void) tmsVector;
+    (void) fromBitIdx;
+    (void) toBitIdx;
+    struct driver_mock *m = ctx;
+    m->callCountTmsPath++;
+    return true;
+}
+
+static bool mock_idle_clocks(void *ctx, int numClocks) {
+    struct driver_mock *m = ctx;
+    m->callCountIdleClocks++;
+    m->numIdleClocks += numClocks;
+    return true;
+}
+
+/* Scans shift out inverted TDI */
+static void mock_scan(const uint8_t *tdiVector, uint8_t *tdoVector, int fromBitIdx, int toBitIdx) {
+    for (int i = fromBitIdx; i < toBitIdx; i++) {
+        if (tdiVector[i / 8] & (1 << (i % 8))) {
+            tdoVector[i / 8] &= (uint8_t) ~(1 << (i % 8));
+        } else {
+            tdoVector[i / 8] |= (uint8_t) (1 << (i % 8));
+        }
+    }
+}
+
+static bool mock_scan_ir(void *ctx, const uint8_t *tdiVector, uint8_t *tdoVector,
+        int fromBitIdx, int toBitIdx, bool exitShift) {
+    (void) exitShift;
+    struct driver_mock *m = ctx;
+    m->callCountScanIr++;
+    mock_scan(tdiVector, tdoVector, fromBitIdx, toBitIdx);
+    return true;
+}
+
+static bool mock_scan_dr(void *ctx, const uint8_t *tdiVector, uint8_t *tdoVector,
+        int fromBitIdx, int toBitIdx, bool exitShift) {
+    (void) exitShift;
+    struct driver_mock *m = ctx;
+    m->callCountScanDr++;
+    mock_scan(tdiVector, tdoVector, fromBitIdx, toBitIdx);
+    return true;
+}
+
+static bool mock_flush(void *ctx) {
+    struct driver_mock *m = ctx;
+    m->callCountFlush++;
+    return true;
+}
+
+/* Same mock that is given JTAG operations instead of vectors */
+static const struct txvc_driver gOpsMockDriver = {
+    .name = "mock",
+    .help = "",
+    .contextSize = sizeof(struct driver_mock),
+    .activate = 0,
+    .deactivate = 0,
+    .max_vector_bits = mock_max_vector_bit,
+    .set_tck_period = mock_set_tck_period,
+    .shift_bits = mock_shift_bits,
+    .tms_path = mock_tms_path,
+    .idle_clocks = mock_idle_clocks,
+    .scan_ir = mock_scan_ir,
+    .scan_dr = mock_scan_dr,
+    .flush = mock_flush,
+};
+
 static void reset_driver_mock(void) {
     gDriverMock.callCountMaxVectorBit = 0;
     gDriverMock.callCountSetTckPeriod = 0;
     gDriverMock.callCountShiftBits = 0;
+    gDriverMock.holdShiftCall = 0;
+    gDriverMock.callCountShiftBitsBatch = 0;
+    gDriverMock.batchNumShifts = 0;
+    gDriverMock.callCountSubmitShift = 0;
+    gDriverMock.numShiftsInFlight = 0;
+    gDriverMock.callCountTmsPath = 0;
+    gDriverMock.callCountIdleClocks = 0;
+    gDriverMock.numIdleClocks = 0;
+    gDriverMock.callCountScanIr = 0;
+    gDriverMock.callCountScanDr = 0;
+    gDriverMock.callCountFlush = 0;
 }
 
 static int gClientSocket;
@@ -94,44 +238,71 @@ static sig_atomic_t gServerShouldTerminate;
 static const char * const gServerAddr = "127.0.0.1"; 
 static in_port_t gServerPort = 9000;
 static pthread_t gServerThread;
+static struct txvc_server_options gServerOptions;
+static const struct txvc_driver *gServerDriver;
 
 static void* server_thread(void* arg) {
     (void) arg;
     char addr[32];
     snprintf(addr, sizeof(addr), "%s:%d", gServerAddr, gServerPort);
-    txvc_run_server(addr, &gDriverMock.driver, &gServerShouldTerminate);
+    txvc_run_server(addr, gServerDriver, &gDriverMock, &gServerOptions, &gServerShouldTerminate);
     return NULL;
 }
 
-DO_BEFORE_EACH_CASE() {
-    reset_driver_mock();
-    gServerShouldTerminate = 0;
-    pthread_create(&gServerThread, NULL, server_thread, NULL);
-    usleep(100 * 1000); /* Let server to start */
-    gClientSocket = socket(AF_INET, SOCK_STREAM, 0);
-    ASSERT_TRUE(gClientSocket >= 0);
+static int connect_client_at(in_port_t port) {
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_TRUE(s >= 0);
     struct sockaddr_in addr = {0};
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = inet_addr(gServerAddr);
-    addr.sin_port = htons(gServerPort);
-    int connectRes = connect(gClientSocket, (struct sockaddr*)&addr, sizeof(addr));
+    addr.sin_port = htons(port);
+    int connectRes = connect(s, (struct sockaddr*)&addr, sizeof(addr));
     if (connectRes != 0) {
-        FAIL_FATAL("Can not connect to %s:%d - %s", gServerAddr, gServerPort, strerror(errno));
+        FAIL_FATAL("Can not connect to %s:%d - %s", gServerAddr, port, strerror(errno));
     }
+    return s;
 }
 
-DO_AFTER_EACH_CASE() {
+static int connect_client(void) {
+    return connect_client_at(gServerPort);
+}
+
+static void start_server_and_connect(void) {
+    gServerShouldTerminate = 0;
+    pthread_create(&gServerThread, NULL, server_thread, NULL);
+    usleep(100 * 1000); /* Let server to start */
+    gClientSocket = connect_client();
+}
+
+static void disconnect_and_stop_server(void) {
     gServerShouldTerminate = 1;
     shutdown(gClientSocket, SHUT_RDWR);
     close(gClientSocket);
     pthread_join(gServerThread, NULL);
     /*
      * Server connection is now in a TIME_WAIT, and it's address is unusable for some time.
-     * Instruct next cases to use different port to let their servers to bind(2) immediately.
+     * Instruct next server to use different port to let it bind(2) immediately.
      */
     gServerPort++;
 }
 
+/* Replaces the server that was started for a case with one that uses updated `gServerOptions` */
+static void restart_server(void) {
+    disconnect_and_stop_server();
+    start_server_and_connect();
+}
+
+DO_BEFORE_EACH_CASE() {
+    reset_driver_mock();
+    memset(&gServerOptions, 0, sizeof(gServerOptions));
+    gServerDriver = &gMockDriver;
+    start_server_and_connect();
+}
+
+DO_AFTER_EACH_CASE() {
+    disconnect_and_stop_server();
+}
+
 TEST_CASE(RequestInfo_DriverIsCalledAndResponseIsReceived) {
     const char expectedResponse[] = "xvcServer_v1.0:123\n";
     const size_t expectedResponseSz = sizeof(expectedResponse) - 1;
@@ -189,3 +360,597 @@ TEST_CASE(RequestShiftBits_DriverIsCalledAndResponseIsReceived) {
     ASSERT_EQ(SPAN(expectedTdo, sizeof(expectedTdo)), SPAN(actualTdo, sizeof(actualTdo)));
 }
 
+TEST_CASE(RequestShiftBitsLongerThanDriverSupports_DriverIsCalledInChunksAndResponseIsReceived) {
+    gServerOptions.maxVectorBits = 1024;
+    restart_server();
+    uint8_t request[6 + 4 + 38 + 38] = { 's', 'h', 'i', 'f', 't', ':',
+        44, 1, 0, 0, /* <num bits> - 300 */
+    };
+    uint8_t expectedTdo[38];
+    for (int i = 0; i < 38; i++) {
+        request[10 + i] = (uint8_t) (i * 7);
+        request[10 + 38 + i] = (uint8_t) (0xa5 + i);
+        expectedTdo[i] = request[10 + i] ^ request[10 + 38 + i];
+    }
+    uint8_t actualTdo[sizeof(expectedTdo)] = { 0 };
+
+    ASSERT_EQ(send(gClientSocket, request, sizeof(request), 0), sizeof(request));
+    ASSERT_EQ(recv(gClientSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    /* Driver supports up to 123 bits, chunks are split at octet boundaries */
+    ASSERT_EQ(3, gDriverMock.callCountShiftBits);
+    EXPECT_EQ(120, gDriverMock.shiftNumBits[0]);
+    EXPECT_EQ(120, gDriverMock.shiftNumBits[1]);
+    EXPECT_EQ(60, gDriverMock.shiftNumBits[2]);
+    ASSERT_EQ(SPAN(expectedTdo, sizeof(expectedTdo)), SPAN(actualTdo, sizeof(actualTdo)));
+}
+
+TEST_CASE(RequestShiftBitsLongerThanDriverSupports_TdoIsSentAsChunksComplete) {
+    gServerOptions.maxVectorBits = 1024 * 1024;
+    restart_server();
+    /* Server sends TDO of completed chunks once there is at least 4K of it */
+    enum { NUM_CHUNKS = 2 * 274, NUM_BYTES = NUM_CHUNKS * 120 / 8, };
+    static uint8_t request[6 + 4 + 2 * NUM_BYTES] = { 's', 'h', 'i', 'f', 't', ':',
+        0xe0, 0x00, 0x01, 0x00, /* <num bits> - 548 chunks of 120 bits */
+    };
+    static uint8_t actualTdo[NUM_BYTES];
+
+    gDriverMock.holdShiftCall = NUM_CHUNKS / 2 + 1;
+    ASSERT_EQ(send(gClientSocket, request, sizeof(request), 0), sizeof(request));
+    /* The first half arrives while the driver is still busy with the second one */
+    ASSERT_EQ(recv(gClientSocket, actualTdo, NUM_BYTES / 2, MSG_WAITALL), NUM_BYTES / 2);
+    EXPECT_TRUE(gDriverMock.callCountShiftBits <= NUM_CHUNKS / 2 + 1);
+    gDriverMock.holdShiftCall = 0;
+    ASSERT_EQ(recv(gClientSocket, actualTdo + NUM_BYTES / 2, NUM_BYTES / 2, MSG_WAITALL),
+            NUM_BYTES / 2);
+    ASSERT_EQ(NUM_CHUNKS, gDriverMock.callCountShiftBits);
+}
+
+TEST_CASE(RequestShiftBitsPipelined_DriverIsCalledOnceAndResponsesAreReceivedInOrder) {
+    const uint8_t request[] = {
+        's', 'h', 'i', 'f', 't', ':',
+        8, 0, 0, 0, /* <num bits> */
+        0x12, /* <tms vector> */
+        0xff, /* <tdi vector> */
+        's', 'h', 'i', 'f', 't', ':',
+        20, 0, 0, 0, /* <num bits> */
+        0x34, 0x56, 0x07, /* <tms vector> */
+        0x0f, 0x0f, 0x0f, /* <tdi vector> */
+        's', 'h', 'i', 'f', 't', ':',
+        16, 0, 0, 0, /* <num bits> */
+        0x78, 0x9a, /* <tms vector> */
+        0x00, 0xff, /* <tdi vector> */
+    };
+    const uint8_t expectedTdo[] = {
+        0x12 ^ 0xff,
+        0x34 ^ 0x0f, 0x56 ^ 0x0f, 0x07 ^ 0x0f,
+        0x78 ^ 0x00, 0x9a ^ 0xff,
+    };
+    uint8_t actualTdo[sizeof(expectedTdo)] = { 0 };
+
+    ASSERT_EQ(send(gClientSocket, request, sizeof(request), 0), sizeof(request));
+    ASSERT_EQ(recv(gClientSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    ASSERT_EQ(SPAN(expectedTdo, sizeof(expectedTdo)), SPAN(actualTdo, sizeof(actualTdo)));
+    ASSERT_EQ(0, gDriverMock.callCountShiftBits);
+    ASSERT_EQ(1, gDriverMock.callCountShiftBitsBatch);
+    ASSERT_EQ(3, gDriverMock.batchNumShifts);
+}
+
+TEST_CASE(RequestsSentInPieces_DriverIsCalledAndResponsesAreReceived) {
+    const uint8_t request[] = {
+        's', 'e', 't', 't', 'c', 'k', ':', 100, 0, 0, 0,
+        's', 'h', 'i', 'f', 't', ':',
+        16, 0, 0, 0, /* <num bits> */
+        0x12, 0x34, /* <tms vector> */
+        0xff, 0x00, /* <tdi vector> */
+    };
+    const uint8_t expectedResponse[] = { 110, 0, 0, 0, 0x12 ^ 0xff, 0x34 ^ 0x00, };
+    uint8_t actualResponse[sizeof(expectedResponse)] = { 0 };
+
+    for (size_t i = 0; i < sizeof(request); i += 3) {
+        size_t sz = sizeof(request) - i < 3 ? sizeof(request) - i : 3;
+        ASSERT_EQ(send(gClientSocket, request + i, sz, 0), sz);
+        usleep(1000);
+    }
+    ASSERT_EQ(recv(gClientSocket, actualResponse, sizeof(actualResponse), MSG_WAITALL),
+            sizeof(actualResponse));
+    ASSERT_EQ(SPAN(expectedResponse, sizeof(expectedResponse)),
+            SPAN(actualResponse, sizeof(actualResponse)));
+    ASSERT_EQ(1, gDriverMock.callCountSetTckPeriod);
+    ASSERT_EQ(1, gDriverMock.callCountShiftBits);
+}
+
+TEST_CASE(RequestShiftBitsLargerThanReceiveBuffer_ResponseIsReceived) {
+    gServerOptions.maxVectorBits = 1024 * 1024;
+    restart_server();
+    enum { NUM_BYTES = 128 * 1024, };
+    static uint8_t request[6 + 4 + 2 * NUM_BYTES] = { 's', 'h', 'i', 'f', 't', ':',
+        0, 0, 16, 0, /* <num bits> - 1M */
+    };
+    static uint8_t expectedTdo[NUM_BYTES];
+    static uint8_t actualTdo[NUM_BYTES];
+    for (int i = 0; i < NUM_BYTES; i++) {
+        request[10 + i] = (uint8_t) i;
+        request[10 + NUM_BYTES + i] = (uint8_t) (i >> 8);
+        expectedTdo[i] = (uint8_t) i ^ (uint8_t) (i >> 8);
+    }
+
+    ASSERT_EQ(send(gClientSocket, request, sizeof(request), 0), sizeof(request));
+    ASSERT_EQ(recv(gClientSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    ASSERT_EQ(SPAN(expectedTdo, sizeof(expectedTdo)), SPAN(actualTdo, sizeof(actualTdo)));
+}
+
+TEST_CASE(RequestShiftBitsPipelinedWithIoUring_ResponsesAreReceivedInOrder) {
+    gServerOptions.useIoUring = true;
+    restart_server();
+    const uint8_t request[] = {
+        's', 'h', 'i', 'f', 't', ':',
+        8, 0, 0, 0, /* <num bits> */
+        0x12, /* <tms vector> */
+        0xff, /* <tdi vector> */
+        's', 'h', 'i', 'f', 't', ':',
+        16, 0, 0, 0, /* <num bits> */
+        0x78, 0x9a, /* <tms vector> */
+        0x00, 0xff, /* <tdi vector> */
+    };
+    const uint8_t expectedTdo[] = { 0x12 ^ 0xff, 0x78 ^ 0x00, 0x9a ^ 0xff, };
+    uint8_t actualTdo[sizeof(expectedTdo)] = { 0 };
+
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(send(gClientSocket, request, sizeof(request), 0), sizeof(request));
+        ASSERT_EQ(recv(gClientSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL),
+                sizeof(actualTdo));
+        ASSERT_EQ(SPAN(expectedTdo, sizeof(expectedTdo)), SPAN(actualTdo, sizeof(actualTdo)));
+    }
+    ASSERT_EQ(3, gDriverMock.callCountShiftBitsBatch);
+}
+
+TEST_CASE(RequestShiftBitsLargerThanReceiveBufferWithIoUring_ResponseIsReceived) {
+    gServerOptions.maxVectorBits = 1024 * 1024;
+    gServerOptions.useIoUring = true;
+    restart_server();
+    enum { NUM_BYTES = 128 * 1024, };
+    static uint8_t request[6 + 4 + 2 * NUM_BYTES] = { 's', 'h', 'i', 'f', 't', ':',
+        0, 0, 16, 0, /* <num bits> - 1M */
+    };
+    static uint8_t expectedTdo[NUM_BYTES];
+    static uint8_t actualTdo[NUM_BYTES];
+    for (int i = 0; i < NUM_BYTES; i++) {
+        request[10 + i] = (uint8_t) (i >> 8);
+        request[10 + NUM_BYTES + i] = (uint8_t) i;
+        expectedTdo[i] = (uint8_t) (i >> 8) ^ (uint8_t) i;
+    }
+
+    ASSERT_EQ(send(gClientSocket, request, sizeof(request), 0), sizeof(request));
+    ASSERT_EQ(recv(gClientSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    ASSERT_EQ(SPAN(expectedTdo, sizeof(expectedTdo)), SPAN(actualTdo, sizeof(actualTdo)));
+}
+
+/* Heap memory that is in use by the process, including mmap(2)-ed chunks */
+static size_t allocated_bytes(void) {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+/*
+ * Sends shifts with responses that are sent with MSG_ZEROCOPY, and takes the responses only
+ * after all shifts are sent. Then checks responses and that server has freed buffers that kernel
+ * was reading from.
+ */
+static void check_zero_copy_responses_to_slow_client(void) {
+    enum { NUM_SHIFTS = 16, NUM_BYTES = 32 * 1024, };
+    static uint8_t request[6 + 4 + 2 * NUM_BYTES] = { 's', 'h', 'i', 'f', 't', ':',
+        0, 0, 4, 0, /* <num bits> - 256K */
+    };
+    static uint8_t expectedTdo[NUM_BYTES];
+    static uint8_t actualTdo[NUM_BYTES];
+
+    /*
+     * Client takes nothing until all shifts are sent, so kernel keeps reading responses from
+     * server's buffer while next ones are queued, and the buffer is retired.
+     */
+    int receiveBufferSz = 4096;
+    ASSERT_EQ(0, setsockopt(gClientSocket, SOL_SOCKET, SO_RCVBUF,
+                &receiveBufferSz, sizeof(receiveBufferSz)));
+    const size_t allocatedBefore = allocated_bytes();
+    for (int i = 0; i < NUM_SHIFTS; i++) {
+        memset(request + 10, i, NUM_BYTES);
+        ASSERT_EQ(send(gClientSocket, request, sizeof(request), 0), sizeof(request));
+        usleep(20 * 1000); /* Let server to send each response on its own */
+    }
+    for (int i = 0; i < NUM_SHIFTS; i++) {
+        memset(expectedTdo, i, NUM_BYTES);
+        ASSERT_EQ(recv(gClientSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL),
+                sizeof(actualTdo));
+        ASSERT_EQ(SPAN(expectedTdo, sizeof(expectedTdo)), SPAN(actualTdo, sizeof(actualTdo)));
+    }
+    /* Completions are reported once client has taken responses, retired buffers are freed */
+    usleep(100 * 1000);
+    ASSERT_TRUE(allocated_bytes() - allocatedBefore < NUM_SHIFTS * NUM_BYTES);
+}
+
+TEST_CASE(ZeroCopyResponsesToSlowClient_ResponsesAreIntactAndBuffersAreFreed) {
+    gServerOptions.maxVectorBits = 1024 * 1024;
+    gServerOptions.zeroCopyMinBytes = 1;
+    restart_server();
+    check_zero_copy_responses_to_slow_client();
+}
+
+TEST_CASE(ZeroCopyResponsesToSlowClientWithIoUring_ResponsesAreIntactAndBuffersAreFreed) {
+    gServerOptions.maxVectorBits = 1024 * 1024;
+    gServerOptions.zeroCopyMinBytes = 1;
+    gServerOptions.useIoUring = true;
+    restart_server();
+    check_zero_copy_responses_to_slow_client();
+}
+
+TEST_CASE(RequestsWithPipelining_ShiftsAreSubmittedAndResponsesAreReceivedInOrder) {
+    gServerOptions.pipelineDepth = 4;
+    restart_server();
+    const uint8_t request[] = {
+        's', 'h', 'i', 'f', 't', ':',
+        8, 0, 0, 0, /* <num bits> */
+        0x12, /* <tms vector> */
+        0xff, /* <tdi vector> */
+        's', 'h', 'i', 'f', 't', ':',
+        16, 0, 0, 0, /* <num bits> */
+        0x34, 0x56, /* <tms vector> */
+        0x0f, 0x0f, /* <tdi vector> */
+        's', 'h', 'i', 'f', 't', ':',
+        8, 0, 0, 0, /* <num bits> */
+        0x78, /* <tms vector> */
+        0x00, /* <tdi vector> */
+        's', 'e', 't', 't', 'c', 'k', ':', 100, 0, 0, 0,
+        's', 'h', 'i', 'f', 't', ':',
+        16, 0, 0, 0, /* <num bits> */
+        0x9a, 0xbc, /* <tms vector> */
+        0xff, 0x00, /* <tdi vector> */
+        'g', 'e', 't', 'i', 'n', 'f', 'o', ':',
+    };
+    const uint8_t expectedResponse[] = {
+        0x12 ^ 0xff,
+        0x34 ^ 0x0f, 0x56 ^ 0x0f,
+        0x78 ^ 0x00,
+        110, 0, 0, 0,
+        0x9a ^ 0xff, 0xbc ^ 0x00,
+        'x', 'v', 'c', 'S', 'e', 'r', 'v', 'e', 'r', '_', 'v', '1', '.', '0', ':', '1', '2', '3',
+        '\n',
+    };
+    uint8_t actualResponse[sizeof(expectedResponse)] = { 0 };
+
+    ASSERT_EQ(send(gClientSocket, request, sizeof(request), 0), sizeof(request));
+    ASSERT_EQ(recv(gClientSocket, actualResponse, sizeof(actualResponse), MSG_WAITALL),
+            sizeof(actualResponse));
+    ASSERT_EQ(SPAN(expectedResponse, sizeof(expectedResponse)),
+            SPAN(actualResponse, sizeof(actualResponse)));
+    ASSERT_EQ(4, gDriverMock.callCountSubmitShift);
+    ASSERT_EQ(0, gDriverMock.callCountShiftBits);
+    ASSERT_EQ(0, gDriverMock.callCountShiftBitsBatch);
+}
+
+TEST_CASE(RequestShiftBitsLongerThanDriverSupportsWithPipelining_ResponsesAreReceivedInOrder) {
+    gServerOptions.maxVectorBits = 1024;
+    gServerOptions.pipelineDepth = 4;
+    restart_server();
+    uint8_t request[6 + 4 + 1 + 1 + 6 + 4 + 38 + 38] = {
+        's', 'h', 'i', 'f', 't', ':',
+        8, 0, 0, 0, /* <num bits> */
+        0x12, /* <tms vector> */
+        0xff, /* <tdi vector> */
+        's', 'h', 'i', 'f', 't', ':',
+        44, 1, 0, 0, /* <num bits> - 300 */
+    };
+    uint8_t expectedTdo[1 + 38] = { 0x12 ^ 0xff, };
+    for (int i = 0; i < 38; i++) {
+        request[22 + i] = (uint8_t) (i * 7);
+        request[22 + 38 + i] = (uint8_t) (0xa5 + i);
+        expectedTdo[1 + i] = request[22 + i] ^ request[22 + 38 + i];
+    }
+    uint8_t actualTdo[sizeof(expectedTdo)] = { 0 };
+
+    ASSERT_EQ(send(gClientSocket, request, sizeof(request), 0), sizeof(request));
+    ASSERT_EQ(recv(gClientSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    ASSERT_EQ(SPAN(expectedTdo, sizeof(expectedTdo)), SPAN(actualTdo, sizeof(actualTdo)));
+    /* Long vector is shifted in chunks once the queued shift completes */
+    ASSERT_EQ(1, gDriverMock.callCountSubmitShift);
+    ASSERT_EQ(3, gDriverMock.callCountShiftBits);
+}
+
+TEST_CASE(RequestShiftBitsWithOpsDriver_OperationsAreCalledAndResponseIsReceived) {
+    gServerDriver = &gOpsMockDriver;
+    restart_server();
+    /* TLR -> RTI x 10 -> SHIFT_DR x 8 -> RTI */
+    const uint8_t request[] = { 's', 'h', 'i', 'f', 't', ':',
+        24, 0, 0, 0, /* <num bits> */
+        0x00, 0x08, 0x60, /* <tms vector> */
+        0x00, 0x40, 0x29, /* <tdi vector>, 0xa5 is scanned */
+    };
+    /* Only scanned bits come from the driver */
+    const uint8_t expectedTdo[] = { 0x00, 0x80, 0x16, };
+    uint8_t actualTdo[sizeof(expectedTdo)] = { 0 };
+
+    ASSERT_EQ(send(gClientSocket, request, sizeof(request), 0), sizeof(request));
+    ASSERT_EQ(recv(gClientSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    ASSERT_EQ(SPAN(expectedTdo, sizeof(expectedTdo)), SPAN(actualTdo, sizeof(actualTdo)));
+    ASSERT_EQ(0, gDriverMock.callCountShiftBits);
+    ASSERT_EQ(3, gDriverMock.callCountTmsPath);
+    ASSERT_EQ(1, gDriverMock.callCountIdleClocks);
+    ASSERT_EQ(10, gDriverMock.numIdleClocks);
+    ASSERT_EQ(0, gDriverMock.callCountScanIr);
+    ASSERT_EQ(1, gDriverMock.callCountScanDr);
+    ASSERT_EQ(1, gDriverMock.callCountFlush);
+}
+
+static const uint8_t gShiftRequest[] = {
+    's', 'h', 'i', 'f', 't', ':',
+    16, 0, 0, 0, /* <num bits> */
+    0x12, 0x34, /* <tms vector> */
+    0xff, 0x00, /* <tdi vector> */
+};
+static const uint8_t gShiftExpectedTdo[] = { 0x12 ^ 0xff, 0x34 ^ 0x00, };
+
+TEST_CASE(SecondClientRequestsInfo_ResponseIsReceivedWhileFirstOwnsCable) {
+    const char request[] = "getinfo:";
+    const char expectedResponse[] = "xvcServer_v1.0:123\n";
+    const size_t expectedResponseSz = sizeof(expectedResponse) - 1;
+    char responseBuffer[64];
+
+    int secondSocket = connect_client();
+    ASSERT_EQ(send(secondSocket, request, sizeof(request) - 1, 0), sizeof(request) - 1);
+    ASSERT_EQ(recv(secondSocket, responseBuffer, expectedResponseSz, MSG_WAITALL),
+            expectedResponseSz);
+    responseBuffer[expectedResponseSz] = '\0';
+    ASSERT_EQ(CSTR(expectedResponse), CSTR(responseBuffer));
+    close(secondSocket);
+}
+
+TEST_CASE(SecondClientShiftsBits_ResponseIsReceivedOnceFirstDisconnects) {
+    uint8_t actualTdo[sizeof(gShiftExpectedTdo)] = { 0 };
+
+    int secondSocket = connect_client();
+    ASSERT_EQ(send(secondSocket, gShiftRequest, sizeof(gShiftRequest), 0), sizeof(gShiftRequest));
+    usleep(100 * 1000);
+    ASSERT_EQ(-1, recv(secondSocket, actualTdo, sizeof(actualTdo), MSG_DONTWAIT));
+    ASSERT_EQ(0, gDriverMock.callCountShiftBits);
+
+    ASSERT_EQ(send(gClientSocket, gShiftRequest, sizeof(gShiftRequest), 0), sizeof(gShiftRequest));
+    ASSERT_EQ(recv(gClientSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    ASSERT_EQ(1, gDriverMock.callCountShiftBits);
+    shutdown(gClientSocket, SHUT_RDWR);
+
+    ASSERT_EQ(recv(secondSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    ASSERT_EQ(SPAN(gShiftExpectedTdo, sizeof(gShiftExpectedTdo)),
+            SPAN(actualTdo, sizeof(actualTdo)));
+    ASSERT_EQ(2, gDriverMock.callCountShiftBits);
+    close(secondSocket);
+}
+
+TEST_CASE(FirstClientIsIdle_DisconnectedAndSecondClientIsServed) {
+    gServerOptions.idleTimeoutMs = 300;
+    restart_server();
+    uint8_t actualTdo[sizeof(gShiftExpectedTdo)] = { 0 };
+
+    int secondSocket = connect_client();
+    ASSERT_EQ(send(secondSocket, gShiftRequest, sizeof(gShiftRequest), 0), sizeof(gShiftRequest));
+    ASSERT_EQ(recv(secondSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    ASSERT_EQ(SPAN(gShiftExpectedTdo, sizeof(gShiftExpectedTdo)),
+            SPAN(actualTdo, sizeof(actualTdo)));
+    /* First client was disconnected */
+    ASSERT_EQ(0, recv(gClientSocket, actualTdo, sizeof(actualTdo), 0));
+    close(secondSocket);
+}
+
+TEST_CASE(FirstClientShiftsMoreBitsThanAdvertised_FirstIsDisconnectedAndSecondIsServed) {
+    const uint8_t request[] = { 's', 'h', 'i', 'f', 't', ':',
+        124, 0, 0, 0, /* <num bits> - one more than advertised */
+    };
+    uint8_t actualTdo[sizeof(gShiftExpectedTdo)] = { 0 };
+
+    int secondSocket = connect_client();
+    ASSERT_EQ(send(secondSocket, gShiftRequest, sizeof(gShiftRequest), 0), sizeof(gShiftRequest));
+    ASSERT_EQ(send(gClientSocket, request, sizeof(request), 0), sizeof(request));
+    ASSERT_EQ(0, recv(gClientSocket, actualTdo, sizeof(actualTdo), 0));
+
+    ASSERT_EQ(recv(secondSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    ASSERT_EQ(SPAN(gShiftExpectedTdo, sizeof(gShiftExpectedTdo)),
+            SPAN(actualTdo, sizeof(actualTdo)));
+    ASSERT_EQ(1, gDriverMock.callCountShiftBits);
+    close(secondSocket);
+}
+
+/*
+ * Sends a shift with a response that is larger than socket buffers of both ends, and never
+ * reads it. Then checks that another client is answered, and gets the cable once the first one
+ * is disconnected for being idle.
+ */
+static void check_client_that_does_not_take_responses(void) {
+    enum { NUM_BYTES = 8 * 1024 * 1024, };
+    static uint8_t request[6 + 4 + 2 * NUM_BYTES] = { 's', 'h', 'i', 'f', 't', ':',
+        0, 0, 0, 4, /* <num bits> - 64M */
+    };
+    const char expectedResponse[] = "xvcServer_v1.0:67108864\n";
+    const size_t expectedResponseSz = sizeof(expectedResponse) - 1;
+    char responseBuffer[64];
+    uint8_t actualTdo[sizeof(gShiftExpectedTdo)] = { 0 };
+
+    int receiveBufferSz = 4096;
+    ASSERT_EQ(0, setsockopt(gClientSocket, SOL_SOCKET, SO_RCVBUF,
+                &receiveBufferSz, sizeof(receiveBufferSz)));
+    ASSERT_EQ(send(gClientSocket, request, sizeof(request), 0), sizeof(request));
+
+    /* Server is not stuck sending to the first client */
+    int secondSocket = connect_client();
+    struct timeval timeout = { .tv_sec = 5, .tv_usec = 0, };
+    ASSERT_EQ(0, setsockopt(secondSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)));
+    ASSERT_EQ(send(secondSocket, "getinfo:", 8, 0), 8);
+    ASSERT_EQ(recv(secondSocket, responseBuffer, expectedResponseSz, MSG_WAITALL),
+            expectedResponseSz);
+    responseBuffer[expectedResponseSz] = '\0';
+    ASSERT_EQ(CSTR(expectedResponse), CSTR(responseBuffer));
+
+    /* Cable is handed over once the first client is disconnected */
+    ASSERT_EQ(send(secondSocket, gShiftRequest, sizeof(gShiftRequest), 0), sizeof(gShiftRequest));
+    ASSERT_EQ(recv(secondSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    ASSERT_EQ(SPAN(gShiftExpectedTdo, sizeof(gShiftExpectedTdo)),
+            SPAN(actualTdo, sizeof(actualTdo)));
+    close(secondSocket);
+}
+
+TEST_CASE(FirstClientDoesNotTakeResponses_OthersAreServedAndFirstIsDisconnected) {
+    gServerOptions.idleTimeoutMs = 300;
+    gServerOptions.maxVectorBits = 64 * 1024 * 1024;
+    restart_server();
+    check_client_that_does_not_take_responses();
+}
+
+TEST_CASE(FirstClientDoesNotTakeResponsesWithIoUring_OthersAreServedAndFirstIsDisconnected) {
+    gServerOptions.idleTimeoutMs = 300;
+    gServerOptions.maxVectorBits = 64 * 1024 * 1024;
+    gServerOptions.useIoUring = true;
+    restart_server();
+    check_client_that_does_not_take_responses();
+}
+
+/* Shifts a single octet of TMS, returns `false` if response is not received */
+static bool shift_tms_octet(int s, uint8_t tms) {
+    const uint8_t request[] = {
+        's', 'h', 'i', 'f', 't', ':',
+        8, 0, 0, 0, /* <num bits> */
+        tms, /* <tms vector> */
+        0x00, /* <tdi vector> */
+    };
+    uint8_t tdo;
+    return send(s, request, sizeof(request), 0) == sizeof(request)
+        && recv(s, &tdo, sizeof(tdo), MSG_WAITALL) == sizeof(tdo) && tdo == tms;
+}
+
+/* TMS octets that take TAP from any state to Run-Test/Idle and from Run-Test/Idle to Shift-DR */
+#define TMS_RESET_TO_IDLE 0x1f
+#define TMS_IDLE_TO_SHIFT_DR 0x01
+
+TEST_CASE(TimeSlicedFirstClientInIdle_SecondClientIsServedWhileFirstIsConnected) {
+    gServerOptions.timeSliceMs = 50;
+    restart_server();
+    uint8_t actualTdo[sizeof(gShiftExpectedTdo)] = { 0 };
+
+    ASSERT_TRUE(shift_tms_octet(gClientSocket, TMS_RESET_TO_IDLE));
+
+    int secondSocket = connect_client();
+    ASSERT_EQ(send(secondSocket, gShiftRequest, sizeof(gShiftRequest), 0), sizeof(gShiftRequest));
+    ASSERT_EQ(recv(secondSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    ASSERT_EQ(SPAN(gShiftExpectedTdo, sizeof(gShiftExpectedTdo)),
+            SPAN(actualTdo, sizeof(actualTdo)));
+    ASSERT_EQ(2, gDriverMock.callCountShiftBits);
+    close(secondSocket);
+}
+
+TEST_CASE(TimeSlicedFirstClientInShiftDr_SecondClientIsServedOnceFirstIsInIdle) {
+    gServerOptions.timeSliceMs = 50;
+    restart_server();
+    uint8_t actualTdo[sizeof(gShiftExpectedTdo)] = { 0 };
+
+    ASSERT_TRUE(shift_tms_octet(gClientSocket, TMS_RESET_TO_IDLE));
+    ASSERT_TRUE(shift_tms_octet(gClientSocket, TMS_IDLE_TO_SHIFT_DR));
+
+    int secondSocket = connect_client();
+    ASSERT_EQ(send(secondSocket, gShiftRequest, sizeof(gShiftRequest), 0), sizeof(gShiftRequest));
+    usleep(300 * 1000);
+    ASSERT_EQ(-1, recv(secondSocket, actualTdo, sizeof(actualTdo), MSG_DONTWAIT));
+
+    /* Exit1-DR, Update-DR, Run-Test/Idle */
+    ASSERT_TRUE(shift_tms_octet(gClientSocket, 0x03));
+    ASSERT_EQ(recv(secondSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    ASSERT_EQ(SPAN(gShiftExpectedTdo, sizeof(gShiftExpectedTdo)),
+            SPAN(actualTdo, sizeof(actualTdo)));
+    close(secondSocket);
+}
+
+TEST_CASE(TimeSlicedClientGetsCableBack_TapIsMovedToStateClientHasLeftItIn) {
+    gServerOptions.timeSliceMs = 50;
+    restart_server();
+
+    ASSERT_TRUE(shift_tms_octet(gClientSocket, TMS_RESET_TO_IDLE));
+    int secondSocket = connect_client();
+    usleep(100 * 1000);
+    /* Leaves TAP in Test-Logic-Reset */
+    ASSERT_TRUE(shift_tms_octet(secondSocket, 0xff));
+    usleep(100 * 1000);
+    ASSERT_TRUE(shift_tms_octet(gClientSocket, 0x00));
+
+    ASSERT_EQ(4, gDriverMock.callCountShiftBits);
+    ASSERT_EQ(8, gDriverMock.shiftNumBits[0]);
+    ASSERT_EQ(8, gDriverMock.shiftNumBits[1]);
+    /* Test-Logic-Reset -> Run-Test/Idle */
+    ASSERT_EQ(1, gDriverMock.shiftNumBits[2]);
+    ASSERT_EQ(8, gDriverMock.shiftNumBits[3]);
+    close(secondSocket);
+}
+
+TEST_CASE(VirtualCablesOfTwoDevices_ScansArePaddedAndInstructionIsRestored) {
+    static const int irLengths[] = { 6, 4 };
+    gServerOptions.chainIrLengths = irLengths;
+    gServerOptions.numChainDevices = 2;
+    restart_server();
+    /* Run-Test/Idle -> Shift-IR, 6 bits of IR, Update-IR -> Run-Test/Idle */
+    const uint8_t irScanRequest[] = {
+        's', 'h', 'i', 'f', 't', ':',
+        12, 0, 0, 0, /* <num bits> */
+        0x03, 0x06, /* <tms vector> */
+        0x00, 0x00, /* <tdi vector> */
+    };
+    uint8_t actualTdo[2];
+
+    ASSERT_TRUE(shift_tms_octet(gClientSocket, TMS_RESET_TO_IDLE));
+    ASSERT_EQ(send(gClientSocket, irScanRequest, sizeof(irScanRequest), 0), sizeof(irScanRequest));
+    ASSERT_EQ(recv(gClientSocket, actualTdo, sizeof(actualTdo), MSG_WAITALL), sizeof(actualTdo));
+    int secondSocket = connect_client_at((in_port_t) (gServerPort + 1));
+    usleep(100 * 1000);
+    /* Leaves TAP in Test-Logic-Reset */
+    ASSERT_TRUE(shift_tms_octet(secondSocket, 0xff));
+    usleep(100 * 1000);
+    ASSERT_TRUE(shift_tms_octet(gClientSocket, 0x00));
+
+    ASSERT_EQ(7, gDriverMock.callCountShiftBits);
+    /* Chain identification: reset and Shift-DR, IDCODEs and 8 more bits, Test-Logic-Reset */
+    ASSERT_EQ(9 + 2 * 32 + 8 + 4, gDriverMock.shiftNumBits[0]);
+    ASSERT_EQ(8, gDriverMock.shiftNumBits[1]);
+    /* 4 bits of BYPASS for the other device */
+    ASSERT_EQ(12 + 4, gDriverMock.shiftNumBits[2]);
+    /* Run-Test/Idle -> Test-Logic-Reset */
+    ASSERT_EQ(3, gDriverMock.shiftNumBits[3]);
+    ASSERT_EQ(8, gDriverMock.shiftNumBits[4]);
+    /* Test-Logic-Reset -> Shift-IR, instructions of both devices, Update-IR -> Run-Test/Idle */
+    ASSERT_EQ(5 + 6 + 4 + 2, gDriverMock.shiftNumBits[5]);
+    ASSERT_EQ(8, gDriverMock.shiftNumBits[6]);
+    close(secondSocket);
+}
+
+static struct driver_mock gSecondDriverMock;
+static sig_atomic_t gSecondServerShouldTerminate;
+
+static void* second_server_thread(void* arg) {
+    (void) arg;
+    char addr[32];
+    snprintf(addr, sizeof(addr), "%s:%d", gServerAddr, gServerPort + 1);
+    txvc_run_server(addr, &gMockDriver, &gSecondDriverMock, &gServerOptions,
+            &gSecondServerShouldTerminate);
+    return NULL;
+}
+
+TEST_CASE(TwoServersWithOwnDriverContexts_EachClientIsServedByItsOwnContext) {
+    memset(&gSecondDriverMock, 0, sizeof(gSecondDriverMock));
+    gSecondServerShouldTerminate = 0;
+    pthread_t secondServerThread;
+    pthread_create(&secondServerThread, NULL, second_server_thread, NULL);
+    usleep(100 * 1000); /* Let server to start */
+    int secondSocket = connect_client_at((in_port_t) (gServerPort + 1));
+
+    ASSERT_TRUE(shift_tms_octet(gClientSocket, TMS_RESET_TO_IDLE));
+    ASSERT_TRUE(shift_tms_octet(secondSocket, TMS_RESET_TO_IDLE));
+    ASSERT_TRUE(shift_tms_octet(secondSocket, TMS_IDLE_TO_SHIFT_DR));
+
+    ASSERT_EQ(1, gDriverMock.callCountShiftBits);
+    ASSERT_EQ(2, gSecondDriverMock.callCountShiftBits);
+    gSecondServerShouldTerminate = 1;
+    close(secondSocket);
+    pthread_join(secondServerThread, NULL);
+}
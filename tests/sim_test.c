@@ -0,0 +1,204 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ttest/test.h"
+
+#include "txvc/driver.h"
+#include "txvc/jtag_sim.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+TEST_SUITE(SimDriver)
+
+extern const struct txvc_driver driver_sim;
+
+#define MAX_VECTOR_BYTES 1024
+
+static void *gCtx;
+static uint8_t gTms[MAX_VECTOR_BYTES];
+static uint8_t gTdi[MAX_VECTOR_BYTES];
+static uint8_t gTdo[MAX_VECTOR_BYTES];
+static int gNumBits;
+
+static bool activate(int numArgs, const char **names, const char **values) {
+    void *ctx = calloc(1, driver_sim.contextSize);
+    if (!driver_sim.activate(ctx, numArgs, names, values)) {
+        free(ctx);
+        return false;
+    }
+    gCtx = ctx;
+    return true;
+}
+
+static void set_bit(uint8_t *vector, int idx, bool value) {
+    if (value) {
+        vector[idx / 8] |= (uint8_t) (1u << (idx % 8));
+    } else {
+        vector[idx / 8] &= (uint8_t) ~(1u << (idx % 8));
+    }
+}
+
+static void add_tms(const char *path) {
+    for (const char *p = path; *p; p++) {
+        set_bit(gTms, gNumBits, *p == '1');
+        set_bit(gTdi, gNumBits, false);
+        gNumBits++;
+    }
+}
+
+/* Returns index of the first scanned bit, the last one is shifted with TMS=1 */
+static int add_scan(int numBits, uint64_t tdi) {
+    const int fromBitIdx = gNumBits;
+    for (int i = 0; i < numBits; i++) {
+        set_bit(gTms, gNumBits, i == numBits - 1);
+        set_bit(gTdi, gNumBits, (tdi >> i) & 1u);
+        gNumBits++;
+    }
+    return fromBitIdx;
+}
+
+static unsigned long get_tdo(int fromBitIdx, int numBits) {
+    unsigned long res = 0;
+    for (int i = 0; i < numBits; i++) {
+        const int idx = fromBitIdx + i;
+        res |= (unsigned long) ((gTdo[idx / 8] >> (idx % 8)) & 1u) << i;
+    }
+    return res;
+}
+
+static void shift(void) {
+    ASSERT_TRUE(driver_sim.shift_bits(gCtx, gNumBits, gTms, gTdi, gTdo));
+    gNumBits = 0;
+}
+
+DO_BEFORE_EACH_CASE() {
+    gCtx = NULL;
+    gNumBits = 0;
+    memset(gTdo, 0, sizeof(gTdo));
+}
+
+DO_AFTER_EACH_CASE() {
+    if (gCtx) {
+        driver_sim.deactivate(gCtx);
+        free(gCtx);
+    }
+}
+
+TEST_CASE(DefaultChain_IdcodeOfXc7a35tIsRead) {
+    ASSERT_TRUE(activate(0, NULL, NULL));
+    add_tms("111110100");
+    const int idcodeIdx = add_scan(32, 0);
+    add_tms("10");
+    shift();
+    EXPECT_EQ(0x0362d093ul, get_tdo(idcodeIdx, 32));
+}
+
+TEST_CASE(ChainOfTwo_IrCaptureAndIdcodesAreRead) {
+    const char *names[] = { "ir_lengths", "idcodes", "idcode_opcodes", "xilinx", };
+    const char *values[] = { "6/4", "13631093/4ba00477", "09/e", "1/0", };
+    ASSERT_TRUE(activate(4, names, values));
+    add_tms("1111101100");
+    /* BYPASS and IDCODE */
+    const int irIdx = add_scan(10, 0x3f | 0xe << 6);
+    add_tms("1100");
+    const int idcodeIdx = add_scan(65, 0);
+    add_tms("10");
+    shift();
+    /* INIT_COMPLETE is set in the first device, DONE is not */
+    EXPECT_EQ(0x11ul | 0x1ul << 6, get_tdo(irIdx, 10));
+    EXPECT_EQ(0x4ba00477ul << 1, get_tdo(idcodeIdx, 33));
+}
+
+TEST_CASE(UserDr_KeepsShiftedValue) {
+    const char *names[] = { "user_dr_bits", };
+    const char *values[] = { "40", };
+    ASSERT_TRUE(activate(1, names, values));
+    add_tms("1111101100");
+    add_scan(6, 0x03);
+    add_tms("1100");
+    const int firstIdx = add_scan(40, 0x12345678abul);
+    add_tms("1100");
+    const int secondIdx = add_scan(40, 0);
+    add_tms("10");
+    shift();
+    EXPECT_EQ(0ul, get_tdo(firstIdx, 40));
+    EXPECT_EQ(0x12345678abul, get_tdo(secondIdx, 40));
+}
+
+static void add_instruction(uint32_t opcode) {
+    add_tms("1100");
+    add_scan(6, opcode);
+    add_tms("10");
+}
+
+TEST_CASE(ConfigurationWithOps_DoneIsSet) {
+    ASSERT_TRUE(activate(0, NULL, NULL));
+    add_tms("11111");
+    add_tms("0");
+    add_instruction(TXVC_JTAG_SIM_JPROGRAM);
+    add_instruction(TXVC_JTAG_SIM_CFG_IN);
+    add_tms("100");
+    /* Dummy word and sync word, shifted MSB first as configuration logic receives them */
+    const uint64_t words = 0xffffffffull << 32 | TXVC_JTAG_SIM_SYNC_WORD;
+    uint64_t data = 0;
+    for (int i = 0; i < 64; i++) {
+        data |= ((words >> (63 - i)) & 1u) << i;
+    }
+    add_scan(64, data);
+    add_tms("10");
+    add_instruction(TXVC_JTAG_SIM_JSTART);
+    shift();
+    ASSERT_TRUE(driver_sim.idle_clocks(gCtx, TXVC_JTAG_SIM_STARTUP_CLOCKS));
+    ASSERT_TRUE(driver_sim.flush(gCtx));
+    add_tms("1100");
+    const int irIdx = add_scan(6, 0x3f);
+    add_tms("10");
+    shift();
+    EXPECT_EQ(0x31ul, get_tdo(irIdx, 6));
+}
+
+TEST_CASE(ScanOps_SameTdoAsShiftBits) {
+    ASSERT_TRUE(activate(0, NULL, NULL));
+    add_tms("111110100");
+    const int idcodeIdx = gNumBits;
+    add_scan(32, 0);
+    ASSERT_TRUE(driver_sim.tms_path(gCtx, gTms, 0, idcodeIdx));
+    ASSERT_TRUE(driver_sim.scan_dr(gCtx, gTdi, gTdo, idcodeIdx, gNumBits, true));
+    ASSERT_TRUE(driver_sim.flush(gCtx));
+    EXPECT_EQ(0x0362d093ul, get_tdo(idcodeIdx, 32));
+}
+
+TEST_CASE(BadChain_ActivationFails) {
+    const char *names[] = { "ir_lengths", "idcodes", "idcode_opcodes", "xilinx", };
+    const char *shortIr[] = { "4", "0", "0", "1", };
+    const char *tooManyIdcodes[] = { "6", "1/2", "9/9", "0", };
+    const char *noIdcodeOpcode[] = { "6", "13631093", "", "0", };
+    EXPECT_FALSE(activate(4, names, shortIr));
+    EXPECT_FALSE(activate(4, names, tooManyIdcodes));
+    EXPECT_FALSE(activate(4, names, noIdcodeOpcode));
+}
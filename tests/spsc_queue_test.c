@@ -0,0 +1,105 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ttest/test.h"
+#include "txvc/spsc_queue.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+TEST_SUITE(SpscQueue)
+
+#define NUM_STRESS_ITEMS 1000000u
+
+static struct txvc_spsc_queue gUut;
+
+DO_BEFORE_EACH_CASE() {
+    txvc_spsc_queue_init(&gUut, 5, sizeof(uint32_t));
+}
+
+DO_AFTER_EACH_CASE() {
+    txvc_spsc_queue_deinit(&gUut);
+}
+
+TEST_CASE(PopFromEmpty_Fails) {
+    uint32_t item;
+    ASSERT_FALSE(txvc_spsc_queue_pop(&gUut, &item));
+    ASSERT_EQ(0ul, txvc_spsc_queue_size(&gUut));
+}
+
+TEST_CASE(PushUntilFull_CapacityIsRoundedUpToPowerOfTwo) {
+    for (uint32_t i = 0; i < 8; i++) {
+        ASSERT_TRUE(txvc_spsc_queue_push(&gUut, &i));
+    }
+    uint32_t item = 8;
+    ASSERT_FALSE(txvc_spsc_queue_push(&gUut, &item));
+    ASSERT_EQ(8ul, txvc_spsc_queue_size(&gUut));
+}
+
+TEST_CASE(PushAndPopAcrossWrap_ItemsComeOutInOrder) {
+    uint32_t next = 0;
+    uint32_t expected = 0;
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < 5; i++, next++) {
+            ASSERT_TRUE(txvc_spsc_queue_push(&gUut, &next));
+        }
+        for (int i = 0; i < 5; i++, expected++) {
+            uint32_t item;
+            ASSERT_TRUE(txvc_spsc_queue_pop(&gUut, &item));
+            ASSERT_EQ(expected, item);
+        }
+    }
+    ASSERT_EQ(0ul, txvc_spsc_queue_size(&gUut));
+}
+
+static void *producer_thread(void *arg) {
+    (void) arg;
+    for (uint32_t i = 0; i < NUM_STRESS_ITEMS; i++) {
+        while (!txvc_spsc_queue_push(&gUut, &i)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+TEST_CASE(ProducerAndConsumerThreads_NoItemIsLostOrReordered) {
+    pthread_t producer;
+    ASSERT_EQ(0, pthread_create(&producer, NULL, producer_thread, NULL));
+    bool inOrder = true;
+    for (uint32_t expected = 0; expected < NUM_STRESS_ITEMS; expected++) {
+        uint32_t item;
+        while (!txvc_spsc_queue_pop(&gUut, &item)) {
+            sched_yield();
+        }
+        inOrder = inOrder && item == expected;
+    }
+    pthread_join(producer, NULL);
+    ASSERT_TRUE(inOrder);
+    ASSERT_EQ(0ul, txvc_spsc_queue_size(&gUut));
+}
+
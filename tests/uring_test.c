@@ -0,0 +1,132 @@
+/*
+ * Copyright 2021 Sergey Guralnik
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ttest/test.h"
+#include "txvc/uring.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+TEST_SUITE(Uring)
+
+static struct txvc_uring gUut;
+static bool gIsSupported;
+static int gSockets[2];
+static uint8_t gTxBuffer[256];
+static uint8_t gRxBuffer[256];
+
+DO_BEFORE_EACH_CASE() {
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, gSockets));
+    /* Nothing to test on kernels without io_uring, the server falls back to blocking calls there */
+    gIsSupported = txvc_uring_init(&gUut, 2);
+    if (gIsSupported) {
+        const struct iovec buffers[] = {
+            { .iov_base = gTxBuffer, .iov_len = sizeof(gTxBuffer), },
+            { .iov_base = gRxBuffer, .iov_len = sizeof(gRxBuffer), },
+        };
+        ASSERT_TRUE(txvc_uring_register_buffers(&gUut, buffers, 2));
+    }
+    memset(gTxBuffer, 0, sizeof(gTxBuffer));
+    memset(gRxBuffer, 0, sizeof(gRxBuffer));
+}
+
+DO_AFTER_EACH_CASE() {
+    if (gIsSupported) {
+        txvc_uring_deinit(&gUut);
+    }
+    close(gSockets[0]);
+    close(gSockets[1]);
+}
+
+TEST_CASE(LinkedWriteAndRead_BothCompleteInOrder) {
+    if (!gIsSupported) {
+        return;
+    }
+    memcpy(gTxBuffer, "hello", 5);
+    ASSERT_TRUE(txvc_uring_prep_rw_fixed(&gUut, true, gSockets[0], gTxBuffer, 5, 0, 10, true));
+    ASSERT_TRUE(txvc_uring_prep_rw_fixed(&gUut, false, gSockets[1], gRxBuffer, 64, 1, 20, false));
+
+    uint64_t userData[2];
+    int res[2];
+    int numCompleted = 0;
+    while (numCompleted < 2) {
+        ASSERT_TRUE(txvc_uring_submit_and_wait(&gUut, 1));
+        while (numCompleted < 2
+                && txvc_uring_pop_completion(&gUut, &userData[numCompleted], &res[numCompleted])) {
+            numCompleted++;
+        }
+    }
+    ASSERT_FALSE(txvc_uring_pop_completion(&gUut, &userData[0], &res[0]));
+    ASSERT_EQ(10, userData[0]);
+    ASSERT_EQ(5, res[0]);
+    ASSERT_EQ(20, userData[1]);
+    ASSERT_EQ(5, res[1]);
+    ASSERT_EQ(SPAN("hello", 5), SPAN(gRxBuffer, 5));
+}
+
+TEST_CASE(ReadFromClosedPeer_CompletesWithZero) {
+    if (!gIsSupported) {
+        return;
+    }
+    close(gSockets[0]);
+    gSockets[0] = -1;
+    ASSERT_TRUE(txvc_uring_prep_rw_fixed(&gUut, false, gSockets[1], gRxBuffer, 64, 1, 1, false));
+    ASSERT_TRUE(txvc_uring_submit_and_wait(&gUut, 1));
+
+    uint64_t userData;
+    int res;
+    ASSERT_TRUE(txvc_uring_pop_completion(&gUut, &userData, &res));
+    ASSERT_EQ(1, userData);
+    ASSERT_EQ(0, res);
+}
+
+TEST_CASE(WriteOutsideOfRegisteredBuffer_CompletesWithError) {
+    if (!gIsSupported) {
+        return;
+    }
+    uint8_t unregistered[8] = { 0 };
+    ASSERT_TRUE(txvc_uring_prep_rw_fixed(&gUut, true, gSockets[0], unregistered, 8, 0, 1, false));
+    ASSERT_TRUE(txvc_uring_submit_and_wait(&gUut, 1));
+
+    uint64_t userData;
+    int res;
+    ASSERT_TRUE(txvc_uring_pop_completion(&gUut, &userData, &res));
+    ASSERT_EQ(-EFAULT, res);
+}
+
+TEST_CASE(PrepMoreThanQueueSize_Fails) {
+    if (!gIsSupported) {
+        return;
+    }
+    ASSERT_TRUE(txvc_uring_prep_rw_fixed(&gUut, false, gSockets[1], gRxBuffer, 1, 1, 1, false));
+    ASSERT_TRUE(txvc_uring_prep_rw_fixed(&gUut, false, gSockets[1], gRxBuffer + 1, 1, 1, 2, false));
+    ASSERT_FALSE(txvc_uring_prep_rw_fixed(&gUut, false, gSockets[1], gRxBuffer + 2, 1, 1, 3, false));
+}
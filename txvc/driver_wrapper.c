@@ -30,57 +30,172 @@
 
 TXVC_DEFAULT_LOG_TAG(driverWrapper);
 
-struct txvc_driver txvcDriverWrapper;
-
 #define DEFAULT_TCK_PERIOD 100
 
-static int (*orig_set_tck_period)(int tckPeriodNs);
-static bool (*orig_shift_bits)(int numBits,
-        const uint8_t *tmsVector,
-        const uint8_t *tdiVector,
-        uint8_t *tdoVector
-        );
+static int max_vector_bits(void *ctx) {
+    struct txvc_driver_wrapper *w = ctx;
+    return w->driver->max_vector_bits(w->driverCtx);
+}
 
-static int noop_set_tck_period(int tckPeriodNs) {
-    WARN("Ignoring new TCK period %dns\n", tckPeriodNs);
-    return tckPeriodNs;
+static int set_tck_period(void *ctx, int tckPeriodNs) {
+    struct txvc_driver_wrapper *w = ctx;
+    if (w->isTckPeriodFixed) {
+        WARN("Ignoring new TCK period %dns\n", tckPeriodNs);
+        return tckPeriodNs;
+    }
+    w->isTckPeriodSet = true;
+    return w->driver->set_tck_period(w->driverCtx, tckPeriodNs);
 }
 
-static int onetime_set_tck_period(int tckPeriodNs) {
-    txvcDriverWrapper.set_tck_period = orig_set_tck_period;
-    return orig_set_tck_period(tckPeriodNs);
+static void ensure_tck_period_set(struct txvc_driver_wrapper *w) {
+    if (!w->isTckPeriodSet) {
+        extern const char *txvcProgname;
+        WARN("Client did not set TCK period before shifting data\n");
+        WARN("Using default value: %dns\n", DEFAULT_TCK_PERIOD);
+        WARN("See \"%s -h\" to enforce other TCK period\n", txvcProgname);
+        set_tck_period(w, DEFAULT_TCK_PERIOD);
+    }
 }
 
-static bool onetime_shift_bits(int numBits,
+static bool shift_bits(void *ctx, int numBits,
         const uint8_t *tmsVector,
         const uint8_t *tdiVector,
         uint8_t *tdoVector
         ) {
-    if (txvcDriverWrapper.set_tck_period == onetime_set_tck_period) {
-        extern const char *txvcProgname;
-        WARN("Client did not set TCK period before shifting data\n");
-        WARN("Using default value: %dns\n", DEFAULT_TCK_PERIOD);
-        WARN("See \"%s -h\" to enforce other TCK period\n", txvcProgname);
-        onetime_set_tck_period(DEFAULT_TCK_PERIOD);
+    struct txvc_driver_wrapper *w = ctx;
+    ensure_tck_period_set(w);
+    return w->driver->shift_bits(w->driverCtx, numBits, tmsVector, tdiVector, tdoVector);
+}
+
+static bool shift_bits_batch(void *ctx, int numShifts, const struct txvc_shift *shifts) {
+    struct txvc_driver_wrapper *w = ctx;
+    ensure_tck_period_set(w);
+    if (w->driver->shift_bits_batch) {
+        return w->driver->shift_bits_batch(w->driverCtx, numShifts, shifts);
+    }
+    for (int i = 0; i < numShifts; i++) {
+        const struct txvc_shift *s = &shifts[i];
+        if (!w->driver->shift_bits(w->driverCtx,
+                    s->numBits, s->tmsVector, s->tdiVector, s->tdoVector)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int max_shifts_in_flight(void *ctx) {
+    struct txvc_driver_wrapper *w = ctx;
+    if (w->driver->submit_shift) {
+        return w->driver->max_shifts_in_flight(w->driverCtx);
+    }
+    return 1;
+}
+
+static bool submit_shift(void *ctx, const struct txvc_shift *shift) {
+    struct txvc_driver_wrapper *w = ctx;
+    ensure_tck_period_set(w);
+    if (w->driver->submit_shift) {
+        return w->driver->submit_shift(w->driverCtx, shift);
+    }
+    /* Synchronous driver completes the shift right away */
+    if (!w->driver->shift_bits(w->driverCtx,
+                shift->numBits, shift->tmsVector, shift->tdiVector, shift->tdoVector)) {
+        return false;
     }
-    txvcDriverWrapper.shift_bits = orig_shift_bits;
-    return orig_shift_bits(numBits, tmsVector, tdiVector, tdoVector);
+    w->numSyncCompleted++;
+    return true;
 }
 
-void txvc_driver_wrapper_setup(const struct txvc_driver *driver,
-        int fixedTckPeriod) {
-    txvcDriverWrapper = *driver;
+static int complete_shifts(void *ctx, bool wait) {
+    struct txvc_driver_wrapper *w = ctx;
+    if (w->driver->submit_shift) {
+        return w->driver->complete_shifts(w->driverCtx, wait);
+    }
+    int numCompleted = w->numSyncCompleted;
+    w->numSyncCompleted = 0;
+    return numCompleted;
+}
+
+static bool tms_path(void *ctx, const uint8_t *tmsVector, int fromBitIdx, int toBitIdx) {
+    struct txvc_driver_wrapper *w = ctx;
+    ensure_tck_period_set(w);
+    return w->driver->tms_path(w->driverCtx, tmsVector, fromBitIdx, toBitIdx);
+}
+
+static bool idle_clocks(void *ctx, int numClocks) {
+    struct txvc_driver_wrapper *w = ctx;
+    ensure_tck_period_set(w);
+    return w->driver->idle_clocks(w->driverCtx, numClocks);
+}
+
+static bool scan_ir(void *ctx, const uint8_t *tdiVector, uint8_t *tdoVector,
+        int fromBitIdx, int toBitIdx, bool exitShift) {
+    struct txvc_driver_wrapper *w = ctx;
+    ensure_tck_period_set(w);
+    return w->driver->scan_ir(w->driverCtx, tdiVector, tdoVector, fromBitIdx, toBitIdx, exitShift);
+}
+
+static bool scan_dr(void *ctx, const uint8_t *tdiVector, uint8_t *tdoVector,
+        int fromBitIdx, int toBitIdx, bool exitShift) {
+    struct txvc_driver_wrapper *w = ctx;
+    ensure_tck_period_set(w);
+    return w->driver->scan_dr(w->driverCtx, tdiVector, tdoVector, fromBitIdx, toBitIdx, exitShift);
+}
+
+static bool flush(void *ctx) {
+    struct txvc_driver_wrapper *w = ctx;
+    return w->driver->flush(w->driverCtx);
+}
+
+const struct txvc_driver txvcDriverWrapper = {
+    .name = "wrapper",
+    .help = "",
+    .contextSize = sizeof(struct txvc_driver_wrapper),
+    .activate = NULL,
+    .deactivate = NULL,
+    .max_vector_bits = max_vector_bits,
+    .set_tck_period = set_tck_period,
+    .shift_bits = shift_bits,
+    .shift_bits_batch = shift_bits_batch,
+    .max_shifts_in_flight = max_shifts_in_flight,
+    .submit_shift = submit_shift,
+    .complete_shifts = complete_shifts,
+};
+
+const struct txvc_driver txvcDriverWrapperWithOps = {
+    .name = "wrapper",
+    .help = "",
+    .contextSize = sizeof(struct txvc_driver_wrapper),
+    .activate = NULL,
+    .deactivate = NULL,
+    .max_vector_bits = max_vector_bits,
+    .set_tck_period = set_tck_period,
+    .shift_bits = shift_bits,
+    .shift_bits_batch = shift_bits_batch,
+    .max_shifts_in_flight = max_shifts_in_flight,
+    .submit_shift = submit_shift,
+    .complete_shifts = complete_shifts,
+    .tms_path = tms_path,
+    .idle_clocks = idle_clocks,
+    .scan_ir = scan_ir,
+    .scan_dr = scan_dr,
+    .flush = flush,
+};
+
+void txvc_driver_wrapper_setup(struct txvc_driver_wrapper *wrapper,
+        const struct txvc_driver *driver, void *driverCtx, int fixedTckPeriod) {
+    *wrapper = (struct txvc_driver_wrapper) {
+        .driver = driver,
+        .driverCtx = driverCtx,
+        .isTckPeriodFixed = false,
+        .isTckPeriodSet = false,
+        .numSyncCompleted = 0,
+    };
     if (fixedTckPeriod > 0) {
         /* Set desired period and inhibit future changes */
-        if (txvcDriverWrapper.set_tck_period(fixedTckPeriod) == fixedTckPeriod) {
-            txvcDriverWrapper.set_tck_period = noop_set_tck_period;
+        wrapper->isTckPeriodSet = true;
+        if (driver->set_tck_period(driverCtx, fixedTckPeriod) == fixedTckPeriod) {
+            wrapper->isTckPeriodFixed = true;
         }
-    } else {
-        /* Wrap methods to monitor if client touches shift too early */
-        orig_set_tck_period = txvcDriverWrapper.set_tck_period;
-        txvcDriverWrapper.set_tck_period = onetime_set_tck_period;
-        orig_shift_bits = txvcDriverWrapper.shift_bits;
-        txvcDriverWrapper.shift_bits = onetime_shift_bits;
     }
 }
-
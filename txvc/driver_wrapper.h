@@ -28,8 +28,25 @@
 
 #include "txvc/driver.h"
 
-extern struct txvc_driver txvcDriverWrapper;
+#include <stdbool.h>
 
-extern void txvc_driver_wrapper_setup(const struct txvc_driver *driver,
-        int fixedTckPeriod);
+/** Context of a wrapped driver, see below. */
+struct txvc_driver_wrapper {
+    const struct txvc_driver *driver;
+    void *driverCtx;
+    bool isTckPeriodFixed;
+    bool isTckPeriodSet;
+    int numSyncCompleted;
+};
 
+/**
+ * Driver that forwards calls to the driver of a `struct txvc_driver_wrapper` context,
+ * enforcing fixed TCK period or warning if client shifts bits before setting it.
+ * Asynchronous shifts are provided for any driver, synchronous ones complete them on submission.
+ */
+extern const struct txvc_driver txvcDriverWrapper;
+/** Same as above, that also forwards JTAG operations of drivers that have them. */
+extern const struct txvc_driver txvcDriverWrapperWithOps;
+
+extern void txvc_driver_wrapper_setup(struct txvc_driver_wrapper *wrapper,
+        const struct txvc_driver *driver, void *driverCtx, int fixedTckPeriod);
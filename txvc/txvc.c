@@ -30,11 +30,14 @@
 
 #include "drivers/drivers.h"
 #include "txvc/driver.h"
+#include "txvc/jtag_splitter.h"
 #include "txvc/log.h"
 #include "txvc/server.h"
 #include "txvc/profile.h"
 #include "txvc/defs.h"
 
+#include <arpa/inet.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #include <limits.h>
@@ -49,6 +52,9 @@ TXVC_DEFAULT_LOG_TAG(txvc);
 
 #define DEFAULT_SERVER_ADDR "127.0.0.1:2542"
 #define DEFAULT_LOG_TAG_SPEC "all+"
+#define DEFAULT_MAX_VECTOR_BITS "4194304"
+/* Profile argument that is taken by the server rather than by the driver */
+#define CHAIN_IR_LENGTHS_ARG "chain_ir_lengths"
 
 #define CLI_OPTION_LIST_ITEMS(OPT_FLAG, OPT)                                                       \
     OPT_FLAG("h", help, "Print this message.")                                                     \
@@ -57,6 +63,12 @@ TXVC_DEFAULT_LOG_TAG(txvc);
             " with FPGA and its parameters. HW profile is specified in the following"              \
             " form:\n\n\t<driver_name>:<arg0>=<val0>,<arg1>=<val1>,<arg2>=<val2>,...\n\n"          \
             "Use '-D' to see available driver names as well as their specific parameters."         \
+            " Any profile may also have \"" CHAIN_IR_LENGTHS_ARG "=<len0>/<len1>/...\", IR"        \
+            " lengths of devices in the chain starting from the one closest to TDO, to serve"      \
+            " each device as a virtual cable at its own port, starting from the server one."       \
+            " Several profiles or aliases separated by ';' are served at once, each by its own"    \
+            " thread at its own port, starting from the server one. A profile with chain IR"       \
+            " lengths takes a port per device."                                                    \
             " Also there are a few predefined profile aliases for specific HW that can be used"    \
             " instead of fully specified descriptions, use '-A' to see available aliases.",        \
             "profile_spec_or_alias", const char *, optarg, NULL)                                   \
@@ -65,6 +77,38 @@ TXVC_DEFAULT_LOG_TAG(txvc);
             "ipv4_address:port", const char *, optarg, DEFAULT_SERVER_ADDR)                        \
     OPT("t", tckPeriodNanos, "Enforced TCK period, expressed in nanoseconds.",                     \
             "tck_period_ns", int, parse_int(optarg), 0)                                            \
+    OPT("v", maxVectorBits, "Vector size in bits to advertise to XVC clients. Vectors that are"    \
+                            " longer than the driver supports are shifted in multiple chunks,"     \
+                            " which saves network round trips for large transfers. Driver's own"   \
+                            " vector size is advertised if it is larger"                           \
+                            " (default: " DEFAULT_MAX_VECTOR_BITS ").",                            \
+            "num_bits", int, parse_int(optarg), parse_int(DEFAULT_MAX_VECTOR_BITS))                \
+    OPT("z", zeroCopyKbytes, "Send responses that are at least this many kilobytes long"           \
+                             " with MSG_ZEROCOPY. Saves copying large TDO vectors to the kernel,"  \
+                             " but costs more than copying for small ones (default: 0 - never).",  \
+            "kbytes", int, parse_int(optarg), 0)                                                   \
+    OPT("i", idleTimeoutSeconds, "Disconnect clients that send nothing for this many seconds,"     \
+                                 " unless they wait for another client to release the cable."      \
+                                 " Keeps a stalled client from blocking the cable for everyone"    \
+                                 " (default: 0 - never).",                                         \
+            "seconds", int, parse_int(optarg), 0)                                                  \
+    OPT("s", timeSliceMs, "Let clients share the cable in time slices of this many milliseconds,"  \
+                          " instead of serving them one after another. Cable changes hands only"   \
+                          " when TAP is in Test-Logic-Reset or Run-Test/Idle, each client sees"    \
+                          " TAP in the state it has left it in (default: 0 - don't share).",       \
+            "ms", int, parse_int(optarg), 0)                                                       \
+    OPT("P", priorities, "Priorities of clients when sharing the cable, by their IPv4 addresses."  \
+                         " Clients get shares of TCK time proportional to their priorities,"       \
+                         " those that are not listed have priority 1.",                            \
+            "ipv4_address=priority,...", const char *, optarg, NULL)                               \
+    OPT_FLAG("u", ioUring, "Use io_uring for network I/O, which sends responses and receives"      \
+                           " next commands with a single system call. Falls back to blocking"      \
+                           " socket calls if io_uring is not supported by the kernel.")            \
+    OPT("q", pipelineDepth, "Shift vectors on a thread of their own, with up to this many shifts"  \
+                            " queued, so that network I/O overlaps with the driver work. Not"      \
+                            " used together with io_uring or split chains (default: 0 - don't"     \
+                            " pipeline).",                                                         \
+            "num_shifts", int, parse_int(optarg), 0)                                               \
     OPT_FLAG("D", helpDrivers, "Print available drivers.")                                         \
     OPT_FLAG("A", helpAliases, "Print available aliases.")                                         \
 
@@ -179,6 +223,62 @@ static int parse_int(const char* s) {
     return *s == '\0' || *p != '\0' ? INT_MIN : res;
 }
 
+#define MAX_CLIENT_PRIORITIES 16
+
+/* Parses "<ipv4_address>=<priority>,...", returns number of parsed items or -1 */
+static int parse_priorities(const char *s, struct txvc_server_priority *out, int maxNum) {
+    char buf[512];
+    strncpy(buf, s, sizeof(buf));
+    buf[sizeof(buf) - 1] = '\0';
+    int num = 0;
+    for (char *item = strtok(buf, ","); item; item = strtok(NULL, ",")) {
+        char *eq = strchr(item, '=');
+        if (!eq || num == maxNum) {
+            return -1;
+        }
+        *eq = '\0';
+        int priority = parse_int(eq + 1);
+        if (!inet_aton(item, &out[num].addr) || priority <= 0) {
+            return -1;
+        }
+        out[num].priority = (unsigned) priority;
+        num++;
+    }
+    return num;
+}
+
+/* Parses "<len0>/<len1>/...", returns number of parsed items or -1 */
+static int parse_ir_lengths(const char *s, int *out, int maxNum) {
+    char buf[128];
+    strncpy(buf, s, sizeof(buf));
+    buf[sizeof(buf) - 1] = '\0';
+    int num = 0;
+    for (char *item = strtok(buf, "/"); item; item = strtok(NULL, "/")) {
+        int irLength = parse_int(item);
+        if (num == maxNum || irLength <= 0) {
+            return -1;
+        }
+        out[num++] = irLength;
+    }
+    return num;
+}
+
+/* Removes argument `key` from the profile, returns its value or NULL if there is none */
+static const char *take_profile_arg(struct txvc_backend_profile *profile, const char *key) {
+    for (unsigned i = 0; i < profile->numArg; i++) {
+        if (strcmp(profile->argKeys[i], key) == 0) {
+            const char *value = profile->argValues[i];
+            profile->numArg--;
+            memmove(&profile->argKeys[i], &profile->argKeys[i + 1],
+                    (profile->numArg - i) * sizeof(profile->argKeys[0]));
+            memmove(&profile->argValues[i], &profile->argValues[i + 1],
+                    (profile->numArg - i) * sizeof(profile->argValues[0]));
+            return value;
+        }
+    }
+    return NULL;
+}
+
 static bool load_config(int argc, char **argv, struct config *out) {
 #define APPLY_DEFAULTS_FLAG(optChar, name, description)                                            \
     out->name = false;
@@ -234,6 +334,87 @@ static bool find_by_name(const struct txvc_driver *d, const void *extra) {
     return strcmp(name, d->name) != 0;
 }
 
+/*
+ * Farm mode.
+ * Every profile is served by its own instance of a driver and its own server, each server runs
+ * on a thread of its own. Instances are activated one after another before any server starts,
+ * so that they don't race for devices.
+ */
+#define MAX_INSTANCES 32
+
+struct instance {
+    struct txvc_backend_profile profile;
+    const struct txvc_driver *driver;
+    void *driverCtx;
+    struct txvc_driver_wrapper wrapper;
+    int chainIrLengths[TXVC_JTAG_SPLIT_MAX_DEVICES];
+    struct txvc_server_options serverOptions;
+    char serverAddr[80];
+    pthread_t thread;
+};
+
+/* Activates driver of `profileStr` and prepares to serve it starting from `*port` */
+static bool activate_instance(struct instance *inst, const char *profileStr,
+        const struct config *config, const struct txvc_server_options *commonOptions,
+        const char *host, int *port) {
+    const struct txvc_profile_alias *alias = txvc_find_alias_by_name(profileStr);
+    if (alias) {
+        INFO("Found alias %s (%s),\n", profileStr, alias->description);
+        INFO("Using profile %s\n", alias->profile);
+        profileStr = alias->profile;
+    }
+    if (!txvc_backend_profile_parse(profileStr, &inst->profile)) {
+        return false;
+    }
+    const char *chainIrLengthsStr = take_profile_arg(&inst->profile, CHAIN_IR_LENGTHS_ARG);
+    int numChainDevices = chainIrLengthsStr
+        ? parse_ir_lengths(chainIrLengthsStr, inst->chainIrLengths, TXVC_JTAG_SPLIT_MAX_DEVICES)
+        : 0;
+    if (numChainDevices < 0) {
+        ERROR("Bad \"%s\": %s\n", CHAIN_IR_LENGTHS_ARG, chainIrLengthsStr);
+        return false;
+    }
+
+    inst->driver = txvc_enumerate_drivers(find_by_name, inst->profile.driverName);
+    if (!inst->driver) {
+        ERROR("Can not find driver \"%s\"\n", inst->profile.driverName);
+        return false;
+    }
+    inst->driverCtx = calloc(1, inst->driver->contextSize ? inst->driver->contextSize : 1);
+    if (!inst->driverCtx) {
+        FATAL("Can not allocate %zu bytes\n", inst->driver->contextSize);
+    }
+    if (!inst->driver->activate(inst->driverCtx,
+                inst->profile.numArg, inst->profile.argKeys, inst->profile.argValues)) {
+        ERROR("Failed to activate driver \"%s\"\n", inst->profile.driverName);
+        free(inst->driverCtx);
+        return false;
+    }
+    txvc_driver_wrapper_setup(&inst->wrapper, inst->driver, inst->driverCtx,
+            config->tckPeriodNanos);
+
+    inst->serverOptions = *commonOptions;
+    inst->serverOptions.chainIrLengths = inst->chainIrLengths;
+    inst->serverOptions.numChainDevices = (size_t) numChainDevices;
+    snprintf(inst->serverAddr, sizeof(inst->serverAddr), "%s:%d", host, *port);
+    *port += numChainDevices ? numChainDevices : 1;
+    return true;
+}
+
+static void deactivate_instance(struct instance *inst) {
+    inst->driver->deactivate(inst->driverCtx);
+    free(inst->driverCtx);
+}
+
+static void *serve_instance(void *arg) {
+    struct instance *inst = arg;
+    const struct txvc_driver *wrapper = inst->driver->flush
+        ? &txvcDriverWrapperWithOps : &txvcDriverWrapper;
+    txvc_run_server(inst->serverAddr, wrapper, &inst->wrapper, &inst->serverOptions,
+            &shouldTerminate);
+    return NULL;
+}
+
 int main(int argc, char**argv) {
     txvcProgname = argv[0];
 
@@ -264,40 +445,107 @@ int main(int argc, char**argv) {
     if (!config.profile) {
         fprintf(stderr, "Profile is missing\n");
         return EXIT_FAILURE;
-    } else {
-        const struct txvc_profile_alias *alias = txvc_find_alias_by_name(config.profile);
-        if (alias) {
-            INFO("Found alias %s (%s),\n", config.profile, alias->description);
-            INFO("Using profile %s\n", alias->profile);
-            config.profile = alias->profile;
-        }
     }
     if (config.tckPeriodNanos < 0) {
         fprintf(stderr, "Bad TCK period\n");
         return EXIT_FAILURE;
     }
-
-    struct txvc_backend_profile profile;
-    if (!txvc_backend_profile_parse(config.profile, &profile)) {
+    if (config.maxVectorBits < 0) {
+        fprintf(stderr, "Bad max vector size\n");
         return EXIT_FAILURE;
     }
-
-    const struct txvc_driver *driver = txvc_enumerate_drivers(find_by_name, profile.driverName);
-    if (!driver) {
-        ERROR("Can not find driver \"%s\"\n", profile.driverName);
+    if (config.zeroCopyKbytes < 0) {
+        fprintf(stderr, "Bad zero-copy response size\n");
+        return EXIT_FAILURE;
+    }
+    if (config.idleTimeoutSeconds < 0) {
+        fprintf(stderr, "Bad idle timeout\n");
+        return EXIT_FAILURE;
+    }
+    if (config.timeSliceMs < 0) {
+        fprintf(stderr, "Bad time slice\n");
+        return EXIT_FAILURE;
+    }
+    if (config.pipelineDepth < 0) {
+        fprintf(stderr, "Bad pipeline depth\n");
+        return EXIT_FAILURE;
+    }
+    struct txvc_server_priority priorities[MAX_CLIENT_PRIORITIES];
+    int numPriorities = config.priorities
+        ? parse_priorities(config.priorities, priorities, MAX_CLIENT_PRIORITIES) : 0;
+    if (numPriorities < 0) {
+        fprintf(stderr, "Bad client priorities\n");
         return EXIT_FAILURE;
     }
 
-    if (!driver->activate(profile.numArg, profile.argKeys, profile.argValues)) {
-        ERROR("Failed to activate driver \"%s\"\n", profile.driverName);
+    /* Ports of farm instances follow the server one */
+    char host[64];
+    strncpy(host, config.serverAddr, sizeof(host));
+    host[sizeof(host) - 1] = '\0';
+    char *portStr = strchr(host, ':');
+    int port = portStr ? parse_int(portStr + 1) : INT_MIN;
+    if (port < 0 || port > 65535) {
+        fprintf(stderr, "Bad server address\n");
         return EXIT_FAILURE;
     }
+    *portStr = '\0';
+
+    const struct txvc_server_options commonOptions = {
+        .maxVectorBits = (size_t) config.maxVectorBits,
+        .zeroCopyMinBytes = (size_t) config.zeroCopyKbytes * 1024,
+        .useIoUring = config.ioUring,
+        .pipelineDepth = (size_t) config.pipelineDepth,
+        .idleTimeoutMs = (size_t) config.idleTimeoutSeconds * 1000,
+        .timeSliceMs = (size_t) config.timeSliceMs,
+        .priorities = priorities,
+        .numPriorities = (size_t) numPriorities,
+        .chainIrLengths = NULL,
+        .numChainDevices = 0,
+    };
+    static struct instance instances[MAX_INSTANCES];
+    size_t numInstances = 0;
+    int res = EXIT_SUCCESS;
+    char profiles[1024];
+    strncpy(profiles, config.profile, sizeof(profiles));
+    profiles[sizeof(profiles) - 1] = '\0';
+    char *savePtr;
+    for (char *item = strtok_r(profiles, ";", &savePtr); item;
+            item = strtok_r(NULL, ";", &savePtr)) {
+        if (numInstances == MAX_INSTANCES) {
+            ERROR("Can not serve more than %d profiles\n", MAX_INSTANCES);
+            res = EXIT_FAILURE;
+            goto bail_deactivate;
+        }
+        if (!activate_instance(&instances[numInstances], item, &config, &commonOptions,
+                    host, &port)) {
+            res = EXIT_FAILURE;
+            goto bail_deactivate;
+        }
+        numInstances++;
+    }
 
-    txvc_driver_wrapper_setup(driver, config.tckPeriodNanos);
-    driver = &txvcDriverWrapper;
+    /* The first instance is served right here */
+    size_t numThreads = 1;
+    while (numThreads < numInstances) {
+        struct instance *inst = &instances[numThreads];
+        if (pthread_create(&inst->thread, NULL, serve_instance, inst)) {
+            ERROR("Can not start thread to serve %s\n", inst->serverAddr);
+            shouldTerminate = 1;
+            res = EXIT_FAILURE;
+            break;
+        }
+        numThreads++;
+    }
+    if (numInstances && !shouldTerminate) {
+        serve_instance(&instances[0]);
+    }
+    while (numThreads > 1) {
+        pthread_join(instances[--numThreads].thread, NULL);
+    }
 
-    txvc_run_server(config.serverAddr, driver, &shouldTerminate);
-    driver->deactivate();
-    return EXIT_SUCCESS;
+bail_deactivate:
+    while (numInstances) {
+        deactivate_instance(&instances[--numInstances]);
+    }
+    return res;
 }
-